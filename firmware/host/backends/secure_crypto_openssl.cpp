@@ -0,0 +1,307 @@
+// OpenSSL (3.x) backend of secure_crypto.h, for Linux builds of the
+// secure layer (gateway, load tests, benchmarks). OpenSSL picks the
+// AES-NI / PCLMULQDQ (or ARMv8 crypto) code paths at run time.
+
+#include "secure_crypto.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/kdf.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+const char* sc_backend_name() {
+  return "openssl";
+}
+
+void sc_random_bytes(uint8_t* buf, size_t len) {
+  if (RAND_bytes(buf, (int)len) != 1) {
+    // Never hand out predictable IVs or challenges
+    abort();
+  }
+}
+
+// Fetched once: the provider lookup costs more than the derivation
+static EVP_KDF* hkdfAlgorithm() {
+  static EVP_KDF* kdf = EVP_KDF_fetch(nullptr, "HKDF", nullptr);
+  return kdf;
+}
+
+bool sc_hkdf_sha256(const uint8_t* ikm, size_t ikm_len,
+                    const uint8_t* salt, size_t salt_len,
+                    const uint8_t* info, size_t info_len,
+                    uint8_t* okm, size_t okm_len) {
+  EVP_KDF* kdf = hkdfAlgorithm();
+  if (!kdf) return false;
+  EVP_KDF_CTX* ctx = EVP_KDF_CTX_new(kdf);
+  if (!ctx) return false;
+
+  char digest[] = "SHA256";
+  OSSL_PARAM params[5];
+  size_t n = 0;
+  params[n++] = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, digest, 0);
+  params[n++] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY,
+                                                  (void*)ikm, ikm_len);
+  params[n++] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT,
+                                                  (void*)salt, salt_len);
+  params[n++] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO,
+                                                  (void*)info, info_len);
+  params[n] = OSSL_PARAM_construct_end();
+
+  int ret = EVP_KDF_derive(ctx, okm, okm_len, params);
+  EVP_KDF_CTX_free(ctx);
+  return ret == 1;
+}
+
+bool sc_hmac_sha256(const uint8_t* key, size_t key_len,
+                    const uint8_t* data, size_t data_len,
+                    uint8_t* out, size_t out_len) {
+  if (out_len == 0 || out_len > 32) return false;
+  unsigned char full[32];
+  unsigned int fullLen = sizeof(full);
+  if (!HMAC(EVP_sha256(), key, (int)key_len, data, data_len, full, &fullLen)) {
+    return false;
+  }
+  memcpy(out, full, out_len);
+  return true;
+}
+
+// ========= AES-256-GCM =========
+
+// Runs one GCM operation on a context that already holds the key
+static bool gcmRun(EVP_CIPHER_CTX* ctx, bool encrypt,
+                   const uint8_t* iv, size_t iv_len,
+                   const uint8_t* aad, size_t aad_len,
+                   const uint8_t* input, size_t in_len,
+                   uint8_t* output,
+                   uint8_t* tag, size_t tag_len) {
+  int len = 0;
+  if (EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nullptr, encrypt) != 1 ||
+      EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, (int)iv_len, nullptr) != 1 ||
+      EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, iv, encrypt) != 1) {
+    return false;
+  }
+  if (aad_len && EVP_CipherUpdate(ctx, nullptr, &len, aad, (int)aad_len) != 1) {
+    return false;
+  }
+  if (in_len && EVP_CipherUpdate(ctx, output, &len, input, (int)in_len) != 1) {
+    return false;
+  }
+  if (!encrypt &&
+      EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, (int)tag_len, tag) != 1) {
+    return false;
+  }
+  // Checks the tag when decrypting
+  if (EVP_CipherFinal_ex(ctx, output + in_len, &len) != 1) {
+    return false;
+  }
+  return !encrypt ||
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, (int)tag_len, tag) == 1;
+}
+
+static EVP_CIPHER_CTX* gcmNewContext(const uint8_t* key) {
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  if (!ctx) return nullptr;
+  if (EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), nullptr, key, nullptr, 1) != 1) {
+    EVP_CIPHER_CTX_free(ctx);
+    return nullptr;
+  }
+  return ctx;
+}
+
+bool sc_aes_gcm_encrypt(const uint8_t* key, size_t key_len,
+                        const uint8_t* iv, size_t iv_len,
+                        const uint8_t* aad, size_t aad_len,
+                        const uint8_t* input, size_t in_len,
+                        uint8_t* output,
+                        uint8_t* tag, size_t tag_len) {
+  if (key_len != 32 || tag_len != 16) return false;
+  EVP_CIPHER_CTX* ctx = gcmNewContext(key);
+  if (!ctx) return false;
+  bool ok = gcmRun(ctx, true, iv, iv_len, aad, aad_len, input, in_len,
+                   output, tag, tag_len);
+  EVP_CIPHER_CTX_free(ctx);
+  return ok;
+}
+
+bool sc_aes_gcm_decrypt(const uint8_t* key, size_t key_len,
+                        const uint8_t* iv, size_t iv_len,
+                        const uint8_t* aad, size_t aad_len,
+                        const uint8_t* input, size_t in_len,
+                        const uint8_t* tag, size_t tag_len,
+                        uint8_t* output) {
+  if (key_len != 32 || tag_len != 16) return false;
+  EVP_CIPHER_CTX* ctx = gcmNewContext(key);
+  if (!ctx) return false;
+  bool ok = gcmRun(ctx, false, iv, iv_len, aad, aad_len, input, in_len,
+                   output, (uint8_t*)tag, tag_len);
+  EVP_CIPHER_CTX_free(ctx);
+  return ok;
+}
+
+// ========= Cached GCM contexts =========
+
+#ifndef SC_GCM_CACHE_SLOTS
+#define SC_GCM_CACHE_SLOTS 4
+#endif
+
+struct GcmCacheSlot {
+  uint32_t lastUse;
+  uint8_t key[32];
+  EVP_CIPHER_CTX* ctx;  // nullptr when the slot is free
+};
+
+static GcmCacheSlot g_gcmCache[SC_GCM_CACHE_SLOTS];
+static uint32_t g_gcmCacheTick = 0;
+
+// Returns a context keyed with `key`, reusing a cached one when possible.
+// Only the IV changes between messages, the AES key schedule and the
+// GHASH table are kept.
+static EVP_CIPHER_CTX* gcmCacheGet(const uint8_t* key) {
+  GcmCacheSlot* victim = &g_gcmCache[0];
+  for (size_t i = 0; i < SC_GCM_CACHE_SLOTS; ++i) {
+    GcmCacheSlot& s = g_gcmCache[i];
+    if (s.ctx && CRYPTO_memcmp(s.key, key, 32) == 0) {
+      s.lastUse = ++g_gcmCacheTick;
+      return s.ctx;
+    }
+    if (!s.ctx) {
+      victim = &s;
+    } else if (victim->ctx && s.lastUse < victim->lastUse) {
+      victim = &s;
+    }
+  }
+
+  if (victim->ctx) {
+    EVP_CIPHER_CTX_free(victim->ctx);
+  }
+  victim->ctx = gcmNewContext(key);
+  if (!victim->ctx) return nullptr;
+  memcpy(victim->key, key, 32);
+  victim->lastUse = ++g_gcmCacheTick;
+  return victim->ctx;
+}
+
+void sc_aes_gcm_cache_flush() {
+  for (size_t i = 0; i < SC_GCM_CACHE_SLOTS; ++i) {
+    GcmCacheSlot& s = g_gcmCache[i];
+    if (s.ctx) {
+      EVP_CIPHER_CTX_free(s.ctx);  // also wipes the key schedule
+      s.ctx = nullptr;
+    }
+    OPENSSL_cleanse(s.key, sizeof(s.key));
+  }
+}
+
+bool sc_aes_gcm_encrypt_cached(const uint8_t* key, size_t key_len,
+                               const uint8_t* iv, size_t iv_len,
+                               const uint8_t* aad, size_t aad_len,
+                               const uint8_t* input, size_t in_len,
+                               uint8_t* output,
+                               uint8_t* tag, size_t tag_len) {
+  if (key_len != 32 || tag_len != 16) return false;
+  EVP_CIPHER_CTX* ctx = gcmCacheGet(key);
+  if (!ctx) return false;
+  return gcmRun(ctx, true, iv, iv_len, aad, aad_len, input, in_len,
+                output, tag, tag_len);
+}
+
+bool sc_aes_gcm_decrypt_cached(const uint8_t* key, size_t key_len,
+                               const uint8_t* iv, size_t iv_len,
+                               const uint8_t* aad, size_t aad_len,
+                               const uint8_t* input, size_t in_len,
+                               const uint8_t* tag, size_t tag_len,
+                               uint8_t* output) {
+  if (key_len != 32 || tag_len != 16) return false;
+  EVP_CIPHER_CTX* ctx = gcmCacheGet(key);
+  if (!ctx) return false;
+  return gcmRun(ctx, false, iv, iv_len, aad, aad_len, input, in_len,
+                output, (uint8_t*)tag, tag_len);
+}
+
+// ========= KMS signature =========
+
+// The KMS key must be of the provisioned suite, so that a key of another
+// type cannot be substituted
+static bool pkeyMatchesSuite(const EVP_PKEY* pkey) {
+  if (sc_get_kms_sig_suite() == SC_SIG_P256) {
+    return EVP_PKEY_get_base_id(pkey) == EVP_PKEY_EC &&
+           EVP_PKEY_get_bits(pkey) == 256;
+  }
+  return EVP_PKEY_get_base_id(pkey) == EVP_PKEY_RSA &&
+         EVP_PKEY_get_bits(pkey) == 2048;
+}
+
+// KMS public key, parsed once and reused for every verification
+static EVP_PKEY* g_kmsPkey = nullptr;
+
+bool sc_set_kms_pubkey_pem(const char* pem) {
+  if (g_kmsPkey) {
+    EVP_PKEY_free(g_kmsPkey);
+    g_kmsPkey = nullptr;
+  }
+  if (!pem || pem[0] == '\0') {
+    return false;
+  }
+
+  BIO* bio = BIO_new_mem_buf(pem, -1);
+  if (!bio) return false;
+  g_kmsPkey = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
+  BIO_free(bio);
+  return g_kmsPkey != nullptr;
+}
+
+bool sc_set_kms_pubkey_der(const uint8_t* der, size_t der_len) {
+  if (g_kmsPkey) {
+    EVP_PKEY_free(g_kmsPkey);
+    g_kmsPkey = nullptr;
+  }
+  if (!der || der_len == 0) {
+    return false;
+  }
+
+  const unsigned char* p = der;
+  g_kmsPkey = d2i_PUBKEY(nullptr, &p, (long)der_len);
+  return g_kmsPkey != nullptr;
+}
+
+size_t sc_pubkey_pem_to_der(const char* pem, uint8_t* out, size_t out_size) {
+  if (!pem || pem[0] == '\0') {
+    return 0;
+  }
+  BIO* bio = BIO_new_mem_buf(pem, -1);
+  if (!bio) return 0;
+  EVP_PKEY* pkey = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
+  BIO_free(bio);
+  if (!pkey) return 0;
+
+  size_t len = 0;
+  int needed = i2d_PUBKEY(pkey, nullptr);
+  if (needed > 0 && (size_t)needed <= out_size) {
+    unsigned char* p = out;
+    len = (size_t)i2d_PUBKEY(pkey, &p);
+  }
+  EVP_PKEY_free(pkey);
+  return len;
+}
+
+bool sc_verify_kms_signature(const uint8_t* message, size_t message_len,
+                             const uint8_t* sig, size_t sig_len) {
+  if (!g_kmsPkey || !pkeyMatchesSuite(g_kmsPkey)) {
+    return false;
+  }
+
+  // SHA-256, PKCS#1 v1.5 for RSA (the default padding), DER for ECDSA
+  EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+  if (!ctx) return false;
+  bool ok = EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, g_kmsPkey) == 1 &&
+            EVP_DigestVerify(ctx, sig, sig_len, message, message_len) == 1;
+  EVP_MD_CTX_free(ctx);
+  return ok;
+}
@@ -0,0 +1,62 @@
+#include "alloc_counter.h"
+
+#include <stddef.h>
+#include <atomic>
+
+static std::atomic<uint64_t> g_allocCount{0};
+static std::atomic<uint64_t> g_allocBytes{0};
+
+AllocStats allocCounterRead() {
+  AllocStats s;
+  s.count = g_allocCount.load(std::memory_order_relaxed);
+  s.bytes = g_allocBytes.load(std::memory_order_relaxed);
+  return s;
+}
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+
+// glibc exports its allocator under these names, so the public symbols
+// can be replaced by counting wrappers. This also catches the mbedTLS /
+// OpenSSL allocations inside the shared libraries.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+static void countAlloc(size_t size) {
+  g_allocCount.fetch_add(1, std::memory_order_relaxed);
+  g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void* malloc(size_t size) {
+  countAlloc(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+  countAlloc(n * size);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  countAlloc(size);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  __libc_free(ptr);
+}
+}
+
+bool allocCounterAvailable() {
+  return true;
+}
+
+#else
+
+bool allocCounterAvailable() {
+  return false;
+}
+
+#endif
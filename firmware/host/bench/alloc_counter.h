@@ -0,0 +1,16 @@
+#pragma once
+
+// Counts heap allocations made by the whole process (our code, the C++
+// runtime and the crypto library), so a benchmark can report allocations
+// and bytes per operation. Only available with glibc, where malloc can be
+// interposed; allocCounterAvailable() is false elsewhere.
+
+#include <stdint.h>
+
+struct AllocStats {
+  uint64_t count;
+  uint64_t bytes;
+};
+
+bool allocCounterAvailable();
+AllocStats allocCounterRead();
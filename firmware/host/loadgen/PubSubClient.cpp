@@ -0,0 +1,181 @@
+#include "PubSubClient.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const uint8_t MQTT_CONNECT    = 0x10;
+static const uint8_t MQTT_CONNACK    = 0x20;
+static const uint8_t MQTT_PUBLISH    = 0x30;
+static const uint8_t MQTT_SUBSCRIBE  = 0x82;  // reserved flags 0010
+static const uint8_t MQTT_SUBACK     = 0x90;
+static const uint8_t MQTT_PINGREQ    = 0xC0;
+static const uint8_t MQTT_PINGRESP   = 0xD0;
+
+static const size_t READ_CHUNK = 16 * 1024;
+// Largest packet accepted from the broker
+static const size_t MAX_PACKET = 256 * 1024;
+
+void PubSubClient::begin(int fd, const char* clientId, uint16_t keepAliveS) {
+  fd_ = fd;
+  connAck_ = false;
+  out_.clear();
+  outPos_ = 0;
+  in_.clear();
+
+  size_t idLen = strlen(clientId);
+  putHeader(MQTT_CONNECT, 10 + 2 + idLen);
+  static const uint8_t variable[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02};  // clean session
+  out_.insert(out_.end(), variable, variable + sizeof(variable));
+  out_.push_back((uint8_t)(keepAliveS >> 8));
+  out_.push_back((uint8_t)keepAliveS);
+  putString(clientId, idLen);
+}
+
+void PubSubClient::close() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  connAck_ = false;
+}
+
+void PubSubClient::putHeader(uint8_t type, size_t remaining) {
+  out_.push_back(type);
+  do {
+    uint8_t b = remaining & 0x7F;
+    remaining >>= 7;
+    out_.push_back(remaining ? (uint8_t)(b | 0x80) : b);
+  } while (remaining);
+}
+
+void PubSubClient::putString(const char* s, size_t len) {
+  out_.push_back((uint8_t)(len >> 8));
+  out_.push_back((uint8_t)len);
+  out_.insert(out_.end(), s, s + len);
+}
+
+bool PubSubClient::subscribe(const char* filter) {
+  if (fd_ < 0) return false;
+  size_t len = strlen(filter);
+  uint16_t id = nextPacketId_++;
+  if (nextPacketId_ == 0) nextPacketId_ = 1;
+  putHeader(MQTT_SUBSCRIBE, 2 + 2 + len + 1);
+  out_.push_back((uint8_t)(id >> 8));
+  out_.push_back((uint8_t)id);
+  putString(filter, len);
+  out_.push_back(0);  // QoS 0
+  return true;
+}
+
+bool PubSubClient::ping() {
+  if (fd_ < 0) return false;
+  putHeader(MQTT_PINGREQ, 0);
+  return true;
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int length) {
+  if (fd_ < 0 || out_.size() - outPos_ > LOADGEN_MQTT_MAX_PENDING) {
+    publishDropped++;
+    return false;
+  }
+  size_t topicLen = strlen(topic);
+  putHeader(MQTT_PUBLISH, 2 + topicLen + length);
+  putString(topic, topicLen);
+  out_.insert(out_.end(), payload, payload + length);
+  publishCount++;
+  return true;
+}
+
+bool PubSubClient::flush() {
+  while (outPos_ < out_.size()) {
+    ssize_t n = ::send(fd_, out_.data() + outPos_, out_.size() - outPos_, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if (errno == EINTR) continue;
+      return false;
+    }
+    outPos_ += (size_t)n;
+    lastSendMs = millis();
+  }
+  if (outPos_ == out_.size()) {
+    out_.clear();
+    outPos_ = 0;
+  } else if (outPos_ > READ_CHUNK && outPos_ * 2 > out_.size()) {
+    out_.erase(out_.begin(), out_.begin() + outPos_);
+    outPos_ = 0;
+  }
+  return true;
+}
+
+bool PubSubClient::receive(MqttMessageHandler handler, void* user) {
+  for (;;) {
+    size_t have = in_.size();
+    in_.resize(have + READ_CHUNK);
+    ssize_t n = ::recv(fd_, in_.data() + have, READ_CHUNK, 0);
+    if (n <= 0) {
+      in_.resize(have);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      if (n < 0 && errno == EINTR) continue;
+      return false;  // closed or broken
+    }
+    in_.resize(have + (size_t)n);
+    if ((size_t)n < READ_CHUNK) break;
+  }
+
+  // Every complete packet in the buffer
+  size_t pos = 0;
+  while (in_.size() - pos >= 2) {
+    size_t remaining = 0;
+    size_t i = 1;
+    int shift = 0;
+    bool complete = false;
+    while (pos + i < in_.size() && i <= 4) {
+      uint8_t b = in_[pos + i++];
+      remaining |= (size_t)(b & 0x7F) << shift;
+      shift += 7;
+      if (!(b & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (i > 4) return false;  // malformed length
+      break;
+    }
+    if (remaining > MAX_PACKET) return false;
+    if (in_.size() - pos - i < remaining) break;
+    if (!handlePacket(in_[pos], in_.data() + pos + i, remaining, handler, user)) {
+      return false;
+    }
+    pos += i + remaining;
+  }
+  in_.erase(in_.begin(), in_.begin() + pos);
+  return true;
+}
+
+bool PubSubClient::handlePacket(uint8_t header, uint8_t* body, size_t len,
+                                MqttMessageHandler handler, void* user) {
+  switch (header & 0xF0) {
+    case MQTT_CONNACK:
+      // [flags][return code], 0 = accepted
+      if (len < 2 || body[1] != 0) return false;
+      connAck_ = true;
+      return true;
+    case MQTT_PUBLISH: {
+      if (len < 2) return false;
+      size_t topicLen = ((size_t)body[0] << 8) | body[1];
+      size_t offset = 2 + topicLen;
+      if ((header & 0x06) != 0) offset += 2;  // packet id of QoS 1/2
+      if (offset > len || topicLen >= LOADGEN_MQTT_MAX_TOPIC) return false;
+      char topic[LOADGEN_MQTT_MAX_TOPIC];
+      memcpy(topic, body + 2, topicLen);
+      topic[topicLen] = '\0';
+      handler(user, topic, body + offset, (unsigned int)(len - offset));
+      return true;
+    }
+    case MQTT_SUBACK:
+    case MQTT_PINGRESP:
+      return true;
+    default:
+      return true;  // nothing else is expected at QoS 0
+  }
+}
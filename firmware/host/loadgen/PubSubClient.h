@@ -0,0 +1,68 @@
+#pragma once
+
+// Load generator stand-in for PubSubClient: a minimal MQTT 3.1.1 client
+// (QoS 0, clean session) on a non-blocking socket owned by the caller's
+// event loop. publish() only appends the packet to the output buffer,
+// flush() writes it when the socket is writable and receive() parses what
+// arrived, handing every PUBLISH to a callback. The secure layer sees the
+// same publish()/connected() interface as on the device.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+
+#ifndef LOADGEN_MQTT_MAX_PENDING
+#define LOADGEN_MQTT_MAX_PENDING (256 * 1024)  // unsent bytes before publish() fails
+#endif
+#define LOADGEN_MQTT_MAX_TOPIC 256
+
+typedef void (*MqttMessageHandler)(void* user,
+                                   const char* topic,
+                                   uint8_t* payload,
+                                   unsigned int length);
+
+class PubSubClient {
+ public:
+  uint32_t publishCount = 0;
+  uint32_t publishDropped = 0;   // refused, output buffer full
+  uint32_t lastSendMs = 0;
+
+  // Takes a connected (or connecting) non-blocking socket and queues the
+  // CONNECT packet
+  void begin(int fd, const char* clientId, uint16_t keepAliveS);
+  void close();
+
+  int fd() const { return fd_; }
+  bool connected() const { return fd_ >= 0 && connAck_; }
+  bool wantsWrite() const { return outPos_ < out_.size(); }
+
+  bool subscribe(const char* filter);
+  bool ping();
+
+  bool publish(const char* topic, const char* payload) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload));
+  }
+  bool publish(const char* topic, const uint8_t* payload, unsigned int length);
+
+  // Writes what the socket takes. Returns false on a socket error.
+  bool flush();
+
+  // Reads what is available and calls `handler` for every PUBLISH. Returns
+  // false when the connection is closed, refused or broken.
+  bool receive(MqttMessageHandler handler, void* user);
+
+ private:
+  int fd_ = -1;
+  bool connAck_ = false;
+  uint16_t nextPacketId_ = 1;
+  std::vector<uint8_t> out_;
+  size_t outPos_ = 0;
+  std::vector<uint8_t> in_;
+
+  void putHeader(uint8_t type, size_t remaining);
+  void putString(const char* s, size_t len);
+  bool handlePacket(uint8_t header, uint8_t* body, size_t len,
+                    MqttMessageHandler handler, void* user);
+};
@@ -0,0 +1,656 @@
+// Simulated ESP32 fleet, to measure how many devices one KMS and one
+// broker can serve. Every simulated device runs the firmware's own secure
+// layer (secure_mqtt.cpp, one SecureMqttContext each) over its own MQTT
+// connection to the broker, all from a single epoll loop:
+//   - connect, handshake with the KMS (or resume with its ticket after a
+//     reconnection), publish a reading every --publish-ms on the data
+//     topic, follow the group rekeys, ask for the key after a decrypt
+//     failure, as main.ino and mqtt_client.cpp do;
+//   - the first --listeners devices also subscribe to the data topic and
+//     decrypt every reading, which carries its sender and send time.
+//
+// The KMS must share its master key and public key with the tool:
+//   KMS_MASTER_KEY=<64 hex> KMS_PUBKEY_FILE=kms_pubkey.pem python kms_server.py
+//   secure_loadgen --master-key <64 hex> --pubkey kms_pubkey.pem --clients 2000
+//
+// Reported: handshakes per second and their latency, the latency from a
+// device's key arrival to the first decrypt of one of its readings,
+// publish-to-decrypt latency, message throughput, and for every key
+// rotation seen, how long the fleet took to install the new epoch.
+// The --min-*/--max-* options turn these into a pass/fail exit status.
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "secure_crypto.h"
+#include "sec_log.h"
+#include "secure_mqtt.h"
+#include "topic_router.h"
+
+// Normally defined by main.ino: the secure layer drops the frames sent by
+// this id. Follows the selected device.
+const char* mqttClientId = "";
+
+enum SimState : uint8_t {
+  SIM_IDLE,        // waiting for its (re)connection time
+  SIM_CONNECTING,  // TCP connect and MQTT CONNECT sent, no CONNACK yet
+  SIM_HANDSHAKE,   // auth sent, waiting for the TOPIC_key
+  SIM_READY,
+};
+
+struct SimClient {
+  char id[32];
+  uint32_t index;
+  SecureMqttContext* sec;
+  PubSubClient mqtt;
+  TopicRouter router;
+  SimState state;
+  bool listener;
+  bool pollingOut;          // EPOLLOUT registered
+  bool haveEpoch;
+  uint32_t epoch;
+  uint32_t seq;
+  uint64_t connectAtUs;
+  uint64_t hsStartUs;       // first auth of the current handshake
+  uint64_t hsAttemptUs;     // last auth sent
+  uint64_t readyUs;         // TOPIC_key installed
+  uint64_t firstDecryptUs;  // a listener first decrypted one of our readings
+  uint64_t nextPublishUs;
+  uint64_t lastKeyRequestUs;
+  uint64_t lastRotateRequestUs;
+  char requestKeyTopic[TOPIC_ROUTER_NAME_MAX];
+};
+
+struct Options {
+  const char* host = "127.0.0.1";
+  int port = 1883;
+  unsigned clients = 100;
+  unsigned listeners = 4;
+  double connectRate = 200;      // new connections per second
+  unsigned durationS = 60;
+  unsigned publishMs = 5000;
+  unsigned handshakeTimeoutMs = 10000;
+  const char* base = "iot/esp32";
+  const char* topic = "iot/esp32/data";
+  const char* prefix = "sim";
+  const char* masterKeyHex = nullptr;
+  const char* pubkeyPath = nullptr;
+  const char* sigSuite = "rsa2048";
+  bool verbose = false;
+  // Release gates, 0 = not checked
+  double minHandshakeRate = 0;
+  double maxFirstDecryptP99Ms = 0;
+  double maxRekeyMs = 0;
+  double minMessageRate = 0;
+};
+
+// Devices moving forward to one epoch
+struct EpochStats {
+  uint64_t firstUs = 0;
+  std::vector<uint32_t> latencyUs;  // since firstUs
+};
+
+struct Stats {
+  uint32_t connects = 0;
+  uint32_t disconnects = 0;
+  uint32_t handshakes = 0;
+  uint32_t handshakeRetries = 0;
+  uint64_t firstHandshakeUs = 0;
+  uint64_t lastHandshakeUs = 0;
+  std::vector<uint32_t> handshakeUs;
+  std::vector<uint32_t> keyToFirstDecryptUs;
+  std::vector<uint32_t> endToEndUs;
+  uint64_t published = 0;
+  uint64_t publishFailed = 0;
+  uint64_t decrypted = 0;
+  uint64_t decryptFailed = 0;
+  uint32_t keyRequests = 0;
+  uint32_t rotateRequests = 0;   // no counter lease stored, fresh epoch asked
+  uint32_t epochRollbacks = 0;   // a key answer older than the installed epoch
+  uint64_t firstPublishUs = 0;
+  std::map<uint32_t, EpochStats> epochs;
+};
+
+static Options g_opt;
+static Stats g_stats;
+static std::vector<SimClient> g_clients;
+static SimClient* g_current = nullptr;
+static int g_epoll = -1;
+static sockaddr_in g_broker;
+static uint64_t g_t0Us = 0;
+
+static uint64_t nowUs() {
+  return (uint64_t)micros();
+}
+
+static void selectClient(SimClient& c) {
+  if (g_current == &c) return;
+  secureMqttSelectContext(c.sec);
+  mqttClientId = c.id;
+  g_current = &c;
+}
+
+static void watchOutput(SimClient& c) {
+  bool want = c.mqtt.wantsWrite();
+  if (want == c.pollingOut || c.mqtt.fd() < 0) return;
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  if (want) ev.events |= EPOLLOUT;
+  ev.data.u32 = c.index;
+  epoll_ctl(g_epoll, EPOLL_CTL_MOD, c.mqtt.fd(), &ev);
+  c.pollingOut = want;
+}
+
+static void disconnect(SimClient& c, uint64_t now) {
+  if (c.mqtt.fd() >= 0) {
+    epoll_ctl(g_epoll, EPOLL_CTL_DEL, c.mqtt.fd(), nullptr);
+    g_stats.disconnects++;
+  }
+  c.mqtt.close();
+  c.pollingOut = false;
+  c.state = SIM_IDLE;
+  c.connectAtUs = now + 1000000;  // retry in 1 s
+}
+
+static void startConnect(SimClient& c, uint64_t now) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "socket: %s\n", strerror(errno));
+    c.connectAtUs = now + 1000000;
+    return;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (const sockaddr*)&g_broker, sizeof(g_broker)) < 0 && errno != EINPROGRESS) {
+    close(fd);
+    c.connectAtUs = now + 1000000;
+    return;
+  }
+  c.mqtt.begin(fd, c.id, 60);
+  epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT;
+  ev.data.u32 = c.index;
+  epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &ev);
+  c.pollingOut = true;
+  c.state = SIM_CONNECTING;
+  g_stats.connects++;
+}
+
+// ========= Data topic (listeners) =========
+
+static uint32_t fieldU32(const uint8_t* text, size_t len, const char* key, bool* found) {
+  size_t keyLen = strlen(key);
+  for (size_t i = 0; i + keyLen < len; ++i) {
+    if (memcmp(text + i, key, keyLen) == 0) {
+      *found = true;
+      return (uint32_t)strtoul((const char*)text + i + keyLen, nullptr, 10);
+    }
+  }
+  *found = false;
+  return 0;
+}
+
+static void onData(const RouteContext&,
+                   const char* topic,
+                   const uint8_t* payload,
+                   unsigned int length) {
+  uint8_t frame[SECURE_MQTT_MAX_FRAME + 1];
+  if (length > SECURE_MQTT_MAX_FRAME) return;
+  memcpy(frame, payload, length);
+  SecurePlaintext plain;
+  if (!secureMqttOpenFrame(topic, frame, length, &plain)) {
+    // Our own readings, echoed by the broker, are dropped without a failure
+    if (secureMqttHasTopicKey(topic) && length >= 13 && payload[0] != '{') {
+      uint32_t sender = ((uint32_t)payload[9] << 24) | ((uint32_t)payload[10] << 16) |
+                        ((uint32_t)payload[11] << 8) | payload[12];
+      if (sender != secureMqttSenderIndex(mqttClientId)) g_stats.decryptFailed++;
+    }
+    return;
+  }
+  // Plaintext: {"temperature":..,"humidity":..,"id":N,"t":<0.1 ms since start>}
+  bool haveId = false, haveT = false;
+  uint32_t id = fieldU32(plain.data, plain.len, "\"id\":", &haveId);
+  uint32_t sentTicks = fieldU32(plain.data, plain.len, "\"t\":", &haveT);
+  if (!haveId || !haveT || id >= g_clients.size()) return;
+
+  uint64_t now = nowUs();
+  g_stats.decrypted++;
+  uint64_t sentUs = g_t0Us + (uint64_t)sentTicks * 100;
+  if (now > sentUs) g_stats.endToEndUs.push_back((uint32_t)(now - sentUs));
+
+  SimClient& sender = g_clients[id];
+  if (sender.firstDecryptUs == 0 && sender.readyUs != 0) {
+    sender.firstDecryptUs = now;
+    g_stats.keyToFirstDecryptUs.push_back((uint32_t)(now - sender.readyUs));
+  }
+}
+
+// ========= Device behaviour =========
+
+static void noteEpoch(SimClient& c, uint64_t now) {
+  uint32_t epoch;
+  if (!secureMqttTopicEpoch(g_opt.topic, &epoch)) return;
+  if (c.haveEpoch && epoch != c.epoch) {
+    if ((int32_t)(epoch - c.epoch) < 0) {
+      // A key answer wrapped before a rotation, delivered after its rekey
+      g_stats.epochRollbacks++;
+    } else {
+      EpochStats& e = g_stats.epochs[epoch];
+      if (e.firstUs == 0) e.firstUs = now;
+      e.latencyUs.push_back((uint32_t)(now - e.firstUs));
+    }
+  }
+  c.haveEpoch = true;
+  c.epoch = epoch;
+}
+
+static void beginHandshake(SimClient& c, uint64_t now) {
+  if (c.state != SIM_HANDSHAKE) {
+    c.state = SIM_HANDSHAKE;
+    c.hsStartUs = now;
+  }
+  c.hsAttemptUs = now;
+  secureMqttBeginHandshake(c.mqtt);
+}
+
+static void onConnected(SimClient& c, uint64_t now) {
+  RouteContext ctx;
+  ctx.client = &c.mqtt;
+  ctx.index = 0;
+  topicRouterInit(&c.router);
+  if (c.listener) {
+    topicRouterAdd(&c.router, g_opt.topic, onData, ctx);
+    c.mqtt.subscribe(g_opt.topic);
+  }
+  secureMqttAddKmsRoutes(&c.router, c.mqtt, g_opt.base, c.id);
+
+  char filter[TOPIC_ROUTER_NAME_MAX];
+  snprintf(filter, sizeof(filter), "%s/%s/kms/#", g_opt.base, c.id);
+  c.mqtt.subscribe(filter);
+  snprintf(filter, sizeof(filter), "%s/kms/grouprekey", g_opt.base);
+  c.mqtt.subscribe(filter);
+
+  c.state = SIM_CONNECTING;  // until the handshake starts
+  beginHandshake(c, now);
+}
+
+static void onMessage(void* user, const char* topic, uint8_t* payload, unsigned int length) {
+  SimClient& c = *(SimClient*)user;
+  topicRouterDispatch(&c.router, topic, payload, length);
+}
+
+static void publishReading(SimClient& c, uint64_t now) {
+  // Tenths of ms since the start: fits 32 bits for 4 days
+  uint32_t t = (uint32_t)((now - g_t0Us) / 100);
+  char payload[128];
+  snprintf(payload, sizeof(payload),
+           "{\"temperature\":%.1f,\"humidity\":%.1f,\"id\":%u,\"t\":%u}",
+           20.0 + (c.seq % 50) / 10.0, 40.0 + (c.seq % 30) / 10.0, c.index, t);
+  c.seq++;
+  if (secureMqttEncryptAndPublish(c.mqtt, g_opt.topic, (const uint8_t*)payload, strlen(payload))) {
+    g_stats.published++;
+    if (g_stats.firstPublishUs == 0) g_stats.firstPublishUs = now;
+  } else {
+    g_stats.publishFailed++;
+  }
+}
+
+// After any input or timer: state transitions and periodic work
+static void step(SimClient& c, uint64_t now) {
+  if (c.state == SIM_CONNECTING && c.mqtt.connected()) {
+    onConnected(c, now);
+  }
+  if (c.state == SIM_HANDSHAKE) {
+    if (secureMqttIsReady()) {
+      c.state = SIM_READY;
+      c.readyUs = now;
+      c.nextPublishUs = now;
+      g_stats.handshakes++;
+      g_stats.handshakeUs.push_back((uint32_t)(now - c.hsStartUs));
+      if (g_stats.firstHandshakeUs == 0) g_stats.firstHandshakeUs = now;
+      g_stats.lastHandshakeUs = now;
+    } else if (now - c.hsAttemptUs > (uint64_t)g_opt.handshakeTimeoutMs * 1000) {
+      g_stats.handshakeRetries++;
+      beginHandshake(c, now);
+    }
+  }
+  if (c.state == SIM_READY) {
+    noteEpoch(c, now);
+    // Not before a fresh epoch when the counter lease store was empty
+    if (now >= c.nextPublishUs && secureMqttIsTopicReady(g_opt.topic)) {
+      publishReading(c, now);
+      c.nextPublishUs += (uint64_t)g_opt.publishMs * 1000;
+      if (c.nextPublishUs < now) c.nextPublishUs = now + (uint64_t)g_opt.publishMs * 1000;
+    }
+    // As requestKeyOnDecryptFailure(), at most every 5 s
+    char topic[64];
+    if (secureMqttConsumeDecryptFailure(topic, sizeof(topic)) &&
+        now - c.lastKeyRequestUs > 5000000) {
+      c.lastKeyRequestUs = now;
+      char body[128];
+      snprintf(body, sizeof(body), "{\"topic\":\"%s\"}", topic);
+      c.mqtt.publish(c.requestKeyTopic, body);
+      g_stats.keyRequests++;
+    }
+    // As requestRotationOnLostCounter()
+    char body[256];
+    if (secureMqttRotationRequest(topic, sizeof(topic), body, sizeof(body)) &&
+        now - c.lastRotateRequestUs > 5000000) {
+      c.lastRotateRequestUs = now;
+      c.mqtt.publish(c.requestKeyTopic, body);
+      g_stats.rotateRequests++;
+    }
+  }
+  if (c.mqtt.fd() >= 0 && millis() - c.mqtt.lastSendMs > 30000) {
+    c.mqtt.ping();
+  }
+  if (c.mqtt.fd() >= 0 && c.mqtt.wantsWrite() && !c.mqtt.flush()) {
+    disconnect(c, now);
+    return;
+  }
+  watchOutput(c);
+}
+
+// ========= Report =========
+
+static double percentileMs(std::vector<uint32_t> v, double q) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  size_t i = (size_t)(q * (v.size() - 1) + 0.5);
+  return v[i] / 1000.0;
+}
+
+static void printDistribution(const char* name, const std::vector<uint32_t>& v) {
+  printf("%-24s %8zu   p50 %8.1f   p90 %8.1f   p99 %8.1f   max %8.1f ms\n", name, v.size(),
+         percentileMs(v, 0.50), percentileMs(v, 0.90), percentileMs(v, 0.99), percentileMs(v, 1.0));
+}
+
+static bool gate(const char* name, bool ok, double value, double limit) {
+  printf("  %-30s %10.1f (limit %.1f)  %s\n", name, value, limit, ok ? "PASS" : "FAIL");
+  return ok;
+}
+
+static int report(uint64_t endUs) {
+  unsigned ready = 0;
+  for (const SimClient& c : g_clients) ready += c.state == SIM_READY;
+
+  double hsWindowS = (g_stats.lastHandshakeUs - g_stats.firstHandshakeUs) / 1e6;
+  double hsRate = g_stats.handshakes > 1 && hsWindowS > 0 ? (g_stats.handshakes - 1) / hsWindowS : 0;
+  double pubWindowS = g_stats.firstPublishUs ? (endUs - g_stats.firstPublishUs) / 1e6 : 0;
+  double pubRate = pubWindowS > 0 ? g_stats.published / pubWindowS : 0;
+  double decRate = pubWindowS > 0 ? g_stats.decrypted / pubWindowS : 0;
+
+  printf("\n=== secure_loadgen: %u devices, %u listeners, %.0f s ===\n",
+         g_opt.clients, g_opt.listeners, (endUs - g_t0Us) / 1e6);
+  printf("devices ready            %u / %u (connects %u, disconnects %u)\n",
+         ready, g_opt.clients, g_stats.connects, g_stats.disconnects);
+  printf("handshakes               %u (%.1f/s, %u retries)\n",
+         g_stats.handshakes, hsRate, g_stats.handshakeRetries);
+  printDistribution("  handshake latency", g_stats.handshakeUs);
+  printDistribution("key -> first decrypt", g_stats.keyToFirstDecryptUs);
+  printDistribution("publish -> decrypt", g_stats.endToEndUs);
+  printf("messages                 published %llu (%.1f/s, %llu refused), decrypted %llu (%.1f/s)\n",
+         (unsigned long long)g_stats.published, pubRate, (unsigned long long)g_stats.publishFailed,
+         (unsigned long long)g_stats.decrypted, decRate);
+  printf("decrypt failures         %llu, key requests %u, rotate requests %u, epoch rollbacks %u\n",
+         (unsigned long long)g_stats.decryptFailed, g_stats.keyRequests,
+         g_stats.rotateRequests, g_stats.epochRollbacks);
+
+  // Rotations: devices that moved to each epoch, and ready devices still
+  // on an older one when the run ended
+  double worstRekeyMs = 0;
+  bool rekeyComplete = true;
+  for (const auto& it : g_stats.epochs) {
+    const EpochStats& e = it.second;
+    unsigned behind = 0;
+    for (const SimClient& c : g_clients) {
+      behind += c.readyUs != 0 && c.haveEpoch && (int32_t)(c.epoch - it.first) < 0;
+    }
+    double maxMs = percentileMs(e.latencyUs, 1.0);
+    printf("rekey epoch %-12lu %zu devices, %u behind   p50 %8.1f   p99 %8.1f   max %8.1f ms\n",
+           (unsigned long)it.first, e.latencyUs.size(), behind,
+           percentileMs(e.latencyUs, 0.50), percentileMs(e.latencyUs, 0.99), maxMs);
+    worstRekeyMs = std::max(worstRekeyMs, maxMs);
+    // The epoch seen last may still be spreading when the run ends
+    if (behind && endUs - e.firstUs > 5000000) rekeyComplete = false;
+  }
+  if (g_stats.epochs.empty()) {
+    printf("rekey                    no rotation seen (run longer than the KMS rotate period)\n");
+  }
+
+  bool ok = true;
+  bool gated = g_opt.minHandshakeRate || g_opt.maxFirstDecryptP99Ms ||
+               g_opt.maxRekeyMs || g_opt.minMessageRate;
+  if (gated) printf("\nrelease gates\n");
+  if (g_opt.minHandshakeRate) {
+    ok &= gate("handshakes/s", hsRate >= g_opt.minHandshakeRate, hsRate, g_opt.minHandshakeRate);
+  }
+  if (g_opt.maxFirstDecryptP99Ms) {
+    double p99 = percentileMs(g_stats.keyToFirstDecryptUs, 0.99);
+    ok &= gate("key -> first decrypt p99 (ms)",
+               !g_stats.keyToFirstDecryptUs.empty() && p99 <= g_opt.maxFirstDecryptP99Ms,
+               p99, g_opt.maxFirstDecryptP99Ms);
+  }
+  if (g_opt.maxRekeyMs) {
+    ok &= gate("rekey completion (ms)",
+               !g_stats.epochs.empty() && rekeyComplete && worstRekeyMs <= g_opt.maxRekeyMs,
+               worstRekeyMs, g_opt.maxRekeyMs);
+  }
+  if (g_opt.minMessageRate) {
+    ok &= gate("messages/s", pubRate >= g_opt.minMessageRate, pubRate, g_opt.minMessageRate);
+  }
+  return ok ? 0 : 1;
+}
+
+// ========= Setup =========
+
+static bool readFile(const char* path, std::string* out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out->append(buf, n);
+  fclose(f);
+  return true;
+}
+
+static bool parseHexKey(const char* hex, uint8_t out[32]) {
+  if (!hex || strlen(hex) != 64) return false;
+  for (int i = 0; i < 32; ++i) {
+    unsigned v;
+    if (sscanf(hex + 2 * i, "%2x", &v) != 1) return false;
+    out[i] = (uint8_t)v;
+  }
+  return true;
+}
+
+static bool resolveBroker() {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  char port[8];
+  snprintf(port, sizeof(port), "%d", g_opt.port);
+  if (getaddrinfo(g_opt.host, port, &hints, &res) != 0 || !res) return false;
+  memcpy(&g_broker, res->ai_addr, sizeof(g_broker));
+  freeaddrinfo(res);
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: secure_loadgen --master-key HEX --pubkey FILE [options]\n"
+          "  --host H --port P          broker (127.0.0.1:1883)\n"
+          "  --clients N                simulated devices (100)\n"
+          "  --listeners N              devices decrypting the data topic (4)\n"
+          "  --connect-rate R           new connections per second (200)\n"
+          "  --duration S               run time in seconds (60)\n"
+          "  --publish-ms MS            reading period of each device (5000)\n"
+          "  --handshake-timeout-ms MS  before the auth is sent again (10000)\n"
+          "  --base T --topic T         base topic (iot/esp32), data topic (iot/esp32/data)\n"
+          "  --prefix P                 client ids P_00000... (sim)\n"
+          "  --sig-suite S              rsa2048 or p256 (rsa2048)\n"
+          "  --min-handshake-rate R --max-first-decrypt-p99-ms MS\n"
+          "  --max-rekey-ms MS --min-message-rate R   release gates\n"
+          "  --verbose                  secure layer logs on stderr\n");
+}
+
+static bool parseArgs(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(a, "--verbose") == 0) { g_opt.verbose = true; continue; }
+    if (!v) return false;
+    ++i;
+    if (strcmp(a, "--host") == 0) g_opt.host = v;
+    else if (strcmp(a, "--port") == 0) g_opt.port = atoi(v);
+    else if (strcmp(a, "--clients") == 0) g_opt.clients = (unsigned)atoi(v);
+    else if (strcmp(a, "--listeners") == 0) g_opt.listeners = (unsigned)atoi(v);
+    else if (strcmp(a, "--connect-rate") == 0) g_opt.connectRate = atof(v);
+    else if (strcmp(a, "--duration") == 0) g_opt.durationS = (unsigned)atoi(v);
+    else if (strcmp(a, "--publish-ms") == 0) g_opt.publishMs = (unsigned)atoi(v);
+    else if (strcmp(a, "--handshake-timeout-ms") == 0) g_opt.handshakeTimeoutMs = (unsigned)atoi(v);
+    else if (strcmp(a, "--base") == 0) g_opt.base = v;
+    else if (strcmp(a, "--topic") == 0) g_opt.topic = v;
+    else if (strcmp(a, "--prefix") == 0) g_opt.prefix = v;
+    else if (strcmp(a, "--master-key") == 0) g_opt.masterKeyHex = v;
+    else if (strcmp(a, "--pubkey") == 0) g_opt.pubkeyPath = v;
+    else if (strcmp(a, "--sig-suite") == 0) g_opt.sigSuite = v;
+    else if (strcmp(a, "--min-handshake-rate") == 0) g_opt.minHandshakeRate = atof(v);
+    else if (strcmp(a, "--max-first-decrypt-p99-ms") == 0) g_opt.maxFirstDecryptP99Ms = atof(v);
+    else if (strcmp(a, "--max-rekey-ms") == 0) g_opt.maxRekeyMs = atof(v);
+    else if (strcmp(a, "--min-message-rate") == 0) g_opt.minMessageRate = atof(v);
+    else return false;
+  }
+  return g_opt.masterKeyHex && g_opt.pubkeyPath && g_opt.clients > 0 &&
+         g_opt.publishMs > 0 && g_opt.connectRate > 0;
+}
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv)) {
+    usage();
+    return 2;
+  }
+  Serial.enabled = g_opt.verbose;
+
+  uint8_t kmsMasterKey[32];
+  std::string pem;
+  if (!parseHexKey(g_opt.masterKeyHex, kmsMasterKey)) {
+    fprintf(stderr, "--master-key: 64 hex digits expected\n");
+    return 2;
+  }
+  if (!readFile(g_opt.pubkeyPath, &pem) || !secureMqttSetKmsPubkey(pem.c_str())) {
+    fprintf(stderr, "%s: not a usable KMS public key\n", g_opt.pubkeyPath);
+    return 2;
+  }
+  if (!secureMqttSetKmsSigSuite(g_opt.sigSuite)) {
+    fprintf(stderr, "--sig-suite: unknown suite %s\n", g_opt.sigSuite);
+    return 2;
+  }
+  if (!resolveBroker()) {
+    fprintf(stderr, "cannot resolve %s\n", g_opt.host);
+    return 2;
+  }
+  g_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+  // Each device: its own context, id and CLIENT_MASTER_KEY as the KMS
+  // derives it, HKDF(KMS_master_key, salt = client_id, "CLIENT_MASTER_KEY")
+  g_clients.resize(g_opt.clients);
+  g_t0Us = nowUs();
+  for (uint32_t i = 0; i < g_opt.clients; ++i) {
+    SimClient& c = g_clients[i];
+    snprintf(c.id, sizeof(c.id), "%s_%05u", g_opt.prefix, i);
+    c.index = i;
+    c.sec = secureMqttContextCreate();
+    c.listener = i < g_opt.listeners;
+    c.connectAtUs = g_t0Us + (uint64_t)(i * 1e6 / g_opt.connectRate);
+    snprintf(c.requestKeyTopic, sizeof(c.requestKeyTopic), "%s/%s/kms/request_key",
+             g_opt.base, c.id);
+
+    selectClient(c);
+    sc_hkdf_sha256(kmsMasterKey, 32, (const uint8_t*)c.id, strlen(c.id),
+                   (const uint8_t*)"CLIENT_MASTER_KEY", strlen("CLIENT_MASTER_KEY"),
+                   CLIENT_MASTER_KEY, 32);
+    secureMqttInit(c.id);
+    secureMqttAddTopic(g_opt.topic, SECURE_FRAME_SESSION);
+  }
+
+  printf("secure_loadgen: %u devices -> %s:%d, crypto backend %s\n",
+         g_opt.clients, g_opt.host, g_opt.port, sc_backend_name());
+
+  const uint64_t endUs = g_t0Us + (uint64_t)g_opt.durationS * 1000000;
+  uint64_t lastScanUs = 0;
+  uint64_t nextProgressUs = g_t0Us + 5000000;
+  std::vector<epoll_event> events(1024);
+
+  for (;;) {
+    int n = epoll_wait(g_epoll, events.data(), (int)events.size(), 5);
+    if (g_opt.verbose) secLogDrain(256);
+    uint64_t now = nowUs();
+    if (now >= endUs) break;
+
+    for (int i = 0; i < n; ++i) {
+      SimClient& c = g_clients[events[i].data.u32];
+      selectClient(c);
+      if ((events[i].events & (EPOLLERR | EPOLLHUP)) && c.state == SIM_CONNECTING &&
+          !c.mqtt.connected()) {
+        disconnect(c, now);
+        continue;
+      }
+      if ((events[i].events & EPOLLIN) && !c.mqtt.receive(onMessage, &c)) {
+        disconnect(c, now);
+        continue;
+      }
+      step(c, now);
+    }
+
+    // Timers of every device, every 5 ms
+    if (now - lastScanUs >= 5000) {
+      lastScanUs = now;
+      for (SimClient& c : g_clients) {
+        if (c.state == SIM_IDLE) {
+          if (now >= c.connectAtUs) startConnect(c, now);
+          continue;
+        }
+        if (c.state == SIM_CONNECTING && !c.mqtt.connected()) continue;
+        selectClient(c);
+        step(c, now);
+      }
+    }
+
+    if (now >= nextProgressUs) {
+      nextProgressUs += 5000000;
+      unsigned ready = 0;
+      for (const SimClient& c : g_clients) ready += c.state == SIM_READY;
+      printf("[%5.0f s] ready %u/%u, handshakes %u, published %llu, decrypted %llu\n",
+             (now - g_t0Us) / 1e6, ready, g_opt.clients, g_stats.handshakes,
+             (unsigned long long)g_stats.published, (unsigned long long)g_stats.decrypted);
+      fflush(stdout);
+    }
+  }
+
+  int status = report(nowUs());
+  for (SimClient& c : g_clients) {
+    c.mqtt.close();
+    secureMqttContextDestroy(c.sec);
+  }
+  return status;
+}
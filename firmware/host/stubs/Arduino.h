@@ -0,0 +1,41 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core used by the secure
+// layer: Serial, millis() and micros(). Serial goes to stderr and can be
+// muted so benchmarks are not timing printf.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+class HostSerial {
+ public:
+  bool enabled = true;
+
+  void print(const char* s) { if (enabled) fputs(s, stderr); }
+  void print(char c) { if (enabled) fputc(c, stderr); }
+  void print(int v) { if (enabled) fprintf(stderr, "%d", v); }
+  void print(unsigned int v) { if (enabled) fprintf(stderr, "%u", v); }
+  void print(long v) { if (enabled) fprintf(stderr, "%ld", v); }
+  void print(unsigned long v) { if (enabled) fprintf(stderr, "%lu", v); }
+  void print(double v) { if (enabled) fprintf(stderr, "%.2f", v); }
+
+  template <typename T>
+  void println(T v) { print(v); println(); }
+  void println() { if (enabled) fputc('\n', stderr); }
+
+  template <typename... Args>
+  void printf(const char* fmt, Args... args) {
+    if (enabled) fprintf(stderr, fmt, args...);
+  }
+};
+
+extern HostSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
@@ -0,0 +1,21 @@
+#pragma once
+
+// Host stand-in for the ESP32 NVS Preferences: an in-memory store that
+// lives as long as the process.
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool readOnly = false);
+  void end();
+  uint32_t getULong(const char* key, uint32_t defaultValue = 0);
+  size_t putULong(const char* key, uint32_t value);
+  bool isKey(const char* key);
+  size_t getBytes(const char* key, void* buf, size_t maxLen);
+  size_t putBytes(const char* key, const void* value, size_t len);
+
+  // Number of put calls so far, across every namespace
+  static uint32_t writeCount();
+};
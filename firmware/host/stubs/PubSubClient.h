@@ -0,0 +1,36 @@
+#pragma once
+
+// Host stand-in for PubSubClient: nothing is sent, the last publish is
+// kept so it can be fed back to the receiving side.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Arduino.h"
+
+#ifndef HOST_MQTT_MAX_PAYLOAD
+#define HOST_MQTT_MAX_PAYLOAD 2048
+#endif
+
+class PubSubClient {
+ public:
+  char lastTopic[128] = {0};
+  uint8_t lastPayload[HOST_MQTT_MAX_PAYLOAD];
+  size_t lastLength = 0;
+  uint32_t publishCount = 0;
+
+  bool publish(const char* topic, const char* payload) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload));
+  }
+
+  bool publish(const char* topic, const uint8_t* payload, unsigned int length) {
+    if (length > sizeof(lastPayload)) return false;
+    snprintf(lastTopic, sizeof(lastTopic), "%s", topic);
+    memcpy(lastPayload, payload, length);
+    lastLength = length;
+    publishCount++;
+    return true;
+  }
+
+  bool connected() { return true; }
+};
@@ -0,0 +1,93 @@
+#include "Arduino.h"
+#include "Preferences.h"
+#include "esp_random.h"
+
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+
+HostSerial Serial;
+
+static uint64_t monotonicUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+unsigned long millis() {
+  return (unsigned long)(monotonicUs() / 1000u);
+}
+
+unsigned long micros() {
+  return (unsigned long)monotonicUs();
+}
+
+void delay(unsigned long ms) {
+  timespec ts;
+  ts.tv_sec = (time_t)(ms / 1000);
+  ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+  nanosleep(&ts, nullptr);
+}
+
+extern "C" uint32_t esp_random(void) {
+  static FILE* urandom = fopen("/dev/urandom", "rb");
+  uint32_t r = 0;
+  if (!urandom || fread(&r, sizeof(r), 1, urandom) != 1) {
+    r = (uint32_t)rand();
+  }
+  return r;
+}
+
+// ========= Preferences =========
+
+static std::map<std::string, uint32_t>& prefsStore() {
+  static std::map<std::string, uint32_t> store;
+  return store;
+}
+
+static uint32_t g_prefsWrites = 0;
+
+bool Preferences::begin(const char*, bool) {
+  return true;
+}
+
+void Preferences::end() {
+}
+
+uint32_t Preferences::getULong(const char* key, uint32_t defaultValue) {
+  auto it = prefsStore().find(key);
+  return it == prefsStore().end() ? defaultValue : it->second;
+}
+
+size_t Preferences::putULong(const char* key, uint32_t value) {
+  prefsStore()[key] = value;
+  g_prefsWrites++;
+  return sizeof(value);
+}
+
+static std::map<std::string, std::string>& prefsBlobs() {
+  static std::map<std::string, std::string> blobs;
+  return blobs;
+}
+
+bool Preferences::isKey(const char* key) {
+  return prefsStore().count(key) || prefsBlobs().count(key);
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  auto it = prefsBlobs().find(key);
+  if (it == prefsBlobs().end() || it->second.size() > maxLen) return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  prefsBlobs()[key].assign((const char*)value, len);
+  g_prefsWrites++;
+  return len;
+}
+
+uint32_t Preferences::writeCount() {
+  return g_prefsWrites;
+}
@@ -0,0 +1,79 @@
+// Key ring of a secure topic (topic_table.h): epochs only move forward.
+// A key answer for a past epoch, late or replayed, must not become
+// current again; it may only be kept to decrypt frames in flight.
+//
+//   topic_table_test
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "topic_table.h"
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...)                                     \
+  do {                                                       \
+    if (!(cond)) {                                           \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__);            \
+      printf(__VA_ARGS__);                                   \
+      printf("\n");                                          \
+      g_failed++;                                            \
+    }                                                        \
+  } while (0)
+
+static const uint8_t* keyOf(uint8_t fill) {
+  static uint8_t key[32];
+  memset(key, fill, sizeof(key));
+  return key;
+}
+
+static uint32_t currentEpoch(const TopicEntry* entry) {
+  const TopicKeySlot* slot = topicCurrentKey(entry);
+  return slot ? slot->epoch : 0xDEADBEEF;
+}
+
+int main() {
+  TopicTable table;
+  topicTableInit(&table);
+  TopicEntry* entry = &table.entries[topicTableAdd(&table, "iot/esp32/data")];
+
+  CHECK(topicInstallKey(entry, 10, keyOf(10)) == TOPIC_KEY_CURRENT, "first key");
+  CHECK(topicInstallKey(entry, 11, keyOf(11)) == TOPIC_KEY_CURRENT, "rotation");
+  CHECK(topicInstallKey(entry, 12, keyOf(12)) == TOPIC_KEY_CURRENT, "second rotation");
+  CHECK(currentEpoch(entry) == 12, "current epoch %lu", (unsigned long)currentEpoch(entry));
+
+  // Replay of the retired epoch 10: older than everything kept
+  CHECK(topicInstallKey(entry, 10, keyOf(10)) == TOPIC_KEY_REFUSED, "epoch 10 replayed");
+  CHECK(topicKeyForEpoch(entry, 10) == nullptr, "epoch 10 back in the ring");
+  // Replay of the previous epoch: still kept for receiving, not current
+  CHECK(topicInstallKey(entry, 11, keyOf(11)) == TOPIC_KEY_RECEIVE_ONLY, "epoch 11 replayed");
+  CHECK(currentEpoch(entry) == 12, "current epoch moved back to %lu",
+        (unsigned long)currentEpoch(entry));
+  CHECK(topicCurrentKey(entry)->key[0] == 12, "current key replaced");
+  // The KMS resending the current epoch
+  CHECK(topicInstallKey(entry, 12, keyOf(12)) == TOPIC_KEY_CURRENT, "epoch 12 resent");
+
+  // Late answer into a free slot of a fresh ring: receive-only
+  TopicEntry* alarms = &table.entries[topicTableAdd(&table, "iot/esp32/alarms")];
+  topicInstallKey(alarms, 5, keyOf(5));
+  CHECK(topicInstallKey(alarms, 4, keyOf(4)) == TOPIC_KEY_RECEIVE_ONLY, "late epoch 4");
+  CHECK(currentEpoch(alarms) == 5 && topicKeyForEpoch(alarms, 4), "epoch 4 kept, 5 current");
+  // A newer epoch evicts the oldest one, not the current one
+  CHECK(topicInstallKey(alarms, 6, keyOf(6)) == TOPIC_KEY_CURRENT, "epoch 6");
+  CHECK(topicKeyForEpoch(alarms, 5) && !topicKeyForEpoch(alarms, 4), "epoch 4 not evicted");
+
+  // Serial arithmetic across the wrap
+  TopicEntry* wrap = &table.entries[topicTableAdd(&table, "iot/esp32/wrap")];
+  topicInstallKey(wrap, 0xFFFFFFFFu, keyOf(1));
+  CHECK(topicInstallKey(wrap, 0, keyOf(2)) == TOPIC_KEY_CURRENT, "epoch wrap");
+  CHECK(topicInstallKey(wrap, 0xFFFFFFFEu, keyOf(3)) == TOPIC_KEY_REFUSED, "before the wrap");
+  CHECK(currentEpoch(wrap) == 0, "current epoch %lu", (unsigned long)currentEpoch(wrap));
+
+  if (g_failed) {
+    printf("%d check(s) failed\n", g_failed);
+    return 1;
+  }
+  printf("topic_table_test: OK\n");
+  return 0;
+}
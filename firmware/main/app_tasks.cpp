@@ -0,0 +1,288 @@
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <string.h>
+#include <atomic>
+#include "app_tasks.h"
+#include "spsc_queue.h"
+#include "conn_manager.h"
+#include "mqtt_client.h"
+#include "secure_mqtt.h"
+#include "sec_metrics.h"
+#include "sec_scratch.h"
+#include "sec_log.h"
+
+// `ticket` is 0 for an untracked payload, see appQueuePublishTracked()
+struct OutgoingPlain {
+  const char* topic;
+  uint32_t ticket;
+  uint8_t len;
+  char data[APP_PLAIN_MAX];
+};
+
+struct OutgoingFrame {
+  const char* topic;
+  uint32_t ticket;
+  uint16_t len;
+  uint8_t data[APP_FRAME_MAX];
+};
+
+struct IncomingFrame {
+  char topic[APP_TOPIC_MAX];
+  uint16_t len;
+  uint8_t data[APP_FRAME_MAX];
+};
+
+// One producer and one consumer each, see app_tasks.h
+static SpscQueue<OutgoingPlain, 8>   g_uiToCrypto;
+static SpscQueue<OutgoingFrame, 8>   g_cryptoToNet;
+static SpscQueue<IncomingFrame, 8>   g_netToCrypto;
+static SpscQueue<RemoteReading, 16>  g_cryptoToUi;
+
+static TaskHandle_t g_netTask = nullptr;
+static TaskHandle_t g_cryptoTask = nullptr;
+
+// Tickets of tracked payloads: handed out by the UI task, the last one
+// published stored by the network task
+static uint32_t g_nextTicket = 0;
+static std::atomic<uint32_t> g_publishedTicket{0};
+
+// Upper bound on the wait when nothing is notified
+static const TickType_t NET_POLL_TICKS = pdMS_TO_TICKS(10);
+static const TickType_t CRYPTO_IDLE_TICKS = pdMS_TO_TICKS(100);
+static const TickType_t LOG_POLL_TICKS = pdMS_TO_TICKS(20);
+
+extern PubSubClient client;
+extern const char* ssid;
+extern const char* password;
+extern const char* mqttClientId;
+extern const char* topic_cmd_sub;
+extern const char* topic_data_sub;
+extern const char* topic_alarm;
+extern const char* topic_metrics;
+
+static bool queuePlain(const char* topic, const uint8_t* payload, size_t len, uint32_t ticket) {
+  if (len > APP_PLAIN_MAX) {
+    SLOG_W("[TASK] Payload too large, dropped");
+    return false;
+  }
+  OutgoingPlain* slot = g_uiToCrypto.reserve();
+  if (!slot) {
+    SLOG_W("[TASK] Crypto queue full, payload dropped");
+    return false;
+  }
+  slot->topic = topic;
+  slot->ticket = ticket;
+  slot->len = (uint8_t)len;
+  memcpy(slot->data, payload, len);
+  g_uiToCrypto.commit();
+  if (g_cryptoTask) xTaskNotifyGive(g_cryptoTask);
+  return true;
+}
+
+bool appQueuePublish(const char* topic, const char* payload) {
+  return queuePlain(topic, (const uint8_t*)payload, strlen(payload), 0);
+}
+
+bool appQueuePublishBytes(const char* topic, const uint8_t* payload, size_t len) {
+  return queuePlain(topic, payload, len, 0);
+}
+
+bool appQueuePublishTracked(const char* topic, const char* payload, uint32_t* ticket) {
+  uint32_t next = g_nextTicket + 1;
+  if (next == 0) next = 1;
+  if (!queuePlain(topic, (const uint8_t*)payload, strlen(payload), next)) return false;
+  g_nextTicket = next;
+  *ticket = next;
+  return true;
+}
+
+bool appPublished(uint32_t ticket) {
+  uint32_t published = g_publishedTicket.load(std::memory_order_acquire);
+  return published != 0 && (int32_t)(published - ticket) >= 0;
+}
+
+bool appNextRemoteReading(RemoteReading* out) {
+  return g_cryptoToUi.pop(out);
+}
+
+bool appQueueIncoming(const char* topic, const uint8_t* payload, unsigned int length) {
+  if (length > APP_FRAME_MAX || strlen(topic) >= APP_TOPIC_MAX) {
+    SLOG_W("[TASK] Incoming frame too large, dropped");
+    return false;
+  }
+  IncomingFrame* slot = g_netToCrypto.reserve();
+  if (!slot) {
+    SLOG_W("[TASK] Receive queue full, frame dropped");
+    return false;
+  }
+  strcpy(slot->topic, topic);
+  slot->len = (uint16_t)length;
+  memcpy(slot->data, payload, length);
+  g_netToCrypto.commit();
+  if (g_cryptoTask) xTaskNotifyGive(g_cryptoTask);
+  return true;
+}
+
+bool appPostRemoteReading(RemoteReadingKind kind, float value) {
+  RemoteReading r;
+  r.kind = kind;
+  r.value = value;
+  r.atMs = millis();
+  return g_cryptoToUi.push(r);
+}
+
+// Owns the WiFi link and the PubSubClient: nothing else touches `client`.
+static void netTask(void*) {
+  static const char* secureTopics[] = { topic_data_sub, topic_alarm };
+
+  ConnConfig cfg;
+  cfg.ssid = ssid;
+  cfg.password = password;
+  cfg.clientId = mqttClientId;
+  cfg.baseTopic = "iot/esp32";
+  cfg.commandTopic = topic_cmd_sub;
+  cfg.secureTopics = secureTopics;
+  cfg.secureTopicCount = sizeof(secureTopics) / sizeof(secureTopics[0]);
+  connManagerInit(&client, cfg);
+
+  for (;;) {
+    connManagerStep();
+
+    if (client.connected()) {
+      client.loop(); // KMS messages are handled here, data frames are queued
+    }
+
+    OutgoingFrame* frame;
+    while ((frame = g_cryptoToNet.front()) != nullptr) {
+      uint32_t publishStart = secMetricsNow();
+      bool published = client.connected() &&
+                       client.publish(frame->topic, frame->data, frame->len);
+      secMetricsRecord(SEC_STAGE_PUBLISH, secMetricsNow() - publishStart);
+      if (!published) {
+        SLOG_W("[TASK] Publish failed");
+      } else if (frame->ticket != 0) {
+        g_publishedTicket.store(frame->ticket, std::memory_order_release);
+      }
+      g_cryptoToNet.release();
+    }
+
+    if (client.connected()) {
+      requestKeyOnDecryptFailure(client);
+      requestRotationOnLostCounter(client);
+    }
+
+    // Woken early when the crypto worker has sealed a frame
+    ulTaskNotifyTake(pdTRUE, NET_POLL_TICKS);
+  }
+}
+
+// Memory gauges of each metrics report, sampled on the crypto task when
+// the report starts: the secure layer's scratch arena, and the stack
+// high-water marks (fewest free bytes so far) of the two secure tasks
+static void sampleMemoryGauges() {
+  secMetricsSetGauge(SEC_GAUGE_SCRATCH_PEAK, (uint32_t)secScratchPeak());
+  secMetricsSetGauge(SEC_GAUGE_SCRATCH_SIZE, SEC_SCRATCH_SIZE);
+  secMetricsSetGauge(SEC_GAUGE_SCRATCH_FAILURES, secScratchFailures());
+  secMetricsSetGauge(SEC_GAUGE_NET_STACK_FREE, uxTaskGetStackHighWaterMark(g_netTask));
+  secMetricsSetGauge(SEC_GAUGE_CRYPTO_STACK_FREE, uxTaskGetStackHighWaterMark(g_cryptoTask));
+}
+
+#if SEC_METRICS
+// Seals the next chunk of the metrics report, if one is due. Chunks go
+// out one per wake-up so a report never fills the publish queue.
+static void sealMetricsChunk() {
+  if (!secureMqttIsTopicReady(topic_metrics)) return;
+  OutgoingFrame* frame = g_cryptoToNet.reserve();
+  if (!frame) return;  // retried on the next wake-up
+
+  char chunk[192];
+  size_t len = secMetricsNextChunk(millis(), chunk, sizeof(chunk));
+  if (len == 0) return;
+  len = secureMqttEncryptFrame(topic_metrics, (const uint8_t*)chunk, len,
+                               frame->data, sizeof(frame->data));
+  if (len > 0) {
+    frame->topic = topic_metrics;
+    frame->ticket = 0;
+    frame->len = (uint16_t)len;
+    g_cryptoToNet.commit();
+    xTaskNotifyGive(g_netTask);
+  }
+}
+#endif
+
+#ifdef APP_RX_PROFILE
+static void profileIncoming(uint32_t cycles) {
+  static uint32_t frames = 0;
+  static uint64_t totalCycles = 0;
+  totalCycles += cycles;
+  if (++frames % 64 == 0) {
+    SLOG_I("[TASK] rx: %lu cycles/frame, stack high-water %u bytes",
+           (unsigned long)(totalCycles / 64),
+           (unsigned)uxTaskGetStackHighWaterMark(g_cryptoTask));
+    totalCycles = 0;
+  }
+}
+#endif
+
+// Seals outgoing payloads and opens incoming frames, off the UI core's
+// hot path and off the network task.
+static void cryptoTask(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, CRYPTO_IDLE_TICKS);
+
+    OutgoingPlain* plain;
+    while ((plain = g_uiToCrypto.front()) != nullptr) {
+      OutgoingFrame* frame = g_cryptoToNet.reserve();
+      if (!frame) {
+        SLOG_W("[TASK] Publish queue full, frame dropped");
+      } else {
+        size_t len = secureMqttEncryptFrame(plain->topic,
+                                            (const uint8_t*)plain->data, plain->len,
+                                            frame->data, sizeof(frame->data));
+        if (len > 0) {
+          frame->topic = plain->topic;
+          frame->ticket = plain->ticket;
+          frame->len = (uint16_t)len;
+          g_cryptoToNet.commit();
+          xTaskNotifyGive(g_netTask);
+        }
+      }
+      g_uiToCrypto.release();
+    }
+
+    IncomingFrame* in;
+    while ((in = g_netToCrypto.front()) != nullptr) {
+#ifdef APP_RX_PROFILE
+      uint32_t start = ESP.getCycleCount();
+      decodeDataFrame(in->topic, in->data, in->len);
+      profileIncoming(ESP.getCycleCount() - start);
+#else
+      decodeDataFrame(in->topic, in->data, in->len);
+#endif
+      g_netToCrypto.release();
+    }
+
+#if SEC_METRICS
+    sealMetricsChunk();
+#endif
+  }
+}
+
+// Prints the log ring (sec_log.h), so the other tasks never wait on the
+// UART. Runs below the network task on its core.
+static void logTask(void*) {
+  for (;;) {
+    secLogDrain(8);
+    vTaskDelay(LOG_POLL_TICKS);
+  }
+}
+
+void appTasksStart() {
+  secMetricsSetGaugeSampler(sampleMemoryGauges);
+  xTaskCreatePinnedToCore(netTask, "secure_net", 8192, nullptr,
+                          APP_NET_TASK_PRIORITY, &g_netTask, APP_NET_CORE);
+  xTaskCreatePinnedToCore(cryptoTask, "secure_crypto", 8192, nullptr,
+                          APP_CRYPTO_TASK_PRIORITY, &g_cryptoTask, APP_CRYPTO_CORE);
+  xTaskCreatePinnedToCore(logTask, "log_drain", 4096, nullptr,
+                          APP_LOG_TASK_PRIORITY, nullptr, APP_LOG_CORE);
+}
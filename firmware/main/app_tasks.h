@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Task layout. The Arduino loop task is the UI task; setup() starts the
+// others:
+//   core 1  UI (button, SOS blink, DHT, OLED)            priority 3
+//   core 1  crypto worker (seal outgoing, open incoming)   priority 1
+//   core 0  secure-MQTT I/O (WiFi, client.loop, handshake,
+//           publishing sealed frames)                      priority 2
+//   core 0  log drain (sec_log.h ring -> Serial)          priority 1
+// They only talk through single-producer/single-consumer queues:
+//   UI -> crypto -> net for outgoing payloads, net -> crypto -> UI for
+//   incoming data frames. A full queue drops the newest item, so a slow
+//   publish or a stalled TCP write never blocks the UI.
+
+#define APP_UI_TASK_PRIORITY     3
+#define APP_NET_TASK_PRIORITY    2
+#define APP_CRYPTO_TASK_PRIORITY 1
+#define APP_LOG_TASK_PRIORITY    1
+#define APP_NET_CORE    0
+#define APP_CRYPTO_CORE 1
+#define APP_LOG_CORE    0
+
+#define APP_PLAIN_MAX 64    // largest outgoing plaintext
+#define APP_FRAME_MAX 512   // largest sealed or received frame
+#define APP_TOPIC_MAX 64
+
+// Uncomment (or build with -DAPP_RX_PROFILE) to print, every 64 received
+// frames, the average cycles spent opening and decoding a frame and the
+// crypto task's stack high-water mark
+// #define APP_RX_PROFILE
+
+enum RemoteReadingKind : uint8_t {
+  REMOTE_HUMIDITY,
+  REMOTE_TEMPERATURE,
+  REMOTE_SOS,
+};
+
+struct RemoteReading {
+  RemoteReadingKind kind;
+  float value;
+  unsigned long atMs;
+};
+
+// Starts the network and crypto tasks (call once, at the end of setup)
+void appTasksStart();
+
+// UI task: queues a plaintext payload to be sealed and published on
+// `topic` (must outlive the call, e.g. a string literal). Returns false
+// if the queue is full.
+bool appQueuePublish(const char* topic, const char* payload);
+// Same for a binary payload of up to APP_PLAIN_MAX bytes
+bool appQueuePublishBytes(const char* topic, const uint8_t* payload, size_t len);
+// Same as appQueuePublish(), and `*ticket` identifies the payload for
+// appPublished(). A queued payload can still be dropped further on.
+bool appQueuePublishTracked(const char* topic, const char* payload, uint32_t* ticket);
+// UI task: true once the payload of `ticket`, or one queued after it, was
+// handed to the MQTT client
+bool appPublished(uint32_t ticket);
+
+// UI task: next decoded reading from the other node, false if none.
+bool appNextRemoteReading(RemoteReading* out);
+
+// Network task: hands a received data frame to the crypto worker.
+bool appQueueIncoming(const char* topic, const uint8_t* payload, unsigned int length);
+
+// Crypto task: reports a decoded reading to the UI.
+bool appPostRemoteReading(RemoteReadingKind kind, float value);
@@ -0,0 +1,204 @@
+#include <Arduino.h>
+#include <string.h>
+#include <stdio.h>
+#include "conn_manager.h"
+#include "local_network.h"
+#include "mqtt_client.h"
+#include "secure_mqtt.h"
+#include "sec_log.h"
+
+static PubSubClient* g_client = nullptr;
+static ConnConfig g_cfg;
+static char g_statusTopic[128];  // baseTopic/clientId/status/conn
+
+static ConnState g_state = CONN_WIFI_CONNECTING;
+static unsigned long g_enteredMs = 0;
+static ConnStats g_stats;
+
+// Where to resume once the backoff delay has elapsed
+static ConnState g_retryState = CONN_WIFI_CONNECTING;
+static unsigned long g_retryAtMs = 0;
+
+// Consecutive failures per stage, reset on success
+static uint8_t g_wifiAttempt = 0;
+static uint8_t g_mqttAttempt = 0;
+static uint8_t g_handshakeAttempt = 0;
+
+static const char* const STATE_NAMES[CONN_STATE_COUNT] = {
+  "wifi", "mqtt", "handshake", "ready", "backoff",
+};
+
+const char* connStateName(ConnState state) {
+  return state < CONN_STATE_COUNT ? STATE_NAMES[state] : "?";
+}
+
+uint32_t connBackoffDelayMs(uint8_t attempt, uint32_t rnd) {
+  uint32_t ceiling = CONN_BACKOFF_CAP_MS;
+  if (attempt < 16 && ((uint32_t)CONN_BACKOFF_BASE_MS << attempt) < ceiling) {
+    ceiling = (uint32_t)CONN_BACKOFF_BASE_MS << attempt;
+  }
+  return rnd % (ceiling + 1);
+}
+
+static void enterState(ConnState next) {
+  unsigned long now = millis();
+  g_stats.timeInStateMs[g_state] += now - g_enteredMs;
+  g_stats.entries[next]++;
+  g_state = next;
+  g_enteredMs = now;
+}
+
+static void scheduleRetry(ConnState retry, uint8_t* attempt) {
+  uint32_t delayMs = connBackoffDelayMs(*attempt, esp_random());
+  if (*attempt < 255) (*attempt)++;
+  g_retryState = retry;
+  g_retryAtMs = millis() + delayMs;
+
+  SLOG_I("[CONN] Retrying %s in %lu ms", connStateName(retry), (unsigned long)delayMs);
+  enterState(CONN_BACKOFF);
+}
+
+static void startWifi() {
+  wifiBegin(g_cfg.ssid, g_cfg.password);
+  enterState(CONN_WIFI_CONNECTING);
+}
+
+static void startHandshake() {
+  secureMqttBeginHandshake(*g_client);
+  enterState(CONN_HANDSHAKING);
+}
+
+// Publishes the cumulative time per state, e.g. after each reconnect
+static void reportStats() {
+  ConnStats s;
+  connManagerGetStats(&s);
+
+  char body[256];
+  snprintf(body, sizeof(body),
+           "{\"wifi_ms\":%lu,\"mqtt_ms\":%lu,\"handshake_ms\":%lu,"
+           "\"ready_ms\":%lu,\"backoff_ms\":%lu,\"sessions\":%lu,"
+           "\"wifi_fail\":%lu,\"mqtt_fail\":%lu,\"handshake_timeout\":%lu}",
+           (unsigned long)s.timeInStateMs[CONN_WIFI_CONNECTING],
+           (unsigned long)s.timeInStateMs[CONN_MQTT_CONNECTING],
+           (unsigned long)s.timeInStateMs[CONN_HANDSHAKING],
+           (unsigned long)s.timeInStateMs[CONN_READY],
+           (unsigned long)s.timeInStateMs[CONN_BACKOFF],
+           (unsigned long)s.entries[CONN_READY],
+           (unsigned long)s.wifiFailures,
+           (unsigned long)s.mqttFailures,
+           (unsigned long)s.handshakeTimeouts);
+  SLOG_I("[CONN] Ready, handshake %lu ms, session %lu",
+         (unsigned long)s.timeInStateMs[CONN_HANDSHAKING],
+         (unsigned long)s.entries[CONN_READY]);
+  g_client->publish(g_statusTopic, body);
+}
+
+// Falls back to an earlier state when the link below has gone away.
+// Returns true if it did.
+static bool handleLinkLoss() {
+  if (!wifiIsConnected()) {
+    SLOG_W("[CONN] WiFi lost");
+    scheduleRetry(CONN_WIFI_CONNECTING, &g_wifiAttempt);
+    return true;
+  }
+  if (!g_client->connected()) {
+    SLOG_W("[CONN] MQTT connection lost, rc=%d", g_client->state());
+    // Even the first retry is jittered: a broker restart drops every
+    // device at once.
+    scheduleRetry(CONN_MQTT_CONNECTING, &g_mqttAttempt);
+    return true;
+  }
+  return false;
+}
+
+void connManagerInit(PubSubClient* client, const ConnConfig& cfg) {
+  g_client = client;
+  g_cfg = cfg;
+  snprintf(g_statusTopic, sizeof(g_statusTopic), "%s/%s/status/conn",
+           g_cfg.baseTopic, g_cfg.clientId);
+  memset(&g_stats, 0, sizeof(g_stats));
+  g_state = CONN_WIFI_CONNECTING;
+  g_enteredMs = millis();
+  g_stats.entries[CONN_WIFI_CONNECTING] = 1;
+  wifiBegin(g_cfg.ssid, g_cfg.password);
+}
+
+void connManagerStep() {
+  unsigned long now = millis();
+
+  switch (g_state) {
+    case CONN_WIFI_CONNECTING:
+      if (wifiIsConnected()) {
+        wifiPrintStatus();
+        g_wifiAttempt = 0;
+        enterState(CONN_MQTT_CONNECTING);
+      } else if (now - g_enteredMs > CONN_WIFI_TIMEOUT_MS) {
+        SLOG_W("[CONN] WiFi connect timeout");
+        g_stats.wifiFailures++;
+        scheduleRetry(CONN_WIFI_CONNECTING, &g_wifiAttempt);
+      }
+      break;
+
+    case CONN_MQTT_CONNECTING:
+      if (!wifiIsConnected()) {
+        scheduleRetry(CONN_WIFI_CONNECTING, &g_wifiAttempt);
+      } else if (tryConnectMQTT(*g_client, g_cfg.baseTopic, g_cfg.clientId,
+                                g_cfg.commandTopic,
+                                g_cfg.secureTopics, g_cfg.secureTopicCount)) {
+        g_mqttAttempt = 0;
+        startHandshake();
+      } else {
+        g_stats.mqttFailures++;
+        scheduleRetry(CONN_MQTT_CONNECTING, &g_mqttAttempt);
+      }
+      break;
+
+    case CONN_HANDSHAKING:
+      if (handleLinkLoss()) break;
+      if (secureMqttIsReady()) {
+        g_handshakeAttempt = 0;
+        enterState(CONN_READY);
+        reportStats();
+      } else if (now - g_enteredMs > CONN_HANDSHAKE_TIMEOUT_MS) {
+        SLOG_W("[CONN] Handshake timeout");
+        g_stats.handshakeTimeouts++;
+        scheduleRetry(CONN_HANDSHAKING, &g_handshakeAttempt);
+      }
+      break;
+
+    case CONN_READY:
+      handleLinkLoss();
+      break;
+
+    case CONN_BACKOFF:
+      // A late key reply still completes the handshake being retried
+      if (g_retryState == CONN_HANDSHAKING && g_client->connected() &&
+          secureMqttIsReady()) {
+        g_handshakeAttempt = 0;
+        enterState(CONN_READY);
+        reportStats();
+        break;
+      }
+      if ((long)(now - g_retryAtMs) < 0) break;
+      if (g_retryState == CONN_WIFI_CONNECTING) {
+        startWifi();
+      } else if (g_retryState == CONN_HANDSHAKING && g_client->connected()) {
+        startHandshake();
+      } else {
+        enterState(CONN_MQTT_CONNECTING);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+ConnState connManagerState() {
+  return g_state;
+}
+
+void connManagerGetStats(ConnStats* out) {
+  *out = g_stats;
+  out->timeInStateMs[g_state] += millis() - g_enteredMs;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+// Event-driven connection manager for the network task: WiFi, then the
+// MQTT session, then the KMS handshake. connManagerStep() never waits;
+// failed attempts are retried after a "full jitter" exponential backoff,
+// delay = random(0, min(cap, base * 2^attempt)), so devices that lose the
+// broker at the same moment do not all come back on the same grid.
+
+#ifndef CONN_BACKOFF_BASE_MS
+#define CONN_BACKOFF_BASE_MS 1000
+#endif
+#ifndef CONN_BACKOFF_CAP_MS
+#define CONN_BACKOFF_CAP_MS 60000
+#endif
+#define CONN_WIFI_TIMEOUT_MS 15000       // WiFi association attempt
+#define CONN_HANDSHAKE_TIMEOUT_MS 10000  // auth sent, no key yet
+
+enum ConnState : uint8_t {
+  CONN_WIFI_CONNECTING = 0,
+  CONN_MQTT_CONNECTING,
+  CONN_HANDSHAKING,
+  CONN_READY,
+  CONN_BACKOFF,
+  CONN_STATE_COUNT,
+};
+
+struct ConnConfig {
+  const char* ssid;
+  const char* password;
+  const char* clientId;
+  const char* baseTopic;       // e.g. "iot/esp32"
+  const char* commandTopic;
+  const char* const* secureTopics;  // data topics to subscribe to
+  uint8_t secureTopicCount;
+};
+
+struct ConnStats {
+  uint32_t timeInStateMs[CONN_STATE_COUNT];  // cumulative, current state included
+  uint32_t entries[CONN_STATE_COUNT];
+  uint32_t wifiFailures;
+  uint32_t mqttFailures;
+  uint32_t handshakeTimeouts;
+};
+
+// `cfg` strings must outlive the manager. Starts the WiFi connection.
+void connManagerInit(PubSubClient* client, const ConnConfig& cfg);
+
+// Advances the state machine; call often from the network task. Only the
+// MQTT CONNECT itself can take time (one attempt per call).
+void connManagerStep();
+
+ConnState connManagerState();
+const char* connStateName(ConnState state);
+void connManagerGetStats(ConnStats* out);
+
+// Backoff before retry number `attempt` (0-based) given a random word
+uint32_t connBackoffDelayMs(uint8_t attempt, uint32_t rnd);
@@ -0,0 +1,35 @@
+#include "counter_lease.h"
+
+void counterLeaseInit(CounterLease* lease,
+                      uint32_t persistedEnd,
+                      uint32_t block,
+                      CounterLeasePersistFn persist,
+                      void* ctx) {
+  // Skip whatever was left of the previous lease
+  lease->current = persistedEnd;
+  lease->end = persistedEnd;
+  lease->block = block ? block : 1;
+  lease->persist = persist;
+  lease->ctx = ctx;
+}
+
+bool counterLeaseNext(CounterLease* lease, uint32_t* counterOut) {
+  if (lease->current == UINT32_MAX) {
+    return false;
+  }
+
+  if (lease->current >= lease->end) {
+    uint32_t newEnd = (UINT32_MAX - lease->current > lease->block)
+                          ? lease->current + lease->block
+                          : UINT32_MAX;
+    // The lease must be durable before any counter from it is used
+    if (!lease->persist || !lease->persist(newEnd, lease->ctx)) {
+      return false;
+    }
+    lease->end = newEnd;
+  }
+
+  lease->current++;
+  *counterOut = lease->current;
+  return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Counter leases: instead of persisting the message counter on every
+// publish, a block of counters is reserved by persisting the end of the
+// block ("lease"), then counters are handed out from RAM. After a reboot
+// the counter restarts at the end of the last lease, so it never goes
+// backwards; at most one block of counters is skipped per crash.
+//
+// The guarantee only holds while the lease survives. If the stored lease
+// is lost (NVS erased, new partition, restored flash image) the counter
+// restarts from 0, and with counter-based nonces (session frames) that
+// reuses nonces under any traffic key still in use: GCM then leaks the
+// XOR of plaintexts and the authentication key. The secure layer treats
+// a missing lease as such a loss and waits for a fresh epoch, i.e. a new
+// key, before publishing again (secureMqttRotationRequest()).
+
+// Persists the new lease end; returns false if the write failed
+typedef bool (*CounterLeasePersistFn)(uint32_t leaseEnd, void* ctx);
+
+struct CounterLease {
+  uint32_t current;  // last counter handed out
+  uint32_t end;      // last counter covered by the persisted lease
+  uint32_t block;    // counters reserved per persistent write
+  CounterLeasePersistFn persist;
+  void* ctx;
+};
+
+// `persistedEnd` is the value last written by `persist` (0 if none).
+void counterLeaseInit(CounterLease* lease,
+                      uint32_t persistedEnd,
+                      uint32_t block,
+                      CounterLeasePersistFn persist,
+                      void* ctx);
+
+// Hands out the next counter, persisting a new lease first when the
+// current one is exhausted. Returns false (and does not advance) if the
+// lease could not be persisted or the counter space is used up.
+bool counterLeaseNext(CounterLease* lease, uint32_t* counterOut);
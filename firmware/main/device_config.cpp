@@ -0,0 +1,234 @@
+#include "device_config.h"
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <esp_crc.h>
+#include <stddef.h>
+#include <string.h>
+
+#define CONFIG_NAMESPACE "config"
+#define RECORD_KEY "rec"
+
+static const uint32_t RECORD_MAGIC = 0x47464344;  // "DCFG"
+static const uint16_t RECORD_VERSION = 1;
+
+// Stored as is. A layout change bumps RECORD_VERSION and loads the
+// previous version here, as the old keys are below.
+struct ConfigRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;     // sizeof(DeviceConfig)
+  DeviceConfig cfg;
+  uint32_t crc;      // CRC-32 of everything before it
+};
+
+static Preferences configPrefs;
+
+static uint32_t recordCrc(const ConfigRecord* rec) {
+  return esp_crc32_le(0, (const uint8_t*)rec, offsetof(ConfigRecord, crc));
+}
+
+static bool terminated(const char* s, size_t size) {
+  return memchr(s, '\0', size) != nullptr;
+}
+
+static bool recordValid(const ConfigRecord* rec, size_t len) {
+  const DeviceConfig& cfg = rec->cfg;
+  return len == sizeof(ConfigRecord) &&
+         rec->magic == RECORD_MAGIC &&
+         rec->version == RECORD_VERSION &&
+         rec->size == sizeof(DeviceConfig) &&
+         rec->crc == recordCrc(rec) &&
+         terminated(cfg.wifi_ssid, sizeof(cfg.wifi_ssid)) &&
+         terminated(cfg.wifi_password, sizeof(cfg.wifi_password)) &&
+         terminated(cfg.mqtt_broker, sizeof(cfg.mqtt_broker)) &&
+         terminated(cfg.client_id, sizeof(cfg.client_id)) &&
+         terminated(cfg.kms_sig_suite, sizeof(cfg.kms_sig_suite)) &&
+         cfg.kms_pubkey_len <= sizeof(cfg.kms_pubkey_der);
+}
+
+// The namespace must be open read-write
+static bool putRecord(const DeviceConfig* cfg) {
+  ConfigRecord rec;
+  memset(&rec, 0, sizeof(rec));  // padding too, it is part of the CRC
+  rec.magic = RECORD_MAGIC;
+  rec.version = RECORD_VERSION;
+  rec.size = sizeof(DeviceConfig);
+  rec.cfg = *cfg;
+  rec.crc = recordCrc(&rec);
+  bool ok = configPrefs.putBytes(RECORD_KEY, &rec, sizeof(rec)) == sizeof(rec);
+  memset(&rec, 0, sizeof(rec));  // Wi-Fi password and master key
+  return ok;
+}
+
+static bool copyString(char* out, size_t outSize, const char* value) {
+  size_t len = strlen(value);
+  if (len >= outSize) return false;
+  memcpy(out, value, len + 1);
+  return true;
+}
+
+static bool hexToBytes(const char* hex, uint8_t* out, size_t outLen) {
+  size_t hexLen = strlen(hex);
+  if (hexLen != outLen * 2) return false;
+
+  auto val = [](char c)->int {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+
+  for (size_t i = 0; i < outLen; ++i) {
+    int v1 = val(hex[2*i]);
+    int v2 = val(hex[2*i+1]);
+    if (v1 < 0 || v2 < 0) return false;
+    out[i] = (uint8_t)((v1 << 4) | v2);
+  }
+  return true;
+}
+
+// Keys of firmware before the record, read once through Arduino Strings.
+// An unknown signature suite falls back to rsa2048 and a KMS key that
+// does not parse is left empty, as the old boot did.
+static DeviceConfigStatus migrateOldKeys(DeviceConfig* cfg) {
+  if (!configPrefs.begin(CONFIG_NAMESPACE, false)) {
+    return DEVICE_CONFIG_INVALID;
+  }
+  memset(cfg, 0, sizeof(*cfg));
+  bool ok = configPrefs.getBytesLength("cmk") == 32 &&
+            configPrefs.getBytes("cmk", cfg->client_master_key, 32) == 32 &&
+            copyString(cfg->wifi_ssid, sizeof(cfg->wifi_ssid),
+                       configPrefs.getString("ssid", "").c_str()) &&
+            copyString(cfg->wifi_password, sizeof(cfg->wifi_password),
+                       configPrefs.getString("wpass", "").c_str()) &&
+            copyString(cfg->mqtt_broker, sizeof(cfg->mqtt_broker),
+                       configPrefs.getString("broker", "").c_str()) &&
+            copyString(cfg->client_id, sizeof(cfg->client_id),
+                       configPrefs.getString("cid", "esp32_client").c_str());
+  cfg->mqtt_port = (uint16_t)configPrefs.getInt("port", 1883);
+  cfg->is_temp_node = configPrefs.getBool("is_temp", true) ? 1 : 0;
+
+  String suite = configPrefs.getString("kms_sig", "rsa2048");
+  ScSigSuite parsed;
+  if (!sc_sig_suite_from_name(suite.c_str(), &parsed)) suite = "rsa2048";
+  copyString(cfg->kms_sig_suite, sizeof(cfg->kms_sig_suite), suite.c_str());
+
+  cfg->kms_pubkey_len = (uint16_t)sc_pubkey_pem_to_der(
+      configPrefs.getString("kms_pub", "").c_str(),
+      cfg->kms_pubkey_der, sizeof(cfg->kms_pubkey_der));
+
+  // The record replaces the old keys only once it is written
+  if (ok) ok = putRecord(cfg);
+  if (ok) {
+    static const char* const OLD_KEYS[] = {
+      "ssid", "wpass", "broker", "port", "cid", "is_temp", "cmk", "kms_pub", "kms_sig",
+    };
+    for (const char* key : OLD_KEYS) configPrefs.remove(key);
+  }
+  configPrefs.end();
+  if (!ok) memset(cfg, 0, sizeof(*cfg));
+  return ok ? DEVICE_CONFIG_MIGRATED : DEVICE_CONFIG_INVALID;
+}
+
+DeviceConfigStatus deviceConfigLoad(DeviceConfig* cfg) {
+  if (!configPrefs.begin(CONFIG_NAMESPACE, true)) {  // no namespace yet
+    return DEVICE_CONFIG_MISSING;
+  }
+  ConfigRecord rec;
+  size_t len = configPrefs.getBytes(RECORD_KEY, &rec, sizeof(rec));
+  // getBytes() also gives 0 for a record larger than ours
+  bool haveRecord = len > 0 || configPrefs.isKey(RECORD_KEY);
+  bool haveOldKeys = !haveRecord && configPrefs.isKey("ssid");
+  configPrefs.end();
+
+  if (haveOldKeys) return migrateOldKeys(cfg);
+  if (!haveRecord) return DEVICE_CONFIG_MISSING;
+
+  DeviceConfigStatus status = DEVICE_CONFIG_INVALID;
+  if (recordValid(&rec, len)) {
+    *cfg = rec.cfg;
+    status = DEVICE_CONFIG_OK;
+  }
+  memset(&rec, 0, sizeof(rec));
+  return status;
+}
+
+bool deviceConfigSave(const DeviceConfig* cfg) {
+  if (!configPrefs.begin(CONFIG_NAMESPACE, false)) {
+    return false;
+  }
+  // The record is the only key of the namespace
+  configPrefs.clear();
+  bool ok = putRecord(cfg);
+  configPrefs.end();
+  return ok;
+}
+
+bool deviceConfigClear() {
+  if (!configPrefs.begin(CONFIG_NAMESPACE, false)) {
+    return false;
+  }
+  bool ok = configPrefs.clear();
+  configPrefs.end();
+  return ok;
+}
+
+bool deviceConfigFromJson(char* json, DeviceConfig* cfg, const char** error) {
+  // A mutable input is parsed in place (strings unescaped in the input
+  // and referenced from the document): the document only holds the
+  // members of the object.
+  StaticJsonDocument<JSON_OBJECT_SIZE(16)> doc;
+  DeserializationError err = deserializeJson(doc, json);
+  if (err) {
+    *error = err.c_str();
+    return false;
+  }
+
+  memset(cfg, 0, sizeof(*cfg));
+  *error = nullptr;
+  if (!copyString(cfg->wifi_ssid, sizeof(cfg->wifi_ssid), doc["wifi_ssid"] | "")) {
+    *error = "wifi_ssid too long";
+  } else if (!copyString(cfg->wifi_password, sizeof(cfg->wifi_password),
+                         doc["wifi_password"] | "")) {
+    *error = "wifi_password too long";
+  } else if (!copyString(cfg->mqtt_broker, sizeof(cfg->mqtt_broker),
+                         doc["mqtt_broker"] | "")) {
+    *error = "mqtt_broker too long";
+  } else if (!copyString(cfg->client_id, sizeof(cfg->client_id),
+                         doc["client_id"] | "esp32_client")) {
+    *error = "client_id too long";
+  }
+  if (*error) return false;
+
+  long port = doc["mqtt_port"] | 1883;
+  if (port <= 0 || port > 65535) {
+    *error = "Invalid mqtt_port";
+    return false;
+  }
+  cfg->mqtt_port = (uint16_t)port;
+  cfg->is_temp_node = (doc["is_temp_node"] | 1) != 0 ? 1 : 0;
+
+  if (!hexToBytes(doc["client_master_key"] | "", cfg->client_master_key, 32)) {
+    *error = "Invalid client_master_key hex";
+    return false;
+  }
+
+  const char* kms_sig = doc["kms_sig_suite"] | "rsa2048";
+  ScSigSuite suite;
+  if (!sc_sig_suite_from_name(kms_sig, &suite) ||
+      !copyString(cfg->kms_sig_suite, sizeof(cfg->kms_sig_suite), kms_sig)) {
+    *error = "Invalid kms_sig_suite (expected rsa2048 or p256)";
+    return false;
+  }
+
+  cfg->kms_pubkey_len = (uint16_t)sc_pubkey_pem_to_der(doc["kms_pubkey_pem"] | "",
+                                                       cfg->kms_pubkey_der,
+                                                       sizeof(cfg->kms_pubkey_der));
+  if (cfg->kms_pubkey_len == 0) {
+    *error = "Invalid kms_pubkey_pem";
+    return false;
+  }
+  return true;
+}
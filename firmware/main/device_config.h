@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "secure_crypto.h"
+
+// Device configuration, provisioned over serial and kept in NVS as one
+// binary record: a versioned header, this struct with fixed-size fields
+// and a CRC-32. Boot reads it with a single NVS access, without heap
+// allocation, and the KMS key is stored in DER so it is parsed as is.
+//
+// Firmware before the record stored one NVS key per field and the KMS key
+// as PEM. deviceConfigLoad() converts such a config once and removes the
+// old keys.
+
+#define DEVICE_CONFIG_SSID_MAX       32  // characters, without terminator
+#define DEVICE_CONFIG_PASSWORD_MAX   64
+#define DEVICE_CONFIG_HOST_MAX       64
+#define DEVICE_CONFIG_CLIENT_ID_MAX  32
+#define DEVICE_CONFIG_SUITE_MAX       7  // "rsa2048"
+#define DEVICE_CONFIG_JSON_MAX     1024  // provisioning line, terminator included
+
+struct DeviceConfig {
+  char wifi_ssid[DEVICE_CONFIG_SSID_MAX + 1];
+  char wifi_password[DEVICE_CONFIG_PASSWORD_MAX + 1];
+  char mqtt_broker[DEVICE_CONFIG_HOST_MAX + 1];
+  char client_id[DEVICE_CONFIG_CLIENT_ID_MAX + 1];
+  char kms_sig_suite[DEVICE_CONFIG_SUITE_MAX + 1];  // "rsa2048" or "p256"
+  uint16_t mqtt_port;
+  uint8_t is_temp_node;
+  uint8_t client_master_key[32];
+  uint16_t kms_pubkey_len;
+  uint8_t kms_pubkey_der[SC_KMS_PUBKEY_DER_MAX];
+};
+
+enum DeviceConfigStatus : uint8_t {
+  DEVICE_CONFIG_OK = 0,
+  DEVICE_CONFIG_MIGRATED,  // read from the keys of older firmware, now a record
+  DEVICE_CONFIG_MISSING,   // not provisioned
+  DEVICE_CONFIG_INVALID,   // bad CRC, unknown version or incomplete old keys
+};
+
+// `cfg` is filled when the status is OK or MIGRATED
+DeviceConfigStatus deviceConfigLoad(DeviceConfig* cfg);
+bool deviceConfigSave(const DeviceConfig* cfg);
+// Erases the whole config namespace (record and any old keys)
+bool deviceConfigClear();
+
+// Provisioning line, e.g.
+//   {"wifi_ssid":"...","wifi_password":"...","mqtt_broker":"192.168.3.170",
+//    "mqtt_port":1883,"client_id":"esp32_temp_client","is_temp_node":1,
+//    "client_master_key":"0011...ff",
+//    "kms_pubkey_pem":"-----BEGIN PUBLIC KEY-----\n...","kms_sig_suite":"p256"}
+// parsed in place: `json` is modified and no string is copied but into
+// `cfg`. On failure returns false and sets `error`.
+bool deviceConfigFromJson(char* json, DeviceConfig* cfg, const char** error);
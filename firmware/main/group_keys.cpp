@@ -0,0 +1,124 @@
+#include "group_keys.h"
+
+#include <string.h>
+#include "secure_crypto.h"
+
+static const size_t PATH_ENTRY_LEN = 2 + 4 + 32;
+static const char GROUP_AAD_LABEL[] = "KMS_GROUP_KEY";
+static const size_t GROUP_AAD_LABEL_LEN = sizeof(GROUP_AAD_LABEL) - 1;
+
+static uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t getU32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// 0 for the leaf itself, k for the ancestor at level k, -1 if `node` is
+// not on the path
+static int levelOf(const GroupPath* path, uint16_t node) {
+  if (node == path->leaf) return 0;
+  for (uint8_t k = 1; k <= path->depth; ++k) {
+    if ((path->leaf >> k) == node) return k;
+  }
+  return -1;
+}
+
+void groupPathClear(GroupPath* path) {
+  memset(path, 0, sizeof(*path));
+}
+
+bool groupPathSet(GroupPath* path, const uint8_t* plain, size_t len) {
+  groupPathClear(path);
+  if (len < 3) return false;
+  uint16_t leaf = getU16(plain);
+  uint8_t count = plain[2];
+  uint8_t depth = 0;
+  while ((leaf >> (depth + 1)) != 0) ++depth;
+  if (depth == 0 || depth > GROUP_TREE_MAX_DEPTH || count != depth ||
+      len != 3 + (size_t)count * PATH_ENTRY_LEN) {
+    return false;
+  }
+
+  path->leaf = leaf;
+  path->depth = depth;
+  const uint8_t* p = plain + 3;
+  for (uint8_t i = 0; i < count; ++i, p += PATH_ENTRY_LEN) {
+    int level = levelOf(path, getU16(p));
+    if (level <= 0) {
+      groupPathClear(path);
+      return false;
+    }
+    path->version[level - 1] = getU32(p + 2);
+    memcpy(path->key[level - 1], p + 6, 32);
+    path->have |= (uint16_t)(1u << (level - 1));
+  }
+  if (path->have != (uint16_t)((1u << depth) - 1)) {
+    groupPathClear(path);
+    return false;
+  }
+  return true;
+}
+
+bool groupRekeyApply(GroupPath* path,
+                     const uint8_t leafKey[32],
+                     uint32_t topicHash,
+                     const uint8_t* wraps, uint8_t count,
+                     bool hasEpoch, uint32_t currentEpoch,
+                     uint32_t* epochOut, uint8_t topicKeyOut[32]) {
+  if (path->leaf == 0) return false;
+  bool gotTopicKey = false;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    const uint8_t* w = wraps + (size_t)i * GROUP_WRAP_LEN;
+    uint16_t target = getU16(w);
+    uint32_t version = getU32(w + 2);
+    uint16_t under = getU16(w + 6);
+
+    // Only the wraps sealed with a key we hold, delivering a newer key
+    int underLevel = levelOf(path, under);
+    if (underLevel < 0) continue;
+    if (underLevel > 0 && !(path->have & (1u << (underLevel - 1)))) continue;
+    int targetLevel = 0;
+    if (target == 0) {
+      if (under != 1) continue;
+      if (hasEpoch && (int32_t)(version - currentEpoch) <= 0) continue;
+    } else {
+      targetLevel = levelOf(path, target);
+      if (targetLevel <= 0) continue;
+      bool held = path->have & (1u << (targetLevel - 1));
+      if (held && (int32_t)(version - path->version[targetLevel - 1]) <= 0) continue;
+    }
+
+    const uint8_t* nonce = w + 8;
+    uint8_t aad[GROUP_AAD_LABEL_LEN + 4 + 8];
+    memcpy(aad, GROUP_AAD_LABEL, GROUP_AAD_LABEL_LEN);
+    aad[GROUP_AAD_LABEL_LEN]     = (uint8_t)(topicHash >> 24);
+    aad[GROUP_AAD_LABEL_LEN + 1] = (uint8_t)(topicHash >> 16);
+    aad[GROUP_AAD_LABEL_LEN + 2] = (uint8_t)(topicHash >> 8);
+    aad[GROUP_AAD_LABEL_LEN + 3] = (uint8_t)topicHash;
+    memcpy(aad + GROUP_AAD_LABEL_LEN + 4, w, 8);
+
+    const uint8_t* underKey = underLevel == 0 ? leafKey : path->key[underLevel - 1];
+    uint8_t key[32];
+    if (!sc_aes_gcm_decrypt(underKey, 32, nonce, 12, aad, sizeof(aad),
+                            w + 20, 32, w + 20 + 32, 16, key)) {
+      continue;  // not for our copy of that key, e.g. a rekey we missed
+    }
+
+    if (target == 0) {
+      memcpy(topicKeyOut, key, 32);
+      *epochOut = version;
+      currentEpoch = version;
+      hasEpoch = true;
+      gotTopicKey = true;
+    } else {
+      memcpy(path->key[targetLevel - 1], key, 32);
+      path->version[targetLevel - 1] = version;
+      path->have |= (uint16_t)(1u << (targetLevel - 1));
+    }
+    memset(key, 0, sizeof(key));
+  }
+  return gotTopicKey;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Group rekeying with a logical key hierarchy (kms/key_tree.py). The KMS
+// keeps one binary key tree per topic, nodes numbered from the root (1),
+// children 2n and 2n+1. The device sits on a leaf whose key is its own
+// TOPIC_key_enc_key, and holds the keys of the nodes above it (its path),
+// received sealed in the /kms/key answer. The root key seals every new
+// TOPIC_key, so a rotation is a single wrap for the whole fleet, and a
+// revocation replaces the revoked member's path with O(log n) wraps.
+//
+// Group rekey message, on <base>/kms/grouprekey:
+//   [ver:1][topic hash:4][count:1] then `count` wraps of
+//   [target:2][version:4][under:2][nonce:12][ciphertext:32][tag:16]
+// The key of node `target` (0: the TOPIC_key, version = epoch), sealed
+// with AES-256-GCM under the current key of node `under`, with a random
+// nonce (node versions restart when the KMS does, leaf keys never change):
+//   AAD   = "KMS_GROUP_KEY" || topic hash:4 || target:2 || version:4 || under:2
+// Wraps come bottom-up: a key is always delivered before it seals another.
+
+#ifndef GROUP_TREE_MAX_DEPTH
+#define GROUP_TREE_MAX_DEPTH 12    // up to 4096 devices per topic
+#endif
+#define GROUP_REKEY_VERSION 0x02
+#define GROUP_REKEY_HEADER  6
+#define GROUP_WRAP_LEN      (2 + 4 + 2 + 12 + 32 + 16)
+
+// Keys of the device's path in one topic's tree; level k (1..depth) is
+// node leaf >> k, the root being level `depth`
+struct GroupPath {
+  uint16_t leaf;       // 0: not a member
+  uint8_t depth;
+  uint16_t have;       // bit k-1: key of level k held
+  uint32_t version[GROUP_TREE_MAX_DEPTH];
+  uint8_t key[GROUP_TREE_MAX_DEPTH][32];
+};
+
+void groupPathClear(GroupPath* path);
+
+// Installs the path from the decrypted /kms/key field:
+//   [leaf:2][count:1] then `count` entries [node:2][version:4][key:32]
+// Returns false, leaving the path cleared, if it is malformed or deeper
+// than GROUP_TREE_MAX_DEPTH.
+bool groupPathSet(GroupPath* path, const uint8_t* plain, size_t len);
+
+// Applies the wraps of a group rekey message (header already checked)
+// that this device can open: path keys are replaced in place, and a new
+// TOPIC_key is returned through epochOut/topicKeyOut. `currentEpoch` is
+// the epoch of the key in use (hasEpoch false if none): older epochs are
+// not reinstalled. Returns true if a TOPIC_key was unwrapped.
+bool groupRekeyApply(GroupPath* path,
+                     const uint8_t leafKey[32],
+                     uint32_t topicHash,
+                     const uint8_t* wraps, uint8_t count,
+                     bool hasEpoch, uint32_t currentEpoch,
+                     uint32_t* epochOut, uint8_t topicKeyOut[32]);
@@ -1,30 +1,19 @@
 #include "local_network.h"
+#include "sec_log.h"
 
-extern void handleButtonInput();
-
-void setupWiFi(const char* ssid, const char* password) {
-  Serial.print("Connecting to WiFi: ");
-  Serial.println(ssid);
+void wifiBegin(const char* ssid, const char* password) {
+  SLOG_I("Connecting to WiFi: %s", ssid);
+  // Drop any half-open association before starting over
+  WiFi.disconnect();
   WiFi.begin(ssid, password);
+}
 
-  unsigned long start = millis();
-  const unsigned long timeoutMs = 15000;
-
-  while (WiFi.status() != WL_CONNECTED &&
-         (millis() - start) < timeoutMs) {
-
-    Serial.print(".");
-    handleButtonInput();
-    delay(200);
-  }
+bool wifiIsConnected() {
+  return WiFi.status() == WL_CONNECTED;
+}
 
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println();
-    Serial.println("WiFi connected");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-  } else {
-    Serial.println();
-    Serial.println("WiFi connect timeout, continuing without network.");
-  }
+void wifiPrintStatus() {
+  Serial.println("WiFi connected");
+  Serial.print("IP address: ");
+  Serial.println(WiFi.localIP());
 }
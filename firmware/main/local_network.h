@@ -1,4 +1,7 @@
 #pragma once
 #include <WiFi.h>
 
-void setupWiFi(const char* ssid, const char* password);
+// Non-blocking WiFi helpers, driven by the connection manager
+void wifiBegin(const char* ssid, const char* password);
+bool wifiIsConnected();
+void wifiPrintStatus();
@@ -1,25 +1,16 @@
 #include <Arduino.h>
-#include <Preferences.h>
-#include <ArduinoJson.h>
 #include "led.h"
 #include "sensor.h"
 #include "oled.h"
 #include "local_network.h"
 #include "mqtt_client.h"
 #include "secure_mqtt.h" 
-
-Preferences prefs;
-
-struct DeviceConfig {
-  String wifi_ssid;
-  String wifi_password;
-  String mqtt_broker;
-  int    mqtt_port;
-  String client_id;
-  bool   is_temp_node;
-  uint8_t client_master_key[32];
-  String kms_pubkey_pem;
-};
+#include "topic_table.h"
+#include "app_tasks.h"
+#include "sec_log.h"
+#include "report_policy.h"
+#include "ts_codec.h"
+#include "device_config.h"
 
 DeviceConfig g_cfg;
 
@@ -38,8 +29,30 @@ int lastStableButton   = LOW;
 // Reading DHT11 periodically
 unsigned long lastDht = 0;
 const unsigned long dhtEveryMs = 2000; // ms
-// If no data from the other ESP for this many milliseconds, treat as stale
-const unsigned long REMOTE_TIMEOUT_MS = 10000; // 10 seconds
+
+// Readings are published on change (report_policy.h), with a heartbeat
+// when the value is steady. DHT11 resolution is 1 degC / 1 %RH; humidity
+// readings also jitter by 1 %RH, hence its wider deadband.
+const unsigned long REPORT_HEARTBEAT_MS = 30000; // ms
+const ReportPolicy TEMPERATURE_POLICY = {1.0f, 0.0f, 5000, REPORT_HEARTBEAT_MS};
+const ReportPolicy HUMIDITY_POLICY    = {2.0f, 0.0f, 5000, REPORT_HEARTBEAT_MS};
+ReportState g_reportState;
+// Reading queued for publishing: it only counts as published for the
+// policy once the network task has sent it (appPublished)
+uint32_t g_reportTicket = 0;
+float g_reportValue = 0;
+unsigned long g_reportMs = 0;
+// Every reading also goes, batched and compressed (ts_codec.h), to the
+// device's history topic: one sealed frame per APP_HISTORY_SAMPLES
+// readings, or earlier if the block fills up. 0 disables the history.
+#ifndef APP_HISTORY_SAMPLES
+#define APP_HISTORY_SAMPLES 16
+#endif
+static_assert(TS_BATCH_BYTES <= APP_PLAIN_MAX, "history block must fit a queued payload");
+TsBatch g_history;
+// If no data from the other ESP for this many milliseconds, treat as stale:
+// one lost heartbeat is tolerated.
+const unsigned long REMOTE_TIMEOUT_MS = 2 * REPORT_HEARTBEAT_MS + dhtEveryMs;
 
 // SOS (triple-click) detection
 const unsigned long SOS_CLICK_INTERVAL = 1500; // ms to detect triple-click
@@ -55,6 +68,9 @@ struct SOSState {
 unsigned long g_remoteSosTime = 0; // When we last received a SOS (timestamp)
 bool g_remoteHasSOS = false; // Whether remote is currently sending SOS
 
+// UI loop period: bounds button and SOS blink latency
+const unsigned long UI_TICK_MS = 5;
+
 // Wifi config
 WiFiClient espClient;
 PubSubClient client(espClient);
@@ -67,6 +83,13 @@ const char* password     = nullptr;
 const char* topic_pub      = "iot/esp32/data";
 const char* topic_data_sub = "iot/esp32/data";
 const char* topic_cmd_sub = "iot/esp32/commands";
+const char* topic_alarm    = "iot/esp32/alarms";
+// iot/esp32/<client_id>/metrics, built once the client id is known
+static char topic_metrics_buf[SECURE_TOPIC_NAME_MAX];
+const char* topic_metrics  = topic_metrics_buf;
+// iot/esp32/<client_id>/history, batched readings for the KMS
+static char topic_history_buf[SECURE_TOPIC_NAME_MAX];
+const char* topic_history  = topic_history_buf;
 
 static unsigned long resetPressStart = 0;
 static int lastButtonReading_local = LOW;
@@ -95,7 +118,7 @@ void handleButtonInput() {
       g_sosState.clickCount = 0;
       g_sosState.isActive = true;
       g_sosState.activeSince = now;
-      Serial.println("[SOS] Triple-click detected! Sending SOS...");
+      SLOG_I("[SOS] Triple-click detected! Sending SOS...");
     }
   }
 
@@ -146,83 +169,57 @@ void handleSOSDisplay() {
   }
 }
 
-bool loadConfig(DeviceConfig& cfg) {
-  if (!prefs.begin("config", true)) { // read-only
-    return false;
-  }
-  if (!prefs.isKey("ssid")) {
-    prefs.end();
-    return false;
-  }
-
-  cfg.wifi_ssid      = prefs.getString("ssid", "");
-  cfg.wifi_password  = prefs.getString("wpass", "");
-  cfg.mqtt_broker    = prefs.getString("broker", "");
-  cfg.mqtt_port      = prefs.getInt("port", 1883);
-  cfg.client_id      = prefs.getString("cid", "esp32_client");
-  cfg.is_temp_node   = prefs.getBool("is_temp", true);
-
-  size_t len = prefs.getBytesLength("cmk");
-  if (len != 32) {
-    prefs.end();
-    return false;
+// Applies the readings decoded by the crypto worker
+void handleRemoteReadings() {
+  RemoteReading r;
+  while (appNextRemoteReading(&r)) {
+    switch (r.kind) {
+      case REMOTE_HUMIDITY:
+        g_remoteHumidity = r.value;
+        g_remoteHumidityValid = true;
+        g_remoteHumidityLastMs = r.atMs;
+        break;
+      case REMOTE_TEMPERATURE:
+        g_remoteTemperature = r.value;
+        g_remoteTemperatureValid = true;
+        g_remoteTemperatureLastMs = r.atMs;
+        break;
+      case REMOTE_SOS:
+        g_remoteHasSOS = true;
+        g_remoteSosTime = r.atMs;
+        break;
+    }
   }
-  prefs.getBytes("cmk", cfg.client_master_key, 32);
-
-  cfg.kms_pubkey_pem = prefs.getString("kms_pub", "");
-
-  prefs.end();
-  return true;
 }
 
-bool saveConfig(const DeviceConfig& cfg) {
-  if (!prefs.begin("config", false)) { // read-write
-    return false;
+// Adds a reading to the history block and sends the block once it holds
+// APP_HISTORY_SAMPLES readings or cannot take more
+void recordHistory(float temperature, float humidity, unsigned long now) {
+#if APP_HISTORY_SAMPLES > 0
+  bool added = tsBatchAppend(&g_history, now, temperature, humidity);
+  if (added && g_history.count < APP_HISTORY_SAMPLES) return;
+
+  size_t len = tsBatchFinish(&g_history, now);
+  if (secureMqttIsTopicReady(topic_history)) {
+    appQueuePublishBytes(topic_history, g_history.buf, len);
+  } else {
+    SLOG_D("History TOPIC_key not ready, block dropped");
   }
-  prefs.putString("ssid",   cfg.wifi_ssid);
-  prefs.putString("wpass",  cfg.wifi_password);
-  prefs.putString("broker", cfg.mqtt_broker);
-  prefs.putInt("port",      cfg.mqtt_port);
-  prefs.putString("cid",    cfg.client_id);
-  prefs.putBool("is_temp",  cfg.is_temp_node);
-  prefs.putBytes("cmk",     cfg.client_master_key, 32);
-  prefs.putString("kms_pub", cfg.kms_pubkey_pem);
-  prefs.end();
-  return true;
+  tsBatchReset(&g_history);
+  if (!added) tsBatchAppend(&g_history, now, temperature, humidity);
+#endif
 }
 
 void clearConfig() {
-  if (!prefs.begin("config", false)) {
+  if (!deviceConfigClear()) {
     Serial.println("Failed to open NVS for clear");
     return;
   }
-  prefs.clear();
-  prefs.end();
   Serial.println("Config cleared. Rebooting...");
   delay(1000);
   ESP.restart();
 }
 
-bool hexToBytes(const char* hex, uint8_t* out, size_t outLen) {
-  size_t hexLen = strlen(hex);
-  if (hexLen != outLen * 2) return false;
-
-  auto val = [](char c)->int {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    return -1;
-  };
-
-  for (size_t i = 0; i < outLen; ++i) {
-    int v1 = val(hex[2*i]);
-    int v2 = val(hex[2*i+1]);
-    if (v1 < 0 || v2 < 0) return false;
-    out[i] = (uint8_t)((v1 << 4) | v2);
-  }
-  return true;
-}
-
 void waitForProvisioning() {
   Serial.println("== PROVISIONING MODE ==");
   Serial.println("Send a configuration JSON over serial (end with \\n+).\"");
@@ -231,59 +228,53 @@ void waitForProvisioning() {
                  "\"mqtt_broker\":\"192.168.3.170\",\"mqtt_port\":1883,"
                  "\"client_id\":\"esp32_temp_client\",\"is_temp_node\":1,"
                  "\"client_master_key\":\"0011...ff\","
-                 "\"kms_pubkey_pem\":\"-----BEGIN PUBLIC KEY-----\\n...\"}");
+                 "\"kms_pubkey_pem\":\"-----BEGIN PUBLIC KEY-----\\n...\","
+                 "\"kms_sig_suite\":\"p256\"}");
   // Flush any leftover bytes in the serial buffer
   while (Serial.available()) {
     Serial.read();
   }
 
-  // Read a line from Serial
-  String line;
+  // Read a line from Serial, parsed in place
+  static char line[DEVICE_CONFIG_JSON_MAX];
+  size_t len = 0;
   Serial.println("Waiting for a JSON line...");
-  while (line.length() == 0) {
+  while (len == 0) {
     if (Serial.available()) {
-      line = Serial.readStringUntil('\n');
-      line.trim(); // remove possible '\r'
+      len = Serial.readBytesUntil('\n', line, sizeof(line) - 1);
       break;
     }
     delay(10);
   }
+  if (len == sizeof(line) - 1) {
+    Serial.println("Line too long, aborting.");
+    return;
+  }
+  while (len > 0 && isspace((unsigned char)line[len - 1])) len--;  // possible '\r'
+  line[len] = '\0';
+  char* json = line;
+  while (isspace((unsigned char)*json)) json++;
 
   Serial.print("Received: ");
-  Serial.println(line);
+  Serial.println(json);
 
-  if (!line.startsWith("{")) {
+  if (json[0] != '{') {
     Serial.println("Line doesn't start with '{' -> not JSON, aborting.");
     return;
   }
 
-  StaticJsonDocument<2048> doc;
-  DeserializationError err = deserializeJson(doc, line);
-  if (err) {
-    Serial.print("JSON parse error: ");
-    Serial.println(err.c_str());
-    return;
-  }
-
   DeviceConfig cfg;
-  cfg.wifi_ssid     = doc["wifi_ssid"]     | "";
-  cfg.wifi_password = doc["wifi_password"] | "";
-  cfg.mqtt_broker   = doc["mqtt_broker"]   | "";
-  cfg.mqtt_port     = doc["mqtt_port"]     | 1883;
-  cfg.client_id     = doc["client_id"]     | "esp32_client";
-  cfg.is_temp_node  = (doc["is_temp_node"] | 1) != 0;
-
-  const char* cmk_hex = doc["client_master_key"] | "";
-  if (!hexToBytes(cmk_hex, cfg.client_master_key, 32)) {
-    Serial.println("Invalid client_master_key hex");
-    return;
+  const char* error = nullptr;
+  bool ok = deviceConfigFromJson(json, &cfg, &error);
+  memset(line, 0, sizeof(line));
+  if (ok && !deviceConfigSave(&cfg)) {
+    error = "Failed to save config!";
+    ok = false;
   }
-
-  const char* kms_pem = doc["kms_pubkey_pem"] | "";
-  cfg.kms_pubkey_pem = String(kms_pem);
-
-  if (!saveConfig(cfg)) {
-    Serial.println("Failed to save config!");
+  memset(&cfg, 0, sizeof(cfg));
+  if (!ok) {
+    Serial.print("Provisioning error: ");
+    Serial.println(error);
     return;
   }
 
@@ -297,21 +288,37 @@ void setup() {
   Serial.begin(115200);
   delay(2000);
 
-  if (!loadConfig(g_cfg)) { // no config yet
+  DeviceConfigStatus cfgStatus = deviceConfigLoad(&g_cfg);
+  if (cfgStatus == DEVICE_CONFIG_INVALID) {
+    Serial.println("Stored config is corrupt or incomplete");
+  }
+  if (cfgStatus != DEVICE_CONFIG_OK && cfgStatus != DEVICE_CONFIG_MIGRATED) {
     waitForProvisioning();
     while (true) { delay(1000); }
   }
+  if (cfgStatus == DEVICE_CONFIG_MIGRATED) {
+    Serial.println("Config migrated to the packed NVS record");
+  }
 
-  ssid         = g_cfg.wifi_ssid.c_str();
-  password     = g_cfg.wifi_password.c_str();
-  mqttServer   = g_cfg.mqtt_broker.c_str();
+  ssid         = g_cfg.wifi_ssid;
+  password     = g_cfg.wifi_password;
+  mqttServer   = g_cfg.mqtt_broker;
   mqttPort     = g_cfg.mqtt_port;
-  mqttClientId = g_cfg.client_id.c_str();
-  IS_TEMPERATURE_NODE = g_cfg.is_temp_node;
+  mqttClientId = g_cfg.client_id;
+  IS_TEMPERATURE_NODE = g_cfg.is_temp_node != 0;
 
   memcpy(CLIENT_MASTER_KEY, g_cfg.client_master_key, 32);
 
-  secureMqttSetKmsPubkey(g_cfg.kms_pubkey_pem.c_str());
+#ifdef SECURE_MQTT_BENCH
+  secureMqttRunBenchmark(200);
+#endif
+
+  if (!secureMqttSetKmsPubkeyDer(g_cfg.kms_pubkey_der, g_cfg.kms_pubkey_len)) {
+    Serial.println("Invalid KMS public key in config");
+  }
+  if (!secureMqttSetKmsSigSuite(g_cfg.kms_sig_suite)) {
+    Serial.println("Unknown KMS signature suite in config, using rsa2048");
+  }
 
   Serial.println("Config chargee depuis NVS :");
   Serial.print("  SSID = "); Serial.println(ssid);
@@ -319,6 +326,7 @@ void setup() {
   Serial.print(":"); Serial.println(mqttPort);
   Serial.print("  ClientID = "); Serial.println(mqttClientId);
   Serial.print("  Role = "); Serial.println(IS_TEMPERATURE_NODE ? "TEMP" : "HUM");
+  Serial.print("  KMS sig = "); Serial.println(g_cfg.kms_sig_suite);
 
   pinMode(BTN_PIN, INPUT_PULLDOWN);
   setupLED(LED_PIN);
@@ -334,32 +342,43 @@ void setup() {
     oledShowMessage("Boot...", "DHT + Button OK");
   }
 
-  setupWiFi(ssid, password);
-
   client.setServer(mqttServer, mqttPort);
   client.setCallback(messageReceived);
-  client.setBufferSize(1024);
-
-  secureMqttSetTopic(topic_pub);
-  secureMqttSetClientId(mqttClientId);
-  secureMqttInit(topic_pub, mqttClientId);
+  client.setBufferSize(2048); // group rekeys carry up to 24 key wraps
+
+  secureMqttInit(mqttClientId);
+  // Compact session frames on the telemetry topic (receivers auto-detect);
+  // alarms have their own TOPIC_key so they can be rekeyed separately.
+  secureMqttAddTopic(topic_pub, SECURE_FRAME_SESSION);
+  secureMqttAddTopic(topic_alarm, SECURE_FRAME_BINARY);
+  // Stage latency histograms (sec_metrics.h), one topic per device
+  snprintf(topic_metrics_buf, sizeof(topic_metrics_buf), "iot/esp32/%s/metrics", mqttClientId);
+  secureMqttAddTopic(topic_metrics, SECURE_FRAME_BINARY);
+#if APP_HISTORY_SAMPLES > 0
+  snprintf(topic_history_buf, sizeof(topic_history_buf), "iot/esp32/%s/history", mqttClientId);
+  secureMqttAddTopic(topic_history, SECURE_FRAME_SESSION);
+#endif
+
+  // loop() is the UI task: it must preempt the crypto worker on this core
+  vTaskPrioritySet(nullptr, APP_UI_TASK_PRIORITY);
+  // WiFi, MQTT and the handshake now run on the network task
+  appTasksStart();
 
   Serial.println("Init OK (debounce + DHT11 on GPIO 26)");
 }
 
+// UI task: never touches the network or the keys, it only queues
+// payloads and applies decoded readings.
 void loop() {
-  if (!client.connected()) {
-    reconnectMQTT(client, mqttClientId, topic_cmd_sub, topic_data_sub);
-
-    // Once reconnected, start the secure handshake
-    secureMqttBeginHandshake(client, "iot/esp32", mqttClientId);
-  }
-
-  client.loop(); // IMPORTANT to process MQTT messages
-
   handleButtonInput();
+  handleRemoteReadings();
   handleSOSDisplay();
 
+  if (g_reportTicket != 0 && appPublished(g_reportTicket)) {
+    reportPolicyPublished(&g_reportState, g_reportValue, g_reportMs);
+    g_reportTicket = 0;
+  }
+
   unsigned long now = millis();
   if (now - lastDht >= dhtEveryMs) {
     lastDht = now;
@@ -369,6 +388,13 @@ void loop() {
     float humidityToSend = th.h;
 
     if (th.ok) {
+      recordHistory(th.t, th.h, now);
+    }
+
+    float valueToSend = IS_TEMPERATURE_NODE ? temperatureToSend : humidityToSend;
+    const ReportPolicy* policy = IS_TEMPERATURE_NODE ? &TEMPERATURE_POLICY : &HUMIDITY_POLICY;
+
+    if (th.ok && reportPolicyDue(policy, &g_reportState, valueToSend, now)) {
       char payload[64];
       if (IS_TEMPERATURE_NODE) {
         snprintf(payload, sizeof(payload), "{\"temperature\": %.1f}", temperatureToSend);
@@ -376,31 +402,30 @@ void loop() {
         snprintf(payload, sizeof(payload), "{\"humidity\": %.1f}", humidityToSend);
       }
 
-      if (secureMqttIsReady()) {
-        Serial.print("Publishing SECURE MQTT message to ");
-        Serial.print(topic_pub);
-        Serial.print(": ");
-        Serial.println(payload);
-        secureMqttEncryptAndPublish(client,
-                                    topic_pub,
-                                    (const uint8_t*)payload,
-                                    strlen(payload));
+      // Only this topic's key matters: the others (history, metrics)
+      // may still be waiting for theirs
+      if (secureMqttIsTopicReady(topic_pub)) {
+        SLOG_D("Publishing SECURE MQTT message to %s: %s", topic_pub, payload);
+        uint32_t ticket;
+        if (appQueuePublishTracked(topic_pub, payload, &ticket)) {
+          g_reportTicket = ticket;
+          g_reportValue = valueToSend;
+          g_reportMs = now;
+        }
       } else {
-        Serial.println("TOPIC_key not ready, skipping secure publish");
+        SLOG_D("TOPIC_key not ready, skipping secure publish");
       }
     }
     
-    // Handle SOS transmission - send on iot/esp32/data topic with sos flag
-    if (g_sosState.isActive && secureMqttIsReady()) {
+    // Handle SOS transmission - send on iot/esp32/alarms topic with sos flag
+    if (g_sosState.isActive && secureMqttIsTopicReady(topic_alarm)) {
       char sosPayload[32];
       snprintf(sosPayload, sizeof(sosPayload), "{\"sos\":1}");
-      secureMqttEncryptAndPublish(client,
-                                  topic_pub,
-                                  (const uint8_t*)sosPayload,
-                                  strlen(sosPayload));
-      Serial.println("[SOS] SOS message sent!");
+      if (appQueuePublish(topic_alarm, sosPayload)) {
+        SLOG_I("[SOS] SOS message sent!");
+      }
     } else {
-      Serial.println("DHT -> invalid reading");
+      SLOG_D("DHT -> invalid reading");
     }
 
     // Display rules:
@@ -450,4 +475,6 @@ void loop() {
 
     oledShowTempHumWithSOS(tempStr, humStr, displayOk, g_sosState.isActive, g_remoteHasSOS);
   }
+
+  delay(UI_TICK_MS); // lets the crypto worker run on this core
 }
@@ -1,6 +1,10 @@
 #include <Arduino.h>
 #include "mqtt_client.h"
 #include "secure_mqtt.h"
+#include "app_tasks.h"
+#include "sensor_fields.h"
+#include "topic_router.h"
+#include "sec_log.h"
 
 #include <PubSubClient.h>
 #include <string.h>
@@ -12,143 +16,136 @@ bool g_remoteTemperatureValid = false;
 unsigned long g_remoteHumidityLastMs = 0;
 unsigned long g_remoteTemperatureLastMs = 0;
 
-static bool extractFloatField(const byte* payload,
-                              unsigned int length,
-                              const char* fieldName,
-                              float* valueOut) {
-  if (!payload || length == 0 || !fieldName || !valueOut) return false;
-
-  // Copy into a small buffer to safely null-terminate before parsing.
-  char buffer[256];
-  unsigned int copyLen = (length < sizeof(buffer) - 1) ? length
-                                                       : (sizeof(buffer) - 1);
-  for (unsigned int i = 0; i < copyLen; ++i) {
-    buffer[i] = static_cast<char>(payload[i]);
+// Built by tryConnectMQTT(), used by the network task only
+static TopicRouter g_router;
+static char g_requestKeyTopic[TOPIC_ROUTER_NAME_MAX];
+
+// Secure data topics: handed to the crypto worker once the topic has a key
+static void onSecureData(const RouteContext&,
+                         const char* topic,
+                         const uint8_t* payload,
+                         unsigned int length) {
+  if (secureMqttHasTopicKey(topic)) {
+    appQueueIncoming(topic, payload, length);
   }
-  buffer[copyLen] = '\0';
-
-  char key[32];
-  snprintf(key, sizeof(key), "\"%s\":", fieldName);
-  char* pos = strstr(buffer, key);
-  if (!pos) return false;
-
-  pos += strlen(key);
-  while (*pos == ' ' || *pos == '\t') ++pos;
-  *valueOut = atof(pos);
-  return true;
 }
 
-extern PubSubClient client;
-extern const char* mqttClientId;
-extern const char* topic_cmd_sub;
-extern const char* topic_data_sub;
-extern unsigned long g_remoteSosTime;
-extern bool g_remoteHasSOS;
+static void onCommand(const RouteContext&,
+                      const char* topic,
+                      const uint8_t* payload,
+                      unsigned int length) {
+  // Commands are short text: copied into the log record (truncated)
+  char text[SEC_LOG_STR_BYTES];
+  size_t n = length < sizeof(text) - 1 ? length : sizeof(text) - 1;
+  memcpy(text, payload, n);
+  text[n] = '\0';
+  SLOG_I("[MQTT] Command: %s", text);
+}
 
+// Runs on the network task: KMS messages are handled right away, data
+// frames are handed to the crypto worker.
 void messageReceived(char* topic, byte* payload, unsigned int length) {
+  if (!topicRouterDispatch(&g_router, topic, (const uint8_t*)payload, length)) {
+    SLOG_D("[MQTT] No route for %s (%u bytes)", topic, length);
+  }
+}
 
-  // Check whether this is a KMS message for the secure client
-  if (secureMqttHandleKmsMessage(topic,
-                                 (const uint8_t*)payload,
-                                 length,
-                                 "iot/esp32",
-                                 mqttClientId,
-                                 client)) {
-    Serial.println("[MQTT] Routed to KMS handler");
+void decodeDataFrame(const char* topic, uint8_t* payload, unsigned int length) {
+  // Decrypted in place in the queue slot, then parsed in a single pass
+  SecurePlaintext plain;
+  if (!secureMqttOpenFrame(topic, payload, length, &plain)) {
     return;
   }
 
-  if (strcmp(topic, topic_data_sub) == 0) {
-    // Attempt secure decrypt first
-    char plain[256];
-    bool decrypted = secureMqttDecryptPayload(payload, length, topic, plain, sizeof(plain));
-    const byte* parsePayload = decrypted ? (const byte*)plain : payload;
-    unsigned int parseLen = decrypted ? strlen(plain) : length;
-
-    float value;
-    bool parsed = false;
-    if (extractFloatField(parsePayload, parseLen, "humidity", &value)) {
-      g_remoteHumidity = value;
-      g_remoteHumidityValid = true;
-      g_remoteHumidityLastMs = millis();
-      parsed = true;
-    }
-    if (extractFloatField(parsePayload, parseLen, "temperature", &value)) {
-      g_remoteTemperature = value;
-      g_remoteTemperatureValid = true;
-      g_remoteTemperatureLastMs = millis();
-      parsed = true;
-    }
-    
-    // Check for SOS flag in the payload
-    if (parseLen < 200) {
-      char buffer[256];
-      memcpy(buffer, parsePayload, parseLen);
-      buffer[parseLen] = '\0';
-      if (strstr(buffer, "\"sos\"") && strstr(buffer, ":1")) {
-        g_remoteHasSOS = true;
-        g_remoteSosTime = millis();
-        Serial.println("[SOS] Remote SOS received!");
-      }
-    }
+  SensorFields fields;
+  if (!parseSensorFields((const char*)plain.data, plain.len, &fields)) {
+    SLOG_W("[MQTT] Malformed reading, dropped");
+    return;
   }
-
-
-  for (unsigned int i = 0; i < length; i++) {
-    Serial.print((char)payload[i]);
+  if (fields.hasHumidity) {
+    appPostRemoteReading(REMOTE_HUMIDITY, fields.humidity);
+  }
+  if (fields.hasTemperature) {
+    appPostRemoteReading(REMOTE_TEMPERATURE, fields.temperature);
   }
-  Serial.println();
+  if (fields.sos) {
+    appPostRemoteReading(REMOTE_SOS, 1.0f);
+    SLOG_I("[SOS] Remote SOS received!");
+  }
+}
 
+void requestKeyOnDecryptFailure(PubSubClient& client) {
   // If decryption failed due to tag/auth failure, request current TOPIC_key from KMS.
   // Throttle requests to avoid spamming the KMS (5s).
-  if (secureMqttConsumeDecryptFailure()) {
+  char topic[64];
+  if (secureMqttConsumeDecryptFailure(topic, sizeof(topic))) {
     static unsigned long lastRekeyRequestMs = 0;
     unsigned long now = millis();
     if (now - lastRekeyRequestMs > 5000) { // if more than 5s since last request
       lastRekeyRequestMs = now;
       // publish a simple request: {"topic":"<expectedTopic>"}
-      char reqTopic[128];
-      snprintf(reqTopic, sizeof(reqTopic), "%s/%s/kms/request_key", "iot/esp32", mqttClientId);
       char body[128];
-      // expected app topic is topic_data_sub (we used that as expectedTopic)
       snprintf(body, sizeof(body), "{\"topic\":\"%s\"}", topic);
-      Serial.print("[MQTT] Decrypt tag failure -> requesting key from KMS on ");
-      Serial.println(reqTopic);
-      client.publish(reqTopic, body);
+      SLOG_W("[MQTT] Decrypt tag failure -> requesting key for %s", topic);
+      client.publish(g_requestKeyTopic, body);
     }
   }
 }
 
-extern PubSubClient client;
-extern void handleButtonInput();
-
-void reconnectMQTT(PubSubClient& client,
-                   const char* clientId,
-                   const char* commandTopicSub,
-                   const char* dataTopicSub) {
-  while (!client.connected()) {
-    handleButtonInput();
+void requestRotationOnLostCounter(PubSubClient& client) {
+  char topic[64];
+  char body[256];
+  if (secureMqttRotationRequest(topic, sizeof(topic), body, sizeof(body))) {
+    static unsigned long lastRotateRequestMs = 0;
+    unsigned long now = millis();
+    if (now - lastRotateRequestMs > 5000) {
+      lastRotateRequestMs = now;
+      // "rotate": the stale epoch. The KMS rotates only if it is still current
+      SLOG_W("[MQTT] No counter lease -> requesting a new epoch for %s", topic);
+      client.publish(g_requestKeyTopic, body);
+    }
+  }
+}
 
-    if (client.connect(clientId)) {
-      client.subscribe(commandTopicSub);
-      client.subscribe(dataTopicSub);
+bool tryConnectMQTT(PubSubClient& client,
+                    const char* baseTopic,
+                    const char* clientId,
+                    const char* commandTopicSub,
+                    const char* const* secureTopics,
+                    uint8_t secureTopicCount) {
+  if (!client.connect(clientId)) {
+    SLOG_W("[MQTT] Connect failed, rc=%d", client.state());
+    return false;
+  }
 
-      char kmsTopic[128];
-      snprintf(kmsTopic, sizeof(kmsTopic),
-               "iot/esp32/%s/kms/#", clientId);
-      Serial.print("Subscribing to KMS topic: ");
-      Serial.println(kmsTopic);
-      client.subscribe(kmsTopic);
-    } else {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 5 seconds");
+  // Every topic string is built here once, not per message
+  RouteContext ctx;
+  ctx.client = &client;
+  ctx.index = 0;
+  topicRouterInit(&g_router);
+  bool routed = topicRouterAdd(&g_router, commandTopicSub, onCommand, ctx);
+  for (uint8_t i = 0; i < secureTopicCount; ++i) {
+    ctx.index = i;
+    routed = routed && topicRouterAdd(&g_router, secureTopics[i], onSecureData, ctx);
+  }
+  routed = routed && secureMqttAddKmsRoutes(&g_router, client, baseTopic, clientId);
+  if (!routed) {
+    SLOG_E("[MQTT] Topic router full");
+  }
+  snprintf(g_requestKeyTopic, sizeof(g_requestKeyTopic),
+           "%s/%s/kms/request_key", baseTopic, clientId);
 
-      unsigned long start = millis();
-      while (millis() - start < 5000) {
-        handleButtonInput();
-        delay(100);
-      }
-    }
+  client.subscribe(commandTopicSub);
+  for (uint8_t i = 0; i < secureTopicCount; ++i) {
+    client.subscribe(secureTopics[i]);
   }
-}
\ No newline at end of file
+
+  char kmsTopic[128];
+  snprintf(kmsTopic, sizeof(kmsTopic), "%s/%s/kms/#", baseTopic, clientId);
+  SLOG_I("[MQTT] Subscribing to KMS topic: %s", kmsTopic);
+  client.subscribe(kmsTopic);
+  // TOPIC_key rotations and revocations, shared by the whole fleet
+  snprintf(kmsTopic, sizeof(kmsTopic), "%s/kms/grouprekey", baseTopic);
+  client.subscribe(kmsTopic);
+  return true;
+}
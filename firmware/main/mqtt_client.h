@@ -2,7 +2,7 @@
 
 #include <PubSubClient.h>
 
-// Updated by MQTT message parsing when a metric is received from the other node.
+// Updated by the UI task from the readings decoded by the crypto worker.
 extern float g_remoteHumidity;
 extern bool g_remoteHumidityValid;
 extern float g_remoteTemperature;
@@ -12,7 +12,25 @@ extern unsigned long g_remoteHumidityLastMs;
 extern unsigned long g_remoteTemperatureLastMs;
 
 void messageReceived(char* topic, byte* payload, unsigned int length);
-void reconnectMQTT(PubSubClient& client,
-                   const char* clientId,
-                   const char* commandTopicSub,
-                   const char* dataTopicSub);
+
+// Crypto worker: decrypts a data frame in place (payload is overwritten
+// with the plaintext) and posts the readings it carries.
+void decodeDataFrame(const char* topic, uint8_t* payload, unsigned int length);
+
+// Network task: asks the KMS for the current key of the topic whose
+// frame failed authentication (at most every 5 s).
+void requestKeyOnDecryptFailure(PubSubClient& client);
+
+// Network task: asks the KMS to rotate the key of a topic that lost its
+// counter lease and waits for a fresh epoch (at most every 5 s).
+void requestRotationOnLostCounter(PubSubClient& client);
+
+// One connection attempt, then the subscriptions and the routes of every
+// subscribed topic (see topic_router.h); no retry (the connection manager
+// owns the retry policy).
+bool tryConnectMQTT(PubSubClient& client,
+                    const char* baseTopic,
+                    const char* clientId,
+                    const char* commandTopicSub,
+                    const char* const* secureTopics,
+                    uint8_t secureTopicCount);
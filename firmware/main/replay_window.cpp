@@ -0,0 +1,113 @@
+#include "replay_window.h"
+
+#include <string.h>
+
+static const uint8_t NONE = 0xFF;
+
+static uint8_t bucketOf(uint32_t sender) {
+  // Fibonacci hashing: sender ids are already hashes, but spread them anyway
+  return (uint8_t)((sender * 2654435761u) >> 26) & (REPLAY_TABLE_BUCKETS - 1);
+}
+
+static uint8_t findEntry(const ReplayTable* table, uint32_t sender) {
+  uint8_t i = table->buckets[bucketOf(sender)];
+  while (i != NONE) {
+    if (table->entries[i].sender == sender) return i;
+    i = table->entries[i].chain;
+  }
+  return NONE;
+}
+
+static void lruUnlink(ReplayTable* table, uint8_t i) {
+  ReplayEntry& e = table->entries[i];
+  if (e.newer != NONE) table->entries[e.newer].older = e.older;
+  else table->newest = e.older;
+  if (e.older != NONE) table->entries[e.older].newer = e.newer;
+  else table->oldest = e.newer;
+  e.newer = e.older = NONE;
+}
+
+static void lruPushNewest(ReplayTable* table, uint8_t i) {
+  ReplayEntry& e = table->entries[i];
+  e.newer = NONE;
+  e.older = table->newest;
+  if (table->newest != NONE) table->entries[table->newest].newer = i;
+  table->newest = i;
+  if (table->oldest == NONE) table->oldest = i;
+}
+
+static void bucketUnlink(ReplayTable* table, uint8_t i) {
+  uint8_t* link = &table->buckets[bucketOf(table->entries[i].sender)];
+  while (*link != NONE && *link != i) {
+    link = &table->entries[*link].chain;
+  }
+  if (*link == i) *link = table->entries[i].chain;
+}
+
+void replayTableInit(ReplayTable* table) {
+  memset(table->entries, 0, sizeof(table->entries));
+  memset(table->buckets, NONE, sizeof(table->buckets));
+  memset(table->floors, 0, sizeof(table->floors));
+  table->newest = table->oldest = NONE;
+  table->count = 0;
+}
+
+bool replayCheck(const ReplayTable* table, uint32_t sender, uint32_t counter) {
+  if (counter == 0) return false;  // counters start at 1
+
+  uint8_t i = findEntry(table, sender);
+  if (i == NONE) {
+    // Unknown or evicted: only the bucket's floor to compare with
+    return counter > table->floors[bucketOf(sender)];
+  }
+
+  const ReplayEntry& e = table->entries[i];
+  if (counter > e.highest) return true;
+
+  uint32_t offset = e.highest - counter;
+  if (offset >= REPLAY_WINDOW_BITS) return false;  // too old to tell
+  return (e.bitmap & ((uint64_t)1 << offset)) == 0;
+}
+
+void replayCommit(ReplayTable* table, uint32_t sender, uint32_t counter) {
+  uint8_t i = findEntry(table, sender);
+
+  if (i == NONE) {
+    if (table->count < REPLAY_TABLE_CAPACITY) {
+      i = table->count++;
+    } else {
+      i = table->oldest;
+      uint32_t* floor = &table->floors[bucketOf(table->entries[i].sender)];
+      if (table->entries[i].highest > *floor) *floor = table->entries[i].highest;
+      bucketUnlink(table, i);
+      lruUnlink(table, i);
+    }
+    ReplayEntry& e = table->entries[i];
+    uint8_t bucket = bucketOf(sender);
+    e.sender = sender;
+    e.highest = counter;
+    e.bitmap = 1;
+    e.used = true;
+    e.chain = table->buckets[bucket];
+    table->buckets[bucket] = i;
+    lruPushNewest(table, i);
+    return;
+  }
+
+  ReplayEntry& e = table->entries[i];
+  if (counter > e.highest) {
+    uint32_t shift = counter - e.highest;
+    e.bitmap = (shift >= REPLAY_WINDOW_BITS) ? 1 : ((e.bitmap << shift) | 1);
+    e.highest = counter;
+  } else {
+    uint32_t offset = e.highest - counter;
+    if (offset < REPLAY_WINDOW_BITS) {
+      e.bitmap |= (uint64_t)1 << offset;
+    }
+  }
+
+  if (table->newest != i) {
+    lruUnlink(table, i);
+    lruPushNewest(table, i);
+  }
+}
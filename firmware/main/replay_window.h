@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-sender anti-replay windows (IPsec style, RFC 4303 section 3.4.3).
+// Each sender gets the highest authenticated counter plus a 64-bit bitmap
+// of the counters just below it, so reordered frames inside the window
+// are still accepted. The table has a fixed size: hashed lookup in O(1),
+// and the least recently used sender is evicted when it is full.
+//
+// An evicted sender is forgotten, so its old frames would pass as those
+// of a new sender. Each hash bucket therefore keeps the highest counter
+// evicted from it, and a sender not in the table must be above that
+// floor. The cost: while more senders than REPLAY_TABLE_CAPACITY are
+// active, a sender whose counter is below the floor of its bucket (a new
+// device, say) is refused until its counter passes the floor. Size the
+// capacity for the senders of a topic.
+
+#ifndef REPLAY_TABLE_CAPACITY
+#define REPLAY_TABLE_CAPACITY 32   // senders tracked at once (< 255)
+#endif
+#define REPLAY_TABLE_BUCKETS 64    // power of two, >= capacity
+#define REPLAY_WINDOW_BITS 64
+
+struct ReplayEntry {
+  uint32_t sender;
+  uint32_t highest;   // highest authenticated counter
+  uint64_t bitmap;    // bit i set => counter (highest - i) already seen
+  uint8_t chain;      // next entry in the same hash bucket
+  uint8_t newer;      // LRU neighbours
+  uint8_t older;
+  bool used;
+};
+
+struct ReplayTable {
+  ReplayEntry entries[REPLAY_TABLE_CAPACITY];
+  uint8_t buckets[REPLAY_TABLE_BUCKETS];
+  uint32_t floors[REPLAY_TABLE_BUCKETS];  // highest counter evicted from each bucket
+  uint8_t newest;
+  uint8_t oldest;
+  uint8_t count;
+};
+
+void replayTableInit(ReplayTable* table);
+
+// True if `counter` from `sender` is new and inside the window, or above
+// the eviction floor for a sender not in the table.
+// Does not modify the table: call replayCommit() once the frame has
+// been authenticated.
+bool replayCheck(const ReplayTable* table, uint32_t sender, uint32_t counter);
+
+// Records an authenticated (sender, counter).
+void replayCommit(ReplayTable* table, uint32_t sender, uint32_t counter);
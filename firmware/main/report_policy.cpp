@@ -0,0 +1,26 @@
+#include "report_policy.h"
+
+#include <math.h>
+
+bool reportPolicyDue(const ReportPolicy* policy,
+                     const ReportState* state,
+                     float value,
+                     uint32_t nowMs) {
+  if (!state->published) return true;
+
+  uint32_t elapsed = nowMs - state->lastMs;
+  if (elapsed >= policy->heartbeatMs) return true;
+  if (elapsed < policy->minIntervalMs) return false;
+
+  float delta = fabsf(value - state->lastValue);
+  if (delta == 0.0f) return false;
+  float threshold = policy->relDeadband * fabsf(state->lastValue);
+  if (threshold < policy->absDeadband) threshold = policy->absDeadband;
+  return delta >= threshold;
+}
+
+void reportPolicyPublished(ReportState* state, float value, uint32_t nowMs) {
+  state->published = true;
+  state->lastValue = value;
+  state->lastMs = nowMs;
+}
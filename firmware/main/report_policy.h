@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// On-change reporting: a sensor value is published only when it moved
+// out of the deadband around the last published value, and no more often
+// than minIntervalMs. A heartbeat republishes the value after
+// heartbeatMs without any publish, so receivers can tell a steady sensor
+// from a dead one: a value older than a couple of heartbeats is stale.
+//
+// The change must reach max(absDeadband, relDeadband * |last value|);
+// with both at 0, any change is published.
+
+struct ReportPolicy {
+  float absDeadband;       // in the unit of the value
+  float relDeadband;       // fraction of the last published value
+  uint32_t minIntervalMs;  // between two publishes of a change
+  uint32_t heartbeatMs;    // maximum interval between two publishes
+};
+
+struct ReportState {
+  bool published;      // lastValue/lastMs are meaningful
+  float lastValue;
+  uint32_t lastMs;
+};
+
+// True if `value`, read at `nowMs`, should be published
+bool reportPolicyDue(const ReportPolicy* policy,
+                     const ReportState* state,
+                     float value,
+                     uint32_t nowMs);
+
+// Records a publish; only call it once the value was actually sent, so a
+// publish dropped on the way is retried on the next reading.
+void reportPolicyPublished(ReportState* state, float value, uint32_t nowMs);
@@ -0,0 +1,185 @@
+#include "sec_log.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+static_assert(SEC_LOG_RING_SIZE >= 2 && (SEC_LOG_RING_SIZE & (SEC_LOG_RING_SIZE - 1)) == 0,
+              "SEC_LOG_RING_SIZE must be a power of two");
+
+// Bounded multi-producer ring: each cell carries a sequence number, kept
+// relative to the start of the current lap (position & ~mask) so that the
+// zero-initialized ring is valid. For position p, the cell is free when
+// seq == lap(p), and holds a committed record when seq == lap(p) + 1.
+// Producers race for positions with a compare-and-swap on g_claimPos; the
+// single consumer frees a cell by moving seq to the next lap.
+struct LogCell {
+  std::atomic<uint32_t> seq;
+  SecLogRecord rec;
+};
+
+static const uint32_t RING_MASK = SEC_LOG_RING_SIZE - 1;
+
+static LogCell g_cells[SEC_LOG_RING_SIZE];
+static std::atomic<uint32_t> g_claimPos{0};
+static std::atomic<uint32_t> g_dropped{0};
+static uint32_t g_drainPos = 0;  // consumer only
+
+static inline uint32_t lapOf(uint32_t pos) { return pos & ~RING_MASK; }
+
+SecLogRecord* secLogClaim(uint8_t level, const char* fmt) {
+  uint32_t pos = g_claimPos.load(std::memory_order_relaxed);
+  for (;;) {
+    LogCell& cell = g_cells[pos & RING_MASK];
+    int32_t diff = (int32_t)(cell.seq.load(std::memory_order_acquire) - lapOf(pos));
+    if (diff == 0) {
+      if (g_claimPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        SecLogRecord* rec = &cell.rec;
+        rec->fmt = fmt;
+        rec->pos = pos;
+        rec->level = level;
+        rec->argCount = 0;
+        rec->strLen = 0;
+        return rec;
+      }
+    } else if (diff < 0) {
+      g_dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    } else {
+      pos = g_claimPos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void secLogCommit(SecLogRecord* rec) {
+  g_cells[rec->pos & RING_MASK].seq.store(lapOf(rec->pos) + 1, std::memory_order_release);
+}
+
+void secLogPutU32(SecLogRecord* rec, uint32_t value) {
+  if (rec->argCount < SEC_LOG_MAX_ARGS) rec->args[rec->argCount++] = value;
+}
+
+void secLogPutFloat(SecLogRecord* rec, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  secLogPutU32(rec, bits);
+}
+
+void secLogPutStr(SecLogRecord* rec, const char* s) {
+  size_t room = sizeof(rec->str) - rec->strLen;
+  if (room == 0) return;  // the drain prints "?" for the missing string
+  if (!s) s = "(null)";
+  size_t n = strnlen(s, room - 1);
+  memcpy(rec->str + rec->strLen, s, n);
+  rec->str[rec->strLen + n] = '\0';
+  rec->strLen = (uint8_t)(rec->strLen + n + 1);
+}
+
+// ========= Drain =========
+
+// Appends one conversion (`spec`, e.g. "%02x") of the next argument
+static size_t formatArg(char* out, size_t outSize, const char* spec, char conv,
+                        const SecLogRecord& rec, uint8_t* argIdx, uint8_t* strPos) {
+  if (conv == 's') {
+    if (*strPos >= rec.strLen) return snprintf(out, outSize, "?");
+    const char* s = rec.str + *strPos;
+    *strPos = (uint8_t)(*strPos + strlen(s) + 1);
+    return snprintf(out, outSize, spec, s);
+  }
+  if (*argIdx >= rec.argCount) return snprintf(out, outSize, "?");
+  uint32_t v = rec.args[(*argIdx)++];
+  bool isLong = strchr(spec, 'l') != nullptr;
+  bool isSize = strchr(spec, 'z') != nullptr;
+
+  switch (conv) {
+    case 'd':
+    case 'i':
+      if (isSize) return snprintf(out, outSize, spec, (size_t)v);
+      return isLong ? snprintf(out, outSize, spec, (long)(int32_t)v)
+                    : snprintf(out, outSize, spec, (int)(int32_t)v);
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      if (isSize) return snprintf(out, outSize, spec, (size_t)v);
+      return isLong ? snprintf(out, outSize, spec, (unsigned long)v)
+                    : snprintf(out, outSize, spec, (unsigned)v);
+    case 'c':
+      return snprintf(out, outSize, spec, (int)v);
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G': {
+      float f;
+      memcpy(&f, &v, sizeof(f));
+      return snprintf(out, outSize, spec, (double)f);
+    }
+    default:
+      return snprintf(out, outSize, "%s", spec);
+  }
+}
+
+// printf-style formatting of a record, one conversion at a time
+static void formatRecord(const SecLogRecord& rec, char* line, size_t lineSize) {
+  size_t pos = 0;
+  uint8_t argIdx = 0;
+  uint8_t strPos = 0;
+  const char* p = rec.fmt;
+
+  while (*p && pos + 1 < lineSize) {
+    if (*p != '%') {
+      line[pos++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      line[pos++] = '%';
+      p += 2;
+      continue;
+    }
+
+    // %[flags][width][.precision][length]conversion
+    char spec[16];
+    size_t n = 0;
+    spec[n++] = *p++;
+    while (*p && strchr("-+ #0123456789.hlzj", *p) && n < sizeof(spec) - 2) {
+      spec[n++] = *p++;
+    }
+    if (!*p) break;
+    char conv = *p++;
+    spec[n++] = conv;
+    spec[n] = '\0';
+
+    size_t w = formatArg(line + pos, lineSize - pos, spec, conv, rec, &argIdx, &strPos);
+    pos += w;
+    if (pos >= lineSize) pos = lineSize - 1;  // truncated
+  }
+  line[pos] = '\0';
+}
+
+size_t secLogDrain(size_t max) {
+  size_t printed = 0;
+  char line[160];
+
+  while (printed < max) {
+    LogCell& cell = g_cells[g_drainPos & RING_MASK];
+    if (cell.seq.load(std::memory_order_acquire) != lapOf(g_drainPos) + 1) break;
+
+    formatRecord(cell.rec, line, sizeof(line));
+    cell.seq.store(lapOf(g_drainPos) + SEC_LOG_RING_SIZE, std::memory_order_release);
+    ++g_drainPos;
+
+    Serial.println(line);
+    ++printed;
+  }
+
+  uint32_t dropped = g_dropped.exchange(0, std::memory_order_relaxed);
+  if (dropped) {
+    Serial.print("[LOG] ");
+    Serial.print((unsigned long)dropped);
+    Serial.println(" messages dropped");
+  }
+  return printed;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Deferred logging. A log call does not format or touch the UART: it
+// copies the format string pointer and its arguments into a fixed binary
+// ring, and secLogDrain() formats and prints them later, from the
+// low-priority log task (app_tasks.cpp) or on demand. Several tasks may
+// log at once; a full ring drops the record and counts it.
+//
+// Levels below SEC_LOG_LEVEL compile to nothing, arguments included:
+//   -DSEC_LOG_LEVEL=SEC_LOG_LEVEL_DEBUG  per-message traces
+//   -DSEC_LOG_LEVEL=SEC_LOG_LEVEL_NONE   no logging at all
+//
+// The format must be a string literal (only its address is stored).
+// Supported arguments: integers and enums (32 bits kept), float/double,
+// and C strings, which are copied (up to SEC_LOG_STR_BYTES in total per
+// record, truncated beyond).
+
+#define SEC_LOG_LEVEL_NONE  0
+#define SEC_LOG_LEVEL_ERROR 1
+#define SEC_LOG_LEVEL_WARN  2
+#define SEC_LOG_LEVEL_INFO  3
+#define SEC_LOG_LEVEL_DEBUG 4
+
+#ifndef SEC_LOG_LEVEL
+#define SEC_LOG_LEVEL SEC_LOG_LEVEL_INFO
+#endif
+#ifndef SEC_LOG_RING_SIZE
+#define SEC_LOG_RING_SIZE 32  // records, power of two
+#endif
+#define SEC_LOG_MAX_ARGS  4
+#define SEC_LOG_STR_BYTES 48
+
+struct SecLogRecord {
+  const char* fmt;
+  uint32_t pos;  // ring position, for secLogCommit()
+  uint32_t args[SEC_LOG_MAX_ARGS];
+  uint8_t level;
+  uint8_t argCount;
+  uint8_t strLen;
+  char str[SEC_LOG_STR_BYTES];  // copied strings, each NUL-terminated
+};
+
+// Free record to fill, or nullptr (and one more drop) if the ring is full
+SecLogRecord* secLogClaim(uint8_t level, const char* fmt);
+// Makes a filled record visible to secLogDrain()
+void secLogCommit(SecLogRecord* rec);
+
+void secLogPutU32(SecLogRecord* rec, uint32_t value);
+void secLogPutFloat(SecLogRecord* rec, float value);
+void secLogPutStr(SecLogRecord* rec, const char* s);
+
+inline void secLogPut(SecLogRecord* rec, const char* s) { secLogPutStr(rec, s); }
+inline void secLogPut(SecLogRecord* rec, char* s) { secLogPutStr(rec, s); }
+inline void secLogPut(SecLogRecord* rec, float v) { secLogPutFloat(rec, v); }
+inline void secLogPut(SecLogRecord* rec, double v) { secLogPutFloat(rec, (float)v); }
+template <typename T>
+inline void secLogPut(SecLogRecord* rec, T v) {
+  static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                "log arguments: integers, floats or C strings");
+  secLogPutU32(rec, (uint32_t)v);
+}
+
+inline void secLogPutAll(SecLogRecord*) {}
+template <typename T, typename... Rest>
+inline void secLogPutAll(SecLogRecord* rec, T v, Rest... rest) {
+  secLogPut(rec, v);
+  secLogPutAll(rec, rest...);
+}
+
+template <typename... Args>
+inline void secLog(uint8_t level, const char* fmt, Args... args) {
+  static_assert(sizeof...(Args) <= SEC_LOG_MAX_ARGS, "too many log arguments");
+  SecLogRecord* rec = secLogClaim(level, fmt);
+  if (!rec) return;
+  secLogPutAll(rec, args...);
+  secLogCommit(rec);
+}
+
+#if SEC_LOG_LEVEL >= SEC_LOG_LEVEL_ERROR
+#define SLOG_E(...) secLog(SEC_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define SLOG_E(...) do {} while (0)
+#endif
+#if SEC_LOG_LEVEL >= SEC_LOG_LEVEL_WARN
+#define SLOG_W(...) secLog(SEC_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define SLOG_W(...) do {} while (0)
+#endif
+#if SEC_LOG_LEVEL >= SEC_LOG_LEVEL_INFO
+#define SLOG_I(...) secLog(SEC_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define SLOG_I(...) do {} while (0)
+#endif
+#if SEC_LOG_LEVEL >= SEC_LOG_LEVEL_DEBUG
+#define SLOG_D(...) secLog(SEC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define SLOG_D(...) do {} while (0)
+#endif
+
+// Formats and prints (Serial) up to `max` records, oldest first, then a
+// line with the number of dropped records if any. Returns how many were
+// printed. One task at a time.
+size_t secLogDrain(size_t max);
+
+// Prints everything queued so far
+inline void secLogFlush() { secLogDrain((size_t)-1); }
@@ -0,0 +1,214 @@
+#include "sec_metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Arduino.h>
+#include <esp_cpu.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <time.h>
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+static const char* const STAGE_NAMES[SEC_STAGE_COUNT] = {
+  "hs_auth", "hs_clientauth", "hs_key", "sig_verify", "hkdf",
+  "gcm_seal", "gcm_open", "json_build", "publish", "open_parse", "open",
+};
+
+const char* secStageName(SecStage stage) {
+  return stage < SEC_STAGE_COUNT ? STAGE_NAMES[stage] : "?";
+}
+
+static const char* const GAUGE_NAMES[SEC_GAUGE_COUNT] = {
+  "scratch_peak", "scratch_size", "scratch_failures", "net_stack_free", "crypto_stack_free",
+};
+
+const char* secGaugeName(SecGauge gauge) {
+  return gauge < SEC_GAUGE_COUNT ? GAUGE_NAMES[gauge] : "?";
+}
+
+uint8_t secMetricsBucket(uint32_t ticks) {
+  if (ticks < 2) return 0;
+  uint8_t e = (uint8_t)(31 - __builtin_clz(ticks));
+  return (uint8_t)(2 * e + ((ticks >> (e - 1)) & 1));
+}
+
+uint32_t secMetricsBucketLow(uint8_t bucket) {
+  uint8_t e = bucket / 2;
+  if (e == 0) return 1;
+  return (1u << e) + ((bucket & 1) ? (1u << (e - 1)) : 0);
+}
+
+#if !defined(ARDUINO_ARCH_ESP32)
+static uint64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#if SEC_METRICS
+
+// Written from the network and crypto tasks (two cores): relaxed atomic
+// increments, and the report takes each bucket with an atomic exchange.
+static uint32_t g_hist[SEC_STAGE_COUNT][SEC_METRICS_BUCKETS];
+
+// The cycle counter is per core; every caller is a task pinned to a core.
+uint32_t secMetricsNow() {
+#ifdef ARDUINO_ARCH_ESP32
+  return (uint32_t)esp_cpu_get_cycle_count();
+#elif defined(__x86_64__) || defined(__i386__)
+  return (uint32_t)__rdtsc();
+#else
+  return (uint32_t)monotonicNs();
+#endif
+}
+
+void secMetricsRecord(SecStage stage, uint32_t ticks) {
+  if (stage >= SEC_STAGE_COUNT) return;
+  __atomic_fetch_add(&g_hist[stage][secMetricsBucket(ticks)], 1, __ATOMIC_RELAXED);
+}
+
+#endif
+
+uint32_t secMetricsTicksPerUs() {
+#ifdef ARDUINO_ARCH_ESP32
+  return getCpuFrequencyMhz();
+#elif defined(__x86_64__) || defined(__i386__)
+  // TSC rate, measured once against CLOCK_MONOTONIC over 10 ms
+  static uint32_t ticksPerUs = 0;
+  if (ticksPerUs == 0) {
+    uint64_t ns0 = monotonicNs();
+    uint64_t tsc0 = __rdtsc();
+    while (monotonicNs() - ns0 < 10000000u) {
+    }
+    uint64_t ns = monotonicNs() - ns0;
+    uint64_t tsc = __rdtsc() - tsc0;
+    ticksPerUs = (uint32_t)((tsc * 1000 + ns / 2) / ns);
+    if (ticksPerUs == 0) ticksPerUs = 1;
+  }
+  return ticksPerUs;
+#else
+  return 1000;  // nanoseconds
+#endif
+}
+
+// ========= Report =========
+
+// Set from any task, read by the report
+static uint32_t g_gauges[SEC_GAUGE_COUNT];
+static SecGaugeSampler g_gaugeSampler = nullptr;
+
+void secMetricsSetGauge(SecGauge gauge, uint32_t value) {
+  if (gauge < SEC_GAUGE_COUNT) __atomic_store_n(&g_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+void secMetricsSetGaugeSampler(SecGaugeSampler sampler) {
+  g_gaugeSampler = sampler;
+}
+
+// Used by secMetricsNextChunk() only, i.e. by one task
+static uint32_t g_report[SEC_STAGE_COUNT][SEC_METRICS_BUCKETS];
+static bool g_reportActive = false;
+static bool g_reportGauges = false;  // gauge chunk still to send
+static uint8_t g_reportStage = 0;
+static uint8_t g_reportBucket = 0;
+static uint32_t g_lastReportMs = 0;
+
+static void startReport() {
+  for (uint8_t s = 0; s < SEC_STAGE_COUNT; ++s) {
+    for (uint8_t b = 0; b < SEC_METRICS_BUCKETS; ++b) {
+#if SEC_METRICS
+      g_report[s][b] = __atomic_exchange_n(&g_hist[s][b], 0, __ATOMIC_RELAXED);
+#else
+      g_report[s][b] = 0;
+#endif
+    }
+  }
+  if (g_gaugeSampler) g_gaugeSampler();
+  g_reportActive = true;
+  g_reportGauges = true;
+  g_reportStage = 0;
+  g_reportBucket = 0;
+}
+
+// Last chunk of a report: every gauge, 0 if they do not fit
+static size_t gaugeChunk(char* out, size_t outSize) {
+  int len = snprintf(out, outSize, "{\"mhz\":%lu,\"gauges\":{",
+                     (unsigned long)secMetricsTicksPerUs());
+  size_t pos = len < 0 ? outSize : (size_t)len;
+  for (uint8_t g = 0; g < SEC_GAUGE_COUNT && pos < outSize; ++g) {
+    len = snprintf(out + pos, outSize - pos, "%s\"%s\":%lu", g ? "," : "",
+                   secGaugeName((SecGauge)g),
+                   (unsigned long)__atomic_load_n(&g_gauges[g], __ATOMIC_RELAXED));
+    pos = len < 0 ? outSize : pos + (size_t)len;
+  }
+  if (pos + 3 > outSize) return 0;
+  memcpy(out + pos, "}}", 3);
+  return pos + 2;
+}
+
+// Moves the cursor to the next non-empty bucket; false at the end
+static bool seekNonEmpty() {
+  while (g_reportStage < SEC_STAGE_COUNT) {
+    while (g_reportBucket < SEC_METRICS_BUCKETS) {
+      if (g_report[g_reportStage][g_reportBucket]) return true;
+      ++g_reportBucket;
+    }
+    ++g_reportStage;
+    g_reportBucket = 0;
+  }
+  return false;
+}
+
+size_t secMetricsNextChunk(uint32_t nowMs, char* out, size_t outSize) {
+  if (!g_reportActive) {
+    if (nowMs - g_lastReportMs < SEC_METRICS_REPORT_MS) return 0;
+    g_lastReportMs = nowMs;
+    startReport();
+  }
+  if (!seekNonEmpty()) {
+    if (g_reportGauges) {
+      g_reportGauges = false;
+      size_t len = gaugeChunk(out, outSize);
+      if (len > 0) return len;
+    }
+    g_reportActive = false;
+    return 0;
+  }
+
+  uint8_t stage = g_reportStage;
+  int len = snprintf(out, outSize, "{\"mhz\":%lu,\"stage\":\"%s\",\"b\":[",
+                     (unsigned long)secMetricsTicksPerUs(),
+                     secStageName((SecStage)stage));
+  if (len < 0 || (size_t)len + 3 > outSize) {
+    g_reportActive = false;
+    return 0;
+  }
+
+  // Buckets of this stage, as many as fit ("]}" kept free)
+  size_t pos = (size_t)len;
+  bool first = true;
+  while (seekNonEmpty() && g_reportStage == stage) {
+    char item[24];
+    int n = snprintf(item, sizeof(item), "%s[%u,%lu]", first ? "" : ",",
+                     (unsigned)g_reportBucket,
+                     (unsigned long)g_report[stage][g_reportBucket]);
+    if (pos + (size_t)n + 3 > outSize) {
+      if (first) {
+        g_reportActive = false;  // buffer too small for a single bucket
+        return 0;
+      }
+      break;
+    }
+    memcpy(out + pos, item, (size_t)n);
+    pos += (size_t)n;
+    first = false;
+    ++g_reportBucket;
+  }
+  memcpy(out + pos, "]}", 3);
+  return pos + 2;
+}
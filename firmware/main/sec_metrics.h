@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Cycle-count histograms of the secure layer's hot paths. Each stage is
+// timed with the CPU cycle counter (esp_cpu_get_cycle_count() on the
+// ESP32, the TSC or CLOCK_MONOTONIC on a host) and counted into a fixed
+// log-scale histogram in RAM: bucket 2e covers [2^e, 1.5*2^e) cycles and
+// bucket 2e+1 [1.5*2^e, 2^(e+1)). Recording is two counter reads and one
+// atomic increment, so it stays on in normal builds (-DSEC_METRICS=0
+// compiles it out). The histograms are sent periodically, encrypted, on
+// the device's metrics topic and cleared (see secMetricsNextChunk()).
+
+#ifndef SEC_METRICS
+#define SEC_METRICS 1
+#endif
+#ifndef SEC_METRICS_REPORT_MS
+#define SEC_METRICS_REPORT_MS 60000  // report period
+#endif
+#define SEC_METRICS_BUCKETS 64
+
+enum SecStage : uint8_t {
+  SEC_STAGE_HS_AUTH = 0,      // challenge + auth publish
+  SEC_STAGE_HS_CLIENTAUTH,    // clientauth handling, clientverify publishes
+  SEC_STAGE_HS_KEY,           // key/rekey unwrap and install
+  SEC_STAGE_SIG_VERIFY,       // KMS signature check
+  SEC_STAGE_HKDF,             // per-message or session key derivation
+  SEC_STAGE_GCM_SEAL,
+  SEC_STAGE_GCM_OPEN,
+  SEC_STAGE_JSON_BUILD,       // hex encoding + JSON frame formatting
+  SEC_STAGE_PUBLISH,          // client.publish of a data frame
+  SEC_STAGE_OPEN_PARSE,       // frame parsing before the replay check
+  SEC_STAGE_OPEN,             // whole receive path of one frame
+  SEC_STAGE_COUNT,
+};
+
+const char* secStageName(SecStage stage);
+
+#if SEC_METRICS
+
+uint32_t secMetricsNow();
+void secMetricsRecord(SecStage stage, uint32_t ticks);
+
+// Records the time from construction to the end of the scope
+class SecMetricsScope {
+ public:
+  explicit SecMetricsScope(SecStage stage) : stage_(stage), start_(secMetricsNow()) {}
+  ~SecMetricsScope() { secMetricsRecord(stage_, secMetricsNow() - start_); }
+
+ private:
+  SecStage stage_;
+  uint32_t start_;
+};
+
+#define SEC_METRICS_SCOPE(stage) SecMetricsScope secMetricsScope_##stage(stage)
+
+#else
+
+inline uint32_t secMetricsNow() { return 0; }
+inline void secMetricsRecord(SecStage, uint32_t) {}
+#define SEC_METRICS_SCOPE(stage) do {} while (0)
+
+#endif
+
+// Memory gauges: last value set, sent at the end of every report (see
+// secMetricsNextChunk()). Their owner sets them from the sampler, which
+// runs when a report starts, on the task sending the reports.
+enum SecGauge : uint8_t {
+  SEC_GAUGE_SCRATCH_PEAK = 0,   // most scratch arena bytes in use (sec_scratch.h)
+  SEC_GAUGE_SCRATCH_SIZE,
+  SEC_GAUGE_SCRATCH_FAILURES,   // buffers refused, arena full
+  SEC_GAUGE_NET_STACK_FREE,     // stack high-water marks: fewest free bytes
+  SEC_GAUGE_CRYPTO_STACK_FREE,
+  SEC_GAUGE_COUNT,
+};
+
+const char* secGaugeName(SecGauge gauge);
+void secMetricsSetGauge(SecGauge gauge, uint32_t value);
+
+typedef void (*SecGaugeSampler)();
+void secMetricsSetGaugeSampler(SecGaugeSampler sampler);
+
+// Bucket of a tick count, and the smallest count of a bucket
+uint8_t secMetricsBucket(uint32_t ticks);
+uint32_t secMetricsBucketLow(uint8_t bucket);
+
+// Counter ticks per microsecond (the CPU MHz on the ESP32)
+uint32_t secMetricsTicksPerUs();
+
+// Next chunk of the periodic report, as a JSON object small enough for
+// one secure frame:
+//   {"mhz":240,"stage":"hkdf","b":[[34,12],[35,3]]}
+// with `mhz` the ticks per microsecond and `b` the non-empty buckets as
+// [bucket, count]. A stage may span several chunks; counts add up. The
+// last chunk of a report carries the gauges:
+//   {"mhz":240,"gauges":{"scratch_peak":1480,"net_stack_free":3012,...}}
+// A new report (histograms taken and cleared, gauges sampled) starts once
+// SEC_METRICS_REPORT_MS have passed since the previous one. Returns the
+// length, 0 when there is nothing to send now.
+size_t secMetricsNextChunk(uint32_t nowMs, char* out, size_t outSize);
@@ -0,0 +1,40 @@
+#include "sec_scratch.h"
+#include "sec_log.h"
+
+#include <string.h>
+
+alignas(SEC_SCRATCH_ALIGN) static uint8_t g_arena[SEC_SCRATCH_SIZE];
+static size_t g_used = 0;
+// Read by the task sending the diagnostics, without the state lock
+static size_t g_peak = 0;
+static uint32_t g_failures = 0;
+
+SecScratch::SecScratch() : mark_(g_used) {}
+
+SecScratch::~SecScratch() {
+  // Handshake buffers held nonces, tickets and key paths
+  memset(g_arena + mark_, 0, g_used - mark_);
+  g_used = mark_;
+}
+
+void* SecScratch::takeBytes(size_t n) {
+  size_t bytes = secScratchBytes(n);
+  if (bytes > SEC_SCRATCH_SIZE - g_used) {
+    __atomic_fetch_add(&g_failures, 1, __ATOMIC_RELAXED);
+    SLOG_E("[SEC] Scratch arena full: %u bytes wanted, %u of %u in use",
+           (unsigned)bytes, (unsigned)g_used, (unsigned)SEC_SCRATCH_SIZE);
+    return nullptr;
+  }
+  void* p = g_arena + g_used;
+  g_used += bytes;
+  if (g_used > g_peak) __atomic_store_n(&g_peak, g_used, __ATOMIC_RELAXED);
+  return p;
+}
+
+size_t secScratchPeak() {
+  return __atomic_load_n(&g_peak, __ATOMIC_RELAXED);
+}
+
+uint32_t secScratchFailures() {
+  return __atomic_load_n(&g_failures, __ATOMIC_RELAXED);
+}
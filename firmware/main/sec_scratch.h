@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Scratch memory of the secure layer. The message-sized buffers (copies
+// of KMS messages, hex fields, outgoing payloads and frames) come from one
+// static arena instead of the stack of whichever task runs the secure
+// layer. A SecScratch scope takes buffers with take() and gives all of
+// them back, wiped, when it ends: the arena is empty again after every
+// message. Scopes nest, a handler opens its own inside its caller's.
+// Fixed-size key material and headers stay on the stack.
+//
+// The arena has no lock of its own: every secure_mqtt entry point holds
+// the secure layer's state lock, so one task at a time uses it.
+//
+// The worst case of each path is a compile-time sum of secScratchBytes()
+// checked against SEC_SCRATCH_SIZE in secure_mqtt.cpp. take() checks
+// again at run time: it returns nullptr when the arena is full and counts
+// the failure.
+
+#ifndef SEC_SCRATCH_SIZE
+#define SEC_SCRATCH_SIZE 2560
+#endif
+#define SEC_SCRATCH_ALIGN 8
+
+// Arena bytes taken by a buffer of n bytes
+constexpr size_t secScratchBytes(size_t n) {
+  return (n + SEC_SCRATCH_ALIGN - 1) & ~(size_t)(SEC_SCRATCH_ALIGN - 1);
+}
+
+constexpr size_t secScratchMax(size_t a, size_t b) { return a > b ? a : b; }
+
+class SecScratch {
+ public:
+  SecScratch();
+  ~SecScratch();
+  SecScratch(const SecScratch&) = delete;
+  SecScratch& operator=(const SecScratch&) = delete;
+
+  // `count` objects of T, aligned, valid until the scope ends. nullptr
+  // if the arena is full.
+  template <typename T>
+  T* take(size_t count) { return (T*)takeBytes(count * sizeof(T)); }
+
+ private:
+  size_t mark_;
+  void* takeBytes(size_t n);
+};
+
+// Largest arena use since boot (bytes), and takes refused for lack of space
+size_t secScratchPeak();
+uint32_t secScratchFailures();
@@ -0,0 +1,58 @@
+#pragma once
+
+// Fixed KMS keys and signatures of the challenge 00 01 .. 1f, used by
+// secureMqttRunBenchmark() to time signature verification for each
+// suite. Generated with kms/crypto_utils.py; not used for anything else.
+
+#include <stdint.h>
+
+static const uint8_t BENCH_CHALLENGE[32] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+static const char BENCH_RSA2048_PUBKEY_PEM[] =
+  "-----BEGIN PUBLIC KEY-----\n"
+  "MIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEAsW4JVQO9aNT3mYM6nCQx\n"
+  "CEtZ/S3oZxq2rokyy37rpVKwadlnj81/qWUkqDGJ8BrxVwKvmPiPq734+aOESGlk\n"
+  "hun+DCdeUDuZ+dQEbaF1wPalbgGu7f3mk6BesV2B+nafyQl0w3EAODd9ldGdDpmt\n"
+  "vrPDYObN/R/v4rEs1qsiltH0BziWUQWRgeQKdw+aya2cgoHzEZQ4pEqBzNs3hNWb\n"
+  "CiKFHKKQC4FgJg0nDXOY3hrc0jewx3AkRLbiowGVhumLIsl6nmzJfdTNPB/TV7gZ\n"
+  "bCtF3Vvj5MkFAw5kcCA5amqVREaTbzHhp2fwSe5Bj7HHZw6cr5XtndpUd+tkNuLJ\n"
+  "RQIDAQAB\n"
+  "-----END PUBLIC KEY-----\n"
+  ;
+
+static const uint8_t BENCH_RSA2048_SIG[256] = {
+  0x24, 0xd6, 0xcd, 0x4a, 0x61, 0x04, 0x5b, 0x1d, 0x54, 0x6d, 0x92, 0xae, 0x06, 0x89, 0x37, 0xda,
+  0x05, 0xe7, 0x1a, 0x3e, 0xa3, 0xe0, 0x05, 0x1f, 0xce, 0x60, 0x00, 0x5d, 0x3e, 0xda, 0xb5, 0x54,
+  0x6e, 0xf1, 0x05, 0x7f, 0xb3, 0x3a, 0xcf, 0x1a, 0x73, 0x0f, 0x43, 0x4f, 0xa3, 0xe7, 0x08, 0x5b,
+  0xf3, 0xf6, 0xf3, 0x1f, 0x54, 0x5a, 0x26, 0x3b, 0x4d, 0xdf, 0x8d, 0xd7, 0x1b, 0x45, 0x6d, 0x9e,
+  0x0b, 0xbd, 0x0b, 0xad, 0x22, 0x18, 0x91, 0x3e, 0xb3, 0x47, 0xf6, 0x1a, 0xbe, 0xf4, 0xa0, 0x69,
+  0x53, 0xac, 0xf5, 0x0f, 0x09, 0x6e, 0x9c, 0xfb, 0xae, 0x65, 0x21, 0xe9, 0xaf, 0x9e, 0xbb, 0xbd,
+  0x67, 0xec, 0xea, 0xe7, 0x56, 0x30, 0xe7, 0x85, 0x31, 0x73, 0x33, 0x32, 0xf7, 0x58, 0x2c, 0xa9,
+  0x98, 0xb8, 0x92, 0xc6, 0x46, 0x99, 0xde, 0x01, 0x77, 0xb2, 0x97, 0xc5, 0x94, 0xf5, 0x42, 0x08,
+  0x8e, 0x12, 0xec, 0x35, 0x8a, 0xc1, 0xd4, 0x0c, 0xf0, 0xda, 0xd4, 0xd3, 0x1f, 0x55, 0xe6, 0x44,
+  0x7b, 0xfd, 0x03, 0xdb, 0x65, 0xc9, 0x72, 0xb3, 0xf0, 0xfd, 0x83, 0x90, 0x00, 0x19, 0x84, 0x1c,
+  0x5a, 0x03, 0xb2, 0xf4, 0xab, 0x46, 0xd1, 0x3a, 0x08, 0xe7, 0xcf, 0x45, 0xe3, 0xe5, 0xc6, 0x78,
+  0x94, 0xb1, 0xa9, 0x8c, 0x17, 0x04, 0xd0, 0x97, 0x3e, 0x5e, 0x30, 0x62, 0x60, 0x0e, 0x04, 0xab,
+  0x81, 0xf3, 0x11, 0x03, 0xdc, 0x60, 0x8e, 0x4e, 0x77, 0x78, 0x4b, 0x6a, 0x70, 0xac, 0x5b, 0xd1,
+  0x73, 0x5f, 0x85, 0x8f, 0xce, 0x93, 0x2c, 0x11, 0x14, 0x02, 0x8e, 0xe1, 0x40, 0xd5, 0xf9, 0x8a,
+  0x5b, 0x5e, 0xb6, 0x49, 0x5b, 0xc8, 0xa0, 0xa0, 0xdc, 0x34, 0xdb, 0xef, 0x73, 0xf4, 0xba, 0x7a,
+  0xd0, 0x25, 0x48, 0xd4, 0xf5, 0x0d, 0x4c, 0xc5, 0x86, 0x68, 0xe8, 0x61, 0x26, 0x59, 0x4e, 0xdc,
+};
+
+static const char BENCH_P256_PUBKEY_PEM[] =
+  "-----BEGIN PUBLIC KEY-----\n"
+  "MFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEMFFq5rym96MqiOg70S8aDOn5dhnV\n"
+  "Q1Ng2Q4HLRC5GMVHMfVKXcUFSovXz+8oyNchwla/2NazxYhDvlqr0h00JQ==\n"
+  "-----END PUBLIC KEY-----\n"
+  ;
+
+static const uint8_t BENCH_P256_SIG[71] = {
+  0x30, 0x45, 0x02, 0x20, 0x37, 0x25, 0x1f, 0xf4, 0x87, 0x5a, 0xf2, 0xd8, 0xee, 0x20, 0xbd, 0x39,
+  0x21, 0xb8, 0xee, 0xe7, 0xac, 0x02, 0x32, 0x70, 0x01, 0x2b, 0x4f, 0xdd, 0xe9, 0x07, 0x86, 0xde,
+  0xc7, 0x04, 0xbe, 0x41, 0x02, 0x21, 0x00, 0x9c, 0x8c, 0x09, 0x11, 0x18, 0x89, 0x89, 0xa2, 0xe3,
+  0xc6, 0x4c, 0x96, 0xef, 0xfb, 0xd5, 0xa9, 0xb3, 0xf3, 0x2e, 0x7a, 0x97, 0xb1, 0xc4, 0x17, 0x0b,
+  0xf9, 0xbc, 0x3d, 0xa5, 0x4c, 0xc3, 0x1d,
+};
@@ -4,6 +4,16 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+// Crypto primitives of the secure layer. Exactly one backend implements
+// them, picked at link time: secure_crypto_mbedtls.cpp on the ESP32, or
+// firmware/host/backends/secure_crypto_openssl.cpp for Linux tools (see
+// SC_BACKEND in firmware/host/CMakeLists.txt). secure_crypto.cpp holds
+// what every backend shares. The GCM context cache and the KMS key are
+// global state: callers serialize access (secure_mqtt.cpp holds its lock).
+
+// Name of the linked backend ("mbedtls", "openssl")
+const char* sc_backend_name();
+
 // Generates `len` random bytes into `buf`
 void sc_random_bytes(uint8_t* buf, size_t len);
 
@@ -33,5 +43,57 @@ bool sc_aes_gcm_decrypt(const uint8_t* key, size_t key_len,
                         const uint8_t* tag, size_t tag_len,
                         uint8_t* output);
 
+// AES-256-GCM through a small cache of long-lived contexts: the key
+// schedule and GHASH tables are only rebuilt when `key` is not cached.
+// Meant for keys reused across many messages (session traffic keys).
+bool sc_aes_gcm_encrypt_cached(const uint8_t* key, size_t key_len,
+                               const uint8_t* iv, size_t iv_len,
+                               const uint8_t* aad, size_t aad_len,
+                               const uint8_t* input, size_t in_len,
+                               uint8_t* output,
+                               uint8_t* tag, size_t tag_len);
+
+bool sc_aes_gcm_decrypt_cached(const uint8_t* key, size_t key_len,
+                               const uint8_t* iv, size_t iv_len,
+                               const uint8_t* aad, size_t aad_len,
+                               const uint8_t* input, size_t in_len,
+                               const uint8_t* tag, size_t tag_len,
+                               uint8_t* output);
+
+// Drops (and wipes) every cached GCM context, e.g. after a rekey
+void sc_aes_gcm_cache_flush();
+
+// KMS signature suites, provisioned as "kms_sig_suite"
+enum ScSigSuite : uint8_t {
+  SC_SIG_RSA2048 = 0,  // RSA-2048 PKCS#1 v1.5 / SHA-256
+  SC_SIG_P256    = 1,  // ECDSA P-256 / SHA-256, DER-encoded signature
+};
+
+// Largest signature of any suite (RSA-2048)
+#define SC_MAX_SIG_LEN 256
+
+// Parses a suite name ("rsa2048", "p256"). Returns false if unknown.
+bool sc_sig_suite_from_name(const char* name, ScSigSuite* out);
+
+// Suite the KMS key must match; keys of any other type are rejected
+void sc_set_kms_sig_suite(ScSigSuite suite);
+ScSigSuite sc_get_kms_sig_suite();
+
+// Parses the KMS public key (PEM) once. The parsed context is kept and
+// reused by sc_verify_kms_signature() until the key is set again.
+// Returns false if the key cannot be parsed.
+bool sc_set_kms_pubkey_pem(const char* pem);
+
+// DER (SubjectPublicKeyInfo) of the largest KMS key, RSA-2048: 294 bytes
+#define SC_KMS_PUBKEY_DER_MAX 300
+
+// Same from the DER form the device config stores: no base64 decoding
+// and no copy of the PEM text at boot.
+bool sc_set_kms_pubkey_der(const uint8_t* der, size_t der_len);
+
+// DER form of a PEM public key, at provisioning time. Returns its length,
+// 0 if the key cannot be parsed or does not fit `out_size`.
+size_t sc_pubkey_pem_to_der(const char* pem, uint8_t* out, size_t out_size);
+
 bool sc_verify_kms_signature(const uint8_t* message, size_t message_len,
                              const uint8_t* sig, size_t sig_len);
@@ -0,0 +1,297 @@
+// mbedTLS backend of secure_crypto.h, used on the ESP32 (and by the host
+// build with SC_BACKEND=mbedtls)
+
+#include "secure_crypto.h"
+
+#include <string.h>
+#include <algorithm>
+
+extern "C" {
+#include "esp_random.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/hkdf.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pk.h"
+#include "esp_system.h"
+}
+
+const char* sc_backend_name() {
+  return "mbedtls";
+}
+
+void sc_random_bytes(uint8_t* buf, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    uint32_t r = esp_random();
+    size_t chunk = std::min(len - i, (size_t)4);
+    memcpy(buf + i, &r, chunk);
+    i += chunk;
+  }
+}
+
+bool sc_hkdf_sha256(const uint8_t* ikm, size_t ikm_len,
+                    const uint8_t* salt, size_t salt_len,
+                    const uint8_t* info, size_t info_len,
+                    uint8_t* okm, size_t okm_len) {
+  const mbedtls_md_info_t* md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+  if (!md) return false;
+  int ret = mbedtls_hkdf(md, salt, salt_len, ikm, ikm_len, info, info_len, okm, okm_len);
+  return ret == 0;
+}
+
+bool sc_hmac_sha256(const uint8_t* key, size_t key_len,
+                    const uint8_t* data, size_t data_len,
+                    uint8_t* out, size_t out_len) {
+  if (out_len == 0 || out_len > 32) return false;
+  const mbedtls_md_info_t* md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+  if (!md) return false;
+  unsigned char full[32];
+  int ret = mbedtls_md_hmac(md, key, key_len, data, data_len, full);
+  if (ret != 0) return false;
+  memcpy(out, full, out_len);
+  return true;
+}
+
+bool sc_aes_gcm_encrypt(const uint8_t* key, size_t key_len,
+                        const uint8_t* iv, size_t iv_len,
+                        const uint8_t* aad, size_t aad_len,
+                        const uint8_t* input, size_t in_len,
+                        uint8_t* output,
+                        uint8_t* tag, size_t tag_len) {
+  if (key_len != 32 || tag_len != 16) return false;
+
+  mbedtls_gcm_context ctx;
+  mbedtls_gcm_init(&ctx);
+
+  int ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
+  if (ret != 0) {
+    mbedtls_gcm_free(&ctx);
+    return false;
+  }
+
+  ret = mbedtls_gcm_crypt_and_tag(&ctx,
+                                  MBEDTLS_GCM_ENCRYPT,
+                                  in_len,
+                                  iv, iv_len,
+                                  aad, aad_len,
+                                  input, output,
+                                  tag_len, tag);
+  mbedtls_gcm_free(&ctx);
+  return ret == 0;
+}
+
+bool sc_aes_gcm_decrypt(const uint8_t* key, size_t key_len,
+                        const uint8_t* iv, size_t iv_len,
+                        const uint8_t* aad, size_t aad_len,
+                        const uint8_t* input, size_t in_len,
+                        const uint8_t* tag, size_t tag_len,
+                        uint8_t* output) {
+  if (key_len != 32 || tag_len != 16) return false;
+
+  mbedtls_gcm_context ctx;
+  mbedtls_gcm_init(&ctx);
+
+  int ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
+  if (ret != 0) {
+    mbedtls_gcm_free(&ctx);
+    return false;
+  }
+
+  ret = mbedtls_gcm_auth_decrypt(&ctx,
+                                 in_len,
+                                 iv, iv_len,
+                                 aad, aad_len,
+                                 tag, tag_len,
+                                 input, output);
+  mbedtls_gcm_free(&ctx);
+  return ret == 0;
+}
+
+// ========= Cached GCM contexts =========
+
+#ifndef SC_GCM_CACHE_SLOTS
+#define SC_GCM_CACHE_SLOTS 4
+#endif
+
+struct GcmCacheSlot {
+  bool used;
+  uint32_t lastUse;
+  uint8_t key[32];
+  mbedtls_gcm_context ctx;
+};
+
+static GcmCacheSlot g_gcmCache[SC_GCM_CACHE_SLOTS];
+static uint32_t g_gcmCacheTick = 0;
+
+// Returns a context keyed with `key`, reusing a cached one when possible
+static mbedtls_gcm_context* gcmCacheGet(const uint8_t* key) {
+  GcmCacheSlot* victim = &g_gcmCache[0];
+  for (size_t i = 0; i < SC_GCM_CACHE_SLOTS; ++i) {
+    GcmCacheSlot& s = g_gcmCache[i];
+    if (s.used && memcmp(s.key, key, 32) == 0) {
+      s.lastUse = ++g_gcmCacheTick;
+      return &s.ctx;
+    }
+    if (!s.used) {
+      victim = &s;
+    } else if (victim->used && s.lastUse < victim->lastUse) {
+      victim = &s;
+    }
+  }
+
+  if (victim->used) {
+    mbedtls_gcm_free(&victim->ctx);
+    victim->used = false;
+  }
+  mbedtls_gcm_init(&victim->ctx);
+  if (mbedtls_gcm_setkey(&victim->ctx, MBEDTLS_CIPHER_ID_AES, key, 256) != 0) {
+    mbedtls_gcm_free(&victim->ctx);
+    return nullptr;
+  }
+  memcpy(victim->key, key, 32);
+  victim->used = true;
+  victim->lastUse = ++g_gcmCacheTick;
+  return &victim->ctx;
+}
+
+void sc_aes_gcm_cache_flush() {
+  for (size_t i = 0; i < SC_GCM_CACHE_SLOTS; ++i) {
+    GcmCacheSlot& s = g_gcmCache[i];
+    if (s.used) {
+      mbedtls_gcm_free(&s.ctx);
+    }
+    memset(s.key, 0, sizeof(s.key));
+    s.used = false;
+  }
+}
+
+bool sc_aes_gcm_encrypt_cached(const uint8_t* key, size_t key_len,
+                               const uint8_t* iv, size_t iv_len,
+                               const uint8_t* aad, size_t aad_len,
+                               const uint8_t* input, size_t in_len,
+                               uint8_t* output,
+                               uint8_t* tag, size_t tag_len) {
+  if (key_len != 32 || tag_len != 16) return false;
+
+  mbedtls_gcm_context* ctx = gcmCacheGet(key);
+  if (!ctx) return false;
+
+  int ret = mbedtls_gcm_crypt_and_tag(ctx,
+                                      MBEDTLS_GCM_ENCRYPT,
+                                      in_len,
+                                      iv, iv_len,
+                                      aad, aad_len,
+                                      input, output,
+                                      tag_len, tag);
+  return ret == 0;
+}
+
+bool sc_aes_gcm_decrypt_cached(const uint8_t* key, size_t key_len,
+                               const uint8_t* iv, size_t iv_len,
+                               const uint8_t* aad, size_t aad_len,
+                               const uint8_t* input, size_t in_len,
+                               const uint8_t* tag, size_t tag_len,
+                               uint8_t* output) {
+  if (key_len != 32 || tag_len != 16) return false;
+
+  mbedtls_gcm_context* ctx = gcmCacheGet(key);
+  if (!ctx) return false;
+
+  int ret = mbedtls_gcm_auth_decrypt(ctx,
+                                     in_len,
+                                     iv, iv_len,
+                                     aad, aad_len,
+                                     tag, tag_len,
+                                     input, output);
+  return ret == 0;
+}
+
+// ========= KMS signature =========
+
+// The KMS key must be of the provisioned suite, so that a key of another
+// type cannot be substituted
+static bool pkMatchesSuite(const mbedtls_pk_context* pk) {
+  if (sc_get_kms_sig_suite() == SC_SIG_P256) {
+    return mbedtls_pk_can_do(pk, MBEDTLS_PK_ECDSA) &&
+           mbedtls_pk_get_bitlen(pk) == 256;
+  }
+  return mbedtls_pk_get_type(pk) == MBEDTLS_PK_RSA &&
+         mbedtls_pk_get_bitlen(pk) == 2048;
+}
+
+// KMS public key, parsed once and reused for every verification
+static mbedtls_pk_context g_kmsPk;
+static bool g_kmsPkReady = false;
+
+// PEM (terminator included in key_len) or DER, the parser tells them apart
+static bool setKmsPubkey(const unsigned char* key, size_t key_len) {
+  if (g_kmsPkReady) {
+    mbedtls_pk_free(&g_kmsPk);
+    g_kmsPkReady = false;
+  }
+  if (!key || key_len == 0) {
+    return false;
+  }
+
+  mbedtls_pk_init(&g_kmsPk);
+  int ret = mbedtls_pk_parse_public_key(&g_kmsPk, key, key_len);
+  if (ret != 0) {
+    mbedtls_pk_free(&g_kmsPk);
+    return false;
+  }
+  g_kmsPkReady = true;
+  return true;
+}
+
+bool sc_set_kms_pubkey_pem(const char* pem) {
+  size_t len = (pem && pem[0] != '\0') ? strlen(pem) + 1 : 0;
+  return setKmsPubkey((const unsigned char*)pem, len);
+}
+
+bool sc_set_kms_pubkey_der(const uint8_t* der, size_t der_len) {
+  return setKmsPubkey(der, der_len);
+}
+
+size_t sc_pubkey_pem_to_der(const char* pem, uint8_t* out, size_t out_size) {
+  if (!pem || pem[0] == '\0') {
+    return 0;
+  }
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  size_t len = 0;
+  if (mbedtls_pk_parse_public_key(&pk, (const unsigned char*)pem, strlen(pem) + 1) == 0) {
+    // Written backwards, at the end of the buffer
+    int ret = mbedtls_pk_write_pubkey_der(&pk, out, out_size);
+    if (ret > 0) {
+      len = (size_t)ret;
+      memmove(out, out + out_size - len, len);
+    }
+  }
+  mbedtls_pk_free(&pk);
+  return len;
+}
+
+bool sc_verify_kms_signature(const uint8_t* message, size_t message_len,
+                             const uint8_t* sig, size_t sig_len) {
+  if (!g_kmsPkReady || !pkMatchesSuite(&g_kmsPk)) {
+    return false;
+  }
+
+  // Compute SHA-256(message)
+  unsigned char hash[32];
+  const mbedtls_md_info_t* md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+  if (!md_info) {
+    return false;
+  }
+  int ret = mbedtls_md(md_info, message, message_len, hash);
+  if (ret != 0) {
+    return false;
+  }
+
+  // Verify the signature
+  ret = mbedtls_pk_verify(&g_kmsPk,
+                          MBEDTLS_MD_SHA256,
+                          hash, sizeof(hash),
+                          sig, sig_len);
+  return ret == 0;
+}
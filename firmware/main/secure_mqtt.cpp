@@ -1,67 +1,292 @@
 #include "secure_mqtt.h"
 #include <Preferences.h>
 #include "secure_crypto.h"
+#include "counter_lease.h"
+#include "replay_window.h"
+#include "topic_table.h"
+#include "session_ticket.h"
+#include "group_keys.h"
+#include "topic_router.h"
+#include "sec_metrics.h"
+#include "sec_log.h"
+#include "sec_scratch.h"
 #include <Arduino.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef ARDUINO_ARCH_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#endif
+
+// ========= Persistent storage for counters =========
+// NVS only stores the end of the current counter lease (see counter_lease.h),
+// one lease per secure topic under "ctr_<topic hash>"
+#ifndef SECURE_COUNTER_LEASE_BLOCK
+#define SECURE_COUNTER_LEASE_BLOCK 64
+#endif
 
-// ========= Persistent storage for counter =========
 static Preferences secPrefs;
-static uint32_t g_counter = 0;
-static uint32_t g_counterLastSaved = 0;
-static const char* COUNTER_KEY = "ctr"; 
+static const char* LEGACY_COUNTER_KEY = "ctr";  // single-topic firmware
+
+// ========= Secure topics =========
+
+// Data-plane state of each secure topic, same index as the topic table
+struct TopicState {
+  SecureFrameFormat format;
+  CounterLease lease;
+  uint32_t counter;
+  char counterKey[16];
+  ReplayTable replay;      // anti-replay windows of the remote senders
+  bool decryptFailed;      // tag check failed since the last consume
+  bool txKeyValid;         // cached session traffic key of our own frames
+  uint32_t txEpoch;
+  uint8_t txKey[32];
+  GroupPath group;         // our path in the topic's key tree (group_keys.h)
+  // No counter lease was stored: the counter restarted and may repeat
+  // counters sent before, under the epochs the KMS handed out then. We
+  // only publish again under an epoch newer than the first one received.
+  bool freshEpochNeeded;
+  bool haveStaleEpoch;
+  uint32_t staleEpoch;
+};
+
+// Longest client_id carried in session frames (DEVICE_CONFIG_CLIENT_ID_MAX)
+static const size_t SENDER_ID_MAX = 32;
+
+// One traffic key per (topic, epoch, sender):
+//   traffic_key = HKDF(TOPIC_key, salt = epoch||sender,
+//                      info = "SESSION_KEY"||topic||0x00||client_id)
+// The client_id in the info keeps two senders whose indexes collide on
+// different keys. Our own TX key lives in the topic state, the keys of
+// remote senders are cached in the context and reused LRU.
+struct SessionKey {
+  bool valid;
+  uint8_t topic;
+  uint32_t epoch;
+  uint32_t sender;
+  uint8_t idLen;
+  char id[SENDER_ID_MAX];
+  uint32_t lastUse;
+  uint8_t key[32];
+};
+
+// Everything that belongs to one device. The firmware only uses the
+// default context; Linux tools select others (secureMqttSelectContext)
+struct SecureMqttContext {
+  TopicTable topics;
+  TopicState topicState[SECURE_TOPIC_CAPACITY];
+
+  uint8_t lastChallenge[32];
+  bool haveChallenge;
+  // nonce_c of a single round-trip auth, until the KMS answers
+  uint8_t clientNonce[32];
+  bool haveClientNonce;
+
+  // Handshake resumption (session_ticket.h). The secret of the next ticket
+  // is derived during the handshake and kept until the ticket arrives.
+  SessionTicket ticket;
+  uint8_t nextTicketSecret[32];
+  bool haveNextTicketSecret;
+
+  uint8_t masterKey[32];   // CLIENT_MASTER_KEY while another context is selected
+  char clientId[64];
+
+  // KMS topics we publish on, built once by secureMqttAddKmsRoutes()
+  char kmsAuthTopic[TOPIC_ROUTER_NAME_MAX];
+  char kmsVerifyTopic[TOPIC_ROUTER_NAME_MAX];
+
+  SessionKey sessionKeys[8];
+  uint32_t sessionTick;
+};
+static SecureMqttContext g_defaultContext;
+static SecureMqttContext* g_sec = &g_defaultContext;
+
+static bool persistCounterLease(uint32_t leaseEnd, void* ctx) {
+  TopicState* state = (TopicState*)ctx;
+  bool ok = secPrefs.putULong(state->counterKey, leaseEnd) == sizeof(uint32_t);
+  SLOG_D("[SEC] Counter lease saved, %s = %lu", state->counterKey, (unsigned long)leaseEnd);
+  return ok;
+}
 
 // ========= PROTOCOL CONFIG =========
 
-static char g_topicName[64] = {0};
-
-// Two topic keys for key rotation
-static uint8_t g_topicKeyCurrent[32];
-static uint8_t g_topicKeyPrev[32];
-static bool g_topicKeyReady = false;
-
-// Epochs
-static uint32_t g_epochCurrent = 0;
-static uint32_t g_epochPrev = 0;
+static const char* TICKET_PREFS_KEY = "tkt";
 
-static uint8_t g_lastChallenge[32];
-static bool g_haveChallenge = false;
+// Single round-trip handshake: the auth message already carries a proof
+// of every TOPIC_auth_key, and the KMS answers with its signature and the
+// keys together. A KMS that does not support it (or refuses the proofs)
+// answers with a plain clientauth and the full handshake goes on.
+// 0: always use the clientauth/clientverify exchange.
+#ifndef SECURE_FAST_HANDSHAKE
+#define SECURE_FAST_HANDSHAKE 1
+#endif
 
 // TO BE REPLACED: given by the KMS after launch 
 uint8_t CLIENT_MASTER_KEY[32] = {0};
 
-// TO BE REPLACED: KMS public key in PEM format for signature verification
-char KMS_PUBKEY_PEM[1600] = {0};
+// ========= Scratch budgets =========
+// Worst-case use of the scratch arena (sec_scratch.h) by each path, with
+// the scopes of the functions it calls. A path that does not fit in
+// SEC_SCRATCH_SIZE fails to build.
+#define SECURE_KMS_MESSAGE_MAX 2048   // largest KMS message, copied once
+static constexpr size_t MAX_PLAINTEXT = 256;
+static constexpr size_t HEX32_LEN = 32*2+1;
+static constexpr size_t AUTH_PAYLOAD_MAX =
+    secScratchMax(512, 192 + SECURE_TOPIC_CAPACITY * (8 + 32*2));
+static constexpr size_t CLIENTVERIFY_MAX = 64 + SECURE_TOPIC_NAME_MAX + 2 * 32*2;
+
+static constexpr size_t SCRATCH_INIT = secScratchBytes(SESSION_TICKET_STORED_MAX);
+static constexpr size_t SCRATCH_AUTH =
+    secScratchBytes(HEX32_LEN) + secScratchBytes(AUTH_PAYLOAD_MAX) +
+    secScratchMax(secScratchBytes(SESSION_TICKET_MAX*2+1) + secScratchBytes(HEX32_LEN),
+                  secScratchBytes(HEX32_LEN));
+static constexpr size_t SCRATCH_KMS_MESSAGE =
+    secScratchBytes(SECURE_KMS_MESSAGE_MAX) +
+    secScratchMax(secScratchBytes(CLIENTVERIFY_MAX) + secScratchBytes(HEX32_LEN),
+                  secScratchMax(secScratchBytes(SECURE_TOPIC_NAME_MAX),
+                                secScratchBytes(SESSION_TICKET_STORED_MAX)));
+static constexpr size_t SCRATCH_ENCRYPT =
+    secScratchBytes(MAX_PLAINTEXT) + secScratchBytes(MAX_PLAINTEXT*2+1);
+static constexpr size_t SCRATCH_PUBLISH = secScratchBytes(SECURE_MQTT_MAX_FRAME) + SCRATCH_ENCRYPT;
+
+static_assert(SCRATCH_INIT <= SEC_SCRATCH_SIZE, "SEC_SCRATCH_SIZE too small for the stored ticket");
+static_assert(SCRATCH_AUTH <= SEC_SCRATCH_SIZE, "SEC_SCRATCH_SIZE too small for the auth message");
+static_assert(SCRATCH_KMS_MESSAGE <= SEC_SCRATCH_SIZE, "SEC_SCRATCH_SIZE too small for KMS messages");
+static_assert(SCRATCH_PUBLISH <= SEC_SCRATCH_SIZE, "SEC_SCRATCH_SIZE too small for a JSON frame");
+
+// The handshake runs on the network task while the crypto task seals and
+// opens frames, so the key, epoch, counter and replay state are guarded
+// by one recursive mutex. No-op outside the ESP32 build.
+#ifdef ARDUINO_ARCH_ESP32
+static SemaphoreHandle_t g_stateMutex = nullptr;
+
+struct SecureStateLock {
+  SecureStateLock() { if (g_stateMutex) xSemaphoreTakeRecursive(g_stateMutex, portMAX_DELAY); }
+  ~SecureStateLock() { if (g_stateMutex) xSemaphoreGiveRecursive(g_stateMutex); }
+};
+#else
+struct SecureStateLock { SecureStateLock() {} };
+#endif
+
+static void flushTopicSessionKeys(uint8_t topic);
 
-static char g_clientId[64] = {0};
+void secureMqttSetClientId(const char* client_id) {
+  strncpy(g_sec->clientId, client_id, sizeof(g_sec->clientId)-1);
+  g_sec->clientId[sizeof(g_sec->clientId)-1] = '\0';
+}
 
-static uint32_t g_lastRemoteCounter = 0;
+SecureMqttContext* secureMqttContextCreate() {
+  return new SecureMqttContext();
+}
 
-void secureMqttSetClientId(const char* client_id) {
-  strncpy(g_clientId, client_id, sizeof(g_clientId)-1);
-  g_clientId[sizeof(g_clientId)-1] = '\0';
+void secureMqttContextDestroy(SecureMqttContext* ctx) {
+  if (!ctx || ctx == &g_defaultContext) return;
+  if (ctx == g_sec) secureMqttSelectContext(nullptr);
+  memset(ctx, 0, sizeof(*ctx));
+  delete ctx;
+}
+
+SecureMqttContext* secureMqttSelectContext(SecureMqttContext* ctx) {
+  SecureStateLock lock;
+  SecureMqttContext* previous = g_sec;
+  if (!ctx) ctx = &g_defaultContext;
+  if (ctx != previous) {
+    memcpy(previous->masterKey, CLIENT_MASTER_KEY, sizeof(CLIENT_MASTER_KEY));
+    memcpy(CLIENT_MASTER_KEY, ctx->masterKey, sizeof(CLIENT_MASTER_KEY));
+    g_sec = ctx;
+  }
+  return previous;
 }
 
-void secureMqttInit(const char* topic_name, const char* client_id) {
-  secureMqttSetTopic(topic_name);
+static void loadSessionTicket() {
+  sessionTicketClear(&g_sec->ticket);
+  if (!secPrefs.isKey(TICKET_PREFS_KEY)) return;
+  SecScratch scratch;
+  uint8_t* stored = scratch.take<uint8_t>(SESSION_TICKET_STORED_MAX);
+  if (!stored) return;
+  size_t len = secPrefs.getBytes(TICKET_PREFS_KEY, stored, SESSION_TICKET_STORED_MAX);
+  if (!sessionTicketDeserialize(&g_sec->ticket, stored, len)) {
+    SLOG_W("[SEC] Stored session ticket malformed, ignoring");
+  }
+}
 
+void secureMqttInit(const char* client_id) {
+#ifdef ARDUINO_ARCH_ESP32
+  if (!g_stateMutex) g_stateMutex = xSemaphoreCreateRecursiveMutex();
+#endif
+  secureMqttSetClientId(client_id);
+  topicTableInit(&g_sec->topics);
   secPrefs.begin("sec", false);
-  g_counter = secPrefs.getULong(COUNTER_KEY, 0);
-  g_counterLastSaved = g_counter;
+  loadSessionTicket();
+}
+
+bool secureMqttAddTopic(const char* appTopic, SecureFrameFormat format) {
+  SecureStateLock lock;
 
-  Serial.print("[SEC] Loaded persistent counter = ");
-  Serial.println(g_counter);
+  uint8_t before = g_sec->topics.count;
+  int idx = topicTableAdd(&g_sec->topics, appTopic);
+  if (idx < 0) {
+    SLOG_E("[SEC] Cannot add secure topic %s", appTopic);
+    return false;
+  }
+
+  TopicState& state = g_sec->topicState[idx];
+  state.format = format;
+  if (g_sec->topics.count == before) {
+    return true; // already registered, format updated
+  }
+
+  replayTableInit(&state.replay);
+  state.decryptFailed = false;
+  state.txKeyValid = false;
+
+  snprintf(state.counterKey, sizeof(state.counterKey), "ctr_%08lx",
+           (unsigned long)g_sec->topics.entries[idx].hash);
+  // Older firmware kept one counter for its only topic. It is a valid
+  // lease end for every topic, counters only have to be unique per topic.
+  bool leaseStored = secPrefs.isKey(state.counterKey) || secPrefs.isKey(LEGACY_COUNTER_KEY);
+  uint32_t leaseEnd = secPrefs.getULong(state.counterKey,
+                                        secPrefs.getULong(LEGACY_COUNTER_KEY, 0));
+  counterLeaseInit(&state.lease, leaseEnd, SECURE_COUNTER_LEASE_BLOCK,
+                   persistCounterLease, &state);
+  state.counter = leaseEnd;
+  // A new device, or one whose NVS was erased: see TopicState
+  state.freshEpochNeeded = !leaseStored;
+  state.haveStaleEpoch = false;
+
+  SLOG_I("[SEC] Secure topic %s, counter lease end = %lu%s", appTopic, (unsigned long)leaseEnd,
+         leaseStored ? "" : " (no lease stored, waiting for a fresh epoch)");
+  return true;
 }
 
 // Allow filling the KMS public key from the config
-void secureMqttSetKmsPubkey(const char* pem) {
-  if (!pem) return;
-  size_t len = strlen(pem);
-  if (len >= sizeof(KMS_PUBKEY_PEM)) {
-    len = sizeof(KMS_PUBKEY_PEM) - 1;
+bool secureMqttSetKmsPubkey(const char* pem) {
+  return sc_set_kms_pubkey_pem(pem);
+}
+
+bool secureMqttSetKmsPubkeyDer(const uint8_t* der, size_t len) {
+  return sc_set_kms_pubkey_der(der, len);
+}
+
+bool secureMqttSetKmsSigSuite(const char* name) {
+  ScSigSuite suite;
+  if (!sc_sig_suite_from_name(name, &suite)) {
+    return false;
   }
-  memcpy(KMS_PUBKEY_PEM, pem, len);
-  KMS_PUBKEY_PEM[len] = '\0';
+  sc_set_kms_sig_suite(suite);
+  return true;
+}
+
+static void putU32BE(uint8_t* out, uint32_t v) {
+  out[0] = (v >> 24) & 0xFF;
+  out[1] = (v >> 16) & 0xFF;
+  out[2] = (v >> 8)  & 0xFF;
+  out[3] = (v)       & 0xFF;
+}
+
+static uint32_t getU32BE(const uint8_t* in) {
+  return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+         ((uint32_t)in[2] << 8)  |  (uint32_t)in[3];
 }
 
 // Hex helpers
@@ -75,31 +300,89 @@ static void bytesToHex(const uint8_t* in, size_t len, char* out, size_t outSize)
   out[2*len] = '\0';
 }
 
-// decrypt-failure flag (set when AES-GCM verification fails)
-volatile bool g_secureDecryptTagFailure = false;
+bool secureMqttConsumeDecryptFailure(char* topicOut, size_t topicOutSize) {
+  SecureStateLock lock;
 
-bool secureMqttConsumeDecryptFailure() {
-  bool v = g_secureDecryptTagFailure;
-  g_secureDecryptTagFailure = false;
-  return v;
+  for (uint8_t i = 0; i < g_sec->topics.count; ++i) {
+    if (g_sec->topicState[i].decryptFailed) {
+      g_sec->topicState[i].decryptFailed = false;
+      snprintf(topicOut, topicOutSize, "%s", g_sec->topics.entries[i].name);
+      return true;
+    }
+  }
+  return false;
 }
 
-static size_t hexToBytes(const char* hex, uint8_t* out, size_t maxLen) {
-  size_t hexLen = strlen(hex);
-  size_t outLen = hexLen / 2;
-  if (outLen > maxLen) outLen = maxLen;
-  for (size_t i = 0; i < outLen; ++i) {
-    char c1 = hex[2*i];
-    char c2 = hex[2*i+1];
-    auto val = [](char c)->uint8_t {
-      if (c >= '0' && c <= '9') return c - '0';
-      if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-      if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-      return 0;
-    };
-    out[i] = (val(c1) << 4) | val(c2);
+// Value of "key" in a flat JSON object, located in place (no copy, no
+// terminator needed): the characters between the quotes of a string, or
+// the digits of a number.
+struct JsonSpan {
+  const char* p;
+  size_t len;
+};
+
+static bool jsonFindField(const char* json, size_t jsonLen, const char* key, JsonSpan* value) {
+  size_t keyLen = strlen(key);
+  const char* end = json + jsonLen;
+  for (const char* p = json; p + keyLen + 3 <= end; ++p) {
+    if (p[0] != '"' || memcmp(p + 1, key, keyLen) != 0 ||
+        p[1 + keyLen] != '"' || p[2 + keyLen] != ':') {
+      continue;
+    }
+    const char* v = p + keyLen + 3;
+    while (v < end && *v == ' ') ++v;
+    if (v < end && *v == '"') {
+      const char* close = (const char*)memchr(v + 1, '"', end - (v + 1));
+      if (!close) return false;
+      value->p = v + 1;
+      value->len = close - (v + 1);
+      return true;
+    }
+    const char* q = v;
+    while (q < end && *q >= '0' && *q <= '9') ++q;
+    if (q == v) return false;
+    value->p = v;
+    value->len = q - v;
+    return true;
+  }
+  return false;
+}
+
+static bool spanToU32(const JsonSpan& s, uint32_t* out) {
+  if (s.len == 0 || s.len > 10) return false;
+  uint64_t v = 0;
+  for (size_t i = 0; i < s.len; ++i) {
+    if (s.p[i] < '0' || s.p[i] > '9') return false;
+    v = v * 10 + (uint64_t)(s.p[i] - '0');
+  }
+  if (v > 0xFFFFFFFFu) return false;
+  *out = (uint32_t)v;
+  return true;
+}
+
+static int hexNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Decodes a hex span into `out` (at most `maxLen` bytes). `out` may point
+// at or before the span itself: byte i only overwrites hex digits that
+// have already been read. Returns the byte count, 0 if malformed.
+static size_t hexSpanToBytes(const JsonSpan& s, uint8_t* out, size_t maxLen) {
+  if (s.len % 2 != 0 || s.len / 2 > maxLen) return 0;
+  for (size_t i = 0; i < s.len / 2; ++i) {
+    int hi = hexNibble(s.p[2*i]);
+    int lo = hexNibble(s.p[2*i+1]);
+    if (hi < 0 || lo < 0) return 0;
+    out[i] = (uint8_t)((hi << 4) | lo);
   }
-  return outLen;
+  return s.len / 2;
+}
+
+static bool spanEquals(const JsonSpan& s, const char* str) {
+  return strlen(str) == s.len && memcmp(s.p, str, s.len) == 0;
 }
 
 // HKDF to derive TOPIC_auth_key and TOPIC_key_enc_key
@@ -116,505 +399,1334 @@ static void deriveTopicKeys(const char* topic,
   memcpy(topicEncKey, material + 32, 32);
 }
 
-// ========= API =========
+// Resumption secret of the next ticket: HKDF(ikm, salt, "RESUMPTION"),
+// with the CLIENT_MASTER_KEY and nonce_k after a full handshake, or the
+// presented ticket's secret and the challenge after a resumption
+static void deriveTicketSecret(const uint8_t* ikm, const uint8_t* salt, uint8_t* out) {
+  sc_hkdf_sha256(ikm, 32, salt, 32,
+                 (const uint8_t*)"RESUMPTION", strlen("RESUMPTION"),
+                 out, 32);
+  g_sec->haveNextTicketSecret = true;
+}
 
-void secureMqttSetTopic(const char* topic_name) {
-  strncpy(g_topicName, topic_name, sizeof(g_topicName)-1);
-  g_topicName[sizeof(g_topicName)-1] = '\0';
+// Signed by the KMS in a single round-trip clientauth: challenge || nonce_c
+static void fastAuthSignedData(uint8_t* out) {
+  memcpy(out, g_sec->lastChallenge, 32);
+  memcpy(out + 32, g_sec->clientNonce, 32);
 }
 
-void secureMqttBeginHandshake(PubSubClient& client,
-                              const char* baseTopic,
-                              const char* clientId) {
-  if (g_topicName[0] == '\0') {
-    Serial.println("[SEC] Topic name not set!");
-    return;
+// Single round-trip auth: a fresh nonce_c, then for every secure topic its
+// name hash and proof = HMAC(TOPIC_auth_key, "FAST_AUTH" || challenge || nonce_c)
+static bool buildFastAuth(const char* challHex, char* out, size_t outSize) {
+  SecScratch scratch;
+  char* nonceHex = scratch.take<char>(HEX32_LEN);
+  if (!nonceHex) return false;
+  sc_random_bytes(g_sec->clientNonce, sizeof(g_sec->clientNonce));
+  g_sec->haveClientNonce = true;
+  bytesToHex(g_sec->clientNonce, sizeof(g_sec->clientNonce), nonceHex, HEX32_LEN);
+  size_t n = (size_t)snprintf(out, outSize,
+                              "{\"challenge\":\"%s\",\"nonce_c\":\"%s\",\"topics\":\"",
+                              challHex, nonceHex);
+  for (uint8_t i = 0; i < g_sec->topics.count && n < outSize; ++i) {
+    n += (size_t)snprintf(out + n, outSize - n, "%08lx",
+                          (unsigned long)g_sec->topics.entries[i].hash);
   }
+  if (n < outSize) n += (size_t)snprintf(out + n, outSize - n, "\",\"proofs\":\"");
+
+  uint8_t proofInput[9 + 32 + 32];
+  memcpy(proofInput, "FAST_AUTH", 9);
+  memcpy(proofInput + 9, g_sec->lastChallenge, 32);
+  memcpy(proofInput + 9 + 32, g_sec->clientNonce, 32);
+  for (uint8_t i = 0; i < g_sec->topics.count && n + 32*2 < outSize; ++i) {
+    uint8_t topicAuthKey[32];
+    uint8_t topicEncKey[32];
+    deriveTopicKeys(g_sec->topics.entries[i].name, topicAuthKey, topicEncKey);
+    uint8_t proof[32];
+    sc_hmac_sha256(topicAuthKey, sizeof(topicAuthKey),
+                   proofInput, sizeof(proofInput), proof, sizeof(proof));
+    bytesToHex(proof, sizeof(proof), out + n, outSize - n);
+    n += 32*2;
+  }
+  if (n < outSize) n += (size_t)snprintf(out + n, outSize - n, "\"}");
+  return n < outSize;
+}
 
-  // Generate client challenge
-  sc_random_bytes(g_lastChallenge, sizeof(g_lastChallenge));
-  g_haveChallenge = true;
+// ========= API =========
 
-  char challHex[32*2+1];
-  bytesToHex(g_lastChallenge, sizeof(g_lastChallenge), challHex, sizeof(challHex));
+void secureMqttBeginHandshake(PubSubClient& client) {
+  SecureStateLock lock;
+  SecScratch scratch;
+  SEC_METRICS_SCOPE(SEC_STAGE_HS_AUTH);
 
-  char payload[256];
-  snprintf(payload, sizeof(payload),
-           "{\"challenge\":\"%s\"}", challHex);
+  if (g_sec->topics.count == 0) {
+    SLOG_E("[SEC] No secure topic registered!");
+    return;
+  }
+  if (g_sec->kmsAuthTopic[0] == '\0') {
+    SLOG_E("[SEC] KMS routes not registered!");
+    return;
+  }
 
-  char authTopic[128];
-  snprintf(authTopic, sizeof(authTopic),
-           "%s/%s/kms/auth", baseTopic, clientId);
+  char* challHex = scratch.take<char>(HEX32_LEN);
+  char* payload = scratch.take<char>(AUTH_PAYLOAD_MAX);
+  if (!challHex || !payload) return;
 
-  Serial.print("[SEC] Sending auth to ");
-  Serial.println(authTopic);
-  client.publish(authTopic, payload);
+  // Generate client challenge
+  sc_random_bytes(g_sec->lastChallenge, sizeof(g_sec->lastChallenge));
+  g_sec->haveChallenge = true;
+  bytesToHex(g_sec->lastChallenge, sizeof(g_sec->lastChallenge), challHex, HEX32_LEN);
+
+  g_sec->haveNextTicketSecret = false;
+  g_sec->haveClientNonce = false;
+  char* ticketHex = nullptr;
+  char* binderHex = nullptr;
+  if (sessionTicketUsable(&g_sec->ticket, secureMqttSenderIndex(g_sec->clientId), millis()) &&
+      (ticketHex = scratch.take<char>(SESSION_TICKET_MAX*2+1)) != nullptr &&
+      (binderHex = scratch.take<char>(HEX32_LEN)) != nullptr) {
+    // Resumption: binder = HMAC(secret, "RESUME" || challenge). The KMS
+    // answers with the keys, or with a clientauth if it refuses the ticket.
+    uint8_t binderInput[6 + 32];
+    memcpy(binderInput, "RESUME", 6);
+    memcpy(binderInput + 6, g_sec->lastChallenge, 32);
+    uint8_t binder[32];
+    sc_hmac_sha256(g_sec->ticket.secret, sizeof(g_sec->ticket.secret),
+                   binderInput, sizeof(binderInput), binder, sizeof(binder));
+
+    bytesToHex(g_sec->ticket.blob, g_sec->ticket.len, ticketHex, SESSION_TICKET_MAX*2+1);
+    bytesToHex(binder, sizeof(binder), binderHex, HEX32_LEN);
+    snprintf(payload, AUTH_PAYLOAD_MAX,
+             "{\"challenge\":\"%s\",\"ticket\":\"%s\",\"binder\":\"%s\"}",
+             challHex, ticketHex, binderHex);
+
+    deriveTicketSecret(g_sec->ticket.secret, g_sec->lastChallenge, g_sec->nextTicketSecret);
+    g_sec->ticket.used = true;
+    SLOG_I("[SEC] Resuming session on %s", g_sec->kmsAuthTopic);
+#if SECURE_FAST_HANDSHAKE
+  } else if (buildFastAuth(challHex, payload, AUTH_PAYLOAD_MAX)) {
+    SLOG_I("[SEC] Sending single round-trip auth to %s", g_sec->kmsAuthTopic);
+#endif
+  } else {
+    g_sec->haveClientNonce = false;
+    snprintf(payload, AUTH_PAYLOAD_MAX,
+             "{\"challenge\":\"%s\"}", challHex);
+    SLOG_I("[SEC] Sending auth to %s", g_sec->kmsAuthTopic);
+  }
+  client.publish(g_sec->kmsAuthTopic, payload);
 }
 
+// Called from the UI, network and crypto tasks: the topic state is read
+// under the state lock, as the network task updates it.
 bool secureMqttIsReady() {
-  return g_topicKeyReady;
-}
-
-// Very simple parser for a string field in a tiny JSON: "field":"value"
-static bool extractJsonStringField(const char* json, const char* key,
-                                   char* out, size_t outSize) {
-  char pattern[64];
-  snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
-  const char* p = strstr(json, pattern);
-  if (!p) return false;
-  p += strlen(pattern);
-  const char* end = strchr(p, '"');
-  if (!end) return false;
-  size_t len = (size_t)(end - p);
-  if (len >= outSize) len = outSize - 1;
-  memcpy(out, p, len);
-  out[len] = '\0';
+  SecureStateLock lock;
+  if (g_sec->topics.count == 0) return false;
+  for (uint8_t i = 0; i < g_sec->topics.count; ++i) {
+    if (g_sec->topics.entries[i].keyCount == 0) return false;
+  }
   return true;
 }
 
-// Same for an integer "field":123
-static bool extractJsonIntField(const char* json, const char* key, int* value) {
-  char pattern[64];
-  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
-  const char* p = strstr(json, pattern);
-  if (!p) return false;
-  p += strlen(pattern);
-  *value = atoi(p);
+bool secureMqttIsTopicReady(const char* appTopic) {
+  SecureStateLock lock;
+  int idx = topicTableFind(&g_sec->topics, appTopic);
+  return idx >= 0 && g_sec->topics.entries[idx].keyCount > 0 &&
+         !g_sec->topicState[idx].freshEpochNeeded;
+}
+
+bool secureMqttHasTopicKey(const char* appTopic) {
+  SecureStateLock lock;
+  int idx = topicTableFind(&g_sec->topics, appTopic);
+  return idx >= 0 && g_sec->topics.entries[idx].keyCount > 0;
+}
+
+bool secureMqttTopicEpoch(const char* appTopic, uint32_t* epoch) {
+  SecureStateLock lock;
+  int idx = topicTableFind(&g_sec->topics, appTopic);
+  const TopicKeySlot* current = idx >= 0 ? topicCurrentKey(&g_sec->topics.entries[idx]) : nullptr;
+  if (!current) return false;
+  *epoch = current->epoch;
   return true;
 }
 
-static void handleClientAuth(const char* json,
-                             const char* baseTopic,
-                             const char* clientId,
-                             PubSubClient& client) {
-  if (!g_haveChallenge) {
-    Serial.println("[SEC] No stored challenge, ignoring clientauth");
-    return;
+// proof = HMAC(TOPIC_auth_key, "ROTATE" || stale epoch || topic_name): only
+// the device itself can make the KMS start a new epoch for it
+bool secureMqttRotationRequest(char* topicOut, size_t topicOutSize,
+                               char* body, size_t bodySize) {
+  SecureStateLock lock;
+
+  for (uint8_t i = 0; i < g_sec->topics.count; ++i) {
+    const TopicState& state = g_sec->topicState[i];
+    if (!state.freshEpochNeeded || !state.haveStaleEpoch) continue;
+
+    const char* topicName = g_sec->topics.entries[i].name;
+    size_t topicLen = strlen(topicName);
+    uint8_t proofInput[6 + 4 + SECURE_TOPIC_NAME_MAX];
+    memcpy(proofInput, "ROTATE", 6);
+    putU32BE(proofInput + 6, state.staleEpoch);
+    memcpy(proofInput + 10, topicName, topicLen);
+
+    uint8_t topicAuthKey[32];
+    uint8_t topicEncKey[32];
+    deriveTopicKeys(topicName, topicAuthKey, topicEncKey);
+    uint8_t proof[32];
+    sc_hmac_sha256(topicAuthKey, sizeof(topicAuthKey),
+                   proofInput, 10 + topicLen, proof, sizeof(proof));
+    char proofHex[HEX32_LEN];
+    bytesToHex(proof, sizeof(proof), proofHex, sizeof(proofHex));
+
+    snprintf(topicOut, topicOutSize, "%s", topicName);
+    int n = snprintf(body, bodySize, "{\"topic\":\"%s\",\"rotate\":%lu,\"proof\":\"%s\"}",
+                     topicName, (unsigned long)state.staleEpoch, proofHex);
+    return n > 0 && (size_t)n < bodySize;
   }
+  return false;
+}
 
-  char challHex[32*2+1];
-  char nonceHex[32*2+1];
-  char sigHex[1024];
+// The KMS JSON handlers get the message copied into the scratch arena
+// (onKmsMessage) and decode its hex fields in place, over their digits.
+static void handleClientAuth(char* json, size_t jsonLen, PubSubClient& client) {
+  SEC_METRICS_SCOPE(SEC_STAGE_HS_CLIENTAUTH);
+  SecScratch scratch;
+  if (!g_sec->haveChallenge) {
+    SLOG_W("[SEC] No stored challenge, ignoring clientauth");
+    return;
+  }
 
-  if (!extractJsonStringField(json, "challenge", challHex, sizeof(challHex))) {
-    Serial.println("[SEC] challenge missing in clientauth");
+  JsonSpan challSpan, sigSpan, nonceSpan;
+  if (!jsonFindField(json, jsonLen, "challenge", &challSpan)) {
+    SLOG_W("[SEC] challenge missing in clientauth");
     return;
   }
-  if (!extractJsonStringField(json, "signature", sigHex, sizeof(sigHex))) {
-    Serial.println("[SEC] signature missing in clientauth");
+  if (!jsonFindField(json, jsonLen, "signature", &sigSpan)) {
+    SLOG_W("[SEC] signature missing in clientauth");
     return;
   }
-  if (!extractJsonStringField(json, "nonce_k", nonceHex, sizeof(nonceHex))) {
-    Serial.println("[SEC] nonce_k missing in clientauth");
+  // Without nonce_k, the answer to a single round-trip auth: the keys
+  // follow on .../kms/key. With it, the full handshake goes on.
+  bool fast = !jsonFindField(json, jsonLen, "nonce_k", &nonceSpan);
+  if (fast && !g_sec->haveClientNonce) {
+    SLOG_W("[SEC] nonce_k missing in clientauth");
     return;
   }
 
-  uint8_t challRecv[32];
-  hexToBytes(challHex, challRecv, sizeof(challRecv));
-  if (memcmp(challRecv, g_lastChallenge, sizeof(g_lastChallenge)) != 0) {
-    Serial.println("[SEC] Challenge mismatch, aborting");
+  uint8_t* challRecv = (uint8_t*)challSpan.p;
+  if (hexSpanToBytes(challSpan, challRecv, sizeof(g_sec->lastChallenge)) != sizeof(g_sec->lastChallenge) ||
+      memcmp(challRecv, g_sec->lastChallenge, sizeof(g_sec->lastChallenge)) != 0) {
+    SLOG_W("[SEC] Challenge mismatch, aborting");
     return;
   }
 
   // Verify the signature
-  uint8_t sig[256]; // for RSA-2048
-  size_t sigLen = hexToBytes(sigHex, sig, sizeof(sig));
-
-  // V
-  if (!sc_verify_kms_signature(g_lastChallenge, sizeof(g_lastChallenge),
-                               sig, sigLen)) {
-    Serial.println("[SEC] KMS signature invalid, aborting");
+  uint8_t* sig = (uint8_t*)sigSpan.p;
+  size_t sigLen = hexSpanToBytes(sigSpan, sig, SC_MAX_SIG_LEN);
+
+  uint8_t signedData[64];
+  size_t signedLen = sizeof(g_sec->lastChallenge);
+  if (fast) {
+    fastAuthSignedData(signedData);
+    signedLen = sizeof(signedData);
+  } else {
+    memcpy(signedData, g_sec->lastChallenge, signedLen);
+  }
+  uint32_t verifyStart = secMetricsNow();
+  bool sigOk = sigLen > 0 && sc_verify_kms_signature(signedData, signedLen, sig, sigLen);
+  secMetricsRecord(SEC_STAGE_SIG_VERIFY, secMetricsNow() - verifyStart);
+  if (!sigOk) {
+    SLOG_E("[SEC] KMS signature invalid, aborting");
     return;
   }
 
-  Serial.println("[SEC] KMS authenticated (signature OK).");
+  if (fast) {
+    g_sec->haveClientNonce = false;
+    deriveTicketSecret(CLIENT_MASTER_KEY, g_sec->clientNonce, g_sec->nextTicketSecret);
+    SLOG_I("[SEC] KMS authenticated (signature OK), keys follow.");
+    return;
+  }
+  SLOG_I("[SEC] KMS authenticated (signature OK).");
+  g_sec->haveClientNonce = false;
 
+  // nonce_k stays in hex in the message, it is sent back as is
   uint8_t nonceK[32];
-  hexToBytes(nonceHex, nonceK, sizeof(nonceK));
-
-  // HMAC(nonce_k) with TOPIC_auth_key
-  uint8_t topicAuthKey[32];
-  uint8_t topicEncKey[32];
-  deriveTopicKeys(g_topicName, topicAuthKey, topicEncKey);
-
-  uint8_t hmacVal[32];
-  sc_hmac_sha256(topicAuthKey, sizeof(topicAuthKey),
-                 nonceK, sizeof(nonceK),
-                 hmacVal, sizeof(hmacVal));
-
-  char hmacHex[32*2+1];
-  bytesToHex(hmacVal, sizeof(hmacVal), hmacHex, sizeof(hmacHex));
-
-  // send clientverify back
-  char payload[512];
-  snprintf(payload, sizeof(payload),
-           "{\"topic\":\"%s\",\"nonce_k\":\"%s\",\"hmac\":\"%s\"}",
-           g_topicName, nonceHex, hmacHex);
-
-  char verifyTopic[128];
-  snprintf(verifyTopic, sizeof(verifyTopic),
-           "%s/%s/kms/clientverify", baseTopic, clientId);
+  if (hexSpanToBytes(nonceSpan, nonceK, sizeof(nonceK)) != sizeof(nonceK)) {
+    SLOG_W("[SEC] Malformed nonce_k in clientauth");
+    return;
+  }
+  deriveTicketSecret(CLIENT_MASTER_KEY, nonceK, g_sec->nextTicketSecret);
+
+  char* hmacHex = scratch.take<char>(HEX32_LEN);
+  char* payload = scratch.take<char>(CLIENTVERIFY_MAX);
+  if (!hmacHex || !payload) return;
+
+  // One clientverify per secure topic: the KMS answers each with its key
+  for (uint8_t i = 0; i < g_sec->topics.count; ++i) {
+    const char* topicName = g_sec->topics.entries[i].name;
+
+    // HMAC(nonce_k) with TOPIC_auth_key
+    uint8_t topicAuthKey[32];
+    uint8_t topicEncKey[32];
+    deriveTopicKeys(topicName, topicAuthKey, topicEncKey);
+
+    uint8_t hmacVal[32];
+    sc_hmac_sha256(topicAuthKey, sizeof(topicAuthKey),
+                   nonceK, sizeof(nonceK),
+                   hmacVal, sizeof(hmacVal));
+    bytesToHex(hmacVal, sizeof(hmacVal), hmacHex, HEX32_LEN);
+
+    // send clientverify back; the last one asks for a session ticket
+    bool last = (i + 1 == g_sec->topics.count);
+    snprintf(payload, CLIENTVERIFY_MAX,
+             "{\"topic\":\"%s\",\"nonce_k\":\"%.*s\",\"hmac\":\"%s\"%s}",
+             topicName, (int)nonceSpan.len, nonceSpan.p, hmacHex,
+             last ? ",\"ticket\":1" : "");
+
+    SLOG_I("[SEC] Sending clientverify for %s", topicName);
+    client.publish(g_sec->kmsVerifyTopic, payload);
+  }
+}
 
-  Serial.print("[SEC] Sending clientverify to ");
-  Serial.println(verifyTopic);
-  client.publish(verifyTopic, payload);
+// Called when `epoch` becomes the current epoch of a topic. A topic that
+// lost its counter lease keeps the first epoch it receives as stale (we
+// may have sent under it before) and publishes again from the next one.
+static void noteCurrentEpoch(uint8_t topic, uint32_t epoch) {
+  TopicState& state = g_sec->topicState[topic];
+  if (!state.freshEpochNeeded) return;
+  if (!state.haveStaleEpoch) {
+    state.haveStaleEpoch = true;
+    state.staleEpoch = epoch;
+    SLOG_W("[SEC] %s: no counter lease, not publishing under epoch %lu",
+           g_sec->topics.entries[topic].name, (unsigned long)epoch);
+  } else if ((int32_t)(epoch - state.staleEpoch) > 0) {
+    state.freshEpochNeeded = false;
+    SLOG_I("[SEC] %s: fresh epoch %lu, publishing", g_sec->topics.entries[topic].name,
+           (unsigned long)epoch);
+  }
 }
 
-static void handleKeyMessage(const char* json) {
-  char topicBuf[64];
-  char ivHex[12*2+1];
-  char ctHex[128*2+1];   // large buffer
-  char tagHex[16*2+1];
-  int epoch = 0;
+static void handleKeyMessage(char* json, size_t jsonLen) {
+  SEC_METRICS_SCOPE(SEC_STAGE_HS_KEY);
+  SecScratch scratch;
+  JsonSpan topicSpan, ivSpan, ctSpan, tagSpan, epochSpan, pathSpan;
 
-  if (!extractJsonStringField(json, "topic", topicBuf, sizeof(topicBuf))) {
-    Serial.println("[SEC] key.topic missing");
+  if (!jsonFindField(json, jsonLen, "topic", &topicSpan)) {
+    SLOG_W("[SEC] key.topic missing");
     return;
   }
-  if (strcmp(topicBuf, g_topicName) != 0) {
-    Serial.println("[SEC] key for different topic, ignoring");
+  char* topicBuf = scratch.take<char>(SECURE_TOPIC_NAME_MAX);
+  if (!topicBuf) return;
+  size_t topicLen = topicSpan.len < SECURE_TOPIC_NAME_MAX ? topicSpan.len : SECURE_TOPIC_NAME_MAX - 1;
+  memcpy(topicBuf, topicSpan.p, topicLen);
+  topicBuf[topicLen] = '\0';
+  int idx = topicTableFind(&g_sec->topics, topicBuf);
+  if (idx < 0) {
+    SLOG_W("[SEC] key for unknown topic, ignoring");
     return;
   }
+  TopicEntry& entry = g_sec->topics.entries[idx];
 
-  if (!extractJsonStringField(json, "iv", ivHex, sizeof(ivHex))) {
-    Serial.println("[SEC] key.iv missing");
+  if (!jsonFindField(json, jsonLen, "iv", &ivSpan)) {
+    SLOG_W("[SEC] key.iv missing");
     return;
   }
-  if (!extractJsonStringField(json, "ciphertext", ctHex, sizeof(ctHex))) {
-    Serial.println("[SEC] key.ciphertext missing");
+  if (!jsonFindField(json, jsonLen, "ciphertext", &ctSpan)) {
+    SLOG_W("[SEC] key.ciphertext missing");
     return;
   }
-  if (!extractJsonStringField(json, "tag", tagHex, sizeof(tagHex))) {
-    Serial.println("[SEC] key.tag missing");
+  if (!jsonFindField(json, jsonLen, "tag", &tagSpan)) {
+    SLOG_W("[SEC] key.tag missing");
     return;
   }
-  if (!extractJsonIntField(json, "epoch", &epoch)) {
-    epoch = 0;
+  uint32_t epoch = 0;
+  if (jsonFindField(json, jsonLen, "epoch", &epochSpan) && !spanToU32(epochSpan, &epoch)) {
+    SLOG_W("[SEC] key.epoch malformed");
+    return;
   }
+  bool havePath = jsonFindField(json, jsonLen, "path", &pathSpan);
 
-  uint8_t iv[12];
-  uint8_t ciphertext[64]; // max size of the encrypted TOPIC_key (32 bytes)
-  uint8_t tag[16];
-
-  size_t ivLen = hexToBytes(ivHex, iv, sizeof(iv));
-  size_t ctLen = hexToBytes(ctHex, ciphertext, sizeof(ciphertext));
-  hexToBytes(tagHex, tag, sizeof(tag));
+  // Every field has been located: decode them in place
+  uint8_t* iv = (uint8_t*)ivSpan.p;
+  uint8_t* ciphertext = (uint8_t*)ctSpan.p;
+  uint8_t* tag = (uint8_t*)tagSpan.p;
+  uint8_t plain[32];
+  size_t ivLen = hexSpanToBytes(ivSpan, iv, 12);
+  size_t ctLen = hexSpanToBytes(ctSpan, ciphertext, sizeof(plain));
+  if (ivLen == 0 || ctLen != sizeof(plain) || hexSpanToBytes(tagSpan, tag, 16) != 16) {
+    SLOG_W("[SEC] key message malformed");
+    return;
+  }
 
   uint8_t topicAuthKey[32];
   uint8_t topicEncKey[32];
-  deriveTopicKeys(g_topicName, topicAuthKey, topicEncKey);
+  deriveTopicKeys(entry.name, topicAuthKey, topicEncKey);
 
-  uint8_t plain[32];
   bool ok = sc_aes_gcm_decrypt(topicEncKey, sizeof(topicEncKey),
                                iv, ivLen,
                                (const uint8_t*)"KMS_TOPIC_KEY", strlen("KMS_TOPIC_KEY"),
                                ciphertext, ctLen,
-                               tag, sizeof(tag),
+                               tag, 16,
                                plain);
   if (!ok) {
-    Serial.println("[SEC] Failed to decrypt TOPIC_key");
+    SLOG_E("[SEC] Failed to decrypt TOPIC_key");
     return;
   }
 
-  if (g_topicKeyReady) {
-    memcpy(g_topicKeyPrev, g_topicKeyCurrent, 32);
-    g_epochPrev = g_epochCurrent;
+  const TopicKeySlot* current = topicCurrentKey(&entry);
+  uint32_t currentEpoch = current ? current->epoch : 0;
+  TopicKeyInstall installed = topicInstallKey(&entry, epoch, plain);
+  memset(plain, 0, sizeof(plain));
+
+  // Traffic keys are re-derived lazily from the new key ring
+  if (installed != TOPIC_KEY_REFUSED) flushTopicSessionKeys((uint8_t)idx);
+  if (installed != TOPIC_KEY_CURRENT) {
+    // A late or replayed answer: neither the key nor its path (older than
+    // ours) may replace what a rotation or a revocation installed
+    SLOG_W("[SEC] TOPIC_key of past epoch %lu for %s (current %lu), %s",
+           (unsigned long)epoch, entry.name, (unsigned long)currentEpoch,
+           installed == TOPIC_KEY_RECEIVE_ONLY ? "kept for receiving only" : "ignored");
+    return;
   }
 
-  memcpy(g_topicKeyCurrent, plain, 32);
-  g_epochCurrent = (uint32_t)epoch;
-  g_topicKeyReady = true;
+  // Our path in the topic's key tree, for the group rekeys. Absent if the
+  // KMS does not count us as a member (then only this answer updates us).
+  // Decrypted in place in the message copy, wiped with the arena scope.
+  GroupPath& group = g_sec->topicState[idx].group;
+  uint8_t* pathBlob = havePath ? (uint8_t*)pathSpan.p : nullptr;
+  size_t pathLen = havePath
+                       ? hexSpanToBytes(pathSpan, pathBlob,
+                                        12 + 3 + GROUP_TREE_MAX_DEPTH * (2 + 4 + 32) + 16)
+                       : 0;
+  if (pathLen > 12 + 16 &&
+      sc_aes_gcm_decrypt(topicEncKey, sizeof(topicEncKey),
+                         pathBlob, 12,
+                         (const uint8_t*)"KMS_GROUP_PATH", strlen("KMS_GROUP_PATH"),
+                         pathBlob + 12, pathLen - 12 - 16,
+                         pathBlob + pathLen - 16, 16,
+                         pathBlob + 12) &&
+      groupPathSet(&group, pathBlob + 12, pathLen - 12 - 16)) {
+    SLOG_D("[SEC] Key tree path of %s: leaf %u", entry.name, (unsigned)group.leaf);
+  } else {
+    if (pathLen > 0) SLOG_W("[SEC] Invalid key tree path for %s", entry.name);
+    groupPathClear(&group);
+  }
 
-  Serial.print("[SEC] TOPIC_key updated. New epoch = ");
-  Serial.println(g_epochCurrent);
+  noteCurrentEpoch((uint8_t)idx, epoch);
+  SLOG_I("[SEC] TOPIC_key updated for %s. New epoch = %lu", entry.name, (unsigned long)epoch);
 }
 
-bool secureMqttHandleKmsMessage(const char* topic,
-                                const uint8_t* payload,
-                                unsigned int length,
-                                const char* baseTopic,
-                                const char* clientId,
-                                PubSubClient& client) {
+// Group rekey on <base>/kms/grouprekey (binary, see group_keys.h): the
+// wraps we can open update our path and possibly the TOPIC_key
+static void handleGroupRekey(const uint8_t* msg, size_t len) {
+  SEC_METRICS_SCOPE(SEC_STAGE_HS_KEY);
+  if (len < GROUP_REKEY_HEADER || msg[0] != GROUP_REKEY_VERSION ||
+      len != GROUP_REKEY_HEADER + (size_t)msg[5] * GROUP_WRAP_LEN) {
+    SLOG_W("[SEC] Malformed group rekey (%u bytes)", (unsigned)len);
+    return;
+  }
+  uint32_t topicHash = ((uint32_t)msg[1] << 24) | ((uint32_t)msg[2] << 16) |
+                       ((uint32_t)msg[3] << 8) | msg[4];
+  int idx = -1;
+  for (uint8_t i = 0; i < g_sec->topics.count; ++i) {
+    if (g_sec->topics.entries[i].hash == topicHash) {
+      idx = i;
+      break;
+    }
+  }
+  if (idx < 0 || g_sec->topicState[idx].group.leaf == 0) return;  // not for us
+  TopicEntry& entry = g_sec->topics.entries[idx];
 
-  // Expecting: baseTopic/clientId/kms/xxx
-  char prefix[128];
-  snprintf(prefix, sizeof(prefix), "%s/%s/kms/", baseTopic, clientId);
-  size_t prefixLen = strlen(prefix);
+  uint8_t topicAuthKey[32];
+  uint8_t topicEncKey[32];
+  deriveTopicKeys(entry.name, topicAuthKey, topicEncKey);
+
+  const TopicKeySlot* current = topicCurrentKey(&entry);
+  uint32_t epoch = 0;
+  uint8_t topicKey[32];
+  if (groupRekeyApply(&g_sec->topicState[idx].group, topicEncKey, topicHash,
+                      msg + GROUP_REKEY_HEADER, msg[5],
+                      current != nullptr, current ? current->epoch : 0,
+                      &epoch, topicKey)) {
+    // Newer than the current epoch, so it becomes current
+    topicInstallKey(&entry, epoch, topicKey);
+    flushTopicSessionKeys((uint8_t)idx);
+    memset(topicKey, 0, sizeof(topicKey));
+    noteCurrentEpoch((uint8_t)idx, epoch);
+    SLOG_I("[SEC] Group rekey of %s. New epoch = %lu", entry.name, (unsigned long)epoch);
+  }
+}
 
-  // Check if prefix matches
-  if (strncmp(topic, prefix, prefixLen) != 0) {
-    return false; // not for us
+// Session ticket issued after a handshake: {"ticket":"<hex>","lifetime":<s>}
+static void handleTicketMessage(char* json, size_t jsonLen) {
+  SecScratch scratch;
+  if (!g_sec->haveNextTicketSecret) {
+    SLOG_W("[SEC] Unexpected session ticket, ignoring");
+    return;
+  }
+  JsonSpan ticketSpan, lifetimeSpan;
+  uint32_t lifetime = 0;
+  uint8_t* blob = nullptr;
+  size_t len = 0;
+  if (jsonFindField(json, jsonLen, "ticket", &ticketSpan)) {
+    blob = (uint8_t*)ticketSpan.p;
+    len = hexSpanToBytes(ticketSpan, blob, SESSION_TICKET_MAX);
+  }
+  if (len == 0 || !jsonFindField(json, jsonLen, "lifetime", &lifetimeSpan) ||
+      !spanToU32(lifetimeSpan, &lifetime) || lifetime == 0) {
+    SLOG_W("[SEC] Malformed session ticket");
+    return;
+  }
+  if (!sessionTicketSet(&g_sec->ticket, secureMqttSenderIndex(g_sec->clientId), blob, len,
+                        g_sec->nextTicketSecret, lifetime, millis())) {
+    SLOG_W("[SEC] Session ticket too large");
+    return;
+  }
+  g_sec->haveNextTicketSecret = false;
+
+  // Kept across reboots: one NVS write per handshake
+  uint8_t* stored = scratch.take<uint8_t>(SESSION_TICKET_STORED_MAX);
+  size_t storedLen = stored ? sessionTicketSerialize(&g_sec->ticket, stored, SESSION_TICKET_STORED_MAX)
+                            : 0;
+  if (storedLen == 0 || secPrefs.putBytes(TICKET_PREFS_KEY, stored, storedLen) != storedLen) {
+    SLOG_W("[SEC] Session ticket not persisted");
   }
+  SLOG_I("[SEC] Session ticket stored, lifetime %lu s", (unsigned long)lifetime);
+}
 
-  const char* action = topic + prefixLen; // "clientauth" or "key"
-  // payload -> JSON string
-  static char jsonBuf[1400];
-  size_t copyLen = (length < sizeof(jsonBuf)-1) ? length : (sizeof(jsonBuf)-1);
-  memcpy(jsonBuf, payload, copyLen);
-  jsonBuf[copyLen] = '\0';
-  Serial.print("[SEC] KMS action=");
-  Serial.print(action);
-  Serial.print(" payload=");
-  Serial.println(jsonBuf);
+enum KmsAction : uint8_t {
+  KMS_CLIENTAUTH,
+  KMS_KEY,
+  KMS_REKEY,
+  KMS_TICKET,
+  KMS_GROUP_REKEY,
+};
+
+// Route handler of baseTopic/clientId/kms/{clientauth,key,rekey,ticket}
+// and of baseTopic/kms/grouprekey
+static void onKmsMessage(const RouteContext& ctx,
+                         const char* topic,
+                         const uint8_t* payload,
+                         unsigned int length) {
+  SecureStateLock lock;
+
+  if (ctx.index == KMS_GROUP_REKEY) {
+    handleGroupRekey(payload, length);
+    return;
+  }
 
-  if (strcmp(action, "auth") == 0) {
-    return false; // should not happen, we are the client
+  // payload -> JSON string, in the scratch arena: the handlers decode
+  // the hex fields over it
+  if (length >= SECURE_KMS_MESSAGE_MAX) {
+    SLOG_W("[SEC] KMS message on %s too large (%u bytes), ignoring", topic, length);
+    return;
   }
+  SecScratch scratch;
+  char* json = scratch.take<char>(length + 1);
+  if (!json) return;
+  memcpy(json, payload, length);
+  json[length] = '\0';
+  SLOG_D("[SEC] KMS message on %s (%u bytes)", topic, length);
+
+  if (ctx.index == KMS_CLIENTAUTH) {
+    handleClientAuth(json, length, *ctx.client);
+  } else if (ctx.index == KMS_TICKET) {
+    handleTicketMessage(json, length);
+  } else {
+    handleKeyMessage(json, length);
+  }
+}
 
-  if (strcmp(action, "clientverify") == 0) {
-    return false; // should not happen, we are the client
+bool secureMqttAddKmsRoutes(TopicRouter* router,
+                            PubSubClient& client,
+                            const char* baseTopic,
+                            const char* clientId) {
+  SecureStateLock lock;
+
+  char prefix[TOPIC_ROUTER_NAME_MAX];
+  int n = snprintf(prefix, sizeof(prefix), "%s/%s/kms/", baseTopic, clientId);
+  if (n < 0 || (size_t)n + strlen("clientverify") >= sizeof(g_sec->kmsVerifyTopic)) {
+    SLOG_E("[SEC] KMS topic prefix too long");
+    return false;
   }
+  memcpy(g_sec->kmsAuthTopic, prefix, n);
+  strcpy(g_sec->kmsAuthTopic + n, "auth");
+  memcpy(g_sec->kmsVerifyTopic, prefix, n);
+  strcpy(g_sec->kmsVerifyTopic + n, "clientverify");
+
+  RouteContext ctx;
+  ctx.client = &client;
+  ctx.index = KMS_CLIENTAUTH;
+  bool ok = topicRouterAddJoined(router, prefix, "clientauth", onKmsMessage, ctx);
+  ctx.index = KMS_KEY;
+  ok = ok && topicRouterAddJoined(router, prefix, "key", onKmsMessage, ctx);
+  ctx.index = KMS_REKEY;
+  ok = ok && topicRouterAddJoined(router, prefix, "rekey", onKmsMessage, ctx);
+  ctx.index = KMS_TICKET;
+  ok = ok && topicRouterAddJoined(router, prefix, "ticket", onKmsMessage, ctx);
+  ctx.index = KMS_GROUP_REKEY;
+  ok = ok && topicRouterAddJoined(router, baseTopic, "/kms/grouprekey", onKmsMessage, ctx);
+  if (!ok) {
+    SLOG_E("[SEC] Topic router full, KMS routes missing");
+  }
+  return ok;
+}
 
-  if (strcmp(action, "clientauth") == 0) {
-    Serial.println("[SEC] Handling clientauth");
-    handleClientAuth(jsonBuf, baseTopic, clientId, client);
-    return true;
-  } 
-  
-  if (strcmp(action, "key") == 0) {
-    Serial.println("[SEC] Handling key");
-    handleKeyMessage(jsonBuf);
-    return true;
-  } 
+// ========= Frame formats =========
+
+static const uint8_t SECURE_FRAME_VERSION_1 = 0x01;
+// 0x02 was the session frame without the sender's client_id, no longer accepted
+static const uint8_t SECURE_FRAME_VERSION_SESSION = 0x03;
+static const size_t  FRAME_HEADER_LEN = 1 + 4 + 4 + 4;  // ver, epoch, counter, sender
+// Session frames follow the header with id_len and the client_id
+static const size_t  FRAME_SESSION_HEADER_MAX = FRAME_HEADER_LEN + 1 + SENDER_ID_MAX;
+static const size_t  FRAME_IV_OFFSET = FRAME_HEADER_LEN;
+static const size_t  FRAME_CT_OFFSET = FRAME_IV_OFFSET + 12;
+static const size_t  FRAME_TAG_LEN = 16;
+// JSON frames carry "v":2, whose AAD also covers the sender_id. Frames
+// without it are refused: their sender_id could be rewritten, and a
+// captured frame would pass the replay check again as a new sender.
+static const unsigned JSON_FRAME_VERSION = 2;
+static const size_t  JSON_AAD_MAX = 4 + SECURE_TOPIC_NAME_MAX + 1 + SENDER_ID_MAX;
+static_assert(JSON_AAD_MAX >= FRAME_HEADER_LEN + SECURE_TOPIC_NAME_MAX,
+              "the AAD buffer of secureMqttEncryptFrame() also holds v1 binary AADs");
+
+bool secureMqttSetTopicFrameFormat(const char* appTopic, SecureFrameFormat format) {
+  SecureStateLock lock;
+
+  int idx = topicTableFind(&g_sec->topics, appTopic);
+  if (idx < 0) return false;
+  g_sec->topicState[idx].format = format;
+  return true;
+}
 
-  if (strcmp(action, "rekey") == 0) {
-    Serial.println("[SEC] Handling rekey");
-    handleKeyMessage(jsonBuf);
-    return true;
+// FNV-1a 32-bit over `len` bytes
+static uint32_t senderIndexOf(const char* id, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (uint8_t)id[i];
+    h *= 16777619u;
   }
+  return h;
+}
 
-  Serial.println("[SEC] Unknown KMS action, ignoring");
+uint32_t secureMqttSenderIndex(const char* clientId) {
+  return senderIndexOf(clientId, clientId ? strlen(clientId) : 0);
+}
 
-  return false;
+// JSON frames: AAD = counter || topic_name || 0x00 || sender_id
+static size_t buildJsonAad(uint32_t counter, const char* topicName, size_t topicLen,
+                           const char* senderId, size_t senderIdLen, uint8_t* aad) {
+  putU32BE(aad, counter);
+  memcpy(aad + 4, topicName, topicLen);
+  aad[4 + topicLen] = 0x00;
+  memcpy(aad + 5 + topicLen, senderId, senderIdLen);
+  return 5 + topicLen + senderIdLen;
 }
 
-bool secureMqttEncryptAndPublish(PubSubClient& client,
-                                 const char* appTopic,
-                                 const uint8_t* plaintext,
-                                 size_t plaintextLen) {
-  if (!g_topicKeyReady) {
-    Serial.println("[SEC] Cannot publish, TOPIC_key not ready");
-    return false;
+// ========= Session traffic keys =========
+
+// Traffic keys are derived once per (topic, epoch, sender), see SessionKey
+
+static void flushTopicSessionKeys(uint8_t topic) {
+  g_sec->topicState[topic].txKeyValid = false;
+  for (size_t i = 0; i < sizeof(g_sec->sessionKeys) / sizeof(g_sec->sessionKeys[0]); ++i) {
+    if (g_sec->sessionKeys[i].topic == topic) g_sec->sessionKeys[i].valid = false;
+  }
+  sc_aes_gcm_cache_flush();
+}
+
+static bool deriveSessionKey(const char* topicName, const uint8_t* topicKey,
+                             uint32_t epoch, uint32_t sender,
+                             const char* id, size_t idLen, uint8_t* out) {
+  SEC_METRICS_SCOPE(SEC_STAGE_HKDF);
+  uint8_t salt[8];
+  putU32BE(salt, epoch);
+  putU32BE(salt + 4, sender);
+
+  // "SESSION_KEY" || topic || 0x00 || client_id
+  uint8_t info[11 + SECURE_TOPIC_NAME_MAX + SENDER_ID_MAX];
+  size_t topicLen = strlen(topicName);
+  memcpy(info, "SESSION_KEY", 11);
+  memcpy(info + 11, topicName, topicLen);
+  info[11 + topicLen] = 0x00;
+  memcpy(info + 12 + topicLen, id, idLen);
+
+  return sc_hkdf_sha256(topicKey, 32, salt, sizeof(salt),
+                        info, 12 + topicLen + idLen, out, 32);
+}
+
+static const uint8_t* txSessionKey(uint8_t topic, const TopicKeySlot* current,
+                                   uint32_t sender) {
+  TopicState& state = g_sec->topicState[topic];
+  if (state.txKeyValid && state.txEpoch == current->epoch) {
+    return state.txKey;
+  }
+  if (!deriveSessionKey(g_sec->topics.entries[topic].name, current->key,
+                        current->epoch, sender,
+                        g_sec->clientId, strlen(g_sec->clientId), state.txKey)) {
+    state.txKeyValid = false;
+    return nullptr;
+  }
+  state.txKeyValid = true;
+  state.txEpoch = current->epoch;
+  return state.txKey;
+}
+
+// `id` is the sender's client_id, `sender` its index (already checked)
+static const uint8_t* rxSessionKey(uint8_t topic, const uint8_t* topicKey,
+                                   uint32_t epoch, uint32_t sender,
+                                   const char* id, size_t idLen) {
+  const size_t count = sizeof(g_sec->sessionKeys) / sizeof(g_sec->sessionKeys[0]);
+
+  SessionKey* victim = &g_sec->sessionKeys[0];
+  for (size_t i = 0; i < count; ++i) {
+    SessionKey& e = g_sec->sessionKeys[i];
+    if (e.valid && e.topic == topic && e.epoch == epoch && e.sender == sender &&
+        e.idLen == idLen && memcmp(e.id, id, idLen) == 0) {
+      e.lastUse = ++g_sec->sessionTick;
+      return e.key;
+    }
+    if (!e.valid || (victim->valid && e.lastUse < victim->lastUse)) {
+      victim = &e;
+    }
   }
 
-  g_counter++;
-  if (g_counter - g_counterLastSaved >= 1) {
-    secPrefs.putULong(COUNTER_KEY, g_counter);
-    g_counterLastSaved = g_counter;
-    Serial.print("[SEC] Persistent counter saved = ");
-    Serial.println(g_counter);
+  if (!deriveSessionKey(g_sec->topics.entries[topic].name, topicKey, epoch, sender,
+                        id, idLen, victim->key)) {
+    victim->valid = false;
+    return nullptr;
+  }
+  victim->valid = true;
+  victim->topic = topic;
+  victim->epoch = epoch;
+  victim->sender = sender;
+  victim->idLen = (uint8_t)idLen;
+  memcpy(victim->id, id, idLen);
+  victim->lastUse = ++g_sec->sessionTick;
+  return victim->key;
+}
+
+// nonce = sender || 0x00000000 || counter
+static void buildSessionNonce(uint32_t sender, uint32_t counter, uint8_t* nonce) {
+  putU32BE(nonce, sender);
+  memset(nonce + 4, 0, 4);
+  putU32BE(nonce + 8, counter);
+}
+
+size_t secureMqttEncryptFrame(const char* appTopic,
+                              const uint8_t* plaintext,
+                              size_t plaintextLen,
+                              uint8_t* out,
+                              size_t outSize) {
+  SecureStateLock lock;
+  SecScratch scratch;
+
+  int idx = topicTableFind(&g_sec->topics, appTopic);
+  if (idx < 0) {
+    SLOG_W("[SEC] Cannot publish, not a secure topic: %s", appTopic);
+    return 0;
+  }
+  const TopicEntry& entry = g_sec->topics.entries[idx];
+  TopicState& state = g_sec->topicState[idx];
+
+  const TopicKeySlot* current = topicCurrentKey(&entry);
+  if (!current) {
+    SLOG_W("[SEC] Cannot publish, TOPIC_key not ready");
+    return 0;
+  }
+  if (state.freshEpochNeeded) {
+    SLOG_W("[SEC] Cannot publish on %s, waiting for a fresh epoch", appTopic);
+    return 0;
+  }
+
+  if (plaintextLen > MAX_PLAINTEXT) {
+    SLOG_W("[SEC] Plaintext too large");
+    return 0;
+  }
+
+  // Session and JSON frames authenticate the client_id itself
+  size_t idLen = strlen(g_sec->clientId);
+  if (state.format != SECURE_FRAME_BINARY && idLen > SENDER_ID_MAX) {
+    SLOG_E("[SEC] client_id too long for this frame format");
+    return 0;
+  }
+
+  if (!counterLeaseNext(&state.lease, &state.counter)) {
+    SLOG_E("[SEC] Cannot publish, counter lease not persisted");
+    return 0;
+  }
+
+  const char* topicName = entry.name;
+  size_t topicLen = strlen(topicName);
+  uint32_t counter = state.counter;
+  uint32_t sender = secureMqttSenderIndex(g_sec->clientId);
+
+  // Binary frame header: ver || epoch || counter || sender
+  uint8_t header[FRAME_HEADER_LEN];
+  header[0] = (state.format == SECURE_FRAME_SESSION) ? SECURE_FRAME_VERSION_SESSION
+                                                     : SECURE_FRAME_VERSION_1;
+  putU32BE(header + 1, current->epoch);
+  putU32BE(header + 5, counter);
+  putU32BE(header + 9, sender);
+
+  if (state.format == SECURE_FRAME_SESSION) {
+    const uint8_t* trafficKey = txSessionKey((uint8_t)idx, current, sender);
+    if (!trafficKey) {
+      SLOG_E("[SEC] Session key derivation failed");
+      return 0;
+    }
+
+    uint8_t nonce[12];
+    buildSessionNonce(sender, counter, nonce);
+
+    // The header goes on with id_len || client_id. AAD = header || topic_name
+    size_t headerLen = FRAME_HEADER_LEN + 1 + idLen;
+    uint8_t aad[FRAME_SESSION_HEADER_MAX + SECURE_TOPIC_NAME_MAX];
+    memcpy(aad, header, FRAME_HEADER_LEN);
+    aad[FRAME_HEADER_LEN] = (uint8_t)idLen;
+    memcpy(aad + FRAME_HEADER_LEN + 1, g_sec->clientId, idLen);
+    memcpy(aad + headerLen, topicName, topicLen);
+
+    size_t frameLen = headerLen + plaintextLen + FRAME_TAG_LEN;
+    if (frameLen > outSize) {
+      SLOG_E("[SEC] Frame buffer too small");
+      return 0;
+    }
+    memcpy(out, aad, headerLen);
+    uint32_t sealStart = secMetricsNow();
+    bool ok = sc_aes_gcm_encrypt_cached(trafficKey, 32,
+                                        nonce, sizeof(nonce),
+                                        aad, headerLen + topicLen,
+                                        plaintext, plaintextLen,
+                                        out + headerLen,
+                                        out + headerLen + plaintextLen,
+                                        FRAME_TAG_LEN);
+    secMetricsRecord(SEC_STAGE_GCM_SEAL, secMetricsNow() - sealStart);
+    if (!ok) {
+      SLOG_E("[SEC] AES-GCM encrypt failed");
+      return 0;
+    }
+    return frameLen;
   }
 
   uint8_t iv[12];
   sc_random_bytes(iv, sizeof(iv));
 
   uint8_t counterBytes[4];
-  counterBytes[0] = (g_counter >> 24) & 0xFF;
-  counterBytes[1] = (g_counter >> 16) & 0xFF;
-  counterBytes[2] = (g_counter >> 8)  & 0xFF;
-  counterBytes[3] = (g_counter)       & 0xFF;
-
-  // AAD = counter || topic_name
-  uint8_t aad[4 + 64];
-  size_t aadLen = 4 + strlen(g_topicName);
-  memcpy(aad, counterBytes, 4);
-  memcpy(aad+4, g_topicName, strlen(g_topicName));
+  putU32BE(counterBytes, counter);
+
+  // AAD = header || topic_name (binary) or
+  //       counter || topic_name || 0x00 || sender_id (JSON)
+  uint8_t aad[JSON_AAD_MAX];
+  size_t aadLen = 0;
+  if (state.format == SECURE_FRAME_BINARY) {
+    memcpy(aad, header, FRAME_HEADER_LEN);
+    aadLen = FRAME_HEADER_LEN;
+    memcpy(aad + aadLen, topicName, topicLen);
+    aadLen += topicLen;
+  } else {
+    aadLen = buildJsonAad(counter, topicName, topicLen, g_sec->clientId, idLen, aad);
+  }
 
   // AES_key = HKDF(TOPIC_key, salt = iv||counter)
   uint8_t salt[12+4];
   memcpy(salt, iv, 12);
   memcpy(salt+12, counterBytes, 4);
   uint8_t aesKey[32];
-  sc_hkdf_sha256(g_topicKeyCurrent, sizeof(g_topicKeyCurrent),
+  uint32_t hkdfStart = secMetricsNow();
+  sc_hkdf_sha256(current->key, sizeof(current->key),
                  salt, sizeof(salt),
-                 (const uint8_t*)g_topicName, strlen(g_topicName),
+                 (const uint8_t*)topicName, topicLen,
                  aesKey, sizeof(aesKey));
+  secMetricsRecord(SEC_STAGE_HKDF, secMetricsNow() - hkdfStart);
 
-  uint8_t ciphertext[256];
-  uint8_t tag[16];
-  if (plaintextLen > sizeof(ciphertext)) {
-    Serial.println("[SEC] Plaintext too large");
-    return false;
+  if (state.format == SECURE_FRAME_BINARY) {
+    // Encrypt straight into the frame, no text encoding involved
+    size_t frameLen = FRAME_CT_OFFSET + plaintextLen + FRAME_TAG_LEN;
+    if (frameLen > outSize) {
+      SLOG_E("[SEC] Frame buffer too small");
+      return 0;
+    }
+    memcpy(out, header, FRAME_HEADER_LEN);
+    memcpy(out + FRAME_IV_OFFSET, iv, sizeof(iv));
+
+    uint32_t sealStart = secMetricsNow();
+    bool ok = sc_aes_gcm_encrypt(aesKey, sizeof(aesKey),
+                                 iv, sizeof(iv),
+                                 aad, aadLen,
+                                 plaintext, plaintextLen,
+                                 out + FRAME_CT_OFFSET,
+                                 out + FRAME_CT_OFFSET + plaintextLen, FRAME_TAG_LEN);
+    secMetricsRecord(SEC_STAGE_GCM_SEAL, secMetricsNow() - sealStart);
+    if (!ok) {
+      SLOG_E("[SEC] AES-GCM encrypt failed");
+      return 0;
+    }
+    return frameLen;
   }
 
+  // JSON frames: sealed aside, then hex-encoded into the frame
+  uint8_t* ciphertext = scratch.take<uint8_t>(plaintextLen);
+  char* ctHex = scratch.take<char>(plaintextLen*2+1);
+  if (!ciphertext || !ctHex) return 0;
+  uint8_t tag[16];
+
+  uint32_t sealStart = secMetricsNow();
   bool ok = sc_aes_gcm_encrypt(aesKey, sizeof(aesKey),
                                iv, sizeof(iv),
                                aad, aadLen,
                                plaintext, plaintextLen,
                                ciphertext,
                                tag, sizeof(tag));
+  secMetricsRecord(SEC_STAGE_GCM_SEAL, secMetricsNow() - sealStart);
   if (!ok) {
-    Serial.println("[SEC] AES-GCM encrypt failed");
-    return false;
+    SLOG_E("[SEC] AES-GCM encrypt failed");
+    return 0;
   }
 
   // Build JSON
+  SEC_METRICS_SCOPE(SEC_STAGE_JSON_BUILD);
   char ivHex[12*2+1];
-  char ctHex[256*2+1];
   char tagHex[16*2+1];
 
   bytesToHex(iv, sizeof(iv), ivHex, sizeof(ivHex));
-  bytesToHex(ciphertext, plaintextLen, ctHex, sizeof(ctHex));
+  bytesToHex(ciphertext, plaintextLen, ctHex, plaintextLen*2+1);
   bytesToHex(tag, sizeof(tag), tagHex, sizeof(tagHex));
 
-  char payload[1024];
-  snprintf(payload, sizeof(payload),
-         "{\"iv\":\"%s\",\"counter\":%lu,"
+  int jsonLen = snprintf((char*)out, outSize,
+         "{\"v\":%u,\"iv\":\"%s\",\"counter\":%lu,"
          "\"ciphertext\":\"%s\",\"tag\":\"%s\","
          "\"topic_name\":\"%s\",\"sender_id\":\"%s\",\"epoch\":%lu}",
+         (unsigned)JSON_FRAME_VERSION,
          ivHex,
-         (unsigned long)g_counter,
+         (unsigned long)counter,
          ctHex,
          tagHex,
-         g_topicName,
-         g_clientId,
-         (unsigned long)g_epochCurrent);
+         topicName,
+         g_sec->clientId,
+         (unsigned long)current->epoch);
+  if (jsonLen < 0 || (size_t)jsonLen >= outSize) {
+    SLOG_E("[SEC] Frame buffer too small");
+    return 0;
+  }
+  return (size_t)jsonLen;
+}
 
-  return client.publish(appTopic, payload);
+bool secureMqttEncryptAndPublish(PubSubClient& client,
+                                 const char* appTopic,
+                                 const uint8_t* plaintext,
+                                 size_t plaintextLen) {
+  // The frame lives in the scratch arena, so the state lock is held until
+  // it has been handed to the client
+  SecureStateLock lock;
+  SecScratch scratch;
+  uint8_t* frame = scratch.take<uint8_t>(SECURE_MQTT_MAX_FRAME);
+  if (!frame) return false;
+  size_t frameLen = secureMqttEncryptFrame(appTopic, plaintext, plaintextLen,
+                                           frame, SECURE_MQTT_MAX_FRAME);
+  if (frameLen == 0) return false;
+  SEC_METRICS_SCOPE(SEC_STAGE_PUBLISH);
+  return client.publish(appTopic, frame, (unsigned int)frameLen);
 }
 
-bool secureMqttDecryptPayload(const uint8_t* payload,
-                              unsigned int length,
-                              const char* expectedTopic,
-                              char* outBuffer,
-                              size_t outBufferSize) {
-  if (!g_topicKeyReady) {
-    Serial.println("[SEC] Cannot decrypt, TOPIC_key not ready");
+// Checks replay/epoch, derives the message key and decrypts. Shared by
+// the JSON and binary frame parsers. Session frames use the cached
+// traffic key of `sender`, whose client_id is `senderId` (nullptr for the
+// other frames). The replay window of `sender` only moves once the tag
+// has been verified. `out` may be `ciphertext` itself (in place).
+static bool decryptFrame(uint8_t topic,
+                         uint32_t counter,
+                         uint32_t epoch,
+                         uint32_t sender,
+                         const char* senderId, size_t senderIdLen,
+                         const uint8_t* iv, size_t ivLen,
+                         const uint8_t* aad, size_t aadLen,
+                         const uint8_t* ciphertext, size_t ctLen,
+                         const uint8_t* tag,
+                         uint8_t* out,
+                         size_t outSize) {
+  const TopicEntry& entry = g_sec->topics.entries[topic];
+  TopicState& state = g_sec->topicState[topic];
+
+  if (!replayCheck(&state.replay, sender, counter)) {
+    SLOG_W("[SEC] Replay detected, sender=%lu counter=%lu",
+           (unsigned long)sender, (unsigned long)counter);
     return false;
   }
 
-  if (!payload || length == 0 || !expectedTopic || !outBuffer || outBufferSize == 0) {
-    Serial.println("[SEC] Cannot decrypt, invalid parameters");
+  const uint8_t* topicKeyForThisMsg = topicKeyForEpoch(&entry, epoch);
+  if (!topicKeyForThisMsg) {
+    SLOG_W("[SEC] Decrypt: unknown epoch %lu", (unsigned long)epoch);
     return false;
   }
 
-  // Copy payload to a temporary, null-terminated buffer
-  static char jsonBuf[1024];
-  size_t copyLen = (length < sizeof(jsonBuf)-1) ? length : (sizeof(jsonBuf)-1);
-  memcpy(jsonBuf, payload, copyLen);
-  jsonBuf[copyLen] = '\0';
+  if (ctLen > outSize) {
+    SLOG_W("[SEC] Decrypt: ciphertext too large for buffer");
+    return false;
+  }
 
-  char ivHex[12*2+1];
-  char ctHex[256*2+1];
-  char tagHex[16*2+1];
-  char topicNameBuf[64];
-  int counter = 0;
-  char senderId[64];
+  bool ok = false;
+  if (senderId) {
+    const uint8_t* trafficKey = rxSessionKey(topic, topicKeyForThisMsg, epoch, sender,
+                                             senderId, senderIdLen);
+    if (trafficKey) {
+      uint32_t openStart = secMetricsNow();
+      ok = sc_aes_gcm_decrypt_cached(trafficKey, 32,
+                                     iv, ivLen,
+                                     aad, aadLen,
+                                     ciphertext, ctLen,
+                                     tag, FRAME_TAG_LEN,
+                                     out);
+      secMetricsRecord(SEC_STAGE_GCM_OPEN, secMetricsNow() - openStart);
+    }
+  } else {
+    uint8_t counterBytes[4];
+    putU32BE(counterBytes, counter);
+
+    uint8_t salt[12+4];
+    memcpy(salt, iv, 12);
+    memcpy(salt+12, counterBytes, 4);
+
+    uint8_t aesKey[32];
+    uint32_t hkdfStart = secMetricsNow();
+    sc_hkdf_sha256(topicKeyForThisMsg, 32,
+                   salt, sizeof(salt),
+                   (const uint8_t*)entry.name, strlen(entry.name),
+                   aesKey, sizeof(aesKey));
+    uint32_t openStart = secMetricsNow();
+    secMetricsRecord(SEC_STAGE_HKDF, openStart - hkdfStart);
+
+    ok = sc_aes_gcm_decrypt(aesKey, sizeof(aesKey),
+                            iv, ivLen,
+                            aad, aadLen,
+                            ciphertext, ctLen,
+                            tag, FRAME_TAG_LEN,
+                            out);
+    secMetricsRecord(SEC_STAGE_GCM_OPEN, secMetricsNow() - openStart);
+  }
+  if (!ok) {
+    SLOG_W("[SEC] AES-GCM decrypt failed");
+    // mark tag/auth failure so the MQTT layer can request a rekey
+    state.decryptFailed = true;
+    return false;
+  }
 
-  if (!extractJsonStringField(jsonBuf, "iv", ivHex, sizeof(ivHex))) {
-    Serial.println("[SEC] Decrypt: iv missing");
+  replayCommit(&state.replay, sender, counter);
+  return true;
+}
+
+// Binary and session frames: fields are read in place, the topic name comes
+// from the MQTT topic the frame was received on. The plaintext goes to
+// `dst`, or over the ciphertext when `dst` is nullptr.
+static bool openBinaryFrame(const uint8_t* payload,
+                            size_t length,
+                            uint8_t topic,
+                            uint8_t* dst,
+                            size_t dstSize,
+                            SecurePlaintext* plain) {
+  uint32_t parseStart = secMetricsNow();
+  bool session = (payload[0] == SECURE_FRAME_VERSION_SESSION);
+  size_t headerLen = FRAME_HEADER_LEN;
+  if (session && length > FRAME_HEADER_LEN) {
+    headerLen += 1 + payload[FRAME_HEADER_LEN];
+  }
+  size_t ctOffset = session ? headerLen : FRAME_CT_OFFSET;
+  if (length < ctOffset + FRAME_TAG_LEN || headerLen > FRAME_SESSION_HEADER_MAX) {
+    SLOG_W("[SEC] Decrypt: binary frame too short");
     return false;
   }
-  if (!extractJsonIntField(jsonBuf, "counter", &counter)) {
-    Serial.println("[SEC] Decrypt: counter missing");
+
+  uint32_t epoch   = getU32BE(payload + 1);
+  uint32_t counter = getU32BE(payload + 5);
+  uint32_t sender  = getU32BE(payload + 9);
+
+  extern const char* mqttClientId;
+  if (sender == secureMqttSenderIndex(mqttClientId)) {
+    SLOG_D("[SEC] Decrypt: own message, ignoring");
     return false;
   }
-  if (!extractJsonStringField(jsonBuf, "ciphertext", ctHex, sizeof(ctHex))) {
-    Serial.println("[SEC] Decrypt: ciphertext missing");
+
+  // Session frames: the client_id the traffic key is bound to
+  const char* senderId = nullptr;
+  size_t senderIdLen = 0;
+  if (session) {
+    senderId = (const char*)payload + FRAME_HEADER_LEN + 1;
+    senderIdLen = headerLen - FRAME_HEADER_LEN - 1;
+    if (senderIndexOf(senderId, senderIdLen) != sender) {
+      SLOG_W("[SEC] Decrypt: sender index does not match the client_id");
+      return false;
+    }
+  }
+
+  const char* topicName = g_sec->topics.entries[topic].name;
+  size_t topicLen = strlen(topicName);
+  uint8_t aad[FRAME_SESSION_HEADER_MAX + SECURE_TOPIC_NAME_MAX];
+  memcpy(aad, payload, headerLen);
+  memcpy(aad + headerLen, topicName, topicLen);
+
+  uint8_t nonce[12];
+  const uint8_t* iv = payload + FRAME_IV_OFFSET;
+  if (session) {
+    buildSessionNonce(sender, counter, nonce);
+    iv = nonce;
+  }
+
+  size_t ctLen = length - ctOffset - FRAME_TAG_LEN;
+  if (!dst) {
+    dst = (uint8_t*)payload + ctOffset;
+    dstSize = ctLen;
+  }
+  secMetricsRecord(SEC_STAGE_OPEN_PARSE, secMetricsNow() - parseStart);
+  if (!decryptFrame(topic, counter, epoch,
+                    sender, senderId, senderIdLen,
+                    iv, 12,
+                    aad, headerLen + topicLen,
+                    payload + ctOffset, ctLen,
+                    payload + ctOffset + ctLen,
+                    dst, dstSize)) {
     return false;
   }
-  if (!extractJsonStringField(jsonBuf, "tag", tagHex, sizeof(tagHex))) {
-    Serial.println("[SEC] Decrypt: tag missing");
+  plain->data = dst;
+  plain->len = ctLen;
+  return true;
+}
+
+// JSON frames: every field is parsed where it lies in the payload. The
+// ciphertext is hex-decoded straight into `dst` (or over the start of the
+// payload when `dst` is nullptr) and decrypted there.
+static bool openJsonFrame(const uint8_t* payload,
+                          size_t length,
+                          uint8_t topic,
+                          uint8_t* dst,
+                          size_t dstSize,
+                          SecurePlaintext* plain) {
+  uint32_t parseStart = secMetricsNow();
+  const char* json = (const char*)payload;
+  JsonSpan versionSpan, ivSpan, ctSpan, tagSpan, topicSpan, senderSpan, counterSpan, epochSpan;
+
+  uint32_t version = 0;
+  if (!jsonFindField(json, length, "v", &versionSpan) ||
+      !spanToU32(versionSpan, &version) || version != JSON_FRAME_VERSION) {
+    SLOG_W("[SEC] Decrypt: JSON frame without an authenticated sender_id, refused");
     return false;
   }
-  if (!extractJsonStringField(jsonBuf, "topic_name", topicNameBuf, sizeof(topicNameBuf))) {
-    Serial.println("[SEC] Decrypt: topic_name missing");
+  if (!jsonFindField(json, length, "iv", &ivSpan)) {
+    SLOG_W("[SEC] Decrypt: iv missing");
     return false;
   }
-  if (!extractJsonStringField(jsonBuf, "sender_id", senderId, sizeof(senderId))) {
-  Serial.println("[SEC] Decrypt: sender_id missing");
-  return false;
+  if (!jsonFindField(json, length, "counter", &counterSpan)) {
+    SLOG_W("[SEC] Decrypt: counter missing");
+    return false;
   }
-  int epoch = 0;
-  if (!extractJsonIntField(jsonBuf, "epoch", &epoch)) {
-    Serial.println("[SEC] Decrypt: epoch missing");
+  if (!jsonFindField(json, length, "ciphertext", &ctSpan)) {
+    SLOG_W("[SEC] Decrypt: ciphertext missing");
     return false;
   }
-
-  extern const char* mqttClientId; 
-  if (strcmp(senderId, mqttClientId) == 0) {
-    Serial.println("[SEC] Decrypt: own message, ignoring");
+  if (!jsonFindField(json, length, "tag", &tagSpan)) {
+    SLOG_W("[SEC] Decrypt: tag missing");
+    return false;
+  }
+  if (!jsonFindField(json, length, "topic_name", &topicSpan)) {
+    SLOG_W("[SEC] Decrypt: topic_name missing");
+    return false;
+  }
+  if (!jsonFindField(json, length, "sender_id", &senderSpan)) {
+    SLOG_W("[SEC] Decrypt: sender_id missing");
+    return false;
+  }
+  if (!jsonFindField(json, length, "epoch", &epochSpan)) {
+    SLOG_W("[SEC] Decrypt: epoch missing");
     return false;
   }
 
-  if ((uint32_t)counter <= g_lastRemoteCounter) {
-    Serial.print("[SEC] Replay detected from ");
-    Serial.print(senderId);
-    Serial.print(" counter=");
-    Serial.print(counter);
-    Serial.print(" last=");
-    Serial.println(g_lastRemoteCounter);
+  extern const char* mqttClientId;
+  if (spanEquals(senderSpan, mqttClientId)) {
+    SLOG_D("[SEC] Decrypt: own message, ignoring");
     return false;
   }
-  g_lastRemoteCounter = (uint32_t)counter;
 
-  if (strcmp(topicNameBuf, expectedTopic) != 0) {
-    Serial.print("[SEC] Decrypt: topic_name mismatch (payload=");
-    Serial.print(topicNameBuf);
-    Serial.print(", expected=");
-    Serial.print(expectedTopic);
-    Serial.println(")");
+  const char* topicName = g_sec->topics.entries[topic].name;
+  if (!spanEquals(topicSpan, topicName)) {
+    SLOG_W("[SEC] Decrypt: topic_name mismatch, expected %s", topicName);
     return false;
   }
 
+  uint32_t counter = 0, epoch = 0;
   uint8_t iv[12];
-  uint8_t ciphertext[256];
   uint8_t tag[16];
-  size_t ivLen = hexToBytes(ivHex, iv, sizeof(iv));
-  size_t ctLen = hexToBytes(ctHex, ciphertext, sizeof(ciphertext));
-  hexToBytes(tagHex, tag, sizeof(tag));
+  size_t ivLen = hexSpanToBytes(ivSpan, iv, sizeof(iv));
+  if (!spanToU32(counterSpan, &counter) || !spanToU32(epochSpan, &epoch) ||
+      ivLen == 0 || hexSpanToBytes(tagSpan, tag, sizeof(tag)) != sizeof(tag)) {
+    SLOG_W("[SEC] Decrypt: malformed field");
+    return false;
+  }
+  if (senderSpan.len > SENDER_ID_MAX) {
+    SLOG_W("[SEC] Decrypt: sender_id too long");
+    return false;
+  }
+  uint32_t sender = senderIndexOf(senderSpan.p, senderSpan.len);
+
+  // The sender_id is authenticated: the replay window it selects is the
+  // one of the device that sealed the frame
+  size_t topicLen = strlen(topicName);
+  uint8_t aad[JSON_AAD_MAX];
+  size_t aadLen = buildJsonAad(counter, topicName, topicLen,
+                               senderSpan.p, senderSpan.len, aad);
+
+  // Every field has been read: the payload can now be overwritten
+  if (!dst) {
+    dst = (uint8_t*)payload;
+    dstSize = length;
+  }
+  size_t ctLen = hexSpanToBytes(ctSpan, dst, dstSize);
+  if (ctLen == 0) {
+    SLOG_W("[SEC] Decrypt: malformed ciphertext");
+    return false;
+  }
+  secMetricsRecord(SEC_STAGE_OPEN_PARSE, secMetricsNow() - parseStart);
+
+  if (!decryptFrame(topic, counter, epoch,
+                    sender, nullptr, 0,
+                    iv, ivLen,
+                    aad, aadLen,
+                    dst, ctLen,
+                    tag,
+                    dst, dstSize)) {
+    return false;
+  }
+  plain->data = dst;
+  plain->len = ctLen;
+  return true;
+}
 
-  uint8_t counterBytes[4];
-  counterBytes[0] = (counter >> 24) & 0xFF;
-  counterBytes[1] = (counter >> 16) & 0xFF;
-  counterBytes[2] = (counter >> 8)  & 0xFF;
-  counterBytes[3] = (counter)       & 0xFF;
+// Common entry of both receive APIs, under the state lock
+static bool openFrame(const char* expectedTopic,
+                      const uint8_t* payload,
+                      size_t length,
+                      uint8_t* dst,
+                      size_t dstSize,
+                      SecurePlaintext* plain) {
+  SEC_METRICS_SCOPE(SEC_STAGE_OPEN);
+  if (!payload || length == 0 || !expectedTopic || !plain) {
+    SLOG_W("[SEC] Cannot decrypt, invalid parameters");
+    return false;
+  }
 
-  uint8_t aad[4 + 64];
-  size_t aadLen = 4 + strlen(topicNameBuf);
-  memcpy(aad, counterBytes, 4);
-  memcpy(aad+4, topicNameBuf, strlen(topicNameBuf));
+  int idx = topicTableFind(&g_sec->topics, expectedTopic);
+  if (idx < 0) {
+    SLOG_W("[SEC] Cannot decrypt, not a secure topic");
+    return false;
+  }
+  if (g_sec->topics.entries[idx].keyCount == 0) {
+    SLOG_W("[SEC] Cannot decrypt, TOPIC_key not ready");
+    return false;
+  }
 
-  uint8_t salt[12+4];
-  memcpy(salt, iv, 12);
-  memcpy(salt+12, counterBytes, 4);
+  if (payload[0] == SECURE_FRAME_VERSION_1 ||
+      payload[0] == SECURE_FRAME_VERSION_SESSION) {
+    return openBinaryFrame(payload, length, (uint8_t)idx, dst, dstSize, plain);
+  }
+  return openJsonFrame(payload, length, (uint8_t)idx, dst, dstSize, plain);
+}
 
-  const uint8_t* topicKeyForThisMsg = nullptr;
+bool secureMqttOpenFrame(const char* expectedTopic,
+                         uint8_t* frame,
+                         size_t length,
+                         SecurePlaintext* plain) {
+  SecureStateLock lock;
+  return openFrame(expectedTopic, frame, length, nullptr, 0, plain);
+}
 
-  if ((uint32_t)epoch == g_epochCurrent) {
-    topicKeyForThisMsg = g_topicKeyCurrent;
-  } else if ((uint32_t)epoch == g_epochPrev) {
-    topicKeyForThisMsg = g_topicKeyPrev;
-  } else {
-    Serial.print("[SEC] Decrypt: unknown epoch ");
-    Serial.println(epoch);
+bool secureMqttDecryptPayload(const uint8_t* payload,
+                              unsigned int length,
+                              const char* expectedTopic,
+                              char* outBuffer,
+                              size_t outBufferSize) {
+  SecureStateLock lock;
+
+  if (!outBuffer || outBufferSize == 0) {
+    SLOG_W("[SEC] Cannot decrypt, invalid parameters");
+    return false;
+  }
+  SecurePlaintext plain;
+  if (!openFrame(expectedTopic, payload, length,
+                 (uint8_t*)outBuffer, outBufferSize - 1, &plain)) {
     return false;
   }
+  outBuffer[plain.len] = '\0';
+  return true;
+}
 
-  uint8_t aesKey[32];
-  sc_hkdf_sha256(topicKeyForThisMsg, 32,
-                 salt, sizeof(salt),
-                 (const uint8_t*)topicNameBuf, strlen(topicNameBuf),
-                 aesKey, sizeof(aesKey));
+#ifdef SECURE_MQTT_BENCH
+#include "secure_bench_vectors.h"
 
-  if (ctLen >= outBufferSize) {
-    Serial.println("[SEC] Decrypt: ciphertext too large for buffer");
-    return false;
+// Times sc_verify_kms_signature() with a fixed key of the given suite
+static void benchVerify(const char* name, ScSigSuite suite, const char* pem,
+                        const uint8_t* sig, size_t sigLen, unsigned int iterations) {
+  secureMqttSetKmsPubkey(pem);
+  sc_set_kms_sig_suite(suite);
+
+  bool ok = true;
+  unsigned long start = micros();
+  for (unsigned int i = 0; i < iterations; ++i) {
+    ok &= sc_verify_kms_signature(BENCH_CHALLENGE, sizeof(BENCH_CHALLENGE), sig, sigLen);
   }
+  unsigned long us = micros() - start;
 
-  bool ok = sc_aes_gcm_decrypt(aesKey, sizeof(aesKey),
-                               iv, ivLen,
-                               aad, aadLen,
-                               ciphertext, ctLen,
-                               tag, sizeof(tag),
-                               (uint8_t*)outBuffer);
-  if (!ok) {
-    Serial.println("[SEC] AES-GCM decrypt failed");
-    // mark tag/auth failure so the MQTT layer can request a rekey
-    g_secureDecryptTagFailure = true;
-    return false;
+  Serial.printf("[BENCH] verify %s (%u B sig): %.1f us/op%s\n",
+                name, (unsigned)sigLen, (double)us / iterations, ok ? "" : " (FAILED)");
+}
+
+void secureMqttRunBenchmark(unsigned int iterations) {
+  if (iterations == 0) return;
+
+  // Runs against the traffic-key cache of topic slot 0
+  const char* topicName = g_sec->topics.entries[0].name;
+  TopicKeySlot slot;
+  slot.epoch = 1;
+  sc_random_bytes(slot.key, sizeof(slot.key));
+  const uint8_t* topicKey = slot.key;
+  const uint8_t plaintext[20] = {0};
+  uint8_t aad[FRAME_HEADER_LEN + SECURE_TOPIC_NAME_MAX] = {0};
+  size_t aadLen = FRAME_HEADER_LEN + strlen(topicName);
+  uint8_t out[sizeof(plaintext)];
+  uint8_t tag[16];
+
+  // Per-message key: random IV, HKDF, then a one-shot GCM (init + setkey)
+  unsigned long start = micros();
+  for (unsigned int i = 0; i < iterations; ++i) {
+    uint8_t salt[12+4];
+    sc_random_bytes(salt, 12);
+    putU32BE(salt + 12, i);
+    uint8_t aesKey[32];
+    sc_hkdf_sha256(topicKey, 32, salt, sizeof(salt),
+                   (const uint8_t*)topicName, strlen(topicName),
+                   aesKey, sizeof(aesKey));
+    sc_aes_gcm_encrypt(aesKey, 32, salt, 12, aad, aadLen,
+                       plaintext, sizeof(plaintext), out, tag, sizeof(tag));
   }
+  unsigned long legacyUs = micros() - start;
+
+  // Session: cached traffic key and GCM context, counter nonce
+  flushTopicSessionKeys(0);
+  start = micros();
+  for (unsigned int i = 0; i < iterations; ++i) {
+    const uint8_t* trafficKey = txSessionKey(0, &slot, 0x1234);
+    uint8_t nonce[12];
+    buildSessionNonce(0x1234, i, nonce);
+    sc_aes_gcm_encrypt_cached(trafficKey, 32, nonce, sizeof(nonce), aad, aadLen,
+                              plaintext, sizeof(plaintext), out, tag, sizeof(tag));
+  }
+  unsigned long sessionUs = micros() - start;
+  flushTopicSessionKeys(0);
 
-  outBuffer[ctLen] = '\0';
-  return true;
+  Serial.printf("[BENCH] %u msgs x %u B: per-message key %.1f us/msg, session %.1f us/msg\n",
+                iterations, (unsigned)sizeof(plaintext),
+                (double)legacyUs / iterations, (double)sessionUs / iterations);
+
+  // Handshake signature verification for each suite
+
+  unsigned int verifyIterations = iterations / 20 ? iterations / 20 : 1;
+  benchVerify("rsa2048", SC_SIG_RSA2048, BENCH_RSA2048_PUBKEY_PEM,
+              BENCH_RSA2048_SIG, sizeof(BENCH_RSA2048_SIG), verifyIterations);
+  benchVerify("p256", SC_SIG_P256, BENCH_P256_PUBKEY_PEM,
+              BENCH_P256_SIG, sizeof(BENCH_P256_SIG), verifyIterations);
+  sc_set_kms_pubkey_pem(nullptr);
 }
+#endif
@@ -2,57 +2,173 @@
 
 #include <Arduino.h>
 #include <PubSubClient.h>
+#include "topic_router.h"
 
-void secureMqttInit(const char* topic_name, const char* client_id);
+void secureMqttInit(const char* client_id);
 
 void secureMqttSetClientId(const char* client_id);
 
+// Secure layer state of one device: topics, keys, counters, handshake and
+// session ticket. The firmware uses the default context only. A Linux
+// tool simulating many devices in one process (host/loadgen) creates one
+// context per device and selects it before calling any other function
+// here on its behalf; CLIENT_MASTER_KEY follows the selected context.
+// Not thread-safe: select and use contexts from a single thread.
+struct SecureMqttContext;
+
+SecureMqttContext* secureMqttContextCreate();
+void secureMqttContextDestroy(SecureMqttContext* ctx);
+
+// Makes `ctx` (nullptr: the default context) the current device and
+// returns the previous one.
+SecureMqttContext* secureMqttSelectContext(SecureMqttContext* ctx);
+
 // TO ADJUST: 32-byte CLIENT_MASTER_KEY provisioned (copied from your Python simulation)
 extern uint8_t CLIENT_MASTER_KEY[32];
 
-// TO ADJUST: KMS public key in PEM format for signature verification
-extern char KMS_PUBKEY_PEM[];
+// KMS public key in PEM format for signature verification. The key is
+// parsed once here, not on every handshake. Returns false if invalid.
+bool secureMqttSetKmsPubkey(const char* pem);
+// Same from its DER form (SubjectPublicKeyInfo), as kept in the device
+// config.
+bool secureMqttSetKmsPubkeyDer(const uint8_t* der, size_t len);
 
-void secureMqttSetKmsPubkey(const char* pem);
+// Signature suite of the KMS key ("rsa2048" or "p256"), from provisioning.
+// Returns false (and keeps the previous suite) if the name is unknown.
+bool secureMqttSetKmsSigSuite(const char* name);
 
-// Full name of the secure topic (e.g., "iot/esp32/telemetry")
-void secureMqttSetTopic(const char* topic_name);
+// Routes the KMS answers (baseTopic/clientId/kms/clientauth, key, rekey
+// and ticket) and the fleet-wide group rekeys (baseTopic/kms/grouprekey,
+// see group_keys.h) to the secure layer, and builds the KMS topics it
+// publishes on.
+// Call at connect time, before secureMqttBeginHandshake(). Returns false
+// if the router is full or the topics are too long.
+bool secureMqttAddKmsRoutes(TopicRouter* router,
+                            PubSubClient& client,
+                            const char* baseTopic,
+                            const char* clientId);
 
-// Starts the KMS handshake for this client/topic.
-void secureMqttBeginHandshake(PubSubClient& client,
-                              const char* baseTopic,
-                              const char* clientId);
+// Starts the KMS handshake for every secure topic. With a session ticket
+// from an earlier handshake (kept in NVS across reboots) the device asks
+// to resume: the KMS then sends the current TOPIC_keys in one round trip,
+// or falls back to the full handshake if it refuses the ticket. Without a
+// ticket, the auth message proves every TOPIC_auth_key so the KMS can
+// answer with its signature and the keys at once (SECURE_FAST_HANDSHAKE);
+// a KMS that does not accept it runs the clientauth/clientverify exchange.
+void secureMqttBeginHandshake(PubSubClient& client);
 
-// Must be called from the MQTT callback to handle KMS messages.
-// Returns true if the message was for the KMS and has been handled.
-bool secureMqttHandleKmsMessage(const char* topic,
-                                const uint8_t* payload,
-                                unsigned int length,
-                                const char* baseTopic,
-                                const char* clientId,
-                                PubSubClient& client);
-
-// Returns true when TOPIC_key is ready
+// Returns true when every secure topic has its TOPIC_key
 bool secureMqttIsReady();
 
+// Returns true when appTopic is a secure topic with a TOPIC_key we may
+// publish under (see secureMqttRotationRequest)
+bool secureMqttIsTopicReady(const char* appTopic);
+
+// Returns true when appTopic is a secure topic with a TOPIC_key, so its
+// frames can be decrypted. Unlike secureMqttIsTopicReady, this holds while
+// the topic waits for a fresh epoch to publish under.
+bool secureMqttHasTopicKey(const char* appTopic);
+
+// Current epoch of appTopic's TOPIC_key. Returns false before the first key.
+bool secureMqttTopicEpoch(const char* appTopic, uint32_t* epoch);
+
+// Wire format used for secure data-plane frames.
+//  - SECURE_FRAME_JSON  : hex fields inside a JSON object (default)
+//  - SECURE_FRAME_BINARY: versioned fixed header, then ciphertext and tag
+//    [ver:1][epoch:4][counter:4][sender:4][iv:12][ciphertext:N][tag:16]
+//    (integers big-endian, sender = FNV-1a 32 of the sender client_id)
+//  - SECURE_FRAME_SESSION: binary header without IV, sealed with a traffic
+//    key derived once per (topic, epoch, sender); the nonce is built from
+//    the sender and the counter, so no per-message HKDF, setkey or RNG.
+//    The sender's client_id (at most 32 bytes) is carried and bound into
+//    the traffic key, so colliding sender indexes never share a key.
+//    [ver:1][epoch:4][counter:4][sender:4][id_len:1][client_id][ciphertext:N][tag:16]
+enum SecureFrameFormat : uint8_t {
+  SECURE_FRAME_JSON    = 0,
+  SECURE_FRAME_BINARY  = 1,
+  SECURE_FRAME_SESSION = 2,
+};
+
+// Registers a secure topic (e.g., "iot/esp32/telemetry") to publish and/or
+// receive on, with the frame format used when publishing on it. Each topic
+// gets its own TOPIC_key and epochs from the KMS, its own message counter
+// and its own replay windows. Call after secureMqttInit(), before the
+// handshake. Returns false if the topic table is full.
+bool secureMqttAddTopic(const char* appTopic, SecureFrameFormat format);
+
+// Changes the publishing frame format of a registered topic.
+// Incoming frames are always auto-detected, whatever the local setting.
+bool secureMqttSetTopicFrameFormat(const char* appTopic, SecureFrameFormat format);
+
+// Compact sender identifier carried in binary frames
+uint32_t secureMqttSenderIndex(const char* clientId);
+
+// Largest frame secureMqttEncryptFrame() can produce (JSON format, 256-byte payload)
+#define SECURE_MQTT_MAX_FRAME 1024
+
+// Encrypts a payload for appTopic into `out` using the topic's frame format,
+// without publishing. Returns the frame length, 0 on failure. Safe to call
+// from a different task than the one running the handshake.
+size_t secureMqttEncryptFrame(const char* appTopic,
+                              const uint8_t* plaintext,
+                              size_t plaintextLen,
+                              uint8_t* out,
+                              size_t outSize);
+
 // Encrypts a payload and publishes it to appTopic (e.g., "iot/esp32/telemetry")
 bool secureMqttEncryptAndPublish(PubSubClient& client,
                                  const char* appTopic,
                                  const uint8_t* plaintext,
                                  size_t plaintextLen);
 
-// Decrypts an incoming secure payload for the expected topic into outBuffer.
-// Returns true on success.
+// Decrypted payload, pointing into the buffer it was decrypted in. Not
+// NUL-terminated.
+struct SecurePlaintext {
+  const uint8_t* data;
+  size_t len;
+};
+
+// Decrypts a frame received on expectedTopic in place: the fields are
+// parsed where they lie and the plaintext overwrites the frame, so `plain`
+// points into `frame` (which must stay alive while it is used). Returns
+// true on success.
+bool secureMqttOpenFrame(const char* expectedTopic,
+                         uint8_t* frame,
+                         size_t length,
+                         SecurePlaintext* plain);
+
+// Decrypts an incoming secure payload for the expected topic into
+// outBuffer, NUL-terminated, leaving the payload untouched. Returns true
+// on success.
 bool secureMqttDecryptPayload(const uint8_t* payload,
                               unsigned int length,
                               const char* expectedTopic,
                               char* outBuffer,
                               size_t outBufferSize);
 
-// Set to true when the last decrypt failed due to AES-GCM tag/verification
-// (i.e. the payload could not be authenticated). The MQTT layer can
-// observe this flag and request a rekey from the KMS.
-extern volatile bool g_secureDecryptTagFailure;
+// Returns true (and clears the flag) if a frame failed AES-GCM
+// verification on a secure topic since the last call, i.e. the payload
+// could not be authenticated. The topic is copied to topicOut so the
+// MQTT layer can request its current key from the KMS.
+bool secureMqttConsumeDecryptFailure(char* topicOut, size_t topicOutSize);
+
+// A topic registered without a stored counter lease (new device, erased
+// NVS) restarts its counter, so its nonces may repeat ones sent before
+// under the epochs of that time. It does not publish until an epoch newer
+// than the first one it receives is installed. Returns true while a topic
+// waits for that epoch, with the topic and the request_key body asking the
+// KMS to rotate the key: {"topic":..,"rotate":<stale epoch>,"proof":..},
+// the proof being made with the topic's TOPIC_auth_key.
+bool secureMqttRotationRequest(char* topicOut, size_t topicOutSize,
+                               char* body, size_t bodySize);
+
+// Uncomment (or build with -DSECURE_MQTT_BENCH) to run the crypto
+// micro-benchmark at boot
+// #define SECURE_MQTT_BENCH
 
-// Consume and clear the decrypt-failure flag (atomic-ish)
-bool secureMqttConsumeDecryptFailure();
+#ifdef SECURE_MQTT_BENCH
+// Prints the per-message crypto cost of the per-message-key path and of
+// the session path, and the signature verify time of each suite.
+// Replaces the KMS key: run it before the provisioned key is set.
+void secureMqttRunBenchmark(unsigned int iterations);
+#endif
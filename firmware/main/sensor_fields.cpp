@@ -0,0 +1,91 @@
+#include "sensor_fields.h"
+
+#include <string.h>
+
+static const char* skipSpaces(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+  return p;
+}
+
+// [-]digits[.digits], bounded by `end`. Exponents are not produced by the
+// firmware or the KMS and are rejected.
+static const char* parseNumber(const char* p, const char* end, float* out) {
+  bool negative = false;
+  if (p < end && *p == '-') {
+    negative = true;
+    ++p;
+  }
+  const char* digits = p;
+  float value = 0.0f;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10.0f + (float)(*p - '0');
+    ++p;
+  }
+  if (p < end && *p == '.') {
+    ++p;
+    float scale = 0.1f;
+    while (p < end && *p >= '0' && *p <= '9') {
+      value += (float)(*p - '0') * scale;
+      scale *= 0.1f;
+      ++p;
+    }
+  }
+  if (p == digits) return nullptr;
+  *out = negative ? -value : value;
+  return p;
+}
+
+// Skips a value that is not a number (string, true/false/null)
+static const char* skipValue(const char* p, const char* end) {
+  if (p < end && *p == '"') {
+    const char* close = (const char*)memchr(p + 1, '"', end - (p + 1));
+    return close ? close + 1 : nullptr;
+  }
+  while (p < end && *p != ',' && *p != '}') ++p;
+  return p;
+}
+
+static bool keyIs(const char* key, size_t keyLen, const char* name) {
+  return keyLen == strlen(name) && memcmp(key, name, keyLen) == 0;
+}
+
+bool parseSensorFields(const char* json, size_t len, SensorFields* fields) {
+  memset(fields, 0, sizeof(*fields));
+  const char* end = json + len;
+  const char* p = skipSpaces(json, end);
+  if (p == end || *p != '{') return false;
+  p = skipSpaces(p + 1, end);
+
+  while (p < end && *p != '}') {
+    if (*p != '"') return false;
+    const char* key = p + 1;
+    const char* close = (const char*)memchr(key, '"', end - key);
+    if (!close) return false;
+    size_t keyLen = close - key;
+
+    p = skipSpaces(close + 1, end);
+    if (p == end || *p != ':') return false;
+    p = skipSpaces(p + 1, end);
+
+    float value;
+    const char* next = parseNumber(p, end, &value);
+    if (next) {
+      if (keyIs(key, keyLen, "temperature")) {
+        fields->hasTemperature = true;
+        fields->temperature = value;
+      } else if (keyIs(key, keyLen, "humidity")) {
+        fields->hasHumidity = true;
+        fields->humidity = value;
+      } else if (keyIs(key, keyLen, "sos")) {
+        fields->sos = (value != 0.0f);
+      }
+    } else {
+      next = skipValue(p, end);
+      if (!next) return false;
+    }
+
+    p = skipSpaces(next, end);
+    if (p < end && *p == ',') p = skipSpaces(p + 1, end);
+  }
+  return p < end;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Application fields of a decrypted reading, e.g. {"temperature": 21.5}
+// or {"sos":1}. Parsed in one pass over the plaintext, without copying it
+// or needing a NUL terminator.
+
+struct SensorFields {
+  bool hasTemperature;
+  float temperature;
+  bool hasHumidity;
+  float humidity;
+  bool sos;
+};
+
+// Fills `fields` from a flat JSON object. Unknown keys are skipped.
+// Returns false if the object is malformed.
+bool parseSensorFields(const char* json, size_t len, SensorFields* fields);
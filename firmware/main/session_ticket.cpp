@@ -0,0 +1,77 @@
+#include "session_ticket.h"
+
+#include <string.h>
+
+static const uint8_t STORED_VERSION = 1;
+static const size_t STORED_HEADER = 1 + 4 + 4 + 32 + 2;
+
+void sessionTicketClear(SessionTicket* ticket) {
+  memset(ticket, 0, sizeof(*ticket));
+}
+
+bool sessionTicketSet(SessionTicket* ticket,
+                      uint32_t owner,
+                      const uint8_t* blob, size_t len,
+                      const uint8_t secret[32],
+                      uint32_t lifetimeS,
+                      uint32_t nowMs) {
+  if (len == 0 || len > SESSION_TICKET_MAX) return false;
+  ticket->valid = true;
+  ticket->used = false;
+  ticket->ageKnown = true;
+  ticket->owner = owner;
+  ticket->receivedMs = nowMs;
+  ticket->lifetimeMs = lifetimeS > UINT32_MAX / 1000 ? UINT32_MAX : lifetimeS * 1000;
+  memcpy(ticket->secret, secret, 32);
+  ticket->len = (uint16_t)len;
+  memcpy(ticket->blob, blob, len);
+  return true;
+}
+
+bool sessionTicketUsable(const SessionTicket* ticket, uint32_t owner, uint32_t nowMs) {
+  if (!ticket->valid || ticket->used || ticket->owner != owner) return false;
+  return !ticket->ageKnown || nowMs - ticket->receivedMs < ticket->lifetimeMs;
+}
+
+static void putU32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static uint32_t getU32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+size_t sessionTicketSerialize(const SessionTicket* ticket, uint8_t* out, size_t outSize) {
+  if (!ticket->valid) return 0;
+  size_t total = STORED_HEADER + ticket->len;
+  if (outSize < total) return 0;
+  out[0] = STORED_VERSION;
+  putU32(out + 1, ticket->owner);
+  putU32(out + 5, ticket->lifetimeMs);
+  memcpy(out + 9, ticket->secret, 32);
+  out[41] = (uint8_t)(ticket->len >> 8);
+  out[42] = (uint8_t)ticket->len;
+  memcpy(out + STORED_HEADER, ticket->blob, ticket->len);
+  return total;
+}
+
+bool sessionTicketDeserialize(SessionTicket* ticket, const uint8_t* in, size_t len) {
+  sessionTicketClear(ticket);
+  if (len < STORED_HEADER || in[0] != STORED_VERSION) return false;
+  size_t blobLen = ((size_t)in[41] << 8) | in[42];
+  if (blobLen == 0 || blobLen > SESSION_TICKET_MAX || len != STORED_HEADER + blobLen) {
+    return false;
+  }
+  ticket->valid = true;
+  ticket->used = false;
+  ticket->ageKnown = false;
+  ticket->owner = getU32(in + 1);
+  ticket->lifetimeMs = getU32(in + 5);
+  memcpy(ticket->secret, in + 9, 32);
+  ticket->len = (uint16_t)blobLen;
+  memcpy(ticket->blob, in + STORED_HEADER, blobLen);
+  return true;
+}
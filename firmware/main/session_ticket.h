@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Session ticket for handshake resumption. After a full handshake the KMS
+// sends an opaque ticket (sealed with a key only the KMS has) together
+// with its lifetime; both sides derive the same resumption secret from
+// the handshake. On the next connect the device presents the ticket and
+// an HMAC of its fresh challenge under that secret, and the KMS answers
+// with the current TOPIC_keys directly (see secure_mqtt.cpp).
+//
+// A ticket is presented at most once: every resumption or full handshake
+// brings a new one. The KMS enforces the expiry; the device only skips a
+// ticket it knows to be too old (age is unknown after a reboot, it is
+// then simply tried).
+
+#define SESSION_TICKET_MAX 128  // sealed ticket bytes, as sent by the KMS
+
+struct SessionTicket {
+  bool valid;
+  bool used;             // presented since it was received
+  bool ageKnown;         // receivedMs is meaningful (no reboot since)
+  uint32_t owner;        // sender index of the client id it was issued to
+  uint32_t receivedMs;
+  uint32_t lifetimeMs;
+  uint8_t secret[32];    // resumption secret
+  uint16_t len;
+  uint8_t blob[SESSION_TICKET_MAX];
+};
+
+void sessionTicketClear(SessionTicket* ticket);
+
+// Stores a freshly issued ticket. Returns false if it is too large.
+bool sessionTicketSet(SessionTicket* ticket,
+                      uint32_t owner,
+                      const uint8_t* blob, size_t len,
+                      const uint8_t secret[32],
+                      uint32_t lifetimeS,
+                      uint32_t nowMs);
+
+// True if the ticket of `owner` is worth presenting now
+bool sessionTicketUsable(const SessionTicket* ticket, uint32_t owner, uint32_t nowMs);
+
+// Persistent form, for NVS:
+//   [ver:1][owner:4][lifetime_ms:4][secret:32][len:2][blob:len]
+#define SESSION_TICKET_STORED_MAX (1 + 4 + 4 + 32 + 2 + SESSION_TICKET_MAX)
+size_t sessionTicketSerialize(const SessionTicket* ticket, uint8_t* out, size_t outSize);
+// Loads a stored ticket (age unknown). Returns false, leaving the ticket
+// cleared, if the data is malformed.
+bool sessionTicketDeserialize(SessionTicket* ticket, const uint8_t* in, size_t len);
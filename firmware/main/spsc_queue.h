@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+// Fixed-size lock-free ring buffer for exactly one producer task and one
+// consumer task. Head and tail are free-running counters; only the
+// producer writes head and only the consumer writes tail, so no lock and
+// no compare-and-swap is needed. A full queue refuses new items (the
+// caller decides whether to drop), it never blocks.
+//
+// Large items can be filled and read in place: the producer writes into
+// reserve() then calls commit(), the consumer reads front() then calls
+// release(). That saves a copy of every frame through the stack.
+
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+  // Producer side: free slot to fill, or nullptr if the queue is full
+  T* reserve() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == N) return nullptr;
+    return &slots_[head & (N - 1)];
+  }
+
+  // Producer side: makes the slot returned by reserve() visible
+  void commit() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool push(const T& item) {
+    T* slot = reserve();
+    if (!slot) return false;
+    *slot = item;
+    commit();
+    return true;
+  }
+
+  // Consumer side: oldest item, or nullptr if the queue is empty
+  T* front() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) return nullptr;
+    return &slots_[tail & (N - 1)];
+  }
+
+  // Consumer side: frees the slot returned by front()
+  void release() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool pop(T* out) {
+    T* item = front();
+    if (!item) return false;
+    *out = *item;
+    release();
+    return true;
+  }
+
+  // Approximate when called from a third task
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T slots_[N];
+  std::atomic<size_t> head_{0};  // written by the producer only
+  std::atomic<size_t> tail_{0};  // written by the consumer only
+};
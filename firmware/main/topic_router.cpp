@@ -0,0 +1,78 @@
+#include "topic_router.h"
+#include "topic_table.h"
+
+#include <string.h>
+
+static const uint8_t NONE = 0xFF;
+
+static uint8_t bucketOf(uint32_t hash) {
+  return (uint8_t)(hash & (TOPIC_ROUTER_BUCKETS - 1));
+}
+
+static int findHashed(const TopicRouter* router, const char* topic, uint32_t hash) {
+  uint8_t i = router->buckets[bucketOf(hash)];
+  while (i != NONE) {
+    const TopicRoute& r = router->routes[i];
+    if (r.hash == hash && strcmp(r.topic, topic) == 0) return i;
+    i = r.chain;
+  }
+  return -1;
+}
+
+void topicRouterInit(TopicRouter* router) {
+  memset(router->buckets, NONE, sizeof(router->buckets));
+  router->count = 0;
+}
+
+bool topicRouterAdd(TopicRouter* router,
+                    const char* topic,
+                    TopicHandler handler,
+                    const RouteContext& ctx) {
+  return topicRouterAddJoined(router, topic, "", handler, ctx);
+}
+
+bool topicRouterAddJoined(TopicRouter* router,
+                          const char* prefix,
+                          const char* suffix,
+                          TopicHandler handler,
+                          const RouteContext& ctx) {
+  if (!prefix || !suffix || !handler) return false;
+  size_t prefixLen = strlen(prefix);
+  size_t suffixLen = strlen(suffix);
+  if (prefixLen + suffixLen >= TOPIC_ROUTER_NAME_MAX) return false;
+
+  char topic[TOPIC_ROUTER_NAME_MAX];
+  memcpy(topic, prefix, prefixLen);
+  memcpy(topic + prefixLen, suffix, suffixLen + 1);
+  uint32_t hash = topicNameHash(topic);
+
+  int i = findHashed(router, topic, hash);
+  if (i < 0) {
+    if (router->count >= TOPIC_ROUTER_CAPACITY) return false;
+    i = router->count++;
+    TopicRoute& r = router->routes[i];
+    memcpy(r.topic, topic, prefixLen + suffixLen + 1);
+    r.hash = hash;
+    r.chain = router->buckets[bucketOf(hash)];
+    router->buckets[bucketOf(hash)] = (uint8_t)i;
+  }
+  router->routes[i].handler = handler;
+  router->routes[i].ctx = ctx;
+  return true;
+}
+
+const TopicRoute* topicRouterFind(const TopicRouter* router, const char* topic) {
+  if (!topic) return nullptr;
+  int i = findHashed(router, topic, topicNameHash(topic));
+  return i >= 0 ? &router->routes[i] : nullptr;
+}
+
+bool topicRouterDispatch(const TopicRouter* router,
+                         const char* topic,
+                         const uint8_t* payload,
+                         unsigned int length) {
+  const TopicRoute* route = topicRouterFind(router, topic);
+  if (!route) return false;
+  route->handler(route->ctx, topic, payload, length);
+  return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+class PubSubClient;
+
+// Dispatch table for incoming MQTT messages. Every subscribed topic (and
+// every KMS action topic under this client) is registered once at connect
+// time with its handler and context; a message then costs one FNV-1a hash
+// of its topic and a bucket lookup, whatever the number of routes. Topics
+// are exact names: incoming messages never carry wildcards.
+
+#ifndef TOPIC_ROUTER_CAPACITY
+#define TOPIC_ROUTER_CAPACITY 16   // routes (< 255)
+#endif
+#define TOPIC_ROUTER_BUCKETS 32    // power of two, >= capacity
+#define TOPIC_ROUTER_NAME_MAX 96   // including the terminator
+
+// Handed to the handler of a route, as registered
+struct RouteContext {
+  PubSubClient* client;  // to publish answers on
+  uint8_t index;         // handler-specific, e.g. secure topic or KMS action
+};
+
+typedef void (*TopicHandler)(const RouteContext& ctx,
+                             const char* topic,
+                             const uint8_t* payload,
+                             unsigned int length);
+
+struct TopicRoute {
+  char topic[TOPIC_ROUTER_NAME_MAX];
+  uint32_t hash;
+  uint8_t chain;         // next route in the same bucket
+  TopicHandler handler;
+  RouteContext ctx;
+};
+
+struct TopicRouter {
+  TopicRoute routes[TOPIC_ROUTER_CAPACITY];
+  uint8_t buckets[TOPIC_ROUTER_BUCKETS];
+  uint8_t count;
+};
+
+// Empties the router; required before the first use (re-registering on
+// reconnect starts with it too)
+void topicRouterInit(TopicRouter* router);
+
+// Routes `topic` to `handler`, replacing an existing route for the same
+// topic. Returns false if the router is full or the topic is too long.
+bool topicRouterAdd(TopicRouter* router,
+                    const char* topic,
+                    TopicHandler handler,
+                    const RouteContext& ctx);
+
+// Same, the topic being "<prefix><suffix>" (e.g. "iot/esp32/dev1/kms/" and
+// "key"), so callers do not need a scratch buffer.
+bool topicRouterAddJoined(TopicRouter* router,
+                          const char* prefix,
+                          const char* suffix,
+                          TopicHandler handler,
+                          const RouteContext& ctx);
+
+const TopicRoute* topicRouterFind(const TopicRouter* router, const char* topic);
+
+// Calls the handler of `topic`. Returns false if no route matches.
+bool topicRouterDispatch(const TopicRouter* router,
+                         const char* topic,
+                         const uint8_t* payload,
+                         unsigned int length);
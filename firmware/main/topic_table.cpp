@@ -0,0 +1,110 @@
+#include "topic_table.h"
+
+#include <string.h>
+
+static const uint8_t NONE = 0xFF;
+
+uint32_t topicNameHash(const char* name) {
+  // FNV-1a 32-bit
+  uint32_t h = 2166136261u;
+  for (const char* p = name; *p; ++p) {
+    h ^= (uint8_t)*p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint8_t bucketOf(uint32_t hash) {
+  return (uint8_t)(hash & (SECURE_TOPIC_BUCKETS - 1));
+}
+
+static int findHashed(const TopicTable* table, const char* name, uint32_t hash) {
+  uint8_t i = table->buckets[bucketOf(hash)];
+  while (i != NONE) {
+    const TopicEntry& e = table->entries[i];
+    if (e.hash == hash && strcmp(e.name, name) == 0) return i;
+    i = e.chain;
+  }
+  return -1;
+}
+
+void topicTableInit(TopicTable* table) {
+  memset(table->entries, 0, sizeof(table->entries));
+  memset(table->buckets, NONE, sizeof(table->buckets));
+  table->count = 0;
+}
+
+int topicTableAdd(TopicTable* table, const char* name) {
+  if (!name || strlen(name) >= SECURE_TOPIC_NAME_MAX) return -1;
+
+  uint32_t hash = topicNameHash(name);
+  int found = findHashed(table, name, hash);
+  if (found >= 0) return found;
+  if (table->count >= SECURE_TOPIC_CAPACITY) return -1;
+
+  uint8_t i = table->count++;
+  TopicEntry& e = table->entries[i];
+  memset(&e, 0, sizeof(e));
+  strcpy(e.name, name);
+  e.hash = hash;
+  e.chain = table->buckets[bucketOf(hash)];
+  table->buckets[bucketOf(hash)] = i;
+  return i;
+}
+
+int topicTableFind(const TopicTable* table, const char* name) {
+  if (!name) return -1;
+  return findHashed(table, name, topicNameHash(name));
+}
+
+const TopicKeySlot* topicCurrentKey(const TopicEntry* entry) {
+  return entry->keyCount ? &entry->keys[entry->keyHead] : nullptr;
+}
+
+const uint8_t* topicKeyForEpoch(const TopicEntry* entry, uint32_t epoch) {
+  for (uint8_t n = 0; n < entry->keyCount; ++n) {
+    const TopicKeySlot& slot = entry->keys[n];
+    if (slot.epoch == epoch) return slot.key;
+  }
+  return nullptr;
+}
+
+// Serial arithmetic, epochs may wrap
+static bool epochNewer(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) > 0;
+}
+
+TopicKeyInstall topicInstallKey(TopicEntry* entry, uint32_t epoch, const uint8_t* key) {
+  const TopicKeySlot* current = topicCurrentKey(entry);
+  bool becomesCurrent = !current || !epochNewer(current->epoch, epoch);
+
+  int slot = -1;
+  for (uint8_t n = 0; n < entry->keyCount; ++n) {
+    if (entry->keys[n].epoch == epoch) {
+      slot = n;
+      break;
+    }
+  }
+
+  if (slot < 0) {
+    if (entry->keyCount < SECURE_EPOCH_RING) {
+      slot = entry->keyCount++;
+    } else {
+      for (uint8_t n = 0; n < SECURE_EPOCH_RING; ++n) {
+        if (n == entry->keyHead) continue;
+        if (slot < 0 || epochNewer(entry->keys[slot].epoch, entry->keys[n].epoch)) slot = n;
+      }
+      if (becomesCurrent) {
+        if (slot < 0) slot = entry->keyHead;  // ring of one
+      } else if (slot < 0 || !epochNewer(epoch, entry->keys[slot].epoch)) {
+        return TOPIC_KEY_REFUSED;
+      }
+    }
+    entry->keys[slot].epoch = epoch;
+  }
+
+  memcpy(entry->keys[slot].key, key, 32);
+  if (!becomesCurrent) return TOPIC_KEY_RECEIVE_ONLY;
+  entry->keyHead = (uint8_t)slot;
+  return TOPIC_KEY_CURRENT;
+}
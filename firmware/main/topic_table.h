@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Fixed-capacity table of the secure topics of this device. Each topic
+// has its own ring of TOPIC_keys indexed by epoch, so topics rotate
+// independently. Lookup hashes the topic name (FNV-1a) into chained
+// buckets; the name itself is only compared once the hash matched.
+// Topics are registered at boot and never removed.
+
+#ifndef SECURE_TOPIC_CAPACITY
+#define SECURE_TOPIC_CAPACITY 4    // secure topics per device (< 255)
+#endif
+#define SECURE_TOPIC_BUCKETS 8     // power of two, >= capacity
+#define SECURE_TOPIC_NAME_MAX 64   // including the terminator
+#ifndef SECURE_EPOCH_RING
+#define SECURE_EPOCH_RING 2        // current epoch + the ones still accepted
+#endif
+
+struct TopicKeySlot {
+  uint32_t epoch;
+  uint8_t key[32];
+};
+
+struct TopicEntry {
+  char name[SECURE_TOPIC_NAME_MAX];
+  uint32_t hash;
+  uint8_t chain;       // next entry in the same bucket
+  uint8_t keyCount;    // valid slots in `keys`, 0 until the first key
+  uint8_t keyHead;     // slot of the current epoch
+  TopicKeySlot keys[SECURE_EPOCH_RING];
+};
+
+struct TopicTable {
+  TopicEntry entries[SECURE_TOPIC_CAPACITY];
+  uint8_t buckets[SECURE_TOPIC_BUCKETS];
+  uint8_t count;
+};
+
+uint32_t topicNameHash(const char* name);
+
+void topicTableInit(TopicTable* table);
+
+// Index of `name`, adding it if needed. -1 if the table is full or the
+// name is too long.
+int topicTableAdd(TopicTable* table, const char* name);
+
+// Index of `name`, or -1
+int topicTableFind(const TopicTable* table, const char* name);
+
+// Key of the current epoch, nullptr before the first key
+const TopicKeySlot* topicCurrentKey(const TopicEntry* entry);
+
+// Key of `epoch` if it is still in the ring, nullptr otherwise
+const uint8_t* topicKeyForEpoch(const TopicEntry* entry, uint32_t epoch);
+
+enum TopicKeyInstall : uint8_t {
+  TOPIC_KEY_CURRENT = 0,  // the epoch is the current one
+  TOPIC_KEY_RECEIVE_ONLY, // older than the current epoch, kept for decrypting
+  TOPIC_KEY_REFUSED,      // older than every epoch in the ring
+};
+
+// Installs the key of `epoch`. Epochs compare with serial arithmetic, as
+// the group rekey versions. A newer (or the same) epoch becomes current, an
+// older one never does: a late or replayed KMS answer must not bring back a
+// key that a rotation or a revocation retired. It only fills a free slot or
+// replaces an even older epoch, for frames still in flight. A known epoch
+// is overwritten in place (the KMS resending it); a new one evicts the
+// oldest epoch other than the current one.
+TopicKeyInstall topicInstallKey(TopicEntry* entry, uint32_t epoch, const uint8_t* key);
@@ -0,0 +1,83 @@
+#include "ts_codec.h"
+
+#include <math.h>
+#include <string.h>
+
+// Largest code ('1111' + 32 bits) for the timestamp and both values
+static const uint16_t MAX_READING_BITS = 3 * 36;
+static const uint16_t STREAM_BITS = (TS_BATCH_BYTES - TS_BATCH_HEADER) * 8;
+
+static void putBits(TsBatch* batch, uint32_t value, uint8_t bits) {
+  // MSB first; the buffer is zeroed by tsBatchReset(), only set bits are written
+  for (int i = bits - 1; i >= 0; --i) {
+    if ((value >> i) & 1) {
+      uint16_t pos = batch->bitPos;
+      batch->buf[TS_BATCH_HEADER + pos / 8] |= (uint8_t)(0x80 >> (pos % 8));
+    }
+    batch->bitPos++;
+  }
+}
+
+static void putSigned(TsBatch* batch, int32_t v) {
+  uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+  if (z == 0) {
+    putBits(batch, 0x0, 1);
+  } else if (z < (1u << 7)) {
+    putBits(batch, 0x2, 2);
+    putBits(batch, z, 7);
+  } else if (z < (1u << 9)) {
+    putBits(batch, 0x6, 3);
+    putBits(batch, z, 9);
+  } else if (z < (1u << 12)) {
+    putBits(batch, 0xE, 4);
+    putBits(batch, z, 12);
+  } else {
+    putBits(batch, 0xF, 4);
+    putBits(batch, z, 32);
+  }
+}
+
+static int32_t toTenths(float value) {
+  return (int32_t)lroundf(value * 10.0f);
+}
+
+void tsBatchReset(TsBatch* batch) {
+  memset(batch, 0, sizeof(*batch));
+}
+
+bool tsBatchAppend(TsBatch* batch, uint32_t ms, float temperature, float humidity) {
+  if (batch->count == UINT8_MAX || STREAM_BITS - batch->bitPos < MAX_READING_BITS) {
+    return false;
+  }
+
+  if (batch->count == 0) batch->firstMs = ms;
+  // Ticks since the first reading: wraps of millis() cancel out
+  uint32_t tick = (ms - batch->firstMs) / TS_BATCH_TICK_MS;
+  int32_t temp = toTenths(temperature);
+  int32_t hum = toTenths(humidity);
+
+  if (batch->count > 0) {
+    int32_t delta = (int32_t)(tick - batch->lastTick);
+    putSigned(batch, delta - batch->lastDelta);
+    batch->lastDelta = delta;
+  }
+  putSigned(batch, temp - batch->lastTemp);
+  putSigned(batch, hum - batch->lastHum);
+
+  batch->lastTick = tick;
+  batch->lastTemp = temp;
+  batch->lastHum = hum;
+  batch->count++;
+  return true;
+}
+
+size_t tsBatchFinish(TsBatch* batch, uint32_t nowMs) {
+  if (batch->count == 0) return 0;
+  uint32_t age = (nowMs - batch->firstMs) / TS_BATCH_TICK_MS;
+  if (age > UINT16_MAX) age = UINT16_MAX;
+  batch->buf[0] = TS_BATCH_VERSION;
+  batch->buf[1] = batch->count;
+  batch->buf[2] = (uint8_t)(age >> 8);
+  batch->buf[3] = (uint8_t)age;
+  return TS_BATCH_HEADER + (batch->bitPos + 7) / 8;
+}
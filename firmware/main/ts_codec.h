@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Batch of temperature/humidity readings, compressed in the style of
+// Gorilla (Pelkonen et al., VLDB 2015) so that a whole block is sealed
+// as one frame instead of one frame per reading:
+//   [ver:1][count:1][age:2][bit stream]
+// `age` is how long before the block was sealed the first reading was
+// taken, in TS_BATCH_TICK_MS ticks (big-endian, saturated). The stream
+// holds, for each reading, the delta-of-delta of its timestamp (in ticks,
+// absent for the first reading), then the deltas of temperature and
+// humidity (in tenths, from 0 for the first reading). Every integer uses
+// the same prefix code on its zigzag value z:
+//   z == 0      '0'
+//   z < 2^7     '10'   + 7 bits
+//   z < 2^9     '110'  + 9 bits
+//   z < 2^12    '1110' + 12 bits
+//   otherwise   '1111' + 32 bits
+// A steady sensor read at a steady period costs 3 bits per reading.
+// The values are fixed-point, so deltas compress better than the XOR of
+// the floats would. Decoded by kms/ts_codec.py.
+
+#define TS_BATCH_VERSION 0xB1   // never '{', so JSON readings are told apart
+#define TS_BATCH_BYTES   64     // encoded block, header included
+#define TS_BATCH_TICK_MS 100
+#define TS_BATCH_HEADER  4
+
+struct TsBatch {
+  uint8_t buf[TS_BATCH_BYTES];
+  uint16_t bitPos;       // bits written after the header
+  uint8_t count;
+  uint32_t firstMs;      // millis() of the first reading
+  uint32_t lastTick;     // ticks since firstMs
+  int32_t lastDelta;     // ticks between the last two readings
+  int32_t lastTemp;      // tenths of degC
+  int32_t lastHum;       // tenths of %RH
+};
+
+void tsBatchReset(TsBatch* batch);
+
+// Appends a reading taken at `ms` (millis()). Returns false, leaving the
+// batch untouched, if the block may not have room for it: seal it first.
+bool tsBatchAppend(TsBatch* batch, uint32_t ms, float temperature, float humidity);
+
+// Writes the header for a block sealed at `nowMs` and returns the block
+// length (0 if empty); the block is batch->buf. Reset before reusing.
+size_t tsBatchFinish(TsBatch* batch, uint32_t nowMs);
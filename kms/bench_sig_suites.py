@@ -0,0 +1,59 @@
+# bench_sig_suites.py
+"""
+Compare the KMS signature suites on the handshake path.
+
+For each suite this measures how many `clientauth` responses the KMS can
+produce per second (challenge signature + JSON message, as in
+KMS.handle_auth) and the size of that message. Device-side verify latency
+is printed by the ESP32 itself when the firmware is built with
+SECURE_MQTT_BENCH.
+
+Usage: uv run -m bench_sig_suites [seconds_per_suite]
+"""
+import json
+import os
+import sys
+import time
+
+from crypto_utils import SIG_SUITES, generate_kms_keys, sign, verify
+
+
+def bench_suite(suite: str, duration: float):
+    priv, pub, _ = generate_kms_keys(suite)
+
+    handshakes = 0
+    payload = b""
+    start = time.perf_counter()
+    while time.perf_counter() - start < duration:
+        challenge = os.urandom(32)
+        response = {
+            "challenge": challenge.hex(),
+            "signature": sign(priv, challenge).hex(),
+            "nonce_k": os.urandom(32).hex(),
+        }
+        payload = json.dumps(response, separators=(",", ":")).encode()
+        handshakes += 1
+    elapsed = time.perf_counter() - start
+
+    challenge = os.urandom(32)
+    signature = sign(priv, challenge)
+    verifies = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < duration:
+        assert verify(pub, signature, challenge)
+        verifies += 1
+    verify_elapsed = time.perf_counter() - start
+
+    return handshakes / elapsed, len(payload), verify_elapsed / verifies * 1e6
+
+
+def main():
+    duration = float(sys.argv[1]) if len(sys.argv) > 1 else 2.0
+    print(f"{'suite':<10} {'clientauth/s':>14} {'clientauth bytes':>17} {'host verify us':>15}")
+    for suite in SIG_SUITES:
+        rate, size, verify_us = bench_suite(suite, duration)
+        print(f"{suite:<10} {rate:>14.0f} {size:>17} {verify_us:>15.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -6,14 +6,27 @@ from typing import Tuple
 
 from cryptography.hazmat.primitives.kdf.hkdf import HKDF
 from cryptography.hazmat.primitives import hashes, serialization
-from cryptography.hazmat.primitives.asymmetric import rsa, padding
+from cryptography.hazmat.primitives.asymmetric import rsa, ec, padding
 from cryptography.hazmat.primitives.ciphers.aead import AESGCM
 from cryptography.hazmat.primitives import hashes
 
 
-def generate_kms_keys():
-    """Generate KMS RSA key pair and a symmetric master key."""
-    priv = rsa.generate_private_key(public_exponent=65537, key_size=2048)
+# Signature suites the KMS can authenticate with. The ESP32 learns the
+# suite at provisioning ("kms_sig_suite") and only accepts a KMS public
+# key of that type.
+#   rsa2048: RSA-2048 PKCS#1 v1.5 / SHA-256 (256-byte signature)
+#   p256   : ECDSA P-256 / SHA-256 (DER, at most 72 bytes)
+SIG_SUITES = ("rsa2048", "p256")
+
+
+def generate_kms_keys(sig_suite: str = "rsa2048"):
+    """Generate the KMS signing key pair and a symmetric master key."""
+    if sig_suite == "rsa2048":
+        priv = rsa.generate_private_key(public_exponent=65537, key_size=2048)
+    elif sig_suite == "p256":
+        priv = ec.generate_private_key(ec.SECP256R1())
+    else:
+        raise ValueError(f"Unknown signature suite {sig_suite!r}, expected one of {SIG_SUITES}")
     pub = priv.public_key()
     kms_master_key = os.urandom(32)  # 256 bits
     return priv, pub, kms_master_key
@@ -32,6 +45,8 @@ def hkdf(ikm: bytes, info: bytes, length: int, salt: bytes = None) -> bytes:
 
 
 def sign(privkey, data: bytes) -> bytes:
+    if isinstance(privkey, ec.EllipticCurvePrivateKey):
+        return privkey.sign(data, ec.ECDSA(hashes.SHA256()))
     return privkey.sign(
         data,
         padding.PKCS1v15(),
@@ -43,15 +58,10 @@ def verify(pubkey, signature: bytes, data: bytes) -> bool:
     from cryptography.exceptions import InvalidSignature
 
     try:
-        pubkey.verify(
-            signature,
-            data,
-            padding.PSS(
-                mgf=padding.MGF1(hashes.SHA256()),
-                salt_length=padding.PSS.MAX_LENGTH,
-            ),
-            hashes.SHA256(),
-        )
+        if isinstance(pubkey, ec.EllipticCurvePublicKey):
+            pubkey.verify(signature, data, ec.ECDSA(hashes.SHA256()))
+        else:
+            pubkey.verify(signature, data, padding.PKCS1v15(), hashes.SHA256())
         return True
     except InvalidSignature:
         return False
@@ -1,19 +1,67 @@
-from fastapi import FastAPI
-from fastapi.responses import HTMLResponse, PlainTextResponse
+import asyncio
+import json
+from typing import Optional, Set
+from fastapi import FastAPI, Header, Request
+from fastapi.responses import HTMLResponse, PlainTextResponse, JSONResponse, StreamingResponse
 from fastapi.staticfiles import StaticFiles
 from fastapi.middleware.cors import CORSMiddleware
 from contextlib import asynccontextmanager
-from webserver_utils import clear_kms_log
+from webserver_utils import (
+    EVENTS_UDP_HOST,
+    EVENTS_UDP_PORT,
+    clear_kms_log,
+    read_events,
+)
 
 LOG_FILE = "kms.log"
+METRICS_FILE = "kms_metrics.json"
+# Batches a slow stream client may have waiting before it rereads the file
+STREAM_QUEUE_SIZE = 64
+STREAM_KEEPALIVE_SECONDS = 15
+
+
+class EventHub(asyncio.DatagramProtocol):
+    """
+    Receives the event batches the KMS pushes as it writes them (see
+    webserver_utils.py) and hands them to every stream client.
+    """
+    def __init__(self):
+        self.streams: Set[asyncio.Queue] = set()
+
+    def datagram_received(self, data: bytes, addr):
+        header, _, lines = data.partition(b"\n")
+        try:
+            start, end = (int(x) for x in header.split())
+        except ValueError:
+            return
+        for q in self.streams:
+            try:
+                q.put_nowait((start, end, lines))
+            except asyncio.QueueFull:
+                pass  # that client catches up from the file
+
+    def subscribe(self) -> asyncio.Queue:
+        q = asyncio.Queue(maxsize=STREAM_QUEUE_SIZE)
+        self.streams.add(q)
+        return q
+
+    def unsubscribe(self, q: asyncio.Queue):
+        self.streams.discard(q)
+
+
+hub = EventHub()
+
 
 @asynccontextmanager
 async def lifespan(app: FastAPI):
     clear_kms_log()  # <-- automatic clearing
+    transport, _ = await asyncio.get_running_loop().create_datagram_endpoint(
+        lambda: hub, local_addr=(EVENTS_UDP_HOST, EVENTS_UDP_PORT))
     print("🚀 FastAPI started, kms.log cleared.")
 
     yield
 
+    transport.close()
     print("🛑 FastAPI stopping...")
 
 app = FastAPI(lifespan=lifespan)
@@ -36,10 +84,87 @@ def index():
     return HTMLResponse(content=content, media_type="text/html; charset=utf-8")
 
 @app.get("/events", response_class=PlainTextResponse)
-def get_events():
+def get_events(since: Optional[int] = None):
+    """
+    Without `since`, the whole log. With it, the events written after
+    that byte offset (negative: the last -since bytes of the log), the
+    offset to ask next in X-Events-Cursor, and X-Events-Reset: 1 if the
+    log was cleared since.
+    """
+    if since is not None:
+        cursor, data, reset = read_events(since)
+        headers = {"X-Events-Cursor": str(cursor), "X-Events-Reset": "1" if reset else "0"}
+        return PlainTextResponse(data.decode("utf-8", "replace"), headers=headers)
     try:
         # ensure logs are read as UTF-8 as well
         with open(LOG_FILE, "r", encoding="utf-8") as f:
             return f.read()
     except FileNotFoundError:
         return ""
+
+
+def sse_batch(cursor: int, data: bytes) -> str:
+    lines = data.decode("utf-8", "replace").rstrip("\n").split("\n")
+    return f"id: {cursor}\n" + "".join(f"data: {line}\n" for line in lines) + "\n"
+
+
+async def event_stream(request: Request, since: int):
+    """
+    Server-Sent Events: the events after `since`, read from the log, then
+    the batches pushed by the KMS as they come. Each message is a batch
+    of JSON lines, its id the offset after them. A batch missed in
+    between (lost datagram, slow client) is read from the log.
+    """
+    q = hub.subscribe()
+    try:
+        cursor = since
+        end = None
+        while True:
+            # Read the log up to `end` (None: to its end)
+            while end is None or cursor < end:
+                cursor, data, reset = await asyncio.to_thread(read_events, cursor)
+                if reset:
+                    yield "event: reset\ndata: \n\n"
+                if not data:
+                    break
+                yield sse_batch(cursor, data)
+
+            try:
+                start, end, data = await asyncio.wait_for(q.get(), STREAM_KEEPALIVE_SECONDS)
+            except asyncio.TimeoutError:
+                if await request.is_disconnected():
+                    return
+                yield ": keepalive\n\n"
+                end = None
+                continue
+            if start <= cursor < end:
+                # Offsets are line boundaries, the overlap is whole lines
+                yield sse_batch(end, data[cursor - start:])
+                cursor = end
+            # Otherwise a batch was missed (start > cursor): the loop above
+            # reads the log up to `end`, the queued batches it covers are
+            # then skipped (end <= cursor)
+    finally:
+        hub.unsubscribe(q)
+
+
+@app.get("/events/stream")
+async def stream_events(request: Request, since: int = 0,
+                        last_event_id: Optional[str] = Header(None)):
+    """Live events; a reconnecting EventSource resumes at Last-Event-ID."""
+    if last_event_id and last_event_id.isdigit():
+        since = int(last_event_id)
+    return StreamingResponse(
+        event_stream(request, since),
+        media_type="text/event-stream",
+        headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"},
+    )
+
+@app.get("/metrics")
+def get_metrics():
+    # fleet-wide stage timings and device memory, written by the KMS (metrics.py)
+    try:
+        with open(METRICS_FILE, "r", encoding="utf-8") as f:
+            return JSONResponse(content=json.load(f))
+    except (FileNotFoundError, ValueError):
+        return JSONResponse(content={"updated": None, "stages": [], "memory": []})
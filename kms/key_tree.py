@@ -0,0 +1,163 @@
+# key_tree.py
+import heapq
+import os
+import struct
+from typing import Callable, Dict, Iterable, List, Optional, Tuple
+
+from crypto_utils import aes_gcm_encrypt
+
+# Logical key hierarchy of one topic (see firmware/main/group_keys.h).
+# Binary tree numbered from the root (1), children 2n and 2n+1, members
+# on the leaves [2^depth, 2^(depth+1)). A member's leaf key is its own
+# TOPIC_key_enc_key; it holds the keys of every node above its leaf, and
+# the root key wraps the TOPIC_key. A node only has a key while a member
+# is below it.
+#
+# Group rekey message, on BASE_TOPIC/kms/grouprekey:
+#   [ver:1][topic hash:4][count:1] then `count` wraps of
+#   [target:2][version:4][under:2][nonce:12][ciphertext:32][tag:16]
+# i.e. the key of node `target` (0: the TOPIC_key, version = its epoch)
+# sealed with the current key of node `under`. Wraps are ordered so that
+# every key is delivered before it is used to unwrap another one.
+# The nonce is random: versions restart when a node is recreated or the
+# KMS restarts, and leaf keys never change, so (target, version) does not
+# identify a wrap under a given key. Version 0x01 derived the nonce from it.
+GROUP_REKEY_VERSION = 0x02
+GROUP_HEADER = struct.Struct(">BIB")
+GROUP_WRAP = struct.Struct(">HIH")
+GROUP_NONCE_LEN = 12
+GROUP_WRAP_LEN = GROUP_WRAP.size + GROUP_NONCE_LEN + 32 + 16
+# Wraps per message, so a message fits the devices' MQTT buffer
+GROUP_MAX_WRAPS = 24
+# Individual path, in the /kms/key answer: [leaf:2][count:1] then
+# `count` entries [node:2][version:4][key:32], sealed with the member's
+# TOPIC_key_enc_key
+GROUP_PATH_HEADER = struct.Struct(">HB")
+GROUP_PATH_ENTRY = struct.Struct(">HI32s")
+DEFAULT_GROUP_TREE_DEPTH = 12
+MAX_GROUP_TREE_DEPTH = 15
+
+
+class KeyTree:
+    def __init__(self, topic_hash: int, depth: int, leaf_key: Callable[[str], bytes]):
+        if not 1 <= depth <= MAX_GROUP_TREE_DEPTH:
+            raise ValueError(f"group tree depth must be 1..{MAX_GROUP_TREE_DEPTH}")
+        self.topic_hash = topic_hash
+        self.depth = depth
+        self.leaf_key = leaf_key
+        self.first_leaf = 1 << depth
+        # node -> (version, key), interior nodes with members below
+        self.nodes: Dict[int, Tuple[int, bytes]] = {}
+        # node -> members below it
+        self.counts: Dict[int, int] = {}
+        self.members: Dict[str, int] = {}
+        self.leaves: Dict[int, str] = {}
+        self.free_leaves: List[int] = []
+        self.next_leaf = self.first_leaf
+
+    def __contains__(self, client_id: str) -> bool:
+        return client_id in self.members
+
+    def ancestors(self, leaf: int) -> Iterable[int]:
+        node = leaf >> 1
+        while node:
+            yield node
+            node >>= 1
+
+    def _wrap(self, target: int, version: int, key: bytes, under: int, under_key: bytes) -> bytes:
+        header = GROUP_WRAP.pack(target, version, under)
+        aad = b"KMS_GROUP_KEY" + self.topic_hash.to_bytes(4, "big") + header
+        nonce = os.urandom(GROUP_NONCE_LEN)
+        ciphertext, tag = aes_gcm_encrypt(under_key, nonce, key, aad=aad)
+        return header + nonce + ciphertext + tag
+
+    def _key_of(self, node: int) -> Optional[bytes]:
+        if node >= self.first_leaf:
+            client_id = self.leaves.get(node)
+            return self.leaf_key(client_id) if client_id is not None else None
+        entry = self.nodes.get(node)
+        return entry[1] if entry else None
+
+    def join(self, client_id: str) -> List[bytes]:
+        """Adds a member. Every key on its path is replaced, so it cannot
+        read earlier rekeys; the other members get each new key sealed
+        with the one it replaces. Raises ValueError if the tree is full."""
+        if client_id in self.members:
+            return []
+        if self.free_leaves:
+            leaf = heapq.heappop(self.free_leaves)
+        elif self.next_leaf < 2 * self.first_leaf:
+            leaf = self.next_leaf
+            self.next_leaf += 1
+        else:
+            raise ValueError("group tree full")
+        self.members[client_id] = leaf
+        self.leaves[leaf] = client_id
+
+        wraps = []
+        for node in self.ancestors(leaf):
+            key = os.urandom(32)
+            if node in self.nodes:
+                version, old_key = self.nodes[node]
+                self.nodes[node] = (version + 1, key)
+                wraps.append(self._wrap(node, version + 1, key, node, old_key))
+            else:
+                self.nodes[node] = (0, key)
+            self.counts[node] = self.counts.get(node, 0) + 1
+        return wraps
+
+    def leave(self, client_ids: Iterable[str]) -> List[bytes]:
+        """Removes members. Every key they held is replaced and sealed,
+        bottom-up, with the keys of the children that still have members:
+        about 2 * depth wraps for one member."""
+        changed = set()
+        for client_id in client_ids:
+            leaf = self.members.pop(client_id, None)
+            if leaf is None:
+                continue
+            del self.leaves[leaf]
+            heapq.heappush(self.free_leaves, leaf)
+            for node in self.ancestors(leaf):
+                self.counts[node] -= 1
+                if self.counts[node] == 0:
+                    del self.counts[node]
+                    del self.nodes[node]
+                    changed.discard(node)
+                else:
+                    changed.add(node)
+
+        wraps = []
+        # Children have larger numbers than their parent
+        for node in sorted(changed, reverse=True):
+            version, _ = self.nodes[node]
+            key = os.urandom(32)
+            self.nodes[node] = (version + 1, key)
+            for child in (2 * node, 2 * node + 1):
+                child_key = self._key_of(child)
+                if child_key is not None:
+                    wraps.append(self._wrap(node, version + 1, key, child, child_key))
+        return wraps
+
+    def wrap_topic_key(self, epoch: int, topic_key: bytes) -> Optional[bytes]:
+        """The TOPIC_key of `epoch` sealed with the root key, None if empty."""
+        root = self.nodes.get(1)
+        if root is None:
+            return None
+        return self._wrap(0, epoch, topic_key, 1, root[1])
+
+    def path_of(self, client_id: str) -> Optional[bytes]:
+        """Plaintext of the member's path keys, None if not a member."""
+        leaf = self.members.get(client_id)
+        if leaf is None:
+            return None
+        entries = [GROUP_PATH_ENTRY.pack(node, *self.nodes[node]) for node in self.ancestors(leaf)]
+        return GROUP_PATH_HEADER.pack(leaf, len(entries)) + b"".join(entries)
+
+    def messages(self, wraps: List[bytes]) -> List[bytes]:
+        """Group rekey messages carrying `wraps`, in order."""
+        out = []
+        for i in range(0, len(wraps), GROUP_MAX_WRAPS):
+            chunk = wraps[i : i + GROUP_MAX_WRAPS]
+            out.append(GROUP_HEADER.pack(GROUP_REKEY_VERSION, self.topic_hash, len(chunk))
+                       + b"".join(chunk))
+        return out
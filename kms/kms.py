@@ -3,8 +3,14 @@ import os
 import json
 import hmac
 import time
-from typing import Dict, Tuple
+import struct
+import threading
+from typing import Dict, Iterable, Optional, Tuple
 from webserver_utils import publish_event
+from metrics import FleetMetrics
+import ts_codec
+from key_tree import DEFAULT_GROUP_TREE_DEPTH, KeyTree
+from worker_pool import DEFAULT_DATA_QUEUE_SIZE, DEFAULT_DATA_WORKERS, WorkerPool
 
 
 from crypto_utils import (
@@ -14,6 +20,53 @@ from crypto_utils import (
     aes_gcm_encrypt,
     aes_gcm_decrypt,
 )
+from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+
+
+# Binary data-plane frames (see secure_mqtt.h):
+# v1      [ver:1][epoch:4][counter:4][sender:4][iv:12][ciphertext:N][tag:16]
+# session [ver:1][epoch:4][counter:4][sender:4][id_len:1][client_id][ciphertext:N][tag:16]
+# (0x02 was the session frame without the client_id, no longer accepted)
+FRAME_VERSION_BINARY = 0x01
+FRAME_VERSION_SESSION = 0x03
+FRAME_HEADER = struct.Struct(">BIII")
+FRAME_SENDER_ID_MAX = 32
+FRAME_IV_LEN = 12
+FRAME_TAG_LEN = 16
+
+# JSON frames: "v" 2 has AAD = counter || topic_name || 0x00 || sender_id.
+# Older JSON frames did not authenticate the sender_id and are refused.
+JSON_FRAME_VERSION = 2
+
+# Session tickets (handshake resumption, see firmware/main/session_ticket.h):
+# [ver:1][ticket_epoch:4][iv:12][ciphertext:N][tag:16], sealed with a
+# ticket key derived from KMS_master_key for the ticket epoch, AAD binding
+# the client_id. Plaintext: [expires:4][secret:32][topic hash:4]...
+TICKET_VERSION = 0x01
+TICKET_HEADER = struct.Struct(">BI")
+TICKET_PLAIN = struct.Struct(">I32s")
+DEFAULT_TICKET_LIFETIME_SECONDS = 3600
+
+# Per-device secure topics, BASE_TOPIC/<client_id>/<kind>: stage timings
+# (metrics.py) and batched reading history (ts_codec.py)
+DEVICE_TOPIC_KINDS = ("metrics", "history")
+
+# Rotations asked by devices that lost their message counter (request_key
+# with "rotate"): at most one per topic in this many seconds
+ROTATE_REQUEST_MIN_INTERVAL_SECONDS = 5
+
+
+def fnv1a32(text: str) -> int:
+    h = 2166136261
+    for b in text.encode():
+        h ^= b
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def sender_index(client_id: str) -> int:
+    """FNV-1a 32-bit of the client_id, as carried in binary frames."""
+    return fnv1a32(client_id)
 
 
 class KMS:
@@ -28,22 +81,77 @@ class KMS:
         kms_pubkey,
         kms_master_key: bytes,
         base_topic: str,
+        data_topics: Optional[Iterable[str]] = None,
+        ticket_lifetime: int = DEFAULT_TICKET_LIFETIME_SECONDS,
+        group_depth: int = DEFAULT_GROUP_TREE_DEPTH,
+        revoked: Iterable[str] = (),
+        data_workers: int = DEFAULT_DATA_WORKERS,
+        data_queue_size: int = DEFAULT_DATA_QUEUE_SIZE,
+        fast_handshake: bool = True,
     ):
         self.mqtt = mqtt_client
         self.kms_privkey = kms_privkey
         self.kms_pubkey = kms_pubkey
         self.kms_master_key = kms_master_key
         self.base_topic = base_topic  # ex: "iot/esp32"
+        # Secure data topics, each with its own TOPIC_key and epoch
+        self.data_topics = tuple(data_topics or (f"{base_topic}/data",))
 
-        # (client_id, topic) -> TOPIC_key (AES-256)
+        # Guards the TOPIC_keys and the epoch keys, shared with the data
+        # workers and the rotation threads
+        self.key_lock = threading.Lock()
+        # topic -> current TOPIC_key (AES-256) and its epoch
         self.topic_keys: Dict[str, bytes] = {}
+        self.topic_epochs: Dict[str, int] = {}
+        # topic -> (epoch, TOPIC_key) of the previous epoch, for frames in flight
+        self.prev_topic_keys: Dict[str, Tuple[int, bytes]] = {}
+
+        # sender index (binary frames) -> client_id
+        self.sender_names: Dict[int, str] = {}
+
+        # (topic, epoch) -> (TOPIC_key, client_id -> AES-GCM context of its
+        # traffic key) for session frames, kept for the current and the
+        # previous epoch of each topic
+        self.epoch_keys: Dict[Tuple[str, int], Tuple[bytes, Dict[str, AESGCM]]] = {}
+        # topic -> time of the last rotation asked by a device (request_key
+        # with "rotate"), see handle_request_key
+        self.requested_rotations: Dict[str, float] = {}
+
+        # Session tickets: lifetime, and the tickets already presented
+        # (iv -> expiry), each ticket resumes at most once
+        self.ticket_lifetime = ticket_lifetime
+        self.used_tickets: Dict[bytes, int] = {}
+        # client_id -> (nonce_k, topics verified with it) of the last handshake
+        self.verified_topics: Dict[str, Tuple[bytes, list]] = {}
+        # Single round-trip auth accepted; if False every client gets the
+        # clientauth/clientverify exchange
+        self.fast_handshake = fast_handshake
+
+        # Group rekeying (key_tree.py): one key tree per topic, its members
+        # being the clients that completed a handshake for the topic.
+        # Revoked clients are refused and removed from every tree.
+        self.group_depth = group_depth
+        self.group_trees: Dict[str, KeyTree] = {}
+        self.group_topic = f"{base_topic}/kms/grouprekey"
+        self.group_lock = threading.RLock()
+        self.revoked = set(revoked)
+
+        # Stage timings sent by each device on base_topic/CLIENT_ID/metrics
+        self.metrics = FleetMetrics()
+
+        # Data frames are decrypted on a worker pool, so the MQTT network
+        # thread only reads, queues them and runs the handshakes
+        self.data_pool = WorkerPool("data", self._handle_data_message,
+                                    data_workers, data_queue_size)
 
         # The KMS should listen to all topics: base_topic/CLIENT_ID/kms/...
         # Example: iot/esp32/client_1/kms/auth
         self.mqtt.on_message = self._on_message
         self.mqtt.subscribe(f"{self.base_topic}/+/kms/#")
-        self.mqtt.subscribe(f"{self.base_topic}/data")
-        self.mqtt.subscribe(f"{self.base_topic}/data/#")
+        for data_topic in self.data_topics:
+            self.mqtt.subscribe(data_topic)
+        for kind in DEVICE_TOPIC_KINDS:
+            self.mqtt.subscribe(f"{self.base_topic}/+/{kind}")
 
     def derive_client_master_key(self, client_id: str) -> bytes:
         # Use client_id as salt for deterministic but unique derivation per client
@@ -56,74 +164,155 @@ class KMS:
         topic_key_enc_key = material[32:]
         return topic_auth_key, topic_key_enc_key
 
+    def register_client(self, client_id: str):
+        self.sender_names[sender_index(client_id)] = client_id
+
+    def current_topic_key(self, topic_name: str) -> Tuple[int, bytes]:
+        """(epoch, TOPIC_key) of a topic, created on first use.
+
+        Devices never go back to an older epoch (a replayed key answer
+        could otherwise reinstall a retired key), and the topic keys only
+        live in memory. The first epoch is therefore taken from the clock,
+        in seconds, so that the epochs of a restarted KMS are newer than
+        the ones devices still hold.
+        """
+        with self.key_lock:
+            if topic_name not in self.topic_keys:
+                self.topic_keys[topic_name] = os.urandom(32)
+                self.topic_epochs[topic_name] = int(time.time()) & 0xFFFFFFFF
+            return self.topic_epochs[topic_name], self.topic_keys[topic_name]
+
+    def rotate_topic_key(self, topic_name: str) -> int:
+        """Starts a new epoch for one topic; the other topics are untouched."""
+        epoch, topic_key = self.current_topic_key(topic_name)
+        with self.key_lock:
+            self.prev_topic_keys[topic_name] = (epoch, topic_key)
+            self.topic_keys[topic_name] = os.urandom(32)
+            self.topic_epochs[topic_name] = epoch + 1
+            # Frames older than the previous epoch are no longer accepted
+            for cache_id in [c for c in self.epoch_keys if c[0] == topic_name and c[1] < epoch]:
+                del self.epoch_keys[cache_id]
+        return epoch + 1
+
+    def topic_key_for_epoch(self, topic_name: str, epoch: int) -> Optional[bytes]:
+        with self.key_lock:
+            if topic_name in self.topic_keys and self.topic_epochs[topic_name] == epoch:
+                return self.topic_keys[topic_name]
+            prev = self.prev_topic_keys.get(topic_name)
+            if prev and prev[0] == epoch:
+                return prev[1]
+            return None
+
+    def wrap_topic_key(self, client_id: str, topic_name: str) -> bytes:
+        """Current TOPIC_key of a topic wrapped for one client (JSON payload)."""
+        # Key and path taken together, so a group rekey cannot fall between
+        with self.group_lock:
+            epoch, topic_key = self.current_topic_key(topic_name)
+            tree = self.group_trees.get(topic_name)
+            path = tree.path_of(client_id) if tree else None
+
+        # derive topic_key_enc_key for this client/topic
+        client_master_key = self.derive_client_master_key(client_id)
+        _, topic_key_enc_key = self.derive_topic_keys_material(
+            client_master_key, topic_name
+        )
+
+        # Wrap TOPIC_key with AES-GCM under TOPIC_key_enc_key
+        iv = os.urandom(12)
+        ciphertext, tag = aes_gcm_encrypt(
+            topic_key_enc_key, iv, topic_key, aad=b"KMS_TOPIC_KEY"
+        )
+
+        response = {
+            "topic": topic_name,
+            "epoch": epoch,
+            "iv": iv.hex(),
+            "ciphertext": ciphertext.hex(),
+            "tag": tag.hex(),
+        }
+
+        # Members also get the keys of their path in the topic's key tree
+        if path is not None:
+            path_iv = os.urandom(12)
+            path_ct, path_tag = aes_gcm_encrypt(
+                topic_key_enc_key, path_iv, path, aad=b"KMS_GROUP_PATH"
+            )
+            response["path"] = (path_iv + path_ct + path_tag).hex()
+        return json.dumps(response, separators=(",", ":")).encode()
+
+    # ---------- Group rekeying ----------
+
+    def group_tree(self, topic_name: str) -> KeyTree:
+        tree = self.group_trees.get(topic_name)
+        if tree is None:
+            def leaf_key(client_id: str) -> bytes:
+                client_master_key = self.derive_client_master_key(client_id)
+                return self.derive_topic_keys_material(client_master_key, topic_name)[1]
+            tree = KeyTree(fnv1a32(topic_name), self.group_depth, leaf_key)
+            self.group_trees[topic_name] = tree
+        return tree
+
+    def _publish_group(self, tree: KeyTree, wraps):
+        for payload in tree.messages(wraps):
+            self.mqtt.publish(self.group_topic, payload)
+
+    def group_join(self, client_id: str, topic_name: str):
+        """Makes an authenticated client a member of the topic's tree."""
+        with self.group_lock:
+            tree = self.group_tree(topic_name)
+            if client_id in tree:
+                return
+            try:
+                wraps = tree.join(client_id)
+            except ValueError as e:
+                print(f"[KMS] {client_id} not added to the key tree of {topic_name}: {e}")
+                return
+            print(f"[KMS] {client_id} joined the key tree of {topic_name} "
+                  f"({len(wraps)} wraps for the other members)")
+            self._publish_group(tree, wraps)
+
+    def group_rekey(self, topic_name: str, revoke: Iterable[str] = ()) -> int:
+        """
+        Starts a new epoch for a topic and sends the TOPIC_key to every
+        member at once, sealed with the root key of the tree: one wrap for
+        a plain rotation, O(log n) when members are revoked first.
+        """
+        with self.group_lock:
+            tree = self.group_tree(topic_name)
+            wraps = tree.leave(revoke)
+            self.rotate_topic_key(topic_name)
+            epoch, topic_key = self.current_topic_key(topic_name)
+            root_wrap = tree.wrap_topic_key(epoch, topic_key)
+            if root_wrap is not None:
+                wraps.append(root_wrap)
+            print(f"[KMS] Group rekey of {topic_name}, epoch {epoch}: "
+                  f"{len(wraps)} wraps for {len(tree.members)} members")
+            self._publish_group(tree, wraps)
+            return epoch
+
+    def revoke_client(self, client_id: str):
+        """Refuses the client from now on and rekeys every topic it could read."""
+        with self.group_lock:
+            if client_id in self.revoked:
+                return
+            self.revoked.add(client_id)
+            self.verified_topics.pop(client_id, None)
+            print(f"[KMS] Revoking client {client_id}")
+            for topic_name, tree in list(self.group_trees.items()):
+                if client_id in tree:
+                    self.group_rekey(topic_name, revoke=[client_id])
+
     # ---------- Callback MQTT ----------
 
     def _on_message(self, client, userdata, msg):
         topic = msg.topic
         payload = msg.payload
 
-        #handle data topics (not KMS)
-        if topic == f"{self.base_topic}/data":
-            try:
-                payload_str = payload.decode()
-                if "counter" not in payload_str:
-                    return
-                    
-                #decode json payload
-                payload_data = json.loads(payload_str)
-
-                #Retrieve useful informations
-                iv = bytes.fromhex(payload_data["iv"])
-                ciphertext = bytes.fromhex(payload_data["ciphertext"])
-                tag = bytes.fromhex(payload_data["tag"])
-                counter = payload_data["counter"]
-                topic_name = payload_data["topic_name"]
-                sender_id = payload_data.get("sender_id", "unknown")
-                epoch = payload_data.get("epoch", 0)
-                
-                aad_data = counter.to_bytes(4, "big") + topic_name.encode()
-                topic_key = self.topic_keys.get(topic_name)
-                
-                if not topic_key:
-                    print(f"[KMS] Warning: No TOPIC_key found for {topic_name}, skipping decrypt")
-                    return
-
-                #Derive the decryption aes-key and decrypt
-                salt = iv + counter.to_bytes(4, "big")
-                aes_key = hkdf(topic_key, salt=salt, info=topic_name.encode(), length=32)
-                
-                try:
-                    plaintext = aes_gcm_decrypt(aes_key, iv, ciphertext, tag, aad=aad_data)
-                    
-                    # Parse plaintext to check for SOS flag
-                    data_obj = json.loads(plaintext.decode())
-                    is_sos = data_obj.get("sos") == 1
-                    
-                    event = {
-                        "type": "sos_alert" if is_sos else "data_received",
-                        "topic_name": topic_name,
-                        "timestamp": time.time(),
-                        "data": plaintext.decode(),
-                        "client_id": sender_id,
-                        "epoch": epoch
-                    }
-                    publish_event(event)
-                    
-                    if is_sos:
-                        print(f"[KMS] SOS ALERT from {sender_id}!")
-                    
-                except Exception as decrypt_err:
-                    print(f"[KMS] Decrypt failed for message from {sender_id}:")
-                    print(f"  - Topic: {topic_name}")
-                    print(f"  - Counter: {counter}")
-                    print(f"  - Epoch: {epoch}")
-                    print(f"  - Error: {decrypt_err}")
-                    print(f"  - Possible cause: Client using wrong/old TOPIC_key or epoch mismatch")
-                    
-            except json.JSONDecodeError as e:
-                print(f"[KMS] JSON decode error on data topic: {e}")
-            except Exception as e:
-                print(f"[KMS] Error processing data message: {e}")
+        #handle data topics (not KMS), off the network thread. Frames of
+        #one sender go to the same worker and keep their order
+        if topic in self.data_topics or self.device_topic_kind(topic):
+            self.data_pool.submit(self.data_shard(topic, payload), topic, payload)
+            return
 
         # Only handle KMS topics
         if "/kms/" not in topic:
@@ -143,6 +332,7 @@ class KMS:
         client_id, kms_keyword, action = parts[0], parts[1], parts[2]
         if kms_keyword != "kms":
             return
+        self.register_client(client_id)
 
         data = json.loads(payload.decode())
 
@@ -153,9 +343,355 @@ class KMS:
         elif action == "request_key":
             self.handle_request_key(client_id, data)
 
+    # ---------- Data plane ----------
+
+    def device_topic_kind(self, topic: str) -> Optional[str]:
+        """"metrics" or "history" for base_topic/CLIENT_ID/<kind>, else None."""
+        prefix = self.base_topic + "/"
+        if not topic.startswith(prefix):
+            return None
+        parts = topic[len(prefix) :].split("/")
+        if len(parts) != 2 or parts[1] not in DEVICE_TOPIC_KINDS:
+            return None
+        return parts[1]
+
+    def data_shard(self, topic: str, payload: bytes):
+        """Worker key of a data frame: its topic and, for binary frames,
+        the sender index. JSON frames of a topic share one worker."""
+        if payload[:1] in (bytes([FRAME_VERSION_BINARY]), bytes([FRAME_VERSION_SESSION])):
+            return topic, payload[9:13]
+        return topic
+
+    def _publish_history(self, topic_name: str, sender_id: str, epoch: int, plaintext: bytes):
+        """One data_received event per reading of a batch."""
+        try:
+            age, readings = ts_codec.decode_batch(plaintext)
+        except ValueError as e:
+            print(f"[KMS] Malformed history batch from {sender_id}: {e}")
+            return
+        first = time.time() - age
+        for offset, temperature, humidity in readings:
+            publish_event({
+                "type": "data_received",
+                "topic_name": topic_name,
+                "timestamp": first + offset,
+                "data": json.dumps({"temperature": temperature, "humidity": humidity}),
+                "client_id": sender_id,
+                "epoch": epoch
+            })
+
+    def session_aead(self, topic_name: str, topic_key: bytes, epoch: int,
+                     sender: int, client_id: str) -> AESGCM:
+        """
+        AES-GCM context of one sender's traffic key for one epoch, derived
+        once. The key is bound to the full client_id, so two senders whose
+        indexes collide never share it. Only known senders are cached, so
+        forged client_ids cannot grow the cache.
+        """
+        cache_id = (topic_name, epoch)
+        with self.key_lock:
+            entry = self.epoch_keys.get(cache_id)
+            if entry is not None and entry[0] == topic_key and client_id in entry[1]:
+                return entry[1][client_id]
+        salt = epoch.to_bytes(4, "big") + sender.to_bytes(4, "big")
+        info = b"SESSION_KEY" + topic_name.encode() + b"\x00" + client_id.encode()
+        key = hkdf(topic_key, salt=salt, info=info, length=32)
+        aead = AESGCM(key)
+        if self.sender_names.get(sender) == client_id:
+            with self.key_lock:
+                entry = self.epoch_keys.get(cache_id)
+                if entry is None or entry[0] != topic_key:
+                    entry = (topic_key, {})
+                    self.epoch_keys[cache_id] = entry
+                entry[1][client_id] = aead
+        return aead
+
+    def _decode_json_frame(self, payload: bytes):
+        payload_str = payload.decode()
+        if "counter" not in payload_str:
+            return None
+
+        #decode json payload
+        payload_data = json.loads(payload_str)
+        if payload_data.get("v") != JSON_FRAME_VERSION:
+            print("[KMS] JSON frame without an authenticated sender_id, refused")
+            return None
+
+        #Retrieve useful informations
+        iv = bytes.fromhex(payload_data["iv"])
+        ciphertext = bytes.fromhex(payload_data["ciphertext"])
+        tag = bytes.fromhex(payload_data["tag"])
+        counter = payload_data["counter"]
+        topic_name = payload_data["topic_name"]
+        sender_id = payload_data["sender_id"]
+        epoch = payload_data.get("epoch", 0)
+
+        aad_data = (counter.to_bytes(4, "big") + topic_name.encode() + b"\x00" +
+                    sender_id.encode())
+        return topic_name, sender_id, counter, epoch, iv, ciphertext, tag, aad_data, None
+
+    def _decode_binary_frame(self, topic: str, payload: bytes):
+        session = payload[0] == FRAME_VERSION_SESSION
+        iv_len = 0 if session else FRAME_IV_LEN
+        header_end = FRAME_HEADER.size
+        if session and len(payload) > header_end:
+            header_end += 1 + payload[header_end]
+        if (len(payload) < header_end + iv_len + FRAME_TAG_LEN or
+                header_end > FRAME_HEADER.size + 1 + FRAME_SENDER_ID_MAX):
+            print(f"[KMS] Binary frame too short ({len(payload)} bytes)")
+            return None
+
+        _, epoch, counter, sender = FRAME_HEADER.unpack_from(payload)
+        if session:
+            # The traffic key is bound to the client_id the frame carries
+            try:
+                sender_id = payload[FRAME_HEADER.size + 1 : header_end].decode()
+            except UnicodeDecodeError:
+                sender_id = ""
+            if not sender_id or sender_index(sender_id) != sender:
+                print(f"[KMS] Session frame: sender 0x{sender:08x} does not match its client_id")
+                return None
+            # nonce = sender || 0 || counter
+            iv = sender.to_bytes(4, "big") + bytes(4) + counter.to_bytes(4, "big")
+        else:
+            sender_id = self.sender_names.get(sender, f"0x{sender:08x}")
+            iv = payload[header_end : header_end + FRAME_IV_LEN]
+        ciphertext = payload[header_end + iv_len : -FRAME_TAG_LEN]
+        tag = payload[-FRAME_TAG_LEN:]
+
+        # The topic name is not carried, the MQTT topic is authenticated instead
+        topic_name = topic
+        aad_data = payload[:header_end] + topic_name.encode()
+        return (topic_name, sender_id, counter, epoch, iv, ciphertext, tag, aad_data,
+                sender if session else None)
+
+    def _handle_data_message(self, topic: str, payload: bytes):
+        try:
+            if payload[:1] in (bytes([FRAME_VERSION_BINARY]), bytes([FRAME_VERSION_SESSION])):
+                frame = self._decode_binary_frame(topic, payload)
+            else:
+                frame = self._decode_json_frame(payload)
+            if frame is None:
+                return
+            (topic_name, sender_id, counter, epoch, iv, ciphertext, tag, aad_data,
+             session_sender) = frame
+
+            topic_key = self.topic_key_for_epoch(topic_name, epoch)
+
+            if not topic_key:
+                print(f"[KMS] Warning: No TOPIC_key found for {topic_name} epoch {epoch}, skipping decrypt")
+                return
+
+            #Derive the decryption aes-key and decrypt. v1 and JSON frames
+            #have a key per frame (salt = iv || counter), nothing to cache
+            try:
+                if session_sender is not None:
+                    aead = self.session_aead(topic_name, topic_key, epoch, session_sender,
+                                             sender_id)
+                    plaintext = aead.decrypt(iv, ciphertext + tag, aad_data)
+                else:
+                    salt = iv + counter.to_bytes(4, "big")
+                    aes_key = hkdf(topic_key, salt=salt, info=topic_name.encode(), length=32)
+                    plaintext = aes_gcm_decrypt(aes_key, iv, ciphertext, tag, aad=aad_data)
+
+                kind = self.device_topic_kind(topic_name)
+                if kind == "metrics":
+                    self.metrics.add_report(sender_id, json.loads(plaintext.decode()))
+                    return
+                if kind == "history":
+                    self._publish_history(topic_name, sender_id, epoch, plaintext)
+                    return
+
+                # Parse plaintext to check for SOS flag
+                data_obj = json.loads(plaintext.decode())
+                is_sos = data_obj.get("sos") == 1
+
+                event = {
+                    "type": "sos_alert" if is_sos else "data_received",
+                    "topic_name": topic_name,
+                    "timestamp": time.time(),
+                    "data": plaintext.decode(),
+                    "client_id": sender_id,
+                    "epoch": epoch
+                }
+                publish_event(event)
+
+                if is_sos:
+                    print(f"[KMS] SOS ALERT from {sender_id}!")
+
+            except Exception as decrypt_err:
+                print(f"[KMS] Decrypt failed for message from {sender_id}:")
+                print(f"  - Topic: {topic_name}")
+                print(f"  - Counter: {counter}")
+                print(f"  - Epoch: {epoch}")
+                print(f"  - Error: {decrypt_err}")
+                print(f"  - Possible cause: Client using wrong/old TOPIC_key or epoch mismatch")
+
+        except (json.JSONDecodeError, UnicodeDecodeError) as e:
+            print(f"[KMS] JSON decode error on data topic: {e}")
+        except Exception as e:
+            print(f"[KMS] Error processing data message: {e}")
+
+    # ---------- Session tickets ----------
+
+    def ticket_key(self, ticket_epoch: int) -> bytes:
+        salt = ticket_epoch.to_bytes(4, "big")
+        return hkdf(self.kms_master_key, salt=salt, info=b"KMS_TICKET_KEY", length=32)
+
+    def topics_of_client(self, client_id: str) -> Iterable[str]:
+        """Topics a ticket of this client may name."""
+        yield from self.data_topics
+        for kind in DEVICE_TOPIC_KINDS:
+            yield f"{self.base_topic}/{client_id}/{kind}"
+        with self.key_lock:
+            topics = list(self.topic_keys)
+        yield from topics
+
+    def issue_ticket(self, client_id: str, secret: bytes, topics: Iterable[str]):
+        """Seals a ticket for the client and publishes it on .../kms/ticket.
+        The client derived `secret` on its side, it is never sent."""
+        now = int(time.time())
+        ticket_epoch = now // self.ticket_lifetime
+        header = TICKET_HEADER.pack(TICKET_VERSION, ticket_epoch)
+        plain = TICKET_PLAIN.pack(now + self.ticket_lifetime, secret)
+        plain += b"".join(fnv1a32(t).to_bytes(4, "big") for t in dict.fromkeys(topics))
+        iv = os.urandom(12)
+        ciphertext, tag = aes_gcm_encrypt(
+            self.ticket_key(ticket_epoch), iv, plain,
+            aad=b"KMS_TICKET" + header + client_id.encode(),
+        )
+        response = {
+            "ticket": (header + iv + ciphertext + tag).hex(),
+            "lifetime": self.ticket_lifetime,
+        }
+        resp_topic = f"{self.base_topic}/{client_id}/kms/ticket"
+        print(f"[KMS] Sending session ticket to {resp_topic}")
+        self.mqtt.publish(resp_topic, json.dumps(response, separators=(",", ":")).encode())
+
+    def open_ticket(self, client_id: str, ticket: bytes):
+        """(iv, expires, secret, topic hashes) of a valid ticket, else None."""
+        min_len = TICKET_HEADER.size + 12 + TICKET_PLAIN.size + FRAME_TAG_LEN
+        if len(ticket) < min_len:
+            return None
+        version, ticket_epoch = TICKET_HEADER.unpack_from(ticket)
+        now = int(time.time())
+        # Only the current and previous ticket keys exist
+        if version != TICKET_VERSION or now // self.ticket_lifetime - ticket_epoch not in (0, 1):
+            return None
+        header = ticket[: TICKET_HEADER.size]
+        iv = ticket[TICKET_HEADER.size : TICKET_HEADER.size + 12]
+        ciphertext = ticket[TICKET_HEADER.size + 12 : -FRAME_TAG_LEN]
+        tag = ticket[-FRAME_TAG_LEN:]
+        try:
+            plain = aes_gcm_decrypt(self.ticket_key(ticket_epoch), iv, ciphertext, tag,
+                                    aad=b"KMS_TICKET" + header + client_id.encode())
+        except Exception:
+            return None
+        expires, secret = TICKET_PLAIN.unpack_from(plain)
+        if expires < now:
+            return None
+        hashes = [int.from_bytes(plain[i : i + 4], "big")
+                  for i in range(TICKET_PLAIN.size, len(plain), 4)]
+        return iv, expires, secret, hashes
+
+    def handle_resume(self, client_id: str, data: dict) -> bool:
+        """Resumes a session from a ticket: sends the current key of every
+        topic in the ticket, then a new ticket. False if the ticket is
+        refused (the caller falls back to the full handshake)."""
+        challenge = bytes.fromhex(data["challenge"])
+        opened = self.open_ticket(client_id, bytes.fromhex(data["ticket"]))
+        if opened is None:
+            print(f"[KMS] Session ticket of {client_id} invalid or expired")
+            return False
+        iv, expires, secret, hashes = opened
+
+        now = int(time.time())
+        self.used_tickets = {k: exp for k, exp in self.used_tickets.items() if exp >= now}
+        if iv in self.used_tickets:
+            print(f"[KMS] Session ticket of {client_id} already used")
+            return False
+
+        binder = hmac_sha256(secret, b"RESUME" + challenge)
+        if not hmac.compare_digest(binder, bytes.fromhex(data.get("binder", ""))):
+            print(f"[KMS] Invalid resumption binder for client {client_id}")
+            return False
+        self.used_tickets[iv] = expires
+
+        by_hash = {fnv1a32(t): t for t in self.topics_of_client(client_id)}
+        topics = [by_hash[h] for h in hashes if h in by_hash]
+        print(f"[KMS] Client {client_id} resumed its session ({len(topics)} topics)")
+        resp_topic = f"{self.base_topic}/{client_id}/kms/key"
+        for topic_name in topics:
+            self.group_join(client_id, topic_name)
+            self.mqtt.publish(resp_topic, self.wrap_topic_key(client_id, topic_name))
+
+        next_secret = hkdf(secret, salt=challenge, info=b"RESUMPTION", length=32)
+        self.issue_ticket(client_id, next_secret, topics)
+        return True
+
+    # ---------- Single round-trip handshake ----------
+
+    def handle_fast_auth(self, client_id: str, data: dict) -> bool:
+        """
+        Auth carrying a proof of every TOPIC_auth_key of the client:
+          proof = HMAC(TOPIC_auth_key, "FAST_AUTH" || challenge || nonce_c)
+        for the topics named by their FNV-1a hashes. Answers with the
+        signature of challenge || nonce_c on .../kms/clientauth, then the
+        key of every topic and a session ticket. False if a topic is
+        unknown or a proof is wrong (the caller falls back to the full
+        handshake).
+        """
+        challenge = bytes.fromhex(data["challenge"])
+        nonce_c = bytes.fromhex(data["nonce_c"])
+        hashes = bytes.fromhex(data["topics"])
+        proofs = bytes.fromhex(data["proofs"])
+        if len(hashes) % 4 or len(proofs) != len(hashes) // 4 * 32 or not hashes:
+            print(f"[KMS] Malformed single round-trip auth from {client_id}")
+            return False
+
+        by_hash = {fnv1a32(t): t for t in self.topics_of_client(client_id)}
+        client_master_key = self.derive_client_master_key(client_id)
+        proof_input = b"FAST_AUTH" + challenge + nonce_c
+        topics = []
+        for i in range(0, len(hashes), 4):
+            topic_name = by_hash.get(int.from_bytes(hashes[i : i + 4], "big"))
+            if topic_name is None:
+                print(f"[KMS] Unknown topic in the auth of {client_id}, full handshake")
+                return False
+            topic_auth_key, _ = self.derive_topic_keys_material(client_master_key, topic_name)
+            proof = proofs[i * 8 : i * 8 + 32]
+            if not hmac.compare_digest(proof, hmac_sha256(topic_auth_key, proof_input)):
+                print(f"[KMS] Invalid proof for client {client_id} / topic {topic_name}")
+                return False
+            topics.append(topic_name)
+
+        response = {
+            "challenge": challenge.hex(),
+            "signature": sign(self.kms_privkey, challenge + nonce_c).hex(),
+        }
+        print(f"[KMS] Client {client_id} authenticated in one round trip ({len(topics)} topics)")
+        self.mqtt.publish(f"{self.base_topic}/{client_id}/kms/clientauth",
+                          json.dumps(response, separators=(",", ":")).encode())
+        resp_topic = f"{self.base_topic}/{client_id}/kms/key"
+        for topic_name in topics:
+            self.group_join(client_id, topic_name)
+            self.mqtt.publish(resp_topic, self.wrap_topic_key(client_id, topic_name))
+
+        secret = hkdf(client_master_key, salt=nonce_c, info=b"RESUMPTION", length=32)
+        self.issue_ticket(client_id, secret, topics)
+        return True
+
     # ---------- KMS logic ----------
 
     def handle_auth(self, client_id: str, data: dict):
+        if client_id in self.revoked:
+            print(f"[KMS] Refusing auth of revoked client {client_id}")
+            return
+        if "ticket" in data and self.handle_resume(client_id, data):
+            return
+        if "proofs" in data and self.fast_handshake and self.handle_fast_auth(client_id, data):
+            return
+
         challenge = bytes.fromhex(data["challenge"])
 
         # challenge + signature + nonce_k
@@ -174,6 +710,9 @@ class KMS:
         self.mqtt.publish(resp_topic, payload)
 
     def handle_clientverify(self, client_id: str, data: dict):
+        if client_id in self.revoked:
+            print(f"[KMS] Refusing clientverify of revoked client {client_id}")
+            return
         topic_name = data["topic"]
         hmac_received = bytes.fromhex(data["hmac"])
         nonce_k = bytes.fromhex(data["nonce_k"])
@@ -190,66 +729,81 @@ class KMS:
             return
 
         print(f"[KMS] Client {client_id} authenticated for topic {topic_name}")
-
-        # Generate or retrieve TOPIC_key
-        key_id = (client_id, topic_name)
-        if topic_name not in self.topic_keys:
-            self.topic_keys[topic_name] = os.urandom(32)
-        topic_key = self.topic_keys[topic_name]
-
-        # Wrap TOPIC_key with AES-GCM under TOPIC_key_enc_key
-        iv = os.urandom(12)
-        ciphertext, tag = aes_gcm_encrypt(
-            topic_key_enc_key, iv, topic_key, aad=b"KMS_TOPIC_KEY"
-        )
-
-        response = {
-            "topic": topic_name,
-            "iv": iv.hex(),
-            "ciphertext": ciphertext.hex(),
-            "tag": tag.hex(),
-        }
+        self.group_join(client_id, topic_name)
 
         resp_topic = f"{self.base_topic}/{client_id}/kms/key"
-        payload = json.dumps(response, separators=(",", ":")).encode()
+        payload = self.wrap_topic_key(client_id, topic_name)
         print(f"[KMS] Sending key to {resp_topic}: {payload!r}")
         self.mqtt.publish(resp_topic, payload)
 
+        # Topics verified with this nonce_k go into the ticket, which the
+        # client asks for on its last clientverify
+        last_nonce, topics = self.verified_topics.get(client_id, (None, []))
+        if last_nonce != nonce_k:
+            topics = []
+            self.verified_topics[client_id] = (nonce_k, topics)
+        topics.append(topic_name)
+        if data.get("ticket"):
+            secret = hkdf(client_master_key, salt=nonce_k, info=b"RESUMPTION", length=32)
+            self.issue_ticket(client_id, secret, topics)
+
+    def _rotate_proof_valid(self, client_id: str, topic_name: str, epoch: int, proof) -> bool:
+        """Anyone may publish on a client's request_key topic: only the
+        client, holding its TOPIC_auth_key, can have the topic rotated."""
+        try:
+            proof = bytes.fromhex(proof) if isinstance(proof, str) else b""
+            epoch_bytes = epoch.to_bytes(4, "big")
+        except (ValueError, OverflowError):
+            proof = b""
+        if not proof:
+            print(f"[KMS] Rotate request of {client_id} without a valid proof, ignored")
+            return False
+        topic_auth_key, _ = self.derive_topic_keys_material(
+            self.derive_client_master_key(client_id), topic_name)
+        expected = hmac_sha256(topic_auth_key, b"ROTATE" + epoch_bytes + topic_name.encode())
+        if not hmac.compare_digest(proof, expected):
+            print(f"[KMS] Invalid rotate proof from {client_id} / topic {topic_name}")
+            return False
+        return True
+
     def handle_request_key(self, client_id: str, data: dict):
         """
         Handle a client's request to obtain the current TOPIC_key for a topic.
         Expected payload: { "topic": "<topic_name>" }
         This publishes the wrapped TOPIC_key on BASE_TOPIC/<client_id>/kms/key
+
+        A device without a stored message counter may have used its
+        counters already under the current epoch, and does not publish
+        until a newer one. It adds "rotate": <its current epoch> and
+        "proof": HMAC(TOPIC_auth_key, "ROTATE" || epoch || topic), and a
+        member of the topic's key tree gets a group rekey if the proof
+        holds and that epoch is still the current one (rate limited per
+        topic).
         """
         topic_name = data.get("topic")
         if not topic_name:
             print(f"[KMS] request_key missing topic from client {client_id}")
             return
+        if client_id in self.revoked:
+            print(f"[KMS] Refusing request_key of revoked client {client_id}")
+            return
 
-        # Generate or retrieve TOPIC_key
-        if topic_name not in self.topic_keys:
-            self.topic_keys[topic_name] = os.urandom(32)
-        topic_key = self.topic_keys[topic_name]
-
-        # derive topic_key_enc_key for this client/topic
-        client_master_key = self.derive_client_master_key(client_id)
-        topic_auth_key, topic_key_enc_key = self.derive_topic_keys_material(
-            client_master_key, topic_name
-        )
-
-        iv = os.urandom(12)
-        ciphertext, tag = aes_gcm_encrypt(
-            topic_key_enc_key, iv, topic_key, aad=b"KMS_TOPIC_KEY"
-        )
-
-        response = {
-            "topic": topic_name,
-            "iv": iv.hex(),
-            "ciphertext": ciphertext.hex(),
-            "tag": tag.hex(),
-        }
+        stale_epoch = data.get("rotate")
+        if (isinstance(stale_epoch, int) and not isinstance(stale_epoch, bool) and
+                self._rotate_proof_valid(client_id, topic_name, stale_epoch, data.get("proof"))):
+            with self.group_lock:
+                tree = self.group_trees.get(topic_name)
+                member = tree is not None and client_id in tree
+                epoch, _ = self.current_topic_key(topic_name)
+                now = time.time()
+                last = self.requested_rotations.get(topic_name, 0)
+                if (member and epoch == stale_epoch and
+                        now - last >= ROTATE_REQUEST_MIN_INTERVAL_SECONDS):
+                    self.requested_rotations[topic_name] = now
+                    print(f"[KMS] {client_id} lost its counter, rotating {topic_name}")
+                    self.group_rekey(topic_name)
 
         resp_topic = f"{self.base_topic}/{client_id}/kms/key"
-        payload = json.dumps(response, separators=(",", ":")).encode()
+        payload = self.wrap_topic_key(client_id, topic_name)
         print(f"[KMS] Sending key (on request) to {resp_topic}: {payload!r}")
         self.mqtt.publish(resp_topic, payload)
@@ -4,14 +4,15 @@ import time
 import threading
 import paho.mqtt.client as mqtt
 
-from crypto_utils import generate_kms_keys, hkdf, aes_gcm_encrypt
+from crypto_utils import SIG_SUITES, generate_kms_keys, hkdf
 from kms import KMS
+from key_tree import DEFAULT_GROUP_TREE_DEPTH
+from worker_pool import DEFAULT_DATA_QUEUE_SIZE, DEFAULT_DATA_WORKERS
 
 from cryptography.hazmat.primitives import serialization
 from dotenv import load_dotenv
 
 # ====== KEY ROTATION CONFIG ======
-ROTATE_PERIOD_SECONDS = 60  # duration of an epoch before rotating the TOPIC_key
 # Load the .env at the project root
 load_dotenv()
 
@@ -19,6 +20,14 @@ load_dotenv()
 
 BASE_TOPIC = "iot/esp32"
 DATA_TOPIC = f"{BASE_TOPIC}/data"
+ALARM_TOPIC = f"{BASE_TOPIC}/alarms"
+
+# Duration of an epoch before rotating the TOPIC_key, per secure topic.
+# Each topic has its own key and epoch counter.
+ROTATE_PERIOD_SECONDS = {
+    DATA_TOPIC: 60,
+    ALARM_TOPIC: 300,
+}
 
 # Broker taken from .env (with defaults)
 BROKER_HOST = os.getenv("MQTT_BROKER", "localhost")
@@ -32,9 +41,35 @@ ESP_CLIENT_ID_HUM = "esp32_hum_client"
 DEFAULT_WIFI_SSID = os.getenv("WIFI_SSID", "YOUR_WIFI_SSID")
 DEFAULT_WIFI_PASSWORD = os.getenv("WIFI_PASSWORD", "YOUR_WIFI_PASSWORD")
 
+# KMS signature suite (see crypto_utils.SIG_SUITES)
+KMS_SIG_SUITE = os.getenv("KMS_SIG_SUITE", "rsa2048")
+
+# Lifetime of the session tickets used to resume handshakes (seconds)
+TICKET_LIFETIME_SECONDS = int(os.getenv("TICKET_LIFETIME", "3600"))
+
+# Single round-trip handshake accepted (0: clientauth/clientverify only)
+FAST_HANDSHAKE = os.getenv("FAST_HANDSHAKE", "1") != "0"
+
+# Depth of the per-topic key trees: up to 2^depth clients per topic
+GROUP_TREE_DEPTH = int(os.getenv("GROUP_TREE_DEPTH", str(DEFAULT_GROUP_TREE_DEPTH)))
+
+# Optional fixed KMS_master_key (64 hex digits), so a load generator can
+# derive the CLIENT_MASTER_KEY of simulated devices; random if unset
+KMS_MASTER_KEY_HEX = os.getenv("KMS_MASTER_KEY", "")
+# Optional file the KMS public key (PEM) is written to at startup
+KMS_PUBKEY_FILE = os.getenv("KMS_PUBKEY_FILE", "")
+
+# Data-plane decrypt: worker threads and frames waiting for them (beyond,
+# new frames are dropped rather than delaying the handshakes)
+DATA_WORKERS = int(os.getenv("DATA_WORKERS", str(DEFAULT_DATA_WORKERS)))
+DATA_QUEUE_SIZE = int(os.getenv("DATA_QUEUE_SIZE", str(DEFAULT_DATA_QUEUE_SIZE)))
+
 # Blacklist read from .env (with fallback)
-BLACKLIST = os.getenv("BLACKLIST", "YOUR_BLACKLISTED_CLIENT_ID")
-BLACKLISTED_CLIENT_IDS = [x for x in BLACKLIST.split(",") if x]
+def read_blacklist():
+    return [x for x in os.getenv("BLACKLIST", "YOUR_BLACKLISTED_CLIENT_ID").split(",") if x]
+
+
+BLACKLISTED_CLIENT_IDS = read_blacklist()
 
 
 def get_kms_pubkey_pem(kms_pubkey):
@@ -84,6 +119,7 @@ def print_esp_json_templates(
         "is_temp_node": 1,
         "client_master_key": client_master_key_temp.hex(),
         "kms_pubkey_pem": kms_pubkey_pem,
+        "kms_sig_suite": KMS_SIG_SUITE,
     }
 
     # HUM NODE
@@ -96,6 +132,7 @@ def print_esp_json_templates(
         "is_temp_node": 0,
         "client_master_key": client_master_key_hum.hex(),
         "kms_pubkey_pem": kms_pubkey_pem,
+        "kms_sig_suite": KMS_SIG_SUITE,
     }
 
     if "esp32_temp_client" in BLACKLISTED_CLIENT_IDS:
@@ -122,69 +159,29 @@ def print_esp_json_templates(
 
 # ========= ROTATION / REKEY LOGIC =========
 
-def send_rekey_for_client(kms: KMS, client_id: str, topic_name: str, epoch: int):
-    """Build and send a /kms/rekey message for a given client.
+def refresh_blacklist(kms: KMS):
+    """Re-reads BLACKLIST from the .env: clients added since are revoked
+    (removed from the key trees, with a group rekey of their topics)."""
+    load_dotenv(override=True)
+    for cid in read_blacklist():
+        kms.revoke_client(cid)
 
-    The message is published on: BASE_TOPIC/<client_id>/kms/rekey
-    Payload (JSON): { topic, epoch, iv, ciphertext, tag } where binary fields
-    are hex-encoded strings.
-    """
-
-    # 1) Derive topic_key_enc_key (same derivation as for /kms/key)
-    client_master_key = kms.derive_client_master_key(client_id)
-    topic_auth_key, topic_key_enc_key = kms.derive_topic_keys_material(
-        client_master_key, topic_name
-    )
 
-    # 2) Retrieve the TOPIC_key (create one if it doesn't exist)
-    if topic_name not in kms.topic_keys:
-        kms.topic_keys[topic_name] = os.urandom(32)
-    topic_key = kms.topic_keys[topic_name]
-
-    # 3) AES-GCM encrypt the TOPIC_key
-    iv = os.urandom(12)
-    ciphertext, tag = aes_gcm_encrypt(
-        topic_key_enc_key, iv, topic_key, aad=b"KMS_TOPIC_KEY"
-    )
-
-    response = {
-        "topic": topic_name,
-        "epoch": epoch,
-        "iv": iv.hex(),
-        "ciphertext": ciphertext.hex(),
-        "tag": tag.hex(),
-    }
-
-    resp_topic = f"{BASE_TOPIC}/{client_id}/kms/rekey"
-    payload = json.dumps(response, separators=(",", ":")).encode()
-    print(f"[KMS] Sending REKEY to {resp_topic}: {payload!r}")
-    kms.mqtt.publish(resp_topic, payload)
-
-
-def rotation_loop(kms: KMS):
-    """Thread that advances the epoch every ROTATE_PERIOD_SECONDS and:
-    - generates a new TOPIC_key for DATA_TOPIC
-    - sends a /kms/rekey to each ESP
+def rotation_loop(kms: KMS, topic_name: str, period: int):
+    """Thread that advances the epoch of one topic every `period` seconds:
+    the new TOPIC_key goes to every client of the topic in one group
+    rekey message, sealed with the root key of the topic's key tree.
     """
 
-    epoch = 0
-
     # Wait a bit for the ESPs to complete their initial handshake
     time.sleep(5)
 
     while True:
-        epoch += 1
-        print(f"[KMS] === New epoch {epoch} (rotating TOPIC_key for {DATA_TOPIC}) ===")
-
-        # New random TOPIC_key for this topic
-        kms.topic_keys[DATA_TOPIC] = os.urandom(32)
+        refresh_blacklist(kms)
+        epoch = kms.group_rekey(topic_name)
+        print(f"[KMS] === New epoch {epoch} (rotating TOPIC_key for {topic_name}) ===")
 
-        # Send the rekey to both ESPs (if not blacklisted)
-        for cid in (ESP_CLIENT_ID_TEMP, ESP_CLIENT_ID_HUM):
-            if cid not in BLACKLISTED_CLIENT_IDS:
-                send_rekey_for_client(kms, cid, DATA_TOPIC, epoch)
-
-        time.sleep(ROTATE_PERIOD_SECONDS)
+        time.sleep(period)
 
 def main():
 
@@ -195,10 +192,30 @@ def main():
     mqtt_kms.connect(BROKER_HOST, BROKER_PORT, 60)    
 
     # 2) Generate KMS keys
-    kms_priv, kms_pub, kms_master_key = generate_kms_keys()
+    if KMS_SIG_SUITE not in SIG_SUITES:
+        print(f"Unknown KMS_SIG_SUITE {KMS_SIG_SUITE!r}, expected one of {SIG_SUITES}")
+        return
+    kms_priv, kms_pub, kms_master_key = generate_kms_keys(KMS_SIG_SUITE)
+    if KMS_MASTER_KEY_HEX:
+        try:
+            kms_master_key = bytes.fromhex(KMS_MASTER_KEY_HEX)
+        except ValueError:
+            kms_master_key = b""
+        if len(kms_master_key) != 32:
+            print("KMS_MASTER_KEY must be 64 hex digits")
+            return
 
     # 3) Create the KMS
-    kms = KMS(mqtt_kms, kms_priv, kms_pub, kms_master_key, BASE_TOPIC)
+    kms = KMS(mqtt_kms, kms_priv, kms_pub, kms_master_key, BASE_TOPIC,
+              data_topics=ROTATE_PERIOD_SECONDS.keys(),
+              ticket_lifetime=TICKET_LIFETIME_SECONDS,
+              group_depth=GROUP_TREE_DEPTH,
+              revoked=BLACKLISTED_CLIENT_IDS,
+              data_workers=DATA_WORKERS,
+              data_queue_size=DATA_QUEUE_SIZE,
+              fast_handshake=FAST_HANDSHAKE)
+    kms.register_client(ESP_CLIENT_ID_TEMP)
+    kms.register_client(ESP_CLIENT_ID_HUM)
 
     # 4) Derive the CLIENT_MASTER_KEY for the two ESP32
     # Use client_id as salt for deterministic but unique derivation
@@ -212,9 +229,15 @@ def main():
     print("=== KMS SERVER STARTED ===")
     print(f"MQTT Broker : {BROKER_HOST}:{BROKER_PORT}")
     print(f"Base topic  : {BASE_TOPIC}")
-    print(f"Data topic  : {DATA_TOPIC}")
+    print(f"Data topics : {', '.join(ROTATE_PERIOD_SECONDS)}")
     print(f"Clients     : {ESP_CLIENT_ID_TEMP}, {ESP_CLIENT_ID_HUM}")
-    print(f"Rotate period (seconds) : {ROTATE_PERIOD_SECONDS}")
+    for topic_name, period in ROTATE_PERIOD_SECONDS.items():
+        print(f"Rotate period {topic_name} (seconds) : {period}")
+    print(f"Signature suite : {KMS_SIG_SUITE}")
+    print(f"Ticket lifetime (seconds) : {TICKET_LIFETIME_SECONDS}")
+    print(f"Single round-trip handshake : {'on' if FAST_HANDSHAKE else 'off'}")
+    print(f"Key tree depth : {GROUP_TREE_DEPTH} (up to {1 << GROUP_TREE_DEPTH} clients per topic)")
+    print(f"Data workers : {DATA_WORKERS} (queue of {DATA_QUEUE_SIZE} frames)")
     print()
 
     # (Optional) Print C representation if you still need it
@@ -233,6 +256,10 @@ def main():
     print("};\n")
 
     kms_pub_pem = get_kms_pubkey_pem(kms_pub)
+    if KMS_PUBKEY_FILE:
+        with open(KMS_PUBKEY_FILE, "w") as f:
+            f.write(kms_pub_pem)
+        print(f"KMS public key written to {KMS_PUBKEY_FILE}")
     print_kms_pubkey_c_snippet(kms_pub)
 
     print(
@@ -247,9 +274,11 @@ def main():
         print("Both esp32 clients are blacklisted. Exiting.")
         return
     
-    # 7) Start the key rotation thread
-    t = threading.Thread(target=rotation_loop, args=(kms,), daemon=True)
-    t.start()
+    # 7) Start one key rotation thread per secure topic
+    for topic_name, period in ROTATE_PERIOD_SECONDS.items():
+        t = threading.Thread(target=rotation_loop, args=(kms, topic_name, period),
+                             daemon=True)
+        t.start()
 
     # 8) MQTT loop (blocking)
     mqtt_kms.loop_forever()
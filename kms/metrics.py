@@ -0,0 +1,118 @@
+# metrics.py
+import json
+import os
+import threading
+import time
+from typing import Dict, List
+
+METRICS_FILE = "kms_metrics.json"
+
+# Device histograms (see firmware/main/sec_metrics.h): bucket 2e covers
+# [2^e, 1.5*2^e) ticks and bucket 2e+1 [1.5*2^e, 2^(e+1)). The fleet
+# histograms use the same scheme over nanoseconds so devices running at
+# different clock rates can be merged.
+
+
+def bucket_low(bucket: int) -> int:
+    e = bucket // 2
+    if e == 0:
+        return 1
+    return (1 << e) + ((1 << (e - 1)) if bucket & 1 else 0)
+
+
+def bucket_mid(bucket: int) -> int:
+    return (bucket_low(bucket) + bucket_low(bucket + 1)) // 2
+
+
+def bucket_of(value: int) -> int:
+    if value < 2:
+        return 0
+    e = value.bit_length() - 1
+    return 2 * e + ((value >> (e - 1)) & 1)
+
+
+def percentile_ns(hist: Dict[int, int], q: float) -> int:
+    """Middle of the bucket holding the q-quantile."""
+    total = sum(hist.values())
+    if total == 0:
+        return 0
+    rank = q * total
+    seen = 0
+    for bucket in sorted(hist):
+        seen += hist[bucket]
+        if seen >= rank:
+            return bucket_mid(bucket)
+    return bucket_mid(max(hist))
+
+
+class FleetMetrics:
+    """
+    Stage timings reported by the devices on BASE_TOPIC/<client_id>/metrics,
+    merged per stage for the whole fleet. The summary (samples, p50, p99 in
+    microseconds, reporting devices) is written to METRICS_FILE for the web UI,
+    with the memory gauges each device sent last (scratch arena, task stacks).
+    """
+    def __init__(self, path: str = METRICS_FILE):
+        self.path = path
+        self.lock = threading.Lock()
+        # stage -> ns bucket -> count
+        self.fleet: Dict[str, Dict[int, int]] = {}
+        # stage -> client_id -> samples
+        self.devices: Dict[str, Dict[str, int]] = {}
+        # client_id -> gauge name -> last value
+        self.memory: Dict[str, Dict[str, int]] = {}
+
+    def add_report(self, client_id: str, report: dict):
+        """One chunk: {"mhz": N, "stage": "hkdf", "b": [[bucket, count], ...]}
+        or the last one of a report: {"mhz": N, "gauges": {"scratch_peak": N, ...}}"""
+        gauges = report.get("gauges")
+        if isinstance(gauges, dict):
+            with self.lock:
+                self.memory[client_id] = {
+                    name: int(value) for name, value in gauges.items()
+                    if isinstance(value, int)
+                }
+                self._write()
+            return
+        mhz = int(report.get("mhz", 0))
+        stage = report.get("stage")
+        if mhz <= 0 or not isinstance(stage, str):
+            return
+        with self.lock:
+            hist = self.fleet.setdefault(stage, {})
+            samples = 0
+            for bucket, count in report.get("b", []):
+                ns = bucket_mid(int(bucket)) * 1000 // mhz
+                b = bucket_of(ns)
+                hist[b] = hist.get(b, 0) + int(count)
+                samples += int(count)
+            per_device = self.devices.setdefault(stage, {})
+            per_device[client_id] = per_device.get(client_id, 0) + samples
+            self._write()
+
+    def summary(self) -> List[dict]:
+        with self.lock:
+            return self._summary()
+
+    def _summary(self) -> List[dict]:
+        rows = []
+        for stage, hist in self.fleet.items():
+            rows.append({
+                "stage": stage,
+                "samples": sum(hist.values()),
+                "p50_us": percentile_ns(hist, 0.50) / 1000,
+                "p99_us": percentile_ns(hist, 0.99) / 1000,
+                "devices": len(self.devices.get(stage, {})),
+            })
+        return rows
+
+    def _write(self):
+        # Written aside and renamed, the web server never reads half a file
+        tmp = self.path + ".tmp"
+        with open(tmp, "w") as f:
+            json.dump({
+                "updated": time.time(),
+                "stages": self._summary(),
+                "memory": [dict(client=c, **g) for c, g in sorted(self.memory.items())],
+            }, f)
+        os.replace(tmp, self.path)
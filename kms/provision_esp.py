@@ -18,7 +18,8 @@ CONFIG_JSON = r"""
   "client_id": "",
   "is_temp_node": 0,
   "client_master_key": "",
-  "kms_pubkey_pem": ""       
+  "kms_pubkey_pem": "",
+  "kms_sig_suite": "rsa2048"
 }
 """
 
@@ -0,0 +1,63 @@
+# ts_codec.py
+from typing import List, Tuple
+
+# Batches of readings sent on BASE_TOPIC/<client_id>/history, see
+# firmware/main/ts_codec.h: [ver:1][count:1][age:2][bit stream], the
+# stream holding per reading the delta-of-delta of its timestamp (ticks,
+# absent for the first one) and the deltas of temperature and humidity
+# (tenths), each with a Gorilla-style prefix code on the zigzag value.
+TS_BATCH_VERSION = 0xB1
+TS_BATCH_TICK_MS = 100
+TS_BATCH_HEADER = 4
+
+# prefix ones -> payload bits
+_CODE_BITS = (0, 7, 9, 12, 32)
+
+
+def is_batch(plaintext: bytes) -> bool:
+    return plaintext[:1] == bytes([TS_BATCH_VERSION])
+
+
+class _BitReader:
+    def __init__(self, data: bytes):
+        self.value = int.from_bytes(data, "big")
+        self.left = len(data) * 8
+
+    def bits(self, n: int) -> int:
+        if n > self.left:
+            raise ValueError("truncated batch")
+        self.left -= n
+        return (self.value >> self.left) & ((1 << n) - 1)
+
+    def signed(self) -> int:
+        ones = 0
+        while ones < 4 and self.bits(1):
+            ones += 1
+        z = self.bits(_CODE_BITS[ones])
+        v = (z >> 1) ^ -(z & 1)
+        # The device computes in 32-bit two's complement
+        return (v + (1 << 31)) % (1 << 32) - (1 << 31)
+
+
+def decode_batch(plaintext: bytes) -> Tuple[float, List[Tuple[float, float, float]]]:
+    """
+    (age of the first reading when the block was sealed, in seconds,
+     [(seconds since the first reading, temperature, humidity), ...]).
+    Raises ValueError on a malformed block.
+    """
+    if len(plaintext) < TS_BATCH_HEADER or not is_batch(plaintext):
+        raise ValueError("not a batch")
+    count = plaintext[1]
+    age = int.from_bytes(plaintext[2:4], "big") * TS_BATCH_TICK_MS / 1000
+    reader = _BitReader(plaintext[TS_BATCH_HEADER:])
+
+    readings = []
+    tick = delta = temp = hum = 0
+    for i in range(count):
+        if i > 0:
+            delta += reader.signed()
+            tick += delta
+        temp += reader.signed()
+        hum += reader.signed()
+        readings.append((tick * TS_BATCH_TICK_MS / 1000, temp / 10, hum / 10))
+    return age, readings
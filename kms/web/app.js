@@ -1,5 +1,5 @@
 // app.js — extracted JS for KMS web UI
-// Handles loading logs, formatting, refresh button and back-to-top behaviour
+// Handles streaming logs, formatting, refresh button and back-to-top behaviour
 
 (function () {
   "use strict";
@@ -186,111 +186,192 @@
   let allLogs = []; // Store all parsed logs
   let displayedCount = 20; // Number of logs currently displayed
   const logsPerPage = 20; // Number of logs to add when "Show More" is clicked
+  const MAX_LOGS = 200; // Events kept, FIFO
+
+  // Event stream state: the server sends only the events after `cursor`
+  // (a byte offset in kms.log), so the cost follows the event rate and
+  // not the size of the log
+  const API = "http://localhost:8000";
+  const INITIAL_TAIL_BYTES = 65536; // history loaded on the first connection
+  let cursor = -INITIAL_TAIL_BYTES;
+  let renderPending = false;
+
+  function scheduleRender() {
+    if (renderPending) return;
+    renderPending = true;
+    requestAnimationFrame(function () {
+      renderPending = false;
+      renderLogs();
+      updateSOSDisplay();
+    });
+  }
 
-  async function loadLogs() {
-    const logDiv = document.getElementById("logs");
-    const lastSpan = document.getElementById("last");
-    try {
-      const res = await fetch("http://localhost:8000/events");
-      if (!res.ok) throw new Error(`HTTP ${res.status}`);
-      const text = await res.text();
-      logDiv.innerHTML = ""; // reset
+  function resetLogs() {
+    allLogs = [];
+    sosAlerts.clear();
+    scheduleRender();
+  }
 
-      const lines = text.split("\n").filter((l) => l.trim().length > 0);
-      
-      // Store all logs for pagination
-      allLogs = [];
-      
-      // parse lines into objects for charting (chronological)
-      const parsed = [];
-      for (const line of lines) {
+  // Adds a batch of new JSON lines, in log order
+  function ingestLines(lines) {
+    // parse lines into objects for charting (chronological)
+    const parsed = [];
+    for (const line of lines) {
+      if (line.trim().length === 0) continue;
+      let obj;
+      try {
+        obj = JSON.parse(line);
+      } catch (e) {
+        console.warn("Ignored invalid JSON line:", e, line);
+        continue;
+      }
+      if (typeof obj.data === "string") {
         try {
-          const o = JSON.parse(line);
-          if (typeof o.data === "string") {
-            try {
-              o.data = JSON.parse(o.data);
-            } catch (e) {
-              // keep as string
-            }
-          }
-          o.__tsMs = getTimestampMs(o.timestamp);
-          parsed.push(o);
+          obj.data = JSON.parse(obj.data);
         } catch (e) {
-          // ignore parse errors for charting; logs will still show
+          // keep as string
         }
       }
-      parsed.sort((a, b) => (a.__tsMs || 0) - (b.__tsMs || 0));
-
-      if (lines.length === 0) {
-        logDiv.innerHTML = '<div class="empty">No recent events.</div>';
-        lastSpan.textContent = new Date().toLocaleTimeString();
-        return;
+      obj.__tsMs = getTimestampMs(obj.timestamp);
+      parsed.push(obj);
+
+      allLogs.push(obj);
+      // Track SOS alerts
+      if (obj.type === "sos_alert") {
+        sosAlerts.set(obj.client_id, {
+          timestamp: obj.__tsMs,
+          cleared: false
+        });
       }
+    }
+    if (parsed.length === 0) return;
+    // Enforce max logs limit (FIFO - remove oldest)
+    if (allLogs.length > MAX_LOGS) {
+      allLogs.splice(0, allLogs.length - MAX_LOGS);
+    }
 
-      // Store all logs parsed for pagination (max 200 events, FIFO)
-      const MAX_LOGS = 200;
-      for (const line of lines) {
-        try {
-          const obj = JSON.parse(line);
-          allLogs.push(obj);
-          
-          // Enforce max logs limit (FIFO - remove oldest)
-          if (allLogs.length > MAX_LOGS) {
-            allLogs.shift();
+    // Update charts with the new items only (avoid duplicates)
+    parsed.sort((a, b) => (a.__tsMs || 0) - (b.__tsMs || 0));
+    for (const obj of parsed) {
+      if (!obj.__tsMs) continue;
+      if (obj.__tsMs <= lastChartTimestamp) continue;
+
+      if (obj.data && typeof obj.data === "object") {
+        if (obj.data.temperature !== undefined && tempChart) {
+          const v = Number(obj.data.temperature);
+          if (!Number.isNaN(v)) {
+            pushPoint(tempChart, formatTime(obj.timestamp), v);
+            setLatestValue("valTemp", `${v} °C`);
           }
-          
-          // Track SOS alerts
-          if (obj.type === "sos_alert") {
-            sosAlerts.set(obj.client_id, {
-              timestamp: getTimestampMs(obj.timestamp),
-              cleared: false
-            });
+        }
+        if (obj.data.humidity !== undefined && humChart) {
+          const v = Number(obj.data.humidity);
+          if (!Number.isNaN(v)) {
+            pushPoint(humChart, formatTime(obj.timestamp), v);
+            setLatestValue("valHum", `${v} %`);
           }
-        } catch (e) {
-          console.warn("Ignored invalid JSON line:", e, line);
         }
       }
 
-      // Update SOS display
-      updateSOSDisplay();
+      lastChartTimestamp = obj.__tsMs;
+    }
 
-      // Render logs in reverse order (newest first) with pagination
-      renderLogs();
+    // Render logs in reverse order (newest first) with pagination
+    scheduleRender();
+  }
 
-      // Update charts using parsed chronological items (avoid duplicates)
-      for (const obj of parsed) {
-        if (!obj.__tsMs) continue;
-        if (obj.__tsMs <= lastChartTimestamp) continue;
-
-        if (obj.data && typeof obj.data === "object") {
-          if (obj.data.temperature !== undefined && tempChart) {
-            const v = Number(obj.data.temperature);
-            if (!Number.isNaN(v)) {
-              pushPoint(tempChart, formatTime(obj.timestamp), v);
-              setLatestValue("valTemp", `${v} °C`);
-            }
-          }
-          if (obj.data.humidity !== undefined && humChart) {
-            const v = Number(obj.data.humidity);
-            if (!Number.isNaN(v)) {
-              pushPoint(humChart, formatTime(obj.timestamp), v);
-              setLatestValue("valHum", `${v} %`);
-            }
-          }
-        }
+  function markUpdated(ok) {
+    const lastSpan = document.getElementById("last");
+    if (lastSpan) lastSpan.textContent = ok ? new Date().toLocaleTimeString() : "—";
+  }
 
-        lastChartTimestamp = obj.__tsMs;
-      }
+  // Server-Sent Events: one message per batch of events, its id being
+  // the cursor after them (the browser resumes there on reconnection)
+  function streamLogs() {
+    const source = new EventSource(`${API}/events/stream?since=${cursor}`);
+    source.onopen = function () {
+      markUpdated(true);
+    };
+    source.onmessage = function (e) {
+      if (e.lastEventId) cursor = Number(e.lastEventId);
+      ingestLines(e.data.split("\n"));
+      markUpdated(true);
+    };
+    source.addEventListener("reset", resetLogs);
+    source.onerror = function () {
+      markUpdated(false);
+    };
+  }
 
-      lastSpan.textContent = new Date().toLocaleTimeString();
+  // Fallback without EventSource: poll for the events after the cursor
+  async function pollLogs() {
+    try {
+      const res = await fetch(`${API}/events?since=${cursor}`);
+      if (!res.ok) throw new Error(`HTTP ${res.status}`);
+      const text = await res.text();
+      if (res.headers.get("X-Events-Reset") === "1") resetLogs();
+      cursor = Number(res.headers.get("X-Events-Cursor") || cursor);
+      ingestLines(text.split("\n"));
+      markUpdated(true);
     } catch (err) {
       console.error("Erreur fetch:", err);
-      logDiv.innerHTML = '<div class="empty">Loading Error.</div>';
-      lastSpan.textContent = "—";
+      markUpdated(false);
     }
   }
 
   // ---- Chart helpers ----
+  function fillTable(body, rows) {
+    body.innerHTML = "";
+    for (const cells of rows) {
+      const tr = document.createElement("tr");
+      for (const value of cells) {
+        const td = document.createElement("td");
+        td.textContent = value;
+        tr.appendChild(td);
+      }
+      body.appendChild(tr);
+    }
+  }
+
+  // Fleet-wide p50/p99 per secure layer stage and the memory gauges of
+  // each device (devices report every minute)
+  async function loadMetrics() {
+    const body = document.getElementById("metrics-body");
+    const memoryBody = document.getElementById("memory-body");
+    const updated = document.getElementById("metricsUpdated");
+    if (!body) return;
+    try {
+      const res = await fetch("http://localhost:8000/metrics");
+      if (!res.ok) throw new Error(`HTTP ${res.status}`);
+      const data = await res.json();
+      const stages = data.stages || [];
+      const memory = data.memory || [];
+
+      if (stages.length > 0) {
+        fillTable(body, stages.map((row) => [
+          row.stage,
+          row.samples,
+          row.p50_us.toFixed(1),
+          row.p99_us.toFixed(1),
+          row.devices,
+        ]));
+      }
+      if (memoryBody && memory.length > 0) {
+        fillTable(memoryBody, memory.map((row) => [
+          row.client,
+          row.scratch_peak ?? "—",
+          row.scratch_size ?? "—",
+          row.scratch_failures ?? "—",
+          row.net_stack_free ?? "—",
+          row.crypto_stack_free ?? "—",
+        ]));
+      }
+      if (updated && data.updated && stages.length > 0) updated.textContent = formatTime(data.updated);
+    } catch (err) {
+      console.error("Metrics fetch error:", err);
+    }
+  }
+
   function getTimestampMs(ts) {
     try {
       if (typeof ts === "string" && /^\d+$/.test(ts)) ts = Number(ts);
@@ -410,13 +491,20 @@
       console.warn("Hum chart init failed", e);
     }
 
-    // reload every second
-    setInterval(loadLogs, 1000);
+    renderLogs();
+    if (typeof EventSource !== "undefined") {
+      streamLogs();
+    } else {
+      // poll every second
+      setInterval(pollLogs, 1000);
+      pollLogs();
+    }
     
     // Update SOS display every 500ms to handle expiration smoothly
     setInterval(updateSOSDisplay, 500);
-    
-    loadLogs();
+
+    setInterval(loadMetrics, 5000);
+    loadMetrics();
 
     setupBackToTop();
   });
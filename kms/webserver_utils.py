@@ -1,18 +1,149 @@
 # kms_event_bus.py
+import atexit
 import json
 import os
+import queue
+import socket
+import threading
+from typing import Iterator, Tuple
 
 LOG_FILE = "kms.log"
+# Events waiting for the writer thread; beyond, new events are dropped
+LOG_QUEUE_SIZE = 10000
+# Events written per batch, with a single write and flush
+LOG_BATCH = 256
+
+# Each written batch is also pushed to the web server (a separate
+# process) on this local UDP port, for its event stream:
+#   "<start> <end>\n" then the JSON lines, where start/end are the byte
+# offsets of the lines in LOG_FILE. A lost datagram is a gap between two
+# offsets, which the web server fills from the file.
+EVENTS_UDP_HOST = "127.0.0.1"
+EVENTS_UDP_PORT = int(os.getenv("EVENTS_UDP_PORT", "8765"))
+EVENTS_DATAGRAM_MAX = 32 * 1024
+# Largest response of read_events()
+EVENTS_READ_MAX = 256 * 1024
+
+_events: "queue.Queue[dict]" = queue.Queue(maxsize=LOG_QUEUE_SIZE)
+_writer = None
+_writer_lock = threading.Lock()
+_dropped = 0
+
+
+def _datagrams(start: int, data: bytes) -> Iterator[bytes]:
+    """Datagrams carrying `data`, written at offset `start`, split on lines."""
+    pos = 0
+    while pos < len(data):
+        end = pos + EVENTS_DATAGRAM_MAX
+        if end < len(data):
+            cut = data.rfind(b"\n", pos, end)
+            end = cut + 1 if cut >= pos else data.index(b"\n", end) + 1
+        else:
+            end = len(data)
+        yield f"{start + pos} {start + end}\n".encode() + data[pos:end]
+        pos = end
+
+
+def _write_events():
+    """Writer thread: appends the queued events to the log in batches."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    # O_APPEND: the web server may truncate the file, writes go to its end
+    with open(LOG_FILE, "ab") as f:
+        while True:
+            batch = [_events.get()]
+            while len(batch) < LOG_BATCH:
+                try:
+                    batch.append(_events.get_nowait())
+                except queue.Empty:
+                    break
+            try:
+                data = "".join(json.dumps(event) + "\n" for event in batch).encode()
+                f.write(data)
+                f.flush()
+                end = f.tell()
+                for datagram in _datagrams(end - len(data), data):
+                    try:
+                        sock.sendto(datagram, (EVENTS_UDP_HOST, EVENTS_UDP_PORT))
+                    except OSError:
+                        pass  # web server not running
+            except (OSError, TypeError, ValueError) as e:
+                print(f"[✗] Error while writing {LOG_FILE}: {e}")
+            if len(batch) == 1:
+                print("Log added:", batch[0])
+            else:
+                print(f"Log added: {len(batch)} events")
+            for _ in batch:
+                _events.task_done()
+
+
+def _start_writer():
+    global _writer
+    with _writer_lock:
+        if _writer is None:
+            _writer = threading.Thread(target=_write_events, name="kms-log", daemon=True)
+            _writer.start()
+            atexit.register(flush_events)
+
 
 def publish_event(event: dict):
     """
-    Publishes an event to the KMS log file.
+    Publishes an event to the KMS log file. Does not block: the event is
+    written shortly after by a background thread, in order.
 
     event : dict - A dictionary containing event details to be logged.
     """
-    with open(LOG_FILE, "a") as f:
-        f.write(json.dumps(event) + "\n")
-    print("Log added:", event)
+    global _dropped
+    if _writer is None:
+        _start_writer()
+    try:
+        _events.put_nowait(event)
+    except queue.Full:
+        _dropped += 1
+        if _dropped % 1000 == 1:
+            print(f"[✗] KMS log queue full, {_dropped} events dropped so far")
+
+
+def flush_events():
+    """Waits until every published event is in the log file."""
+    if _writer is not None:
+        _events.join()
+
+def read_events(since: int, max_bytes: int = EVENTS_READ_MAX) -> Tuple[int, bytes, bool]:
+    """
+    Complete lines of LOG_FILE from byte offset `since`, at most
+    `max_bytes` of them (at least one line). A negative `since` counts
+    from the end of the file, starting at the next line.
+
+    Returns (cursor after the lines, lines, reset). `reset` is True when
+    `since` lies beyond the end of the file (it was cleared): the lines
+    then start at offset 0.
+    """
+    try:
+        f = open(LOG_FILE, "rb")
+    except FileNotFoundError:
+        return 0, b"", since > 0
+    with f:
+        size = os.fstat(f.fileno()).st_size
+        reset = since > size
+        if reset:
+            since = 0
+        elif since < 0:
+            since = max(size + since, 0)
+            if since > 0:
+                f.seek(since - 1)
+                # Skip the partial line, unless `since` starts one
+                if f.read(1) != b"\n":
+                    f.readline()
+                since = f.tell()
+        f.seek(since)
+        data = f.read(min(max_bytes, size - since))
+        end = data.rfind(b"\n") + 1
+        if end == 0 and data:
+            # A line longer than max_bytes, or still being written
+            data += f.readline()
+            end = data.rfind(b"\n") + 1
+        return since + end, data[:end], reset
+
 
 def clear_kms_log():
     """
@@ -25,4 +156,4 @@ def clear_kms_log():
 
         print(f"[✓] The file '{LOG_FILE}' has been cleared.")
     except Exception as e:
-        print(f"[✗] Error while clearing the file: {e}")
\ No newline at end of file
+        print(f"[✗] Error while clearing the file: {e}")
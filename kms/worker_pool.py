@@ -0,0 +1,75 @@
+# worker_pool.py
+import queue
+import threading
+import time
+from typing import Callable, Hashable, List
+
+DEFAULT_DATA_WORKERS = 4
+DEFAULT_DATA_QUEUE_SIZE = 1024
+# Seconds between two reports of dropped jobs
+DROP_REPORT_PERIOD = 5.0
+
+
+class WorkerPool:
+    """
+    Runs `handler(*job)` on `workers` threads, away from the MQTT network
+    thread. Each worker has its own bounded queue and a job goes to the
+    worker chosen by its shard key, so the jobs of one key (e.g. one
+    sender) are handled in order. submit() never blocks: when the queue is
+    full the job is dropped and counted, the caller keeps reading the
+    network. With 0 workers, jobs run inline in the caller.
+    """
+    def __init__(self, name: str, handler: Callable, workers: int = DEFAULT_DATA_WORKERS,
+                 queue_size: int = DEFAULT_DATA_QUEUE_SIZE):
+        self.name = name
+        self.handler = handler
+        self.dropped = 0
+        self.last_report = 0.0
+        self.lock = threading.Lock()
+        self.queues: List[queue.Queue] = []
+        for i in range(max(workers, 0)):
+            q = queue.Queue(maxsize=max(queue_size // workers, 1))
+            self.queues.append(q)
+            threading.Thread(target=self._run, args=(q,), name=f"{name}-{i}",
+                             daemon=True).start()
+
+    def submit(self, shard: Hashable, *job) -> bool:
+        """Queues a job, False if it was dropped."""
+        if not self.queues:
+            self.handler(*job)
+            return True
+        q = self.queues[hash(shard) % len(self.queues)]
+        try:
+            q.put_nowait(job)
+            return True
+        except queue.Full:
+            self._count_drop()
+            return False
+
+    def pending(self) -> int:
+        return sum(q.qsize() for q in self.queues)
+
+    def join(self):
+        """Waits until every queued job was handled."""
+        for q in self.queues:
+            q.join()
+
+    def _count_drop(self):
+        with self.lock:
+            self.dropped += 1
+            now = time.monotonic()
+            if now - self.last_report < DROP_REPORT_PERIOD:
+                return
+            self.last_report = now
+            dropped = self.dropped
+        print(f"[KMS] {self.name} queue full, {dropped} jobs dropped so far")
+
+    def _run(self, q: queue.Queue):
+        while True:
+            job = q.get()
+            try:
+                self.handler(*job)
+            except Exception as e:
+                print(f"[KMS] {self.name} worker error: {e}")
+            finally:
+                q.task_done()